@@ -0,0 +1,64 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "template_db.h"
+#include "config.h"
+
+/* Archive file identification */
+#define ARCHIVE_MAGIC 0x52414C4E            // "NLAR" little-endian
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 32
+#define ARCHIVE_ENTRY_HEADER_SIZE 4
+
+/*
+ * Packed template archive used to move a whole store between machines.
+ *
+ * Layout (little-endian):
+ *   0  magic          u32   ARCHIVE_MAGIC
+ *   4  version        u16   ARCHIVE_VERSION
+ *   6  header size    u16   ARCHIVE_HEADER_SIZE
+ *   8  flags          u32   0
+ *  12  crc32          u32   Header CRC with this field taken as zero
+ *  16  count          u64   Entries that follow
+ *  24  payload bytes  u64   Bytes after the header
+ * followed by count entries of [length u32][template_serialize() output].
+ * Each entry carries the template format's own CRC.
+ */
+
+/* Throughput counters for one export or import */
+typedef struct {
+    uint64_t templates;             // Templates written to the archive or stored
+    uint64_t rejected;              // Records that vanished during export, invalid entries on import
+    uint64_t bytes;                 // Archive size in bytes
+    uint64_t elapsed_ms;            // Wall-clock time
+    size_t threads;                 // Parallel slices per round
+} ArchiveStats;
+
+/* Function Prototypes */
+
+/**
+ * Write every template in a database to an archive (temp file + rename)
+ * Records are serialized on the shared scheduler and written in slot order.
+ * @param db: Source database
+ * @param path: Destination archive path
+ * @param stats: Output counters (may be NULL)
+ * Returns: 0 on success, negative on error
+ */
+int archive_export(TemplateDB *db, const char *path, ArchiveStats *stats);
+
+/**
+ * Load every template in an archive into a database
+ * The archive framing is checked before anything is written. Entries are
+ * parsed, validated and re-hashed under their stored salt on the shared
+ * scheduler; entries that fail are counted in stats->rejected and skipped. Existing
+ * users are replaced. The database is synced before returning.
+ * @param db: Destination database
+ * @param path: Source archive path
+ * @param stats: Output counters (may be NULL)
+ * Returns: 0 on success, negative on error
+ */
+int archive_import(TemplateDB *db, const char *path, ArchiveStats *stats);
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,92 @@
+#ifndef AUTH_H
+#define AUTH_H
+
+#include "capture.h"
+#include "identify.h"
+#include "mahalanobis.h"
+#include "template.h"
+#include "config.h"
+
+/*
+ * Decisions and template upkeep shared by the CLI and the daemon, so both
+ * pick the same matcher for a template and keep the same derived state
+ * (cohort statistics, discriminant, approximate indexes) in step with the
+ * database.
+ */
+
+/* Matcher that made an authentication decision */
+typedef enum {
+    AUTH_MATCHER_COSINE = 0,        // Raw fused similarity against SIMILARITY_THRESHOLD
+    AUTH_MATCHER_NORMALIZED = 1,    // Cohort-normalized score against NORMALIZED_SCORE_THRESHOLD
+    AUTH_MATCHER_WHITENED = 2,      // Whitened score against MAHALANOBIS_THRESHOLD
+    AUTH_MATCHER_DISCRIMINANT = 3   // Per-user discriminant against LDA_THRESHOLD
+} AuthMatcher;
+
+/* Function Prototypes */
+
+/**
+ * Authenticate a trial with the strongest matcher available for the template
+ * The user's discriminant wins when one was trained, then the whitened
+ * matcher when a model is given, then cosine similarity normalized against
+ * the cohort when there is one.
+ * @param trial: EEG trial data
+ * @param template: Stored template
+ * @param whitening: Whitening model (may be NULL)
+ * @param cohort: Impostor cohort (may be NULL)
+ * @param result: Output authentication result
+ * @param matcher: Output matcher used (may be NULL)
+ * Returns: 0 on success, negative on error
+ */
+int auth_verify(const EEGData *trial, const Template *template, const MahalanobisModel *whitening,
+                const TemplateMatrix *cohort, AuthResult *result, AuthMatcher *matcher);
+
+/**
+ * Decide on an already extracted probe with the same matcher as auth_verify()
+ * Nothing is logged, so bulk callers can score many probes quietly.
+ * @param probe: Features of the trial
+ * @param template: Stored template
+ * @param whitening: Whitening model (may be NULL)
+ * @param cohort: Impostor cohort (may be NULL)
+ * @param result: Output authentication result
+ * @param matcher: Output matcher used (may be NULL)
+ * Returns: 0 on success, negative on error
+ */
+int auth_verify_features(const FeatureVector *probe, const Template *template, const MahalanobisModel *whitening,
+                         const TemplateMatrix *cohort, AuthResult *result, AuthMatcher *matcher);
+
+/**
+ * Decision threshold of a matcher, on the scale of the score it decides on
+ * @param matcher: Matcher
+ * Returns: Threshold
+ */
+float auth_threshold(AuthMatcher matcher);
+
+/**
+ * Derive cohort statistics and the discriminant for a new template
+ * Failures only lose the refinement and are logged as warnings.
+ * @param template: Newly created template
+ * @param cohort: Impostor cohort (may be NULL, then nothing is derived)
+ */
+void auth_train(Template *template, const TemplateMatrix *cohort);
+
+/**
+ * Fold an accepted trial into the template and refresh its cohort statistics
+ * The Z-norm statistics and, if the template has one, the discriminant are
+ * retrained for the new mean; without a cohort both are left as they were.
+ * @param template: Template that accepted the trial
+ * @param trial: Accepted EEG trial
+ * @param cohort: Impostor cohort (may be NULL)
+ * Returns: 0 if the template changed and should be persisted, negative otherwise
+ */
+int auth_adapt(Template *template, const EEGData *trial, const TemplateMatrix *cohort);
+
+/**
+ * Fold already extracted features into the template, as auth_adapt() does
+ * @param template: Template that accepted the sample
+ * @param sample: Features of the accepted trial
+ * @param cohort: Impostor cohort (may be NULL)
+ * Returns: 0 if the template changed and should be persisted, negative otherwise
+ */
+int auth_adapt_features(Template *template, const FeatureVector *sample, const TemplateMatrix *cohort);
+
+#endif /* AUTH_H */
@@ -0,0 +1,87 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "identify.h"
+#include "mahalanobis.h"
+#include "template_db.h"
+#include "config.h"
+
+/* Binary result file identification */
+#define BATCH_RESULT_MAGIC 0x52424C4E       // "NLBR" little-endian
+#define BATCH_RESULT_VERSION 1
+#define BATCH_RESULT_HEADER_SIZE 16
+#define BATCH_RESULT_RECORD_SIZE 16
+
+/*
+ * Offline re-scoring of archived recordings against the template store.
+ *
+ * The manifest lists one entry per line as "recording,username,task", task
+ * being 0-4 as for --task; blank lines and lines starting with '#' are
+ * skipped. Recordings are eeg_data_save() files. Each entry is decided by
+ * auth_verify_features(), the same matcher the CLI and daemon use, but
+ * templates are never adapted.
+ *
+ * Binary results (little-endian):
+ *   0  magic          u32   BATCH_RESULT_MAGIC
+ *   4  version        u16   BATCH_RESULT_VERSION
+ *   6  record size    u16   BATCH_RESULT_RECORD_SIZE
+ *   8  count          u64   Records that follow, in manifest order
+ * then per record:
+ *   0  line           u32   Manifest line number
+ *   4  status         u8    BatchStatus
+ *   5  matcher        u8    AuthMatcher (0 unless scored)
+ *   6  authenticated  u8
+ *   7  reserved       u8    0
+ *   8  similarity     f32
+ *  12  score          f32   Score compared against the matcher's threshold
+ * CSV results carry the same fields plus the recording path and username.
+ */
+
+/* Outcome of one manifest entry */
+typedef enum {
+    BATCH_OK = 0,                   // Scored
+    BATCH_BAD_RECORDING = 1,        // Recording missing or malformed
+    BATCH_UNKNOWN_USER = 2,         // No template for the user
+    BATCH_TASK_MISMATCH = 3,        // Recorded for another task than the user enrolled with
+    BATCH_SCORE_FAILED = 4          // Feature extraction or matching failed
+} BatchStatus;
+
+/* Result file format */
+typedef enum {
+    BATCH_FORMAT_CSV = 0,
+    BATCH_FORMAT_BINARY = 1
+} BatchFormat;
+
+/* Throughput counters for one run */
+typedef struct {
+    uint64_t records;               // Manifest entries
+    uint64_t accepted;              // Entries scored and authenticated
+    uint64_t rejected;              // Entries scored and refused
+    uint64_t failed;                // Entries that could not be scored
+    uint64_t users;                 // Distinct users looked up
+    uint64_t elapsed_ms;            // Wall-clock time, manifest to results
+    size_t threads;                 // Threads the scheduler ran tasks on
+} BatchStats;
+
+/* Function Prototypes */
+
+/**
+ * Score every manifest entry and write the results
+ * Recordings are decoded, extracted and scored in parallel on the shared
+ * scheduler; results are written in manifest order. Entries that cannot be
+ * scored are reported with their status and do not stop the run.
+ * @param db: Template database
+ * @param whitening: Whitening model (may be NULL)
+ * @param cohort: Impostor cohort (may be NULL)
+ * @param manifest_path: Manifest file
+ * @param output_path: Result file
+ * @param format: Result file format
+ * @param stats: Output counters (may be NULL)
+ * Returns: 0 on success, negative if the manifest or the results could not be processed
+ */
+int batch_score(TemplateDB *db, const MahalanobisModel *whitening, const TemplateMatrix *cohort,
+                const char *manifest_path, const char *output_path, BatchFormat format, BatchStats *stats);
+
+#endif /* BATCH_H */
@@ -15,6 +15,15 @@ typedef struct {
     MentalTask task_type;           // Type of mental task performed
 } EEGData;
 
+/*
+ * Recording file: a 32-byte little-endian header (magic, version, header
+ * size, task, channels, samples per channel, sampling rate, timestamp)
+ * followed by the samples as little-endian f32 in EEGData layout
+ */
+#define RECORDING_MAGIC 0x43524C4Eu     // "NLRC"
+#define RECORDING_VERSION 1
+#define RECORDING_HEADER_SIZE 32
+
 /* Device Connection Status */
 typedef enum {
     DEVICE_DISCONNECTED = 0,
@@ -65,6 +74,15 @@ int capture_stop_streaming(void);
  */
 int capture_record(float duration, MentalTask task, EEGData *output);
 
+/**
+ * Read the samples that arrived since the last read, without blocking
+ * Frames are interleaved: one sample per channel, NUM_CHANNELS per frame.
+ * @param frames: Output, room for max_frames * NUM_CHANNELS samples
+ * @param max_frames: Frames to read at most; the rest stays for the next read
+ * Returns: Frames read (0 if none arrived), negative on error
+ */
+int capture_read(float *frames, size_t max_frames);
+
 /**
  * Disconnect from EEG device
  * Returns: 0 on success, negative on error
@@ -90,6 +108,21 @@ EEGData* eeg_data_alloc(size_t num_channels, size_t num_samples);
  */
 void eeg_data_free(EEGData *data);
 
+/**
+ * Write EEG data to a recording file
+ * @param data: EEG data
+ * @param path: Destination path
+ * Returns: 0 on success, negative on error
+ */
+int eeg_data_save(const EEGData *data, const char *path);
+
+/**
+ * Read a recording file
+ * @param path: Recording path
+ * Returns: Pointer to EEG data, NULL if the file is missing or malformed
+ */
+EEGData* eeg_data_load(const char *path);
+
 /**
  * Display instructions for mental task
  * @param task: Mental task type
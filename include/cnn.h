@@ -0,0 +1,95 @@
+#ifndef CNN_H
+#define CNN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "capture.h"
+#include "config.h"
+
+/* Model file identification */
+#define CNN_FILE_MAGIC 0x4E434C4E           // "NLCN" little-endian
+#define CNN_FILE_VERSION 1
+#define CNN_FILE_HEADER_SIZE 32
+#define CNN_LAYER_HEADER_SIZE 32
+
+/* Layer flags */
+#define CNN_LAYER_RELU 0x1                  // Clamp the layer output at zero
+
+/*
+ * Small 1-D convolutional embedding networks, run in int8 without an ML
+ * runtime. Weights are trained offline and quantized per output channel;
+ * activations are 7-bit unsigned (0..127) with a per-tensor scale and a zero
+ * point of 0 after a ReLU and 64 otherwise, so every multiply-add fits the
+ * u8 x s8 kernels in vector_ops.c without saturating.
+ *
+ * Activations are stored channels-last ([time][channel]). A convolution
+ * window is then kernel * in_channels contiguous bytes, so each output time
+ * step is one row of a u8 x s8 product read straight from the activations
+ * (no im2col copy), with consecutive windows stride * in_channels apart.
+ * Padding is "valid"; a fully connected layer is a convolution whose kernel
+ * spans its whole input. The last layer must be a convolution, and its
+ * output, dequantized and flattened, is the embedding.
+ */
+typedef enum {
+    CNN_LAYER_CONV1D = 1,           // Strided convolution, int8 weights
+    CNN_LAYER_MAXPOOL = 2,          // Per-channel max over kernel steps
+    CNN_LAYER_GLOBAL_AVGPOOL = 3    // Per-channel mean over all time steps
+} CNNLayerType;
+
+typedef struct {
+    CNNLayerType type;
+    uint32_t flags;                 // CNN_LAYER_* flags
+    size_t in_channels;
+    size_t out_channels;
+    size_t kernel;                  // Time steps per window (pooling windows too)
+    size_t stride;
+    size_t in_length;               // Time steps in (fixed by the model input)
+    size_t out_length;              // Time steps out
+    float output_scale;             // Activation scale written by this layer
+    size_t row_bytes;               // kernel * in_channels rounded up to 8
+    int8_t *weights;                // [out_channels * row_bytes], zero padded
+    float *weight_scales;           // [out_channels] per-channel weight scale
+    float *bias;                    // [out_channels]
+    float *multipliers;             // [out_channels] accumulator to output scale
+    float *offsets;                 // [out_channels] bias and zero-point correction
+} CNNLayer;
+
+typedef struct {
+    size_t input_channels;          // EEG channels consumed
+    size_t input_samples;           // Samples per channel consumed
+    float input_scale;              // Quantization step of the normalized signal
+    size_t num_layers;
+    CNNLayer *layers;
+    size_t output_size;             // Embedding length
+    size_t max_activation;          // Largest activation tensor in bytes
+    size_t max_accumulators;        // Largest convolution output in values
+} CNNModel;
+
+/* Function Prototypes */
+
+/**
+ * Read a network from a model file
+ * File layout is documented in cnn.c. Shapes are checked layer by layer.
+ * @param path: Source path
+ * Returns: Pointer to model, NULL on failure
+ */
+CNNModel* cnn_load(const char *path);
+
+/**
+ * Free a network
+ * @param model: Model to free
+ */
+void cnn_free(CNNModel *model);
+
+/**
+ * Run the network on a preprocessed EEG window
+ * Uses the first input_samples samples of each channel. The model is only
+ * read, so one model can serve several threads.
+ * @param model: Network
+ * @param data: Filtered, per-channel normalized EEG data
+ * @param embedding: Output embedding (output_size floats)
+ * Returns: 0 on success, negative on error
+ */
+int cnn_embed(const CNNModel *model, const EEGData *data, float *embedding);
+
+#endif /* CNN_H */
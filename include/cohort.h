@@ -0,0 +1,97 @@
+#ifndef COHORT_H
+#define COHORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "identify.h"
+#include "template.h"
+#include "config.h"
+
+/* Cohort file identification */
+#define COHORT_FILE_MAGIC 0x43434C4E        // "NLCC" little-endian
+#define COHORT_FILE_VERSION 1
+#define COHORT_FILE_HEADER_SIZE 32
+
+/* Score normalization rules */
+typedef enum {
+    SCORE_NORM_NONE = 0,            // Raw similarity against SIMILARITY_THRESHOLD
+    SCORE_NORM_Z = 1,               // (s - mu_z) / sigma_z, template-side impostor statistics
+    SCORE_NORM_T = 2,               // (s - mu_t) / sigma_t, probe-side impostor statistics
+    SCORE_NORM_S = 3                // Mean of Z and T
+} ScoreNorm;
+
+/*
+ * Fixed impostor cohort for score normalization: unit-norm template means
+ * sampled from the database and packed as a TemplateMatrix.
+ *
+ * Z-norm statistics describe how a template scores against impostor probes.
+ * They depend only on the template, so they are computed once at enrolment
+ * (cohort rows stand in for impostor probes) and stored in the template.
+ * T-norm statistics describe how a probe scores against impostor models and
+ * are computed per decision with one matvec_f32() over the cohort.
+ * A cohort row belonging to the claimed user is always left out.
+ */
+
+/* Function Prototypes */
+
+/**
+ * Sample evenly spaced templates from the database into a cohort
+ * @param db: Template database
+ * @param size: Cohort rows wanted (fewer if the database is smaller)
+ * Returns: Pointer to cohort, NULL on failure
+ */
+TemplateMatrix* cohort_build(TemplateDB *db, size_t size);
+
+/**
+ * Write a cohort to a file (temp file + rename)
+ * @param cohort: Cohort
+ * @param path: Destination path
+ * Returns: 0 on success, negative on error
+ */
+int cohort_save(const TemplateMatrix *cohort, const char *path);
+
+/**
+ * Read a cohort written by cohort_save
+ * @param path: Source path
+ * Returns: Pointer to cohort (free with template_matrix_free), NULL on failure
+ */
+TemplateMatrix* cohort_load(const char *path);
+
+/**
+ * Compute a template's Z-norm statistics against the cohort
+ * @param cohort: Cohort
+ * @param template: Template (scored with template_similarity())
+ * @param mean: Output impostor score mean
+ * @param std: Output impostor score standard deviation (at least COHORT_MIN_STD)
+ * Returns: 0 on success, negative on error
+ */
+int cohort_znorm(const TemplateMatrix *cohort, const Template *template, float *mean, float *std);
+
+/**
+ * Compute a probe's T-norm statistics against the cohort with one matvec
+ * @param cohort: Cohort
+ * @param probe: Probe feature vector (need not be normalized)
+ * @param exclude: Username whose cohort row is skipped (may be NULL)
+ * @param mean: Output impostor score mean
+ * @param std: Output impostor score standard deviation (at least COHORT_MIN_STD)
+ * Returns: 0 on success, negative on error
+ */
+int cohort_tnorm(const TemplateMatrix *cohort, const FeatureVector *probe, const char *exclude,
+                 float *mean, float *std);
+
+/**
+ * Normalize a raw similarity
+ * Uses the template's stored Z-norm statistics, computing them on the fly
+ * for templates enrolled before a cohort existed.
+ * @param cohort: Cohort
+ * @param template: Claimed template
+ * @param probe: Probe feature vector
+ * @param raw: Raw similarity of probe against template
+ * @param rule: Normalization rule (not SCORE_NORM_NONE)
+ * @param normalized: Output normalized score
+ * Returns: 0 on success, negative on error
+ */
+int cohort_normalize(const TemplateMatrix *cohort, const Template *template, const FeatureVector *probe,
+                     float raw, ScoreNorm rule, float *normalized);
+
+#endif /* COHORT_H */
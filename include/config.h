@@ -15,6 +15,11 @@
 #define WINDOW_SIZE 256             // FFT window size
 #define OVERLAP 128                 // Window overlap
 
+/* Embedding Network Settings */
+#define CNN_EMBEDDING 0             // 1: features come from the int8 network in CNN_MODEL_PATH (re-enrol after changing)
+#define CNN_MAX_CHANNELS 1024       // Largest layer width accepted from a model file
+#define CNN_MAX_LAYERS 32           // Most layers accepted from a model file
+
 /* Frequency Band Definitions (Hz) */
 #define DELTA_LOW 0.5
 #define DELTA_HIGH 4.0
@@ -36,18 +41,128 @@
 #define NUM_ENROLMENT_TRIALS 3      // Number of trials to average
 #define SIMILARITY_THRESHOLD 0.85   // Cosine similarity threshold (0-1)
 #define SALT_LENGTH 32              // bytes
+#define TEMPLATE_UPDATE_ALPHA 0.05  // Weight of each accepted sample in adaptive updates
+#define TEMPLATE_UPDATE_MIN_SIMILARITY SIMILARITY_THRESHOLD  // Samples below this are not folded in
+#define TEMPLATE_MAX_EXEMPLARS NUM_ENROLMENT_TRIALS  // Enrolment trials kept beside the mean
+#define ENROLL_MIN_CONSISTENCY SIMILARITY_THRESHOLD  // Trials less similar to the running mean are redone
+#define ENROLL_MAX_REDOS 2                  // Inconsistent trials tolerated before enrolment fails
+#define ENROLL_REST_MS 10000                // Rest between enrolment trials
+#define TEMPLATE_FUSION_RULE 2              // Exemplar score fusion (0: max, 1: mean, 2: softmax)
+#define TEMPLATE_FUSION_TEMPERATURE 0.05    // Softmax temperature (smaller leans toward max)
+
+/* Score Normalization Settings */
+#define SCORE_NORMALIZATION 2               // 0: raw, 1: Z-norm, 2: T-norm, 3: S-norm (mean of Z and T)
+#define NORMALIZED_SCORE_THRESHOLD 2.25     // Impostor standard deviations above the impostor mean
+#define COHORT_SIZE 256                     // Impostor templates sampled into the cohort
+#define COHORT_MIN_STD 0.01                 // Floor on cohort score spread
+
+/* Whitened (Mahalanobis) Matcher Settings */
+#define MAHALANOBIS_MATCHER 1               // 1: authenticate with the whitened distance once a model is trained
+#define MAHALANOBIS_THRESHOLD 0.2           // Minimum exp(-d^2 / 2n) score
+#define MAHALANOBIS_SHRINKAGE 0.1           // Blend of the pooled covariance toward a scaled identity
+
+/* Per-User Discriminant Settings */
+#define LDA_MATCHER 1                       // 1: authenticate with the user's discriminant when one is trained
+#define LDA_THRESHOLD 3.0                   // Impostor standard deviations above the cohort projection mean
+#define LDA_SHRINKAGE 0.2                   // Blend of the within-class covariance toward a scaled identity
+
+/* Identification (1:N) Settings */
+#define IDENTIFY_TOP_K 5                    // Candidates reported by identify
+#define IDENTIFY_MAX_THREADS 0              // Scan slices (0 = scheduler concurrency)
+#define IDENTIFY_MIN_ROWS_PER_THREAD 65536  // Don't split scans smaller than this
+#define IDENTIFY_QUANTIZED 1                // Exhaustive scans use int8 templates
+#define IDENTIFY_RERANK_CANDIDATES 64       // Approximate shortlist rescored with exact features
+
+/* Evaluation Settings */
+#define EVAL_MAX_THREADS 0                  // Scoring tasks (0 = scheduler concurrency)
+#define EVAL_HISTOGRAM_BINS 16384           // Score bins over [-1, 1] for threshold sweeps
+
+/* Approximate Nearest-Neighbour (HNSW) Index Settings */
+#define HNSW_M 16                           // Graph degree on upper layers (2x on layer 0)
+#define HNSW_EF_CONSTRUCTION 200            // Candidate list size while inserting
+#define HNSW_EF_SEARCH 128                  // Candidate list size while searching
+#define HNSW_COMPACT_PERCENT 25             // Rebuild once tombstones exceed this share of nodes
+#define HNSW_COMPACT_MIN_NODES 1024         // Never rebuild graphs smaller than this
+
+/* Product Quantization Settings */
+#define PQ_NUM_SUBSPACES 10                 // Code bytes per template (divides FEATURE_VECTOR_SIZE)
+#define PQ_TRAIN_SAMPLES 32768              // Templates sampled for codebook training
+#define PQ_TRAIN_ITERATIONS 16              // k-means iterations per subspace
+#define INDEX_LOG_SNAPSHOT_RECORDS 1024     // Fold an index's change log into its file past this many records
+
+/* Write-Ahead Log Settings */
+#define WAL_CHECKPOINT_BYTES (4u << 20)     // Sync the database and truncate the log past this size
+#define WAL_ASYNC_FLUSH_BYTES (64u << 10)   // Deferred records queued before the appender flushes
+
+/* Shared Snapshot Settings */
+#define SNAPSHOT_POLL_MS 500                // Publisher checks the database for changes this often
+
+/* Archive (export/import) Settings */
+#define ARCHIVE_MAX_THREADS 0               // Serialize/parse slices per round (0 = scheduler concurrency)
+#define ARCHIVE_BATCH_RECORDS 4096          // Templates handed to a worker at a time
+
+/* Job Scheduler Settings */
+#define SCHEDULER_THREADS 0                 // Shared workers (0 = one per online CPU, less the waiting caller)
+#define SCHEDULER_DEQUE_SIZE 1024           // Tasks per worker deque (power of two); overflow is queued centrally
+
+/* Batch Scoring Settings */
+#define BATCH_TASK_RECORDS 32               // Manifest entries decoded and scored per task
+
+/* Daemon (neurolockd) Settings */
+#define DAEMON_WORKERS 0                    // Request threads (0 = one per online CPU)
+#define DAEMON_SOCKET_MODE 0660             // Permissions of the listening socket
+#define DAEMON_IO_TIMEOUT_MS 2000           // A stalled client is dropped after this
+#define DAEMON_GALLERY_REFRESH_MS 1000      // Identification matrix rebuilt at most this often after changes
+#define DAEMON_CLIENT_TIMEOUT_MS 5000       // Client wait for a reply (feature extraction included)
+
+/* PAM Module (pam_neurolock.so) Settings; each can be overridden on the PAM line */
+#define PAM_SOCKET_PATH NEUROLOCK_SOCKET_PATH  // socket=
+#define PAM_DEVICE_NAME "default_eeg_device"              // device=
+#define PAM_TIMEOUT_MS 2000                 // timeout=: daemon reply deadline for a login
+
+/* Continuous Authentication Settings */
+#define CONTINUOUS_CADENCE_MS 2000          // Re-score interval (monitor [cadence_ms] overrides)
+#define CONTINUOUS_DEAUTH_WINDOWS 3         // Rejected windows in a row that de-authenticate the wearer
+#define CONTINUOUS_SIGNAL_TIMEOUT_MS 3000   // No samples for this long de-authenticates too
 
 /* Hashing Settings */
 #define USE_SHA256 1                // Use SHA-256 (set to 0 for BLAKE3)
 #define HASH_OUTPUT_SIZE 32         // bytes (SHA-256 output)
 
 /* Authentication Settings */
-#define MAX_AUTH_ATTEMPTS 3
-#define AUTH_TIMEOUT 30             // seconds
+#define MAX_AUTH_ATTEMPTS 3         // Failed verifications before a user is locked out
+#define AUTH_TIMEOUT 30             // seconds: window for counting failures, and lockout length
+#define LOCKOUT_TABLE_SIZE 16384    // Users with failures in the last AUTH_TIMEOUT tracked at once; beyond that, new ones are refused
+#define LOCKOUT_SHARDS 64           // Probe regions of the attempt table
 
 /* Storage Paths */
 #define TEMPLATE_DIR "./templates"
 #define TEMPLATE_EXTENSION ".nlt"   // NeuroLock Template
+#define TEMPLATE_DB_PATH TEMPLATE_DIR "/templates.nldb"  // Single-file template database
+#define HNSW_INDEX_PATH TEMPLATE_DIR "/templates.hnsw"   // Optional ANN index for identify
+#define PQ_INDEX_PATH TEMPLATE_DIR "/templates.pq"       // Optional compact codes for identify
+#define WAL_PATH TEMPLATE_DIR "/templates.wal"          // Write-ahead log in front of the database
+#define SNAPSHOT_CONTROL_PATH TEMPLATE_DIR "/templates.snap"  // Shared identification snapshot announcement
+#define COHORT_PATH TEMPLATE_DIR "/cohort.nlc"          // Impostor cohort for score normalization
+#define MAHALANOBIS_PATH TEMPLATE_DIR "/whitening.nlw"  // Pooled covariance factor for the whitened matcher
+#define CNN_MODEL_PATH TEMPLATE_DIR "/embedding.nlcn"  // Quantized embedding network weights
+#define EVAL_DET_PATH TEMPLATE_DIR "/det.csv"           // DET curve written by eval
+#define BATCH_OUTPUT_PATH TEMPLATE_DIR "/batch_scores.csv"  // Default results of batch
+#define LOCKOUT_PATH TEMPLATE_DIR "/attempts.nlt"       // Failed-attempt table shared by the CLI and daemon
+#define NEUROLOCK_RUN_DIR "/run/neurolock"                // Created by neurolockd for the default socket
+#define NEUROLOCK_SOCKET_PATH NEUROLOCK_RUN_DIR "/neurolockd.sock"  // Where neurolockd listens and clients connect
+#define DAEMON_SOCKET_PATH NEUROLOCK_SOCKET_PATH          // neurolockd listening socket
+
+/* Template Database Settings */
+#define TEMPLATE_DB_INITIAL_CAPACITY 1024   // Records allocated in a new database
+#define TEMPLATE_DB_RECORD_SIZE 1280        // Bytes per record (multiple of 64)
+#define TEMPLATE_DB_IO_DEPTH 32             // Writes kept in flight by batched stores
+
+/* Batched I/O Settings */
+#define IO_BATCH_URING 1                    // 1: queue batched I/O through io_uring where the kernel allows it
+
+/* Template Cache Settings */
+#define TEMPLATE_CACHE_CAPACITY 4096        // Templates kept in memory
 
 /* Mental Task Types */
 typedef enum {
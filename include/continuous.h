@@ -0,0 +1,93 @@
+#ifndef CONTINUOUS_H
+#define CONTINUOUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "auth.h"
+#include "config.h"
+
+/*
+ * Continuous (post-login) verification of one headset's wearer.
+ *
+ * Samples are pushed as they arrive. The monitor keeps the last
+ * CAPTURE_DURATION seconds of every channel and, once per cadence, scores
+ * that window with the same matcher as auth_verify(). The features are kept
+ * current sample by sample: a sliding DFT holds the band bins of the
+ * window's first WINDOW_SIZE samples and running sums hold each channel's
+ * mean and variance, so they equal extract_features() over the window and a
+ * re-score costs little more than the matcher. Both are recomputed exactly
+ * once per window length to keep rounding from drifting. With
+ * CNN_EMBEDDING set, extract_features() runs on the window at each re-score
+ * instead.
+ *
+ * CONTINUOUS_DEAUTH_WINDOWS rejected windows in a row raise the de-auth
+ * event, once; an accepted window resets the count but does not undo a
+ * de-auth. A monitor belongs to one thread.
+ */
+typedef struct ContinuousMonitor ContinuousMonitor;
+
+/* Outcome of a push */
+typedef enum {
+    CONTINUOUS_IDLE = 0,            // No window scored
+    CONTINUOUS_ACCEPTED = 1,        // Window scored and accepted
+    CONTINUOUS_LOW = 2,             // Window rejected, not (or already) de-authenticated
+    CONTINUOUS_DEAUTH = 3           // Score stayed low: de-authenticate the wearer
+} ContinuousEvent;
+
+/* Counters and the latest decision */
+typedef struct {
+    uint64_t samples;               // Frames pushed
+    uint64_t windows;               // Windows scored
+    uint64_t rejected;              // Windows rejected
+    uint32_t low_streak;            // Rejected windows in a row
+    int deauthenticated;            // 1 once the de-auth event was raised
+    AuthResult last;                // Decision on the latest window
+    AuthMatcher matcher;            // Matcher of the latest decision
+    uint64_t busy_ns;               // Thread CPU time spent pushing and scoring
+} ContinuousStats;
+
+/* Function Prototypes */
+
+/**
+ * Start monitoring a wearer
+ * The template and models are borrowed and must outlive the monitor.
+ * @param template: Wearer's template
+ * @param whitening: Whitening model (may be NULL)
+ * @param cohort: Impostor cohort (may be NULL)
+ * @param cadence_ms: Time between re-scores, in stream time (0 = CONTINUOUS_CADENCE_MS)
+ * Returns: Pointer to monitor, NULL on failure
+ */
+ContinuousMonitor* continuous_create(const Template *template, const MahalanobisModel *whitening,
+                                     const TemplateMatrix *cohort, uint32_t cadence_ms);
+
+/**
+ * Free a monitor
+ * @param monitor: Monitor
+ */
+void continuous_free(ContinuousMonitor *monitor);
+
+/**
+ * Feed samples, re-scoring if a cadence has passed since the last score
+ * @param monitor: Monitor
+ * @param frames: Interleaved samples as from capture_read(), NUM_CHANNELS per frame
+ * @param count: Frames
+ * Returns: ContinuousEvent of the score, CONTINUOUS_IDLE if none, negative on error
+ */
+int continuous_push(ContinuousMonitor *monitor, const float *frames, size_t count);
+
+/**
+ * Features of the current window
+ * @param monitor: Monitor
+ * @param output: Output feature vector (FEATURE_VECTOR_SIZE)
+ * Returns: 0 on success, negative until a full window has been pushed
+ */
+int continuous_features(ContinuousMonitor *monitor, FeatureVector *output);
+
+/**
+ * Counters and the latest decision
+ * @param monitor: Monitor
+ * @param stats: Output statistics
+ */
+void continuous_stats(const ContinuousMonitor *monitor, ContinuousStats *stats);
+
+#endif /* CONTINUOUS_H */
@@ -0,0 +1,91 @@
+#ifndef ENROLL_H
+#define ENROLL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "template.h"
+#include "config.h"
+
+/*
+ * Pipelined enrolment.
+ *
+ * Each trial is handed over as soon as it is captured; its features are
+ * extracted on the shared scheduler while the user rests or records the next
+ * trial. Extracted trials are folded into a running mean and variance
+ * (Welford) in submission order, so the template is ready as soon as the
+ * last trial is in.
+ *
+ * A trial whose cosine similarity to the running mean is below
+ * ENROLL_MIN_CONSISTENCY is flagged and left out of the statistics, so the
+ * user can redo it during the session. The first accepted trial sets the
+ * reference.
+ */
+typedef struct EnrollSession EnrollSession;
+
+/* State of a submitted trial */
+typedef enum {
+    ENROLL_TRIAL_PENDING = 0,       // Not folded in yet
+    ENROLL_TRIAL_ACCEPTED = 1,      // Folded into the running statistics
+    ENROLL_TRIAL_INCONSISTENT = 2,  // Too far from the trials so far: redo it
+    ENROLL_TRIAL_FAILED = 3         // Feature extraction failed: redo it
+} EnrollTrialStatus;
+
+/* Function Prototypes */
+
+/**
+ * Start an enrolment session
+ * @param username: User identifier
+ * @param task: Mental task type
+ * @param max_trials: Trials that may be submitted, redone ones included
+ * Returns: Pointer to session, NULL on failure
+ */
+EnrollSession* enroll_session_create(const char *username, MentalTask task, size_t max_trials);
+
+/**
+ * Hand a captured trial over for extraction
+ * Returns at once; the trial is freed once its features are extracted.
+ * @param session: Session
+ * @param trial: Captured EEG data, owned by the session from here on
+ * Returns: Trial index, negative on error (trial freed)
+ */
+int enroll_session_submit(EnrollSession *session, EEGData *trial);
+
+/**
+ * Wait until every submitted trial has been checked
+ * @param session: Session
+ */
+void enroll_session_wait(EnrollSession *session);
+
+/**
+ * State of a submitted trial, without waiting
+ * @param session: Session
+ * @param index: Trial index from enroll_session_submit()
+ * @param consistency: Output similarity to the running mean (may be NULL)
+ * Returns: Trial state
+ */
+EnrollTrialStatus enroll_session_trial(EnrollSession *session, int index, float *consistency);
+
+/**
+ * Number of trials folded into the running statistics
+ * @param session: Session
+ * Returns: Accepted trials
+ */
+size_t enroll_session_accepted(EnrollSession *session);
+
+/**
+ * Build the template from the accepted trials
+ * Waits for outstanding trials; the running mean and variance become the
+ * template's features and variance.
+ * @param session: Session
+ * @param output: Output template
+ * Returns: 0 on success, negative on error or if no trial was accepted
+ */
+int enroll_session_finish(EnrollSession *session, Template *output);
+
+/**
+ * Free a session, waiting for outstanding trials
+ * @param session: Session
+ */
+void enroll_session_free(EnrollSession *session);
+
+#endif /* ENROLL_H */
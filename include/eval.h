@@ -0,0 +1,95 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "identify.h"
+#include "template_db.h"
+#include "config.h"
+
+/*
+ * Offline accuracy evaluation. Every probe is scored against every template
+ * by cosine similarity, a probe and a template being a genuine pair when
+ * they share a username. Scores are never stored: each block of the score
+ * matrix is computed with a blocked GEMM over normalized rows and binned at
+ * once, so memory stays flat at any size, and FAR/FRR for every threshold
+ * follow from one sweep over the histograms.
+ */
+typedef struct {
+    size_t bins;                    // Equal-width bins over [-1, 1]
+    uint64_t *genuine;              // [bins] genuine score counts
+    uint64_t *impostor;             // [bins] impostor score counts
+    uint64_t genuine_count;
+    uint64_t impostor_count;
+} ScoreHistogram;
+
+/* Function Prototypes */
+
+/**
+ * Allocate an empty score histogram
+ * @param bins: Number of bins over [-1, 1]
+ * Returns: Pointer to histogram, NULL on failure
+ */
+ScoreHistogram* eval_histogram_alloc(size_t bins);
+
+/**
+ * Free a score histogram
+ * @param hist: Histogram to free
+ */
+void eval_histogram_free(ScoreHistogram *hist);
+
+/**
+ * Pack every stored exemplar (enrolment trial) as a probe row
+ * Each exemplar also shaped its own template's mean, so genuine scores
+ * against the same database are optimistic.
+ * @param db: Template database
+ * Returns: Pointer to matrix, NULL on failure
+ */
+TemplateMatrix* eval_probe_matrix(TemplateDB *db);
+
+/**
+ * Score every probe against every template into the histograms
+ * Gallery blocks are shared out across tasks on the shared scheduler. Counts
+ * are added to whatever the histogram already holds.
+ * @param probes: Normalized probe rows
+ * @param gallery: Normalized template rows (usernames unique)
+ * @param hist: Histogram to accumulate into
+ * Returns: 0 on success, negative on error
+ */
+int eval_score_matrix(const TemplateMatrix *probes, const TemplateMatrix *gallery, ScoreHistogram *hist);
+
+/**
+ * Error rates when accepting scores at or above a threshold
+ * The threshold is resolved to the lower edge of its bin.
+ * @param hist: Score histogram
+ * @param threshold: Decision threshold
+ * @param far: Output false accept rate (0-1)
+ * @param frr: Output false reject rate (0-1)
+ */
+void eval_rates(const ScoreHistogram *hist, float threshold, double *far, double *frr);
+
+/**
+ * Find the threshold where the false accept and false reject rates meet
+ * @param hist: Score histogram
+ * @param eer: Output equal error rate (0-1)
+ * Returns: Threshold at the equal error rate
+ */
+float eval_equal_error(const ScoreHistogram *hist, double *eer);
+
+/**
+ * Find the lowest threshold whose false accept rate is at most a target
+ * @param hist: Score histogram
+ * @param far: Target false accept rate (0-1)
+ * Returns: Threshold (bin edge)
+ */
+float eval_threshold_at_far(const ScoreHistogram *hist, double far);
+
+/**
+ * Write the DET curve as CSV (threshold, FAR, FRR), one line per occupied bin
+ * @param hist: Score histogram
+ * @param path: Destination path
+ * Returns: 0 on success, negative on error
+ */
+int eval_write_det(const ScoreHistogram *hist, const char *path);
+
+#endif /* EVAL_H */
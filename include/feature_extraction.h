@@ -2,6 +2,7 @@
 #define FEATURE_EXTRACTION_H
 
 #include "capture.h"
+#include "cnn.h"
 #include "config.h"
 
 /* Feature Vector Structure */
@@ -86,14 +87,37 @@ int compute_fft(const float *input, float *output, size_t size);
  */
 int extract_wavelet_features(const EEGData *data, FeatureVector *output);
 
+/**
+ * Use an embedding network instead of band powers in extract_features
+ * The model must stay loaded until it is replaced; pass NULL to go back to
+ * band powers. Set it once before extracting from several threads.
+ * @param model: Network whose output size is FEATURE_VECTOR_SIZE, or NULL
+ * Returns: 0 on success, negative if the network does not fit the pipeline
+ */
+int feature_extraction_set_model(const CNNModel *model);
+
 /**
  * Complete feature extraction pipeline
+ * Band powers by default, or the embedding network once one is set.
  * @param data: Input EEG data
  * @param output: Output feature vector
  * Returns: 0 on success, negative on error
  */
 int extract_features(const EEGData *data, FeatureVector *output);
 
+/**
+ * Run the feature extraction pipeline over several recordings at once
+ * Recordings are shared out over the job scheduler, one task each; every
+ * output is filled exactly as extract_features() would fill it.
+ * @param data: Input EEG data [count]
+ * @param count: Number of recordings
+ * @param outputs: Output feature vectors [count]
+ * @param status: Per-recording result, 0 or negative (may be NULL)
+ * Returns: Number of recordings that failed
+ */
+size_t extract_features_batch(const EEGData *const *data, size_t count, FeatureVector *const *outputs,
+                              int *status);
+
 /**
  * Allocate memory for FeatureVector
  * @param size: Number of features
@@ -0,0 +1,106 @@
+#ifndef HNSW_H
+#define HNSW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "identify.h"
+#include "template_db.h"
+#include "config.h"
+
+/*
+ * Hierarchical Navigable Small World graph over unit-norm feature vectors.
+ * Similarity is the cosine used by calculate_similarity (a dot product of
+ * normalized vectors). Deleted users are tombstoned: their nodes keep routing
+ * searches but are never returned, and re-inserting the user reuses the node.
+ * Once tombstones exceed HNSW_COMPACT_PERCENT of the nodes, hnsw_remove()
+ * rebuilds the graph without them, which renumbers the nodes.
+ *
+ * The index is not internally synchronized. Searches may run concurrently
+ * with each other but not with hnsw_insert()/hnsw_remove().
+ */
+typedef struct HNSWIndex HNSWIndex;
+
+/* Function Prototypes */
+
+/**
+ * Create an empty index
+ * @param dim: Features per vector
+ * @param m: Neighbours per node on upper layers (layer 0 keeps 2 * m)
+ * @param ef_construction: Candidate list size while inserting
+ * Returns: Pointer to index, NULL on failure
+ */
+HNSWIndex* hnsw_create(size_t dim, size_t m, size_t ef_construction);
+
+/**
+ * Build an index from every template in the database
+ * @param db: Template database
+ * Returns: Pointer to index, NULL on failure
+ */
+HNSWIndex* hnsw_build(TemplateDB *db);
+
+/**
+ * Free an index
+ * @param index: Index to free
+ */
+void hnsw_free(HNSWIndex *index);
+
+/**
+ * Insert or replace a user's vector
+ * @param index: Index
+ * @param username: Owner of the vector
+ * @param features: Feature vector (need not be normalized)
+ * Returns: 0 on success, negative on error
+ */
+int hnsw_insert(HNSWIndex *index, const char *username, const float *features);
+
+/**
+ * Tombstone a user's vector, compacting the graph if tombstones dominate
+ * @param index: Index
+ * @param username: User to remove
+ * Returns: 0 on success, negative if the user is not indexed
+ */
+int hnsw_remove(HNSWIndex *index, const char *username);
+
+/**
+ * Find the k nearest live vectors to a probe
+ * @param index: Index
+ * @param probe: Probe feature vector (need not be normalized)
+ * @param k: Number of candidates wanted
+ * @param ef: Candidate list size (raised to k if smaller); larger is slower but more exact
+ * @param matches: Output array of at least k entries, best first (index is the graph node)
+ * @param num_matches: Output number of candidates written
+ * Returns: 0 on success, negative on error
+ */
+int hnsw_search(const HNSWIndex *index, const FeatureVector *probe, size_t k, size_t ef,
+                IdentifyMatch *matches, size_t *num_matches);
+
+/**
+ * Number of live (non-deleted) vectors
+ * @param index: Index
+ * Returns: Live vector count
+ */
+size_t hnsw_count(const HNSWIndex *index);
+
+/**
+ * Features per indexed vector
+ * @param index: Index
+ * Returns: Vector dimension, 0 if index is NULL
+ */
+size_t hnsw_dim(const HNSWIndex *index);
+
+/**
+ * Write the index to a file (temp file + rename)
+ * @param index: Index
+ * @param path: Destination path
+ * Returns: 0 on success, negative on error
+ */
+int hnsw_save(const HNSWIndex *index, const char *path);
+
+/**
+ * Read an index written by hnsw_save
+ * @param path: Source path
+ * Returns: Pointer to index, NULL on failure
+ */
+HNSWIndex* hnsw_load(const char *path);
+
+#endif /* HNSW_H */
@@ -0,0 +1,95 @@
+#ifndef IDENTIFY_H
+#define IDENTIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "feature_extraction.h"
+#include "template_db.h"
+#include "config.h"
+
+/* Largest code in a quantized row; 7 bits keep maddubs pair sums from saturating */
+#define QUANT_TEMPLATE_MAX 127
+
+/* Largest magnitude in a quantized probe */
+#define QUANT_PROBE_MAX 127
+
+/* Pre-normalized templates packed for 1:N scans (structure of arrays) */
+typedef struct {
+    size_t num_templates;           // Rows in the matrix
+    size_t dim;                     // Features per template
+    size_t stride;                  // Elements between rows (dim rounded up to 8)
+    float *matrix;                  // [num_templates * stride], unit-norm rows (NULL once quantized)
+    uint8_t *codes;                 // [num_templates * stride], int8 rows (NULL unless quantized)
+    float *scales;                  // [num_templates] feature = scale * code + zero_point
+    float *zero_points;             // [num_templates] feature value of code 0
+    char (*usernames)[64];          // [num_templates] row owners
+    MentalTask *task_types;         // [num_templates]
+} TemplateMatrix;
+
+/* One identification candidate */
+typedef struct {
+    char username[64];              // Matched user
+    float similarity;               // Cosine similarity (0-1)
+    size_t index;                   // Row in the TemplateMatrix
+} IdentifyMatch;
+
+/* Function Prototypes */
+
+/**
+ * Pack every template in the database into a normalized feature matrix
+ * @param db: Template database
+ * Returns: Pointer to matrix, NULL on failure
+ */
+TemplateMatrix* template_matrix_build(TemplateDB *db);
+
+/**
+ * Allocate an empty template matrix
+ * @param rows: Number of templates
+ * @param dim: Features per template
+ * Returns: Pointer to zeroed matrix, NULL on failure
+ */
+TemplateMatrix* template_matrix_alloc(size_t rows, size_t dim);
+
+/**
+ * Replace the float rows with per-template affine int8 codes
+ * Each row keeps its own scale and zero-point; the float rows are wiped and
+ * freed, cutting row storage by 4x. template_identify() then scores with
+ * integer multiply-add and the scores carry a small quantization error.
+ * @param matrix: Matrix to quantize in place
+ * Returns: 0 on success, negative on error
+ */
+int template_matrix_quantize(TemplateMatrix *matrix);
+
+/**
+ * Free a template matrix
+ * @param matrix: Matrix to free
+ */
+void template_matrix_free(TemplateMatrix *matrix);
+
+/**
+ * Identify the k most similar enrolled users for a probe (1:N)
+ * @param matrix: Packed templates
+ * @param probe: Probe feature vector (need not be normalized)
+ * @param k: Number of candidates wanted
+ * @param matches: Output array of at least k entries, best first
+ * @param num_matches: Output number of candidates written
+ * Returns: 0 on success, negative on error
+ */
+int template_identify(const TemplateMatrix *matrix, const FeatureVector *probe, size_t k,
+                      IdentifyMatch *matches, size_t *num_matches);
+
+/**
+ * Rescore approximate candidates with the exact fused score (mean and
+ * exemplars, see fused_similarity()) from the database
+ * Candidates no longer in the database are dropped.
+ * @param db: Template database
+ * @param probe: Probe feature vector
+ * @param matches: Candidates in, exact best-first matches out
+ * @param num_matches: Candidate count in, match count out (at most k)
+ * @param k: Number of matches to keep
+ * Returns: 0 on success, negative on error
+ */
+int template_rerank(TemplateDB *db, const FeatureVector *probe, IdentifyMatch *matches,
+                    size_t *num_matches, size_t k);
+
+#endif /* IDENTIFY_H */
@@ -0,0 +1,105 @@
+#ifndef INDEX_LOG_H
+#define INDEX_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hnsw.h"
+#include "pq.h"
+#include "config.h"
+
+/* Log file identification */
+#define INDEX_LOG_MAGIC 0x4C494C4E          // "NLIL" little-endian
+#define INDEX_LOG_VERSION 1
+#define INDEX_LOG_HEADER_SIZE 16
+
+/*
+ * Change logs for the optional HNSW and PQ indexes.
+ *
+ * Enrolments and deletions append one CRC-framed record to "<index>.log"
+ * instead of loading and rewriting the index. Loading an index replays its
+ * log. A snapshot saves the index with the log folded in, cuts the log back
+ * to its header and bumps the generation stored there, so a process tailing
+ * the log knows to reload. Records are idempotent: replaying one that a
+ * snapshot already holds leaves the index unchanged.
+ *
+ * Every operation holds an exclusive flock on the log, so the CLI and the
+ * daemon may share one. Indexes that were never built (file absent) are
+ * skipped.
+ */
+
+/* Resident HNSW and PQ indexes kept in step through their logs */
+typedef struct IndexSet IndexSet;
+
+/* Function Prototypes */
+
+/**
+ * Log a template change against every index that exists
+ * An index whose log reaches INDEX_LOG_SNAPSHOT_RECORDS is snapshotted.
+ * @param hnsw_path: HNSW index path (may be NULL)
+ * @param pq_path: PQ index path (may be NULL)
+ * @param username: User whose template changed
+ * @param features: New template mean, NULL if the user was removed
+ * Returns: 0 on success, negative if a log could not be written
+ */
+int index_log_record(const char *hnsw_path, const char *pq_path, const char *username,
+                     const float *features);
+
+/**
+ * Load an HNSW index and replay its log
+ * @param path: Index file path
+ * Returns: Pointer to index, NULL on failure
+ */
+HNSWIndex* index_log_load_hnsw(const char *path);
+
+/**
+ * Load a PQ index and replay its log
+ * @param path: Index file path
+ * Returns: Pointer to index, NULL on failure
+ */
+PQIndex* index_log_load_pq(const char *path);
+
+/**
+ * Snapshot a freshly built HNSW index: replay the log onto it, save it and
+ * cut the log
+ * @param path: Index file path
+ * @param index: Index to save
+ * Returns: 0 on success, negative on error
+ */
+int index_log_save_hnsw(const char *path, HNSWIndex *index);
+
+/**
+ * Snapshot a freshly trained PQ index: replay the log onto it, save it and
+ * cut the log
+ * @param path: Index file path
+ * @param index: Index to save
+ * Returns: 0 on success, negative on error
+ */
+int index_log_save_pq(const char *path, PQIndex *index);
+
+/**
+ * Load whichever indexes exist and keep them resident
+ * @param hnsw_path: HNSW index path (may be NULL)
+ * @param pq_path: PQ index path (may be NULL)
+ * Returns: Pointer to index set, NULL on failure
+ */
+IndexSet* index_set_open(const char *hnsw_path, const char *pq_path);
+
+/**
+ * Log a template change and apply it to the resident indexes
+ * Records other processes appended are applied first. An index built after
+ * index_set_open() is loaded on first use. Each index is snapshotted once
+ * its log reaches INDEX_LOG_SNAPSHOT_RECORDS. Not thread-safe.
+ * @param set: Index set
+ * @param username: User whose template changed
+ * @param features: New template mean, NULL if the user was removed
+ * Returns: 0 on success, negative if a log could not be written
+ */
+int index_set_update(IndexSet *set, const char *username, const float *features);
+
+/**
+ * Snapshot indexes with unsaved changes and free the set
+ * @param set: Index set
+ */
+void index_set_close(IndexSet *set);
+
+#endif /* INDEX_LOG_H */
@@ -0,0 +1,94 @@
+#ifndef IO_BATCH_H
+#define IO_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+/*
+ * Batched positional file I/O for bulk template store work.
+ *
+ * Reads and writes are queued and run together: on Linux through an
+ * io_uring instance (raw syscalls, no liburing) that keeps up to `depth`
+ * requests in flight and is entered once per window instead of once per
+ * request; elsewhere, or when the kernel refuses io_uring, each request is
+ * run with pread()/pwrite() as it is queued. Callers see the same results
+ * either way. One registered file and one registered buffer are used as
+ * fixed file and fixed buffer where the kernel supports them.
+ *
+ * Requests in one batch may complete in any order; a caller that needs an
+ * order waits between the requests. Buffers must stay untouched until
+ * io_batch_wait() returns. Not thread-safe.
+ */
+typedef struct IOBatch IOBatch;
+
+/* Function Prototypes */
+
+/**
+ * Create a batch queue
+ * @param depth: Requests kept in flight (rounded up to a power of two)
+ * Returns: Pointer to queue, NULL on failure
+ */
+IOBatch* io_batch_create(unsigned depth);
+
+/**
+ * Release a batch queue (pending requests are waited for first)
+ * @param io: Queue
+ */
+void io_batch_free(IOBatch *io);
+
+/**
+ * Whether requests go through io_uring
+ * @param io: Queue
+ * Returns: 1 for io_uring, 0 for the synchronous fallback
+ */
+int io_batch_async(const IOBatch *io);
+
+/**
+ * Register the file most requests go to (replaces any earlier one)
+ * @param io: Queue
+ * @param fd: Open file descriptor
+ * Returns: 0 on success (the fd is used unregistered if the kernel declines)
+ */
+int io_batch_register_file(IOBatch *io, int fd);
+
+/**
+ * Register the buffer most requests read into or write from
+ * @param io: Queue
+ * @param buffer: Buffer start
+ * @param size: Buffer size
+ * Returns: 0 on success (the buffer is used unregistered if the kernel declines)
+ */
+int io_batch_register_buffer(IOBatch *io, void *buffer, size_t size);
+
+/**
+ * Queue a read of size bytes at offset
+ * @param io: Queue
+ * @param fd: File descriptor
+ * @param buffer: Destination
+ * @param size: Bytes to read; reading past end of file is an error
+ * @param offset: File offset
+ * Returns: 0 if queued, negative on error
+ */
+int io_batch_read(IOBatch *io, int fd, void *buffer, size_t size, uint64_t offset);
+
+/**
+ * Queue a write of size bytes at offset
+ * @param io: Queue
+ * @param fd: File descriptor
+ * @param buffer: Source
+ * @param size: Bytes to write
+ * @param offset: File offset
+ * Returns: 0 if queued, negative on error
+ */
+int io_batch_write(IOBatch *io, int fd, const void *buffer, size_t size, uint64_t offset);
+
+/**
+ * Run every queued request to completion
+ * Short transfers are resumed; the queue is empty afterwards.
+ * @param io: Queue
+ * Returns: 0 if every request since the last wait transferred all its bytes, negative otherwise
+ */
+int io_batch_wait(IOBatch *io);
+
+#endif /* IO_BATCH_H */
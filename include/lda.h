@@ -0,0 +1,42 @@
+#ifndef LDA_H
+#define LDA_H
+
+#include <stddef.h>
+#include "identify.h"
+#include "template.h"
+#include "config.h"
+
+/*
+ * Per-user linear discriminant. At enrolment the user's trials (the unit-norm
+ * exemplars) are separated from a background impostor set (the score
+ * normalization cohort, minus the user's own row) with Fisher's closed form:
+ *
+ *   w = Sw^-1 (mu_user - mu_impostor)
+ *
+ * where Sw is the pooled within-class covariance, shrunk toward a scaled
+ * identity and solved through its Cholesky factor. w and the bias are scaled
+ * so impostor projections have mean 0 and unit spread; a score is then the
+ * number of impostor standard deviations a probe sits above the cohort, and
+ * authentication is one dot product plus bias.
+ */
+
+/* Function Prototypes */
+
+/**
+ * Train a template's discriminant against the cohort
+ * Replaces any discriminant the template already holds.
+ * @param template: Template with a mean; its exemplars join the user class
+ * @param cohort: Impostor cohort (unit-norm rows)
+ * Returns: 0 on success, negative on error
+ */
+int lda_train(Template *template, const TemplateMatrix *cohort);
+
+/**
+ * Score a probe with a template's discriminant
+ * @param template: Template with a trained discriminant
+ * @param probe: Probe features (need not be normalized)
+ * Returns: Score in impostor standard deviations; -INFINITY on error
+ */
+float lda_score(const Template *template, const FeatureVector *probe);
+
+#endif /* LDA_H */
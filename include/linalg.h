@@ -0,0 +1,76 @@
+#ifndef LINALG_H
+#define LINALG_H
+
+#include <stddef.h>
+
+/*
+ * Small dense linear algebra for the feature-space models (covariance,
+ * whitening, discriminants). Matrices are row-major double precision
+ * dim x dim arrays; dimensions are FEATURE_VECTOR_SIZE-sized, so everything
+ * here is O(dim^3) at worst and runs once per model, not per request.
+ */
+
+/* Function Prototypes */
+
+/**
+ * Accumulate centered outer products into a symmetric matrix
+ * Computes gram += (x - center)(x - center)^T for every row x, four rows per
+ * pass over gram. Uses an AVX2/FMA kernel when the CPU supports it.
+ * @param gram: Matrix to update (dim x dim)
+ * @param dim: Number of features
+ * @param rows: Row-major float rows (count x stride)
+ * @param count: Number of rows
+ * @param stride: Distance between rows in floats
+ * @param center: Vector subtracted from every row (dim floats, may be NULL)
+ * Returns: 0 on success, negative on error
+ */
+int linalg_gram_accumulate(double *gram, size_t dim, const float *rows, size_t count, size_t stride,
+                           const float *center);
+
+/**
+ * Shrink a covariance matrix toward a scaled identity
+ * Computes cov = (1 - shrinkage) * cov + shrinkage * (trace(cov) / n) * I,
+ * which keeps it well conditioned when there are few samples per feature.
+ * @param cov: Symmetric matrix (n x n), updated in place
+ * @param n: Dimension
+ * @param shrinkage: Blend factor in [0, 1]
+ */
+void linalg_shrink(double *cov, size_t n, double shrinkage);
+
+/**
+ * Cholesky factorization A = L * L^T
+ * The lower triangle of a is replaced by L and the upper triangle is zeroed.
+ * @param a: Symmetric positive definite matrix (n x n)
+ * @param n: Dimension
+ * Returns: 0 on success, negative if a is not positive definite
+ */
+int linalg_cholesky(double *a, size_t n);
+
+/**
+ * Solve L * x = b by forward substitution
+ * @param l: Lower triangular factor (n x n)
+ * @param n: Dimension
+ * @param b: Right-hand side (n values)
+ * @param x: Solution (n values, may alias b)
+ */
+void linalg_solve_lower(const double *l, size_t n, const double *b, double *x);
+
+/**
+ * Solve L^T * x = b by back substitution
+ * @param l: Lower triangular factor (n x n)
+ * @param n: Dimension
+ * @param b: Right-hand side (n values)
+ * @param x: Solution (n values, may alias b)
+ */
+void linalg_solve_lower_transposed(const double *l, size_t n, const double *b, double *x);
+
+/**
+ * Solve A * x = b given the Cholesky factor of A
+ * @param l: Lower triangular factor from linalg_cholesky (n x n)
+ * @param n: Dimension
+ * @param b: Right-hand side (n values)
+ * @param x: Solution (n values, may alias b)
+ */
+void linalg_cholesky_solve(const double *l, size_t n, const double *b, double *x);
+
+#endif /* LINALG_H */
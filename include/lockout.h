@@ -0,0 +1,89 @@
+#ifndef LOCKOUT_H
+#define LOCKOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+/*
+ * Per-user failed-attempt tracking with timed lockout.
+ *
+ * A user may fail MAX_AUTH_ATTEMPTS verifications within AUTH_TIMEOUT
+ * seconds of the first failure; the attempt that reaches the limit starts a
+ * lockout of AUTH_TIMEOUT seconds. An accepted verification clears the count.
+ *
+ * Attempts are counted before matching, so concurrent attempts cannot get
+ * past the limit, and refunded if matching never ran. Each user has one
+ * cache-line slot holding a username fingerprint and a packed atomic state
+ * (failures, start time), updated with compare-and-swap only: a burst
+ * against one user touches that user's line and nobody else's. Slots are
+ * spread over LOCKOUT_SHARDS open-addressed shards; probing stays within a
+ * shard and reclaims slots whose window has passed, so there is no sweeper.
+ * A user whose shard is full of live slots is refused as if locked out until
+ * one lapses, so flooding the table cannot switch rate limiting off.
+ */
+typedef struct AttemptTable AttemptTable;
+
+/* How an acquired attempt ended */
+typedef enum {
+    ATTEMPT_ACCEPTED = 0,           // Verified: clears the user's failures
+    ATTEMPT_REJECTED = 1,           // Refused: stays counted
+    ATTEMPT_ABORTED = 2             // Matching did not run: refunded
+} AttemptOutcome;
+
+/* Function Prototypes */
+
+/**
+ * Create an attempt table private to this process
+ * @param capacity: Users tracked at once (0 = LOCKOUT_TABLE_SIZE)
+ * Returns: Pointer to table, NULL on failure
+ */
+AttemptTable* lockout_create(size_t capacity);
+
+/**
+ * Open (or create) an attempt table shared through a file
+ * Every process that maps the same file counts against the same users, so
+ * the CLI and the daemon enforce one limit. Counts survive restarts. The
+ * fingerprint seed is kept in the file, which is created with mode 0600.
+ * @param path: Table file path
+ * @param capacity: Users tracked at once if the file is created (0 = LOCKOUT_TABLE_SIZE)
+ * Returns: Pointer to table, NULL on failure
+ */
+AttemptTable* lockout_open(const char *path, size_t capacity);
+
+/**
+ * Free an attempt table
+ * @param table: Table
+ */
+void lockout_destroy(AttemptTable *table);
+
+/**
+ * Count an attempt for a user unless the user is locked out
+ * Lock-free; safe to call from many threads.
+ * @param table: Table
+ * @param username: User identifier
+ * @param now_ms: Current time (get_timestamp_ms())
+ * @param attempt: Output attempt number within the current window, from 1
+ * @param retry_ms: Output time until the lockout ends (may be NULL)
+ * Returns: 0 if the attempt may proceed, 1 if the user is locked out or
+ *          cannot be tracked
+ */
+int lockout_acquire(AttemptTable *table, const char *username, uint64_t now_ms, int *attempt,
+                    uint64_t *retry_ms);
+
+/**
+ * Settle an attempt taken with lockout_acquire()
+ * @param table: Table
+ * @param username: User identifier
+ * @param outcome: How the attempt ended
+ */
+void lockout_finish(AttemptTable *table, const char *username, AttemptOutcome outcome);
+
+/**
+ * Attempts refused because the user was locked out or could not be tracked
+ * @param table: Table
+ * Returns: Refusal count since creation
+ */
+uint64_t lockout_refusals(const AttemptTable *table);
+
+#endif /* LOCKOUT_H */
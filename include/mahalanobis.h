@@ -0,0 +1,80 @@
+#ifndef MAHALANOBIS_H
+#define MAHALANOBIS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "template.h"
+#include "template_db.h"
+#include "config.h"
+
+/* Model file identification */
+#define MAHALANOBIS_FILE_MAGIC 0x574D4C4E   // "NLMW" little-endian
+#define MAHALANOBIS_FILE_VERSION 1
+#define MAHALANOBIS_FILE_HEADER_SIZE 32
+
+/*
+ * Whitened matcher. Band powers are strongly correlated, so cosine similarity
+ * counts one underlying change several times. This matcher measures the probe's
+ * distance from the template mean under the pooled within-user covariance of
+ * the enrolment trials, both taken as unit vectors like the cosine matcher.
+ *
+ * The covariance is pooled over every template's exemplars (each user's
+ * trials around their own centroid), shrunk toward a scaled identity and
+ * factored once as L * L^T. A score is then one triangular solve:
+ * d^2 = |L^-1 (p - m)|^2.
+ */
+typedef struct {
+    size_t dim;                     // Features per vector
+    double *factor;                 // [dim * dim] row-major lower Cholesky factor
+    uint64_t samples;               // Degrees of freedom pooled into the covariance
+} MahalanobisModel;
+
+/* Function Prototypes */
+
+/**
+ * Estimate the pooled within-user covariance from stored exemplars and factor it
+ * @param db: Template database
+ * Returns: Pointer to model, NULL on failure or if too few exemplars are stored
+ */
+MahalanobisModel* mahalanobis_train(TemplateDB *db);
+
+/**
+ * Write a model to a file (temp file + rename)
+ * @param model: Model
+ * @param path: Destination path
+ * Returns: 0 on success, negative on error
+ */
+int mahalanobis_save(const MahalanobisModel *model, const char *path);
+
+/**
+ * Read a model written by mahalanobis_save
+ * @param path: Source path
+ * Returns: Pointer to model, NULL on failure
+ */
+MahalanobisModel* mahalanobis_load(const char *path);
+
+/**
+ * Free a model
+ * @param model: Model to free
+ */
+void mahalanobis_free(MahalanobisModel *model);
+
+/**
+ * Squared Mahalanobis distance between two unit-normalized vectors, per feature
+ * @param model: Model
+ * @param a: First vector (model->dim floats, need not be normalized)
+ * @param b: Second vector (model->dim floats, need not be normalized)
+ * Returns: d^2 / dim, negative on error
+ */
+float mahalanobis_distance(const MahalanobisModel *model, const float *a, const float *b);
+
+/**
+ * Score a probe against a template mean with the whitened distance
+ * @param model: Model
+ * @param template: Enrolled template
+ * @param probe: Probe features
+ * Returns: exp(-d^2 / (2 * dim)) in (0, 1], negative on error
+ */
+float mahalanobis_similarity(const MahalanobisModel *model, const Template *template, const FeatureVector *probe);
+
+#endif /* MAHALANOBIS_H */
@@ -0,0 +1,104 @@
+#ifndef PQ_H
+#define PQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "identify.h"
+#include "config.h"
+
+/* Centroids per subspace; codes are one byte per subspace */
+#define PQ_NUM_CENTROIDS 256
+
+/*
+ * Product-quantized templates. Each unit-norm feature vector is split into
+ * num_subspaces slices and every slice is replaced by the index of its nearest
+ * trained centroid, so a template costs num_subspaces bytes instead of
+ * 4 * dim. Probes are scored with asymmetric distance computation: one lookup
+ * table of probe-to-centroid dot products per query, then one table read per
+ * code byte.
+ */
+typedef struct {
+    size_t dim;                     // Features per template
+    size_t num_subspaces;           // Code bytes per template
+    size_t sub_dim;                 // dim / num_subspaces
+    float *centroids;               // [num_subspaces][sub_dim][PQ_NUM_CENTROIDS], transposed
+    size_t num_templates;           // Encoded templates
+    size_t capacity;                // Allocated templates
+    uint8_t *codes;                 // [capacity * num_subspaces]
+    char (*usernames)[64];          // [capacity] code owners
+    uint32_t *map;                  // Username -> row, open addressing
+    size_t map_slots;               // Power of two
+    size_t map_used;                // Live entries plus tombstones
+} PQIndex;
+
+/* Function Prototypes */
+
+/**
+ * Train codebooks on a template matrix and encode every row
+ * @param matrix: Packed unit-norm templates
+ * @param num_subspaces: Code bytes per template (must divide matrix->dim)
+ * Returns: Pointer to index, NULL on failure
+ */
+PQIndex* pq_train(const TemplateMatrix *matrix, size_t num_subspaces);
+
+/**
+ * Free a PQ index
+ * @param index: Index to free
+ */
+void pq_free(PQIndex *index);
+
+/**
+ * Encode a feature vector with the trained codebooks
+ * @param index: Trained index
+ * @param features: Feature vector (need not be normalized)
+ * @param code: Output code (num_subspaces bytes)
+ * Returns: 0 on success, negative on error
+ */
+int pq_encode(const PQIndex *index, const float *features, uint8_t *code);
+
+/**
+ * Encode and add (or replace) a user's template
+ * @param index: Trained index
+ * @param username: Owner of the template
+ * @param features: Feature vector (need not be normalized)
+ * Returns: 0 on success, negative on error
+ */
+int pq_add(PQIndex *index, const char *username, const float *features);
+
+/**
+ * Remove a user's code
+ * @param index: Index
+ * @param username: User to remove
+ * Returns: 0 on success, negative if the user is not encoded
+ */
+int pq_remove(PQIndex *index, const char *username);
+
+/**
+ * Find the k codes with the highest approximate similarity to a probe
+ * Scores are approximate; see template_rerank() for exact ordering.
+ * @param index: Index
+ * @param probe: Probe feature vector (need not be normalized)
+ * @param k: Number of candidates wanted
+ * @param matches: Output array of at least k entries, best first (index is the code row)
+ * @param num_matches: Output number of candidates written
+ * Returns: 0 on success, negative on error
+ */
+int pq_search(const PQIndex *index, const FeatureVector *probe, size_t k,
+              IdentifyMatch *matches, size_t *num_matches);
+
+/**
+ * Write codebooks and codes to a file (temp file + rename)
+ * @param index: Index
+ * @param path: Destination path
+ * Returns: 0 on success, negative on error
+ */
+int pq_save(const PQIndex *index, const char *path);
+
+/**
+ * Read an index written by pq_save
+ * @param path: Source path
+ * Returns: Pointer to index, NULL on failure
+ */
+PQIndex* pq_load(const char *path);
+
+#endif /* PQ_H */
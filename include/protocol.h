@@ -0,0 +1,205 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "capture.h"
+#include "identify.h"
+#include "config.h"
+
+/* Frame identification */
+#define NLD_REQUEST_MAGIC 0x51444C4E        // "NLDQ" little-endian
+#define NLD_RESPONSE_MAGIC 0x52444C4E       // "NLDR" little-endian
+#define NLD_PROTOCOL_VERSION 1
+#define NLD_HEADER_SIZE 16
+
+/* Fixed payload parts */
+#define NLD_USERNAME_SIZE 64
+#define NLD_CAPTURE_HEADER_SIZE 16
+#define NLD_MAX_TRIALS 8                    // Trials accepted in one enrolment
+#define NLD_VERIFY_REPLY_SIZE 24
+#define NLD_LOCKED_REPLY_SIZE 4
+#define NLD_MATCH_SIZE 68                   // Username then f32 similarity
+#define NLD_TRIAL_BYTES (NUM_CHANNELS * SAMPLING_RATE * CAPTURE_DURATION * 4)
+#define NLD_MAX_PAYLOAD (NLD_USERNAME_SIZE + NLD_CAPTURE_HEADER_SIZE + NLD_MAX_TRIALS * NLD_TRIAL_BYTES)
+
+/*
+ * neurolockd wire protocol over a Unix stream socket. Every frame is a
+ * 16-byte little-endian header followed by its payload:
+ *
+ *   offset  field           type  notes
+ *    0      magic           u32   NLD_REQUEST_MAGIC or NLD_RESPONSE_MAGIC
+ *    4      version         u16   NLD_PROTOCOL_VERSION
+ *    6      code            u16   NldOpcode in requests, NldStatus in replies
+ *    8      payload_size    u32   bytes following the header
+ *   12      request_id      u32   chosen by the client, echoed in the reply
+ *
+ * A connection carries any number of request/reply pairs, one at a time.
+ *
+ * Request payloads:
+ *   PING      (empty)
+ *   ENROLL    username[64], capture
+ *   VERIFY    username[64], capture (one trial)
+ *   IDENTIFY  capture (one trial)
+ *   DELETE    username[64]
+ *
+ * where a capture is u32 task, u32 channels, u32 samples, u32 trials
+ * followed by trials * channels * samples f32 values, each trial laid out
+ * like EEGData.data (channel-major). Channels and samples must match
+ * NUM_CHANNELS and SAMPLING_RATE * CAPTURE_DURATION.
+ *
+ * Reply payloads (status OK or REJECTED, and LOCKED; other statuses carry none):
+ *   VERIFY    u32 authenticated, u32 matcher (AuthMatcher), u32 attempts,
+ *             f32 similarity, f32 decision score, f32 threshold;
+ *             LOCKED: u32 milliseconds until the user may try again
+ *   IDENTIFY  u32 count, then count * (username[64], f32 similarity)
+ */
+typedef enum {
+    NLD_OP_PING = 0,
+    NLD_OP_ENROLL = 1,
+    NLD_OP_VERIFY = 2,
+    NLD_OP_IDENTIFY = 3,
+    NLD_OP_DELETE = 4
+} NldOpcode;
+
+typedef enum {
+    NLD_STATUS_OK = 0,
+    NLD_STATUS_REJECTED = 1,        // Verification ran and failed
+    NLD_STATUS_NOT_ENROLLED = 2,
+    NLD_STATUS_EXISTS = 3,          // Enrolment of an enrolled user
+    NLD_STATUS_BAD_REQUEST = 4,
+    NLD_STATUS_DENIED = 5,          // Peer may not change templates
+    NLD_STATUS_ERROR = 6,
+    NLD_STATUS_LOCKED = 7           // Too many failed verifications; try again later
+} NldStatus;
+
+/* Decoded frame header */
+typedef struct {
+    uint16_t code;                  // NldOpcode or NldStatus
+    uint32_t payload_size;
+    uint32_t request_id;
+} NldHeader;
+
+/* Decoded request; capture data points into the received payload */
+typedef struct {
+    NldOpcode opcode;
+    uint32_t request_id;
+    char username[NLD_USERNAME_SIZE];
+    MentalTask task;
+    size_t trials;                  // Trials in the capture (0 if none)
+    const uint8_t *samples;         // trials * NUM_CHANNELS * samples f32 values
+} NldRequest;
+
+/* Verification outcome as carried in a VERIFY reply */
+typedef struct {
+    int authenticated;
+    uint32_t matcher;               // AuthMatcher
+    uint32_t attempts;              // Attempt number within the failure window
+    uint32_t retry_ms;              // LOCKED: time until the lockout ends
+    float similarity;
+    float score;                    // Score the decision was made on
+    float threshold;
+} NldVerifyReply;
+
+/* Function Prototypes */
+
+/**
+ * Send one frame (header and payload in a single write)
+ * @param fd: Connected socket
+ * @param magic: NLD_REQUEST_MAGIC or NLD_RESPONSE_MAGIC
+ * @param code: Opcode or status
+ * @param request_id: Request identifier
+ * @param payload: Payload bytes (may be NULL if payload_size is 0)
+ * @param payload_size: Payload length
+ * Returns: 0 on success, negative on error
+ */
+int nld_send_frame(int fd, uint32_t magic, uint16_t code, uint32_t request_id,
+                   const uint8_t *payload, size_t payload_size);
+
+/**
+ * Receive one frame
+ * @param fd: Connected socket
+ * @param magic: Expected magic
+ * @param header: Output header
+ * @param payload: Buffer for the payload
+ * @param capacity: Buffer size; larger frames are refused
+ * Returns: 0 on success, 1 if the peer closed before a frame began, negative on error
+ */
+int nld_recv_frame(int fd, uint32_t magic, NldHeader *header, uint8_t *payload, size_t capacity);
+
+/**
+ * Validate and decode a request payload
+ * @param header: Received header
+ * @param payload: Received payload
+ * @param request: Output request
+ * Returns: 0 on success, negative if the payload is malformed
+ */
+int nld_parse_request(const NldHeader *header, const uint8_t *payload, NldRequest *request);
+
+/**
+ * Copy one trial of a decoded capture into EEG data
+ * @param request: Decoded request
+ * @param trial: Trial index
+ * @param output: EEG data sized NUM_CHANNELS x SAMPLING_RATE * CAPTURE_DURATION
+ * Returns: 0 on success, negative on error
+ */
+int nld_load_trial(const NldRequest *request, size_t trial, EEGData *output);
+
+/**
+ * Connect to a daemon
+ * Replies slower than timeout_ms fail the call instead of blocking.
+ * @param socket_path: Daemon socket path
+ * @param timeout_ms: Send and receive timeout
+ * Returns: Connected socket, negative on error
+ */
+int nld_connect(const char *socket_path, uint32_t timeout_ms);
+
+/**
+ * Check that the daemon answers
+ * @param fd: Connected socket
+ * Returns: NldStatus, negative on transport error
+ */
+int nld_ping(int fd);
+
+/**
+ * Enrol a user from captured trials
+ * @param fd: Connected socket
+ * @param username: User identifier
+ * @param trials: Enrolment trials
+ * @param num_trials: Number of trials (1 to NLD_MAX_TRIALS)
+ * @param task: Mental task performed
+ * Returns: NldStatus, negative on transport error
+ */
+int nld_enroll(int fd, const char *username, const EEGData **trials, size_t num_trials, MentalTask task);
+
+/**
+ * Verify a claimed identity
+ * @param fd: Connected socket
+ * @param username: Claimed user
+ * @param trial: Captured trial
+ * @param reply: Output outcome (filled for OK and REJECTED; retry_ms for LOCKED)
+ * Returns: NldStatus, negative on transport error
+ */
+int nld_verify(int fd, const char *username, const EEGData *trial, NldVerifyReply *reply);
+
+/**
+ * Identify the wearer among enrolled users
+ * @param fd: Connected socket
+ * @param trial: Captured trial
+ * @param matches: Output candidates, best first
+ * @param max_matches: Capacity of matches
+ * @param num_matches: Output number of candidates
+ * Returns: NldStatus, negative on transport error
+ */
+int nld_identify(int fd, const EEGData *trial, IdentifyMatch *matches, size_t max_matches,
+                 size_t *num_matches);
+
+/**
+ * Delete a user's template
+ * @param fd: Connected socket
+ * @param username: User identifier
+ * Returns: NldStatus, negative on transport error
+ */
+int nld_delete(int fd, const char *username);
+
+#endif /* PROTOCOL_H */
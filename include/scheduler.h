@@ -0,0 +1,100 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include "config.h"
+
+/*
+ * Work-stealing job scheduler shared by the parallel stages (feature
+ * extraction, 1:N scans, score-matrix evaluation, archive export/import).
+ *
+ * Each worker owns a bounded Chase-Lev deque: it pushes and pops its own
+ * tasks at the bottom (newest first, so nested work stays cache-warm) and
+ * idle workers steal from the top of a random victim. Tasks spawned from
+ * threads that are not workers of the scheduler, or that do not fit a full
+ * deque, go to a shared injection queue. Idle workers sleep on a condition
+ * variable and are woken only when there is something to run.
+ *
+ * Tasks are spawned into a task group. A thread waiting for a group runs
+ * queued tasks itself until the group is done, so a wait never parks a core
+ * and groups may nest inside tasks. Cancelling a group skips its tasks that
+ * have not started; running tasks can poll task_group_cancelled().
+ */
+typedef struct Scheduler Scheduler;
+typedef struct TaskGroup TaskGroup;
+
+/* Task body */
+typedef void (*TaskFunc)(void *arg);
+
+/* Function Prototypes */
+
+/**
+ * Start a scheduler
+ * @param workers: Worker threads (0 runs every task on the thread that waits for it)
+ * Returns: Pointer to scheduler, NULL on failure
+ */
+Scheduler* scheduler_create(size_t workers);
+
+/**
+ * Stop the workers and free a scheduler
+ * @param sched: Scheduler (every group must have been waited for)
+ */
+void scheduler_destroy(Scheduler *sched);
+
+/**
+ * Process-wide scheduler, started on first use with SCHEDULER_THREADS workers
+ * Returns: Pointer to scheduler, NULL if it could not be started
+ */
+Scheduler* scheduler_shared(void);
+
+/**
+ * Threads that run tasks while a caller waits (workers plus the caller)
+ * @param sched: Scheduler
+ * Returns: Useful number of parallel slices, at least 1
+ */
+size_t scheduler_concurrency(const Scheduler *sched);
+
+/**
+ * Create an empty task group
+ * @param sched: Scheduler the group's tasks run on
+ * Returns: Pointer to group, NULL on failure
+ */
+TaskGroup* task_group_create(Scheduler *sched);
+
+/**
+ * Queue a task in a group
+ * Tasks may spawn further tasks into any group. A task that cannot be
+ * queued (out of memory) runs at once on the calling thread.
+ * @param group: Task group
+ * @param func: Task body
+ * @param arg: Argument passed to func
+ */
+void task_group_spawn(TaskGroup *group, TaskFunc func, void *arg);
+
+/**
+ * Run queued tasks until every task of the group has finished
+ * @param group: Task group
+ * Returns: 0 if the group completed, -1 if it was cancelled
+ */
+int task_group_wait(TaskGroup *group);
+
+/**
+ * Skip the group's tasks that have not started yet
+ * @param group: Task group
+ */
+void task_group_cancel(TaskGroup *group);
+
+/**
+ * Whether a group has been cancelled
+ * @param group: Task group
+ * Returns: 1 if cancelled, 0 otherwise
+ */
+int task_group_cancelled(const TaskGroup *group);
+
+/**
+ * Free a task group
+ * @param group: Task group (waited for, or never spawned into)
+ */
+void task_group_free(TaskGroup *group);
+
+#endif /* SCHEDULER_H */
@@ -0,0 +1,92 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+/*
+ * Authentication daemon core (neurolockd). One process keeps the template
+ * cache, the write-ahead log, the cohort and whitening models and a packed
+ * identification matrix loaded, and serves the binary protocol in
+ * protocol.h over a Unix socket, so a request costs feature extraction and
+ * matching instead of process start-up and disk reads.
+ *
+ * A fixed pool of workers shares one epoll set. Listening socket and client
+ * connections are armed one-shot, so exactly one worker picks up each event:
+ * it accepts, or reads one request, answers it and re-arms the connection.
+ * Idle connections cost no thread, and a slow request only occupies the
+ * worker serving it. Template changes from other processes arrive through
+ * the cache's inotify descriptor in the same set.
+ *
+ * Enrol and delete are only accepted from peers running as root or as the
+ * daemon's own user; verify and identify from anyone allowed to connect.
+ */
+typedef struct NeurolockServer NeurolockServer;
+
+/* Files the server works on */
+typedef struct {
+    const char *socket_path;        // Listening socket (replaced if stale)
+    const char *db_path;            // Template database
+    const char *wal_path;           // Write-ahead log in front of the database
+    const char *cohort_path;        // Impostor cohort, used if present (may be NULL)
+    const char *whitening_path;     // Whitening model, used if present (may be NULL)
+    const char *hnsw_path;          // HNSW index kept resident and in step if present (may be NULL)
+    const char *pq_path;            // PQ index kept resident and in step if present (may be NULL)
+    const char *lockout_path;       // Attempt table shared with the CLI (NULL = private to the daemon)
+    size_t workers;                 // Request threads (0 = DAEMON_WORKERS)
+} ServerConfig;
+
+/* Request counters */
+typedef struct {
+    uint64_t connections;           // Connections accepted
+    uint64_t requests;              // Requests answered
+    uint64_t failures;              // Requests answered with an error status
+    uint64_t gallery_rebuilds;      // Identification matrix rebuilds
+    uint64_t lockouts;              // Verifications refused while the user was locked out
+} ServerStats;
+
+/* Function Prototypes */
+
+/**
+ * Fill a configuration with the default paths from config.h
+ * @param config: Output configuration
+ */
+void server_config_default(ServerConfig *config);
+
+/**
+ * Load templates and models and start listening
+ * @param config: Server configuration (paths are copied)
+ * Returns: Pointer to server, NULL on failure
+ */
+NeurolockServer* server_create(const ServerConfig *config);
+
+/**
+ * Serve requests until server_stop() is called
+ * The calling thread is one of the workers.
+ * @param server: Server
+ * Returns: 0 on clean shutdown, negative on error
+ */
+int server_run(NeurolockServer *server);
+
+/**
+ * Ask server_run() to return once in-flight requests are answered
+ * Async-signal-safe.
+ * @param server: Server
+ */
+void server_stop(NeurolockServer *server);
+
+/**
+ * Close every connection, flush the log and free the server
+ * @param server: Server (server_run() must have returned)
+ */
+void server_destroy(NeurolockServer *server);
+
+/**
+ * Read request counters
+ * @param server: Server
+ * @param stats: Output counters
+ */
+void server_get_stats(NeurolockServer *server, ServerStats *stats);
+
+#endif /* SERVER_H */
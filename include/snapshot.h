@@ -0,0 +1,93 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "identify.h"
+#include "config.h"
+
+/* Segment and control file identification */
+#define SNAPSHOT_MAGIC 0x53534C4E           // "NLSS" little-endian
+#define SNAPSHOT_CONTROL_MAGIC 0x43534C4E   // "NLSC" little-endian
+#define SNAPSHOT_VERSION 1
+
+/*
+ * Immutable identification snapshots shared between processes on one host.
+ *
+ * A publisher packs a TemplateMatrix into a memfd, seals it against writes and
+ * resizing, and announces it through a small control file guarded by a
+ * seqlock: the sequence counter is odd while the publisher rewrites the
+ * announcement. Readers open the publisher's memfd through
+ * /proc/<pid>/fd/<fd> and map it read-only, so every worker scores against
+ * the same physical pages and picking up a new snapshot is one open + mmap.
+ *
+ * Segments use the host's native layout and are never written to disk.
+ * Readers must be allowed to open the publisher's fds (same user). Linux only.
+ */
+typedef struct SnapshotPublisher SnapshotPublisher;
+typedef struct SnapshotReader SnapshotReader;
+
+/* Function Prototypes */
+
+/**
+ * Create (or take over) a control file and become its only publisher
+ * @param control_path: Control file path
+ * Returns: Pointer to publisher, NULL on failure or if another publisher is live
+ */
+SnapshotPublisher* snapshot_publisher_open(const char *control_path);
+
+/**
+ * Copy a matrix into a new sealed segment and announce it
+ * The previous segment stays open until the next publish so readers that
+ * raced the swap can still map it.
+ * @param publisher: Publisher handle
+ * @param matrix: Templates to publish (float or quantized)
+ * @param db_generation: Database generation the matrix was built from
+ * Returns: 0 on success, negative on error
+ */
+int snapshot_publish(SnapshotPublisher *publisher, const TemplateMatrix *matrix, uint64_t db_generation);
+
+/**
+ * Withdraw the announcement and release the publisher's segments
+ * Readers keep whatever they have mapped.
+ * @param publisher: Publisher handle
+ */
+void snapshot_publisher_close(SnapshotPublisher *publisher);
+
+/**
+ * Attach to a control file and map the current snapshot
+ * @param control_path: Control file path
+ * Returns: Pointer to reader, NULL if no snapshot is being published
+ */
+SnapshotReader* snapshot_reader_open(const char *control_path);
+
+/**
+ * Map the newest snapshot if the publisher has announced one
+ * The previous mapping is released on a swap, so matrices obtained before
+ * the call must not be used after it. Not thread-safe.
+ * @param reader: Reader handle
+ * Returns: 1 if a new snapshot was mapped, 0 if unchanged, negative on error
+ */
+int snapshot_reader_refresh(SnapshotReader *reader);
+
+/**
+ * Get the mapped templates
+ * @param reader: Reader handle
+ * Returns: Read-only matrix view valid until the next refresh or close
+ */
+const TemplateMatrix* snapshot_matrix(const SnapshotReader *reader);
+
+/**
+ * Get the database generation the mapped snapshot was built from
+ * @param reader: Reader handle
+ * Returns: Database generation
+ */
+uint64_t snapshot_db_generation(const SnapshotReader *reader);
+
+/**
+ * Unmap the snapshot and detach from the control file
+ * @param reader: Reader handle
+ */
+void snapshot_reader_close(SnapshotReader *reader);
+
+#endif /* SNAPSHOT_H */
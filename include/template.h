@@ -7,11 +7,42 @@
 #include "hashing.h"
 #include "config.h"
 
+/* On-disk template file (.nlt) format; all fields little-endian */
+#define TEMPLATE_FILE_MAGIC 0x31544C4E      // "NLT1"
+#define TEMPLATE_FILE_VERSION 1
+#define TEMPLATE_FILE_HEADER_SIZE 128
+#define TEMPLATE_FILE_MAX_SIZE 65536        // Upper bound accepted by template_load
+
+/* Section types in the template file section table */
+typedef enum {
+    TEMPLATE_SECTION_FEATURES = 1,          // float32[feature count]
+    TEMPLATE_SECTION_HASH = 2,              // Hash bytes
+    TEMPLATE_SECTION_SALT = 3,              // Salt bytes
+    TEMPLATE_SECTION_VARIANCE = 4,          // float32[feature count], optional
+    TEMPLATE_SECTION_EXEMPLARS = 5,         // float32[exemplars][feature count], optional
+    TEMPLATE_SECTION_ZNORM = 6,             // float32[2] impostor score mean and std, optional
+    TEMPLATE_SECTION_LDA = 7                // float32[feature count + 1] discriminant weights then bias, optional
+} TemplateSectionType;
+
+/* Rules for fusing per-exemplar similarities into one score */
+typedef enum {
+    FUSION_MAX = 0,                         // Best-matching exemplar
+    FUSION_MEAN = 1,                        // Average over exemplars
+    FUSION_SOFTMAX = 2                      // Softmax-weighted average (TEMPLATE_FUSION_TEMPERATURE)
+} FusionRule;
+
 /* Template Structure */
 typedef struct {
     char username[64];              // User identifier
     HashData *hash;                 // Hashed template
     FeatureVector *features;        // Feature vector (for similarity matching)
+    FeatureVector *variance;        // Per-feature variance, NULL if unknown
+    float *exemplars;               // Unit-norm enrolment trials, contiguous rows of features->size
+    size_t num_exemplars;           // Rows in exemplars (0 if none)
+    float znorm_mean;               // Mean cohort impostor score (Z-norm)
+    float znorm_std;                // Std of cohort impostor scores, 0 if not computed
+    float *lda_weights;             // Per-user discriminant over unit-norm features, NULL if not trained
+    float lda_bias;                 // Discriminant offset: score = lda_weights . x + lda_bias
     MentalTask task_type;           // Associated mental task
     time_t created_at;              // Creation timestamp
     time_t last_used;               // Last authentication timestamp
@@ -22,8 +53,10 @@ typedef struct {
 typedef struct {
     int authenticated;              // 1 if authenticated, 0 if not
     float similarity_score;         // Similarity score (0-1)
+    float normalized_score;         // Cohort-normalized score (raw similarity if not normalized)
+    int normalized;                 // 1 if the decision used normalized_score
     time_t timestamp;               // Authentication timestamp
-    int attempts;                   // Number of attempts made
+    int attempts;                   // Attempt number in the lockout window (0 = not tracked)
 } AuthResult;
 
 /* Function Prototypes */
@@ -39,6 +72,22 @@ typedef struct {
  */
 int template_create(const char *username, const EEGData **trials, size_t num_trials, MentalTask task, Template *output);
 
+/**
+ * Build a template around an already computed mean and variance
+ * Salts and hashes the mean, sets the metadata and keeps the first
+ * TEMPLATE_MAX_EXEMPLARS trials as exemplars.
+ * @param username: User identifier
+ * @param task: Mental task type
+ * @param trials: Feature vectors of the enrolment trials
+ * @param num_trials: Number of trials
+ * @param mean: Template features; owned by the template from here on, freed on error
+ * @param variance: Per-feature variance (may be NULL); owned like mean
+ * @param output: Output template
+ * Returns: 0 on success, negative on error
+ */
+int template_from_features(const char *username, MentalTask task, const FeatureVector **trials, size_t num_trials,
+                           FeatureVector *mean, FeatureVector *variance, Template *output);
+
 /**
  * Save template to disk
  * @param template: Template to save
@@ -55,6 +104,25 @@ int template_save(const Template *template, const char *filepath);
  */
 int template_load(const char *filepath, Template *output);
 
+/**
+ * Serialize template into the versioned on-disk format
+ * @param template: Template to serialize
+ * @param buffer: Output buffer (allocated by function, caller frees)
+ * @param size: Output size of buffer
+ * Returns: 0 on success, negative on error
+ */
+int template_serialize(const Template *template, uint8_t **buffer, size_t *size);
+
+/**
+ * Parse a template from the on-disk format, validating magic, version,
+ * section bounds and CRC
+ * @param buffer: Serialized template
+ * @param size: Size of buffer
+ * @param output: Output template (features and hash are allocated)
+ * Returns: 0 on success, negative on error
+ */
+int template_deserialize(const uint8_t *buffer, size_t size, Template *output);
+
 /**
  * Authenticate user against stored template
  * @param trial: EEG data from authentication attempt
@@ -72,6 +140,29 @@ int template_authenticate(const EEGData *trial, const Template *template, AuthRe
  */
 float calculate_similarity(const FeatureVector *vec1, const FeatureVector *vec2);
 
+/**
+ * Score a probe against a template's mean and exemplars in one pass
+ * The probe is normalized once, every exemplar row and the mean are scored
+ * with a single matrix-vector sweep, and the scores are fused by rule.
+ * Falls back to calculate_similarity() with the mean when there are no exemplars.
+ * @param mean: Template mean features
+ * @param exemplars: Unit-norm exemplar rows, contiguous (num_exemplars x mean->size)
+ * @param num_exemplars: Number of rows (at most TEMPLATE_MAX_EXEMPLARS)
+ * @param probe: Probe features
+ * @param rule: How to combine the per-row similarities
+ * Returns: Similarity score (0-1), negative on error
+ */
+float fused_similarity(const FeatureVector *mean, const float *exemplars, size_t num_exemplars,
+                       const FeatureVector *probe, FusionRule rule);
+
+/**
+ * Score a probe against a template with the configured fusion rule
+ * @param template: Enrolled template
+ * @param probe: Probe features
+ * Returns: Similarity score (0-1), negative on error
+ */
+float template_similarity(const Template *template, const FeatureVector *probe);
+
 /**
  * Calculate Hamming distance between two hashes
  * @param hash1: First hash
@@ -82,12 +173,25 @@ int calculate_hamming_distance(const HashData *hash1, const HashData *hash2);
 
 /**
  * Update template with new authentication data (adaptive learning)
+ * Extracts features from the trial and folds them in with
+ * template_update_features(). Call only after a successful authentication.
  * @param template: Template to update
  * @param trial: New EEG trial data
- * Returns: 0 on success, negative on error
+ * Returns: 0 if updated, 1 if the trial was too dissimilar to fold in, negative on error
  */
 int template_update(Template *template, const EEGData *trial);
 
+/**
+ * Fold a feature sample into the template's exponentially weighted mean and
+ * variance (weight TEMPLATE_UPDATE_ALPHA), store it as an exemplar (in a free
+ * row, else over the nearest one), rehash with the existing salt and bump the
+ * template version
+ * @param template: Template to update
+ * @param sample: Features of an accepted authentication
+ * Returns: 0 if updated, 1 if the sample was too dissimilar to fold in, negative on error
+ */
+int template_update_features(Template *template, const FeatureVector *sample);
+
 /**
  * Allocate memory for Template
  * Returns: Pointer to allocated Template, NULL on failure
@@ -100,6 +204,22 @@ Template* template_alloc(void);
  */
 void template_free(Template *template);
 
+/**
+ * Wipe and free everything a template owns, leaving it zeroed
+ * For templates that are not heap-allocated themselves (stack, embedded);
+ * template_free() does the same and frees the structure.
+ * @param template: Template to clear
+ */
+void template_clear(Template *template);
+
+/**
+ * Deep-copy a template (features and hash are allocated for the copy)
+ * @param src: Source template
+ * @param dst: Destination template
+ * Returns: 0 on success, negative on error
+ */
+int template_copy(const Template *src, Template *dst);
+
 /**
  * Get default template filepath for user
  * @param username: User identifier
@@ -117,7 +237,8 @@ int template_get_filepath(const char *username, char *output, size_t size);
 int template_exists(const char *username);
 
 /**
- * Delete template for user
+ * Delete template for user and log the removal against the HNSW and PQ
+ * indexes if they were built
  * @param username: User identifier
  * Returns: 0 on success, negative on error
  */
@@ -0,0 +1,99 @@
+#ifndef TEMPLATE_CACHE_H
+#define TEMPLATE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "template.h"
+#include "template_db.h"
+#include "config.h"
+
+/* In-process template cache (opaque) */
+typedef struct TemplateCache TemplateCache;
+
+/* Cache Statistics */
+typedef struct {
+    uint64_t hits;                  // Lookups served from memory
+    uint64_t misses;                // Lookups that went to the database
+    uint64_t evictions;             // Entries evicted for capacity
+    uint64_t invalidations;         // Entries dropped because storage changed
+    uint64_t updates;               // Entries published by template_cache_publish
+    size_t entries;                 // Entries currently cached
+} TemplateCacheStats;
+
+/* Function Prototypes */
+
+/**
+ * Create a template cache in front of a template database
+ * @param db: Backing database (must outlive the cache)
+ * @param capacity: Maximum number of cached templates
+ * Returns: Pointer to cache, NULL on failure
+ */
+TemplateCache* template_cache_create(TemplateDB *db, size_t capacity);
+
+/**
+ * Destroy cache, securely wiping every cached template
+ * @param cache: Cache to destroy
+ */
+void template_cache_destroy(TemplateCache *cache);
+
+/**
+ * Get a copy of a user's template, loading it from the database on a miss
+ * Hits never take a lock; safe to call from many threads.
+ * @param cache: Template cache
+ * @param username: User identifier
+ * @param output: Output template (features and hash are allocated)
+ * Returns: 0 on success, negative on error or if not enrolled
+ */
+int template_cache_get(TemplateCache *cache, const char *username, Template *output);
+
+/**
+ * Drop a user's cached template (e.g. after writing it)
+ * @param cache: Template cache
+ * @param username: User identifier
+ * Returns: 1 if an entry was dropped, 0 if none was cached
+ */
+int template_cache_invalidate(TemplateCache *cache, const char *username);
+
+/**
+ * Publish a new version of a user's template (e.g. after template_update)
+ * The entry is swapped in with a single atomic store, so concurrent hits
+ * never block and see either the old or the new template. The replaced
+ * entry is freed after a later grace period. The published copy is kept
+ * until the user's database record changes, i.e. until the update (or
+ * anything newer) has been persisted.
+ * @param cache: Template cache
+ * @param template: Template to publish (copied)
+ * Returns: 0 on success, negative on error
+ */
+int template_cache_publish(TemplateCache *cache, const Template *template);
+
+/**
+ * Watch the database file (and .nlt files beside it) for changes
+ * @param cache: Template cache
+ * @param db_path: Path of the backing database file
+ * Returns: 0 on success, negative on error
+ */
+int template_cache_watch(TemplateCache *cache, const char *db_path);
+
+/**
+ * Get the change notification descriptor for use in poll()/epoll loops
+ * @param cache: Template cache
+ * Returns: File descriptor, negative if not watching
+ */
+int template_cache_fd(const TemplateCache *cache);
+
+/**
+ * Process pending change notifications without blocking
+ * @param cache: Template cache
+ * Returns: Number of entries invalidated, negative on error
+ */
+int template_cache_poll(TemplateCache *cache);
+
+/**
+ * Get cache statistics
+ * @param cache: Template cache
+ * @param stats: Output statistics
+ */
+void template_cache_get_stats(const TemplateCache *cache, TemplateCacheStats *stats);
+
+#endif /* TEMPLATE_CACHE_H */
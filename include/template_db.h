@@ -0,0 +1,189 @@
+#ifndef TEMPLATE_DB_H
+#define TEMPLATE_DB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "template.h"
+#include "config.h"
+
+/* Database file identification */
+#define TEMPLATE_DB_MAGIC 0x42444C4E        // "NLDB" little-endian
+#define TEMPLATE_DB_VERSION 3                // v1 (512-byte) and v2 (1 KiB) records are upgraded on open
+#define TEMPLATE_DB_HEADER_SIZE 4096        // Header occupies the first page
+
+/* Record flags */
+#define TEMPLATE_RECORD_USED 0x1
+#define TEMPLATE_RECORD_VARIANCE 0x2        // variance[] holds feature_count valid entries
+#define TEMPLATE_RECORD_ZNORM 0x4           // znorm_mean/znorm_std are valid
+#define TEMPLATE_RECORD_LDA 0x8             // lda_weights/lda_bias hold a trained discriminant
+
+/* Fixed-size template record as laid out in the database file */
+typedef struct {
+    char username[64];              // User identifier (NUL-terminated)
+    uint32_t flags;                 // TEMPLATE_RECORD_* flags
+    uint32_t generation;            // Odd while a write is in progress
+    uint32_t version;               // Template version
+    uint32_t task_type;             // MentalTask
+    int64_t created_at;             // Creation timestamp
+    int64_t last_used;              // Last authentication timestamp
+    uint32_t feature_count;         // Valid entries in features[]
+    uint32_t hash_size;             // Valid bytes in hash[]
+    uint32_t salt_size;             // Valid bytes in salt[]
+    uint32_t next_free;             // Free list link (record index + 1)
+    float features[FEATURE_VECTOR_SIZE];
+    uint8_t hash[HASH_OUTPUT_SIZE];
+    uint8_t salt[SALT_LENGTH];
+    float variance[FEATURE_VECTOR_SIZE];    // Adaptive per-feature variance
+    uint32_t exemplar_count;                // Valid rows in exemplars[]
+    float exemplars[TEMPLATE_MAX_EXEMPLARS * FEATURE_VECTOR_SIZE];  // Unit-norm rows, contiguous
+    float znorm_mean;                       // Cohort impostor score mean
+    float znorm_std;                        // Cohort impostor score std
+    float lda_weights[FEATURE_VECTOR_SIZE]; // Per-user discriminant
+    float lda_bias;
+    uint8_t reserved[TEMPLATE_DB_RECORD_SIZE - 128 - (3 + TEMPLATE_MAX_EXEMPLARS) * FEATURE_VECTOR_SIZE * sizeof(float)
+                     - HASH_OUTPUT_SIZE - SALT_LENGTH];
+} TemplateRecord;
+
+/* Database file header */
+typedef struct {
+    uint32_t magic;                 // TEMPLATE_DB_MAGIC
+    uint32_t version;               // TEMPLATE_DB_VERSION
+    uint32_t record_size;           // sizeof(TemplateRecord)
+    uint32_t feature_size;          // FEATURE_VECTOR_SIZE the file was built with
+    uint32_t capacity;              // Number of record slots
+    uint32_t index_slots;           // Hash index slots (power of two)
+    uint32_t count;                 // Live records
+    uint32_t high_water;            // Record slots ever handed out
+    uint32_t free_head;             // Free list head (record index + 1)
+    uint32_t reserved0;
+    uint64_t generation;            // Bumped on every committed write
+} TemplateDBHeader;
+
+/* Open database handle */
+typedef struct TemplateDB TemplateDB;
+
+/* Callback for template_db_foreach; return non-zero to stop iteration */
+typedef int (*TemplateRecordVisitor)(const TemplateRecord *record, void *ctx);
+
+/* Function Prototypes */
+
+/**
+ * Open (or create) a template database and map it read-only
+ * @param path: Database file path
+ * Returns: Pointer to database handle, NULL on failure
+ */
+TemplateDB* template_db_open(const char *path);
+
+/**
+ * Unmap and close a template database
+ * @param db: Database handle
+ */
+void template_db_close(TemplateDB *db);
+
+/**
+ * Remap the database if another process has grown or replaced it
+ * @param db: Database handle
+ * Returns: 0 on success, negative on error
+ */
+int template_db_refresh(TemplateDB *db);
+
+/**
+ * Look up a user's record in the mapping (zero-copy)
+ * The pointer stays valid until the next write or refresh on this handle.
+ * @param db: Database handle
+ * @param username: User identifier
+ * Returns: Pointer to record, NULL if not found
+ */
+const TemplateRecord* template_db_find(TemplateDB *db, const char *username);
+
+/**
+ * Check if a template exists for user
+ * @param db: Database handle
+ * @param username: User identifier
+ * Returns: 1 if exists, 0 if not
+ */
+int template_db_contains(TemplateDB *db, const char *username);
+
+/**
+ * Load a user's template into a Template structure
+ * @param db: Database handle
+ * @param username: User identifier
+ * @param output: Output template (features and hash are allocated)
+ * Returns: 0 on success, negative on error or if not found
+ */
+int template_db_get(TemplateDB *db, const char *username, Template *output);
+
+/**
+ * Insert or replace a user's template
+ * @param db: Database handle
+ * @param template: Template to store
+ * Returns: 0 on success, negative on error
+ */
+int template_db_put(TemplateDB *db, const Template *template);
+
+/**
+ * Grow the database ahead of a bulk load so it is rebuilt at most once
+ * @param db: Database handle
+ * @param records: Live records the file should be able to hold
+ * Returns: 0 on success, negative on error
+ */
+int template_db_reserve(TemplateDB *db, size_t records);
+
+/**
+ * Insert or replace many templates under one writer lock
+ * The file is grown once for the whole batch. Templates are validated before
+ * anything is written; a write failure leaves the earlier ones stored.
+ * @param db: Database handle
+ * @param templates: Templates to store
+ * @param count: Number of templates
+ * Returns: 0 on success, negative on error
+ */
+int template_db_put_batch(TemplateDB *db, const Template *const *templates, size_t count);
+
+/**
+ * Remove a user's template
+ * @param db: Database handle
+ * @param username: User identifier
+ * Returns: 0 on success, negative on error or if not found
+ */
+int template_db_remove(TemplateDB *db, const char *username);
+
+/**
+ * Get number of templates stored
+ * @param db: Database handle
+ * Returns: Number of live records
+ */
+size_t template_db_count(TemplateDB *db);
+
+/**
+ * Get database generation (changes on every committed write)
+ * @param db: Database handle
+ * Returns: Generation counter
+ */
+uint64_t template_db_generation(TemplateDB *db);
+
+/**
+ * Flush committed writes to stable storage
+ * @param db: Database handle
+ * Returns: 0 on success, negative on error
+ */
+int template_db_sync(TemplateDB *db);
+
+/**
+ * Visit every live record in slot order
+ * @param db: Database handle
+ * @param visitor: Callback invoked per record
+ * @param ctx: Opaque pointer passed to the callback
+ * Returns: 0 on success, value returned by visitor if it stopped early
+ */
+int template_db_foreach(TemplateDB *db, TemplateRecordVisitor visitor, void *ctx);
+
+/**
+ * Copy a mapped record into a Template structure
+ * @param record: Source record
+ * @param output: Output template (features and hash are allocated)
+ * Returns: 0 on success, negative on error
+ */
+int template_record_to_template(const TemplateRecord *record, Template *output);
+
+#endif /* TEMPLATE_DB_H */
@@ -7,13 +7,16 @@
 
 /* Logging Levels */
 typedef enum {
-    LOG_DEBUG = 0,
-    LOG_INFO = 1,
-    LOG_WARNING = 2,
-    LOG_ERROR = 3,
-    LOG_CRITICAL = 4
+    NL_LOG_DEBUG = 0,
+    NL_LOG_INFO = 1,
+    NL_LOG_WARNING = 2,
+    NL_LOG_ERROR = 3,
+    NL_LOG_CRITICAL = 4
 } LogLevel;
 
+/* Receives each formatted message in place of the coloured stderr output */
+typedef void (*LogSink)(LogLevel level, const char *message);
+
 /* Function Prototypes */
 
 /**
@@ -24,6 +27,12 @@ typedef enum {
  */
 void log_message(LogLevel level, const char *format, ...);
 
+/**
+ * Redirect log_message() output, e.g. to syslog inside a host process
+ * @param sink: Receiver of formatted messages, NULL for stderr
+ */
+void log_set_sink(LogSink sink);
+
 /**
  * Get current timestamp in milliseconds
  * Returns: Current timestamp
@@ -58,6 +67,13 @@ int create_directory(const char *path);
  */
 int file_exists(const char *filepath);
 
+/**
+ * Fsync the directory containing a path so a create or rename survives a crash
+ * @param path: Path of the file whose directory entry changed
+ * Returns: 0 on success, negative on error
+ */
+int sync_parent_directory(const char *path);
+
 /**
  * Read entire file into buffer
  * @param filepath: Path to file
@@ -133,6 +149,35 @@ float dot_product(const float *vec1, const float *vec2, size_t size);
  */
 float vector_magnitude(const float *vec, size_t size);
 
+/**
+ * Compute CRC-32 (IEEE 802.3) of a buffer
+ * @param crc: Running CRC (0 to start)
+ * @param data: Input bytes
+ * @param size: Number of bytes
+ * Returns: Updated CRC
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size);
+
+/**
+ * Store integers in little-endian byte order
+ * @param dst: Destination bytes
+ * @param value: Value to store
+ */
+void store_le16(uint8_t *dst, uint16_t value);
+void store_le32(uint8_t *dst, uint32_t value);
+void store_le64(uint8_t *dst, uint64_t value);
+void store_le_f32(uint8_t *dst, float value);
+
+/**
+ * Load integers stored in little-endian byte order
+ * @param src: Source bytes
+ * Returns: Decoded value
+ */
+uint16_t load_le16(const uint8_t *src);
+uint32_t load_le32(const uint8_t *src);
+uint64_t load_le64(const uint8_t *src);
+float load_le_f32(const uint8_t *src);
+
 /**
  * Print error message and exit
  * @param message: Error message
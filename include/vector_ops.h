@@ -0,0 +1,118 @@
+#ifndef VECTOR_OPS_H
+#define VECTOR_OPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Function Prototypes */
+
+/**
+ * Dense matrix-vector product over row-major float rows
+ * Computes out[r] = dot(matrix + r * stride, vec) for r in [0, rows).
+ * Uses AVX2/FMA or SSE kernels when the CPU supports them.
+ * @param matrix: Row-major matrix (rows x stride floats)
+ * @param rows: Number of rows
+ * @param dim: Number of columns used in each row (dim <= stride)
+ * @param stride: Distance between rows in floats
+ * @param vec: Input vector (dim floats)
+ * @param out: Output scores (rows floats)
+ */
+void matvec_f32(const float *matrix, size_t rows, size_t dim, size_t stride,
+                const float *vec, float *out);
+
+/**
+ * Integer matrix-vector product of unsigned 8-bit rows and a signed 8-bit vector
+ * Computes out[r] = sum of matrix[r * stride + c] * vec[c] for c in [0, dim).
+ * Uses AVX-VNNI, AVX2 or SSSE3 multiply-add when available. The SIMD paths
+ * use maddubs, whose 16-bit pair sums saturate: keep matrix values <= 127 so
+ * that 2 * 127 * 127 fits, and dim a multiple of 8.
+ * @param matrix: Row-major matrix (rows x stride bytes)
+ * @param rows: Number of rows
+ * @param dim: Number of columns used in each row (dim <= stride)
+ * @param stride: Distance between rows in bytes
+ * @param vec: Input vector (dim values in [-127, 127])
+ * @param out: Output dot products (rows values)
+ */
+void matvec_u8s8(const uint8_t *matrix, size_t rows, size_t dim, size_t stride,
+                 const int8_t *vec, int32_t *out);
+
+/**
+ * Integer matrix product of unsigned 8-bit rows and signed 8-bit rows
+ * Computes out[r * cols + c] = sum of a[r * lda + k] * b[c * ldb + k] for k in [0, dim),
+ * i.e. A times B transposed, with each row of A loaded once per four rows of B.
+ * Rows of A may overlap (lda < dim), which lets a convolution over channels-last
+ * activations read each receptive field in place. The same maddubs limits as
+ * matvec_u8s8 apply: keep a values <= 127 and dim a multiple of 8.
+ * @param a: Row-major unsigned matrix (rows rows, lda bytes apart)
+ * @param rows: Number of rows of A
+ * @param lda: Distance between rows of A in bytes
+ * @param b: Row-major signed matrix (cols rows, ldb bytes apart)
+ * @param cols: Number of rows of B (output columns)
+ * @param ldb: Distance between rows of B in bytes
+ * @param dim: Length of every dot product
+ * @param out: Output products (rows x cols values)
+ */
+void gemm_u8s8(const uint8_t *a, size_t rows, size_t lda, const int8_t *b, size_t cols, size_t ldb,
+               size_t dim, int32_t *out);
+
+/**
+ * Matrix-vector product over a column-major (transposed) matrix
+ * Computes out[c] = sum over d of matrix[d * cols + c] * vec[d] for c in [0, cols).
+ * Suits many short vectors scored at once, e.g. codebook centroids.
+ * @param matrix: Transposed matrix (dim x cols floats)
+ * @param cols: Number of output scores
+ * @param dim: Length of vec
+ * @param vec: Input vector (dim floats)
+ * @param out: Output scores (cols floats)
+ */
+void matvec_t_f32(const float *matrix, size_t cols, size_t dim, const float *vec, float *out);
+
+/**
+ * Matrix product of row-major rows and a transposed (column-major) panel
+ * Computes out[r * cols + c] = sum over d of a[r * lda + d] * bt[d * cols + c],
+ * i.e. A times B transposed with B pre-packed one feature per row. Uses an
+ * AVX2/FMA kernel producing 6 x 16 outputs per pass when available.
+ * @param a: Row-major matrix (rows rows, lda floats apart)
+ * @param rows: Number of rows of A
+ * @param lda: Distance between rows of A in floats
+ * @param bt: Transposed panel (dim x cols floats)
+ * @param cols: Number of output columns
+ * @param dim: Length of every dot product
+ * @param out: Output products (rows x cols floats)
+ */
+void gemm_t_f32(const float *a, size_t rows, size_t lda, const float *bt, size_t cols, size_t dim,
+                float *out);
+
+/**
+ * Map values to equal-width histogram bins
+ * Computes bins[i] = (int)((values[i] - low) * scale) clamped to [0, top];
+ * NaN goes to bin 0.
+ * @param values: Input values
+ * @param count: Number of values
+ * @param low: Lower edge of bin 0
+ * @param scale: Bins per unit value
+ * @param top: Index of the last bin
+ * @param bins: Output bin indices (count entries)
+ */
+void bin_index_f32(const float *values, size_t count, float low, float scale, int32_t top, int32_t *bins);
+
+/**
+ * Dot product of two float vectors using the best available kernel
+ * @param a: First vector
+ * @param b: Second vector
+ * @param dim: Number of elements
+ * Returns: Dot product
+ */
+float dot_f32(const float *a, const float *b, size_t dim);
+
+/**
+ * Scale a vector to unit L2 norm
+ * Zero vectors are written out as zeros.
+ * @param in: Input vector
+ * @param out: Output vector (may alias in)
+ * @param size: Size of vectors
+ * Returns: Magnitude of the input vector
+ */
+float vector_normalize(const float *in, float *out, size_t size);
+
+#endif /* VECTOR_OPS_H */
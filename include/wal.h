@@ -0,0 +1,118 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "template.h"
+#include "template_db.h"
+#include "config.h"
+
+/* Log file identification */
+#define WAL_MAGIC 0x4C574C4E                // "NLWL" little-endian
+#define WAL_RECORD_MAGIC 0x52574C4E         // "NLWR" little-endian
+#define WAL_VERSION 1
+#define WAL_HEADER_SIZE 16
+#define WAL_RECORD_HEADER_SIZE 24
+
+/* Logged operations */
+typedef enum {
+    WAL_OP_PUT = 1,                 // Payload: template_serialize() output
+    WAL_OP_DELETE = 2               // Payload: 64-byte username
+} WalOp;
+
+/*
+ * Append-only write-ahead log in front of the template database.
+ *
+ * wal_put()/wal_delete() append a CRC-framed record and block until it is
+ * durable. Concurrent callers are group-committed: whichever thread finds no
+ * flush in progress becomes the leader, writes every record queued so far with
+ * one write() and one fdatasync(), applies them to the database in log order
+ * and wakes the others. The database file itself is only fsynced at a
+ * checkpoint, after which the log is truncated.
+ *
+ * Several processes may share one log; each flush holds an exclusive flock.
+ * wal_open() replays records left by a crashed writer and drops a torn tail.
+ * Leaders write through the TemplateDB handle, so other threads must not use
+ * that handle while the log is open.
+ */
+typedef struct TemplateWAL TemplateWAL;
+
+/* Group commit counters */
+typedef struct {
+    uint64_t records;               // Records made durable
+    uint64_t batches;               // Flushes (one fdatasync each)
+    uint64_t checkpoints;           // Database syncs followed by log truncation
+    uint64_t replayed;              // Records recovered by wal_open
+} WalStats;
+
+/* Function Prototypes */
+
+/**
+ * Open (or create) a log, replay any records it holds into the database
+ * and checkpoint
+ * @param path: Log file path
+ * @param db: Database the log applies to (must outlive the log)
+ * Returns: Pointer to log handle, NULL on failure
+ */
+TemplateWAL* wal_open(const char *path, TemplateDB *db);
+
+/**
+ * Flush pending records, checkpoint and close the log
+ * @param wal: Log handle
+ */
+void wal_close(TemplateWAL *wal);
+
+/**
+ * Durably log and apply an insert or replace of a user's template
+ * Thread-safe; returns once the record is on disk and in the database.
+ * @param wal: Log handle
+ * @param template: Template to store
+ * Returns: 0 on success, negative on error
+ */
+int wal_put(TemplateWAL *wal, const Template *template);
+
+/**
+ * Queue an insert or replace without waiting for it to reach disk
+ * The record becomes durable with the next flush: a wal_put()/wal_delete()
+ * from any thread, wal_sync(), wal_close(), or once WAL_ASYNC_FLUSH_BYTES are
+ * queued. Meant for adaptive updates, where losing the last few on a crash
+ * only costs a little drift. Thread-safe.
+ * @param wal: Log handle
+ * @param template: Template to store
+ * Returns: 0 on success, negative on error
+ */
+int wal_put_async(TemplateWAL *wal, const Template *template);
+
+/**
+ * Wait until every queued record is durable and applied
+ * @param wal: Log handle
+ * Returns: 0 on success, negative on error
+ */
+int wal_sync(TemplateWAL *wal);
+
+/**
+ * Durably log and apply removal of a user's template
+ * Thread-safe; returns once the record is on disk and in the database.
+ * Removing a user who is not enrolled is a no-op.
+ * @param wal: Log handle
+ * @param username: User identifier
+ * Returns: 0 on success, negative on error
+ */
+int wal_delete(TemplateWAL *wal, const char *username);
+
+/**
+ * Sync the database and truncate the log
+ * Called automatically once the log exceeds WAL_CHECKPOINT_BYTES.
+ * @param wal: Log handle
+ * Returns: 0 on success, negative on error
+ */
+int wal_checkpoint(TemplateWAL *wal);
+
+/**
+ * Read group commit counters
+ * @param wal: Log handle
+ * @param stats: Output counters
+ */
+void wal_get_stats(TemplateWAL *wal, WalStats *stats);
+
+#endif /* WAL_H */
@@ -0,0 +1,493 @@
+#define _DEFAULT_SOURCE
+#include "archive.h"
+#include "template.h"
+#include "hashing.h"
+#include "utils.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Records serialized by one export task per round */
+typedef struct {
+    TemplateDB *db;
+    const TemplateRecord *const *records;
+    size_t begin;
+    size_t end;
+    uint8_t *buffer;                // Packed entries for [begin, end)
+    size_t size;
+    size_t capacity;
+    uint64_t exported;
+    uint64_t skipped;
+    int failed;
+} ExportTask;
+
+/* Entries parsed by one import task per round */
+typedef struct {
+    const uint8_t *archive;
+    const uint64_t *offsets;        // Entry offsets (length prefix) in the archive
+    size_t begin;
+    size_t end;
+    Template **templates;           // Output slots for [begin, end), NULL if rejected
+    uint64_t rejected;
+} ImportTask;
+
+static size_t archive_slice_count(size_t count) {
+    size_t slices = ARCHIVE_MAX_THREADS > 0 ? (size_t)ARCHIVE_MAX_THREADS
+                                            : scheduler_concurrency(scheduler_shared());
+
+    size_t by_work = (count + ARCHIVE_BATCH_RECORDS - 1) / ARCHIVE_BATCH_RECORDS;
+    if (by_work < 1) by_work = 1;
+
+    return by_work < slices ? by_work : slices;
+}
+
+static uint32_t header_crc(const uint8_t *header) {
+    static const uint8_t zero_crc[4] = {0, 0, 0, 0};
+    uint32_t crc = crc32_update(0, header, 12);
+    crc = crc32_update(crc, zero_crc, sizeof(zero_crc));
+    return crc32_update(crc, header + 16, ARCHIVE_HEADER_SIZE - 16);
+}
+
+static void fill_stats(ArchiveStats *stats, uint64_t templates, uint64_t rejected,
+                       uint64_t bytes, uint64_t start_ms, size_t threads) {
+    if (stats) {
+        stats->templates = templates;
+        stats->rejected = rejected;
+        stats->bytes = bytes;
+        stats->elapsed_ms = get_timestamp_ms() - start_ms;
+        stats->threads = threads;
+    }
+}
+
+/* Visitor state for collecting record pointers */
+typedef struct {
+    const TemplateRecord **records;
+    size_t count;
+    size_t capacity;
+} RecordList;
+
+static int collect_record(const TemplateRecord *record, void *ctx) {
+    RecordList *list = (RecordList*)ctx;
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        const TemplateRecord **grown =
+            (const TemplateRecord**)realloc(list->records, capacity * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        list->records = grown;
+        list->capacity = capacity;
+    }
+    list->records[list->count++] = record;
+    return 0;
+}
+
+static int task_reserve(ExportTask *task, size_t extra) {
+    if (task->size + extra <= task->capacity) {
+        return 0;
+    }
+    size_t capacity = task->capacity ? task->capacity : 1u << 20;
+    while (capacity < task->size + extra) {
+        capacity *= 2;
+    }
+    uint8_t *grown = (uint8_t*)realloc(task->buffer, capacity);
+    if (!grown) {
+        return -1;
+    }
+    task->buffer = grown;
+    task->capacity = capacity;
+    return 0;
+}
+
+static void export_range(ExportTask *task) {
+    for (size_t i = task->begin; i < task->end && !task->failed; i++) {
+        // Re-read through the database so a record rewritten mid-export is never copied torn
+        char username[64];
+        memcpy(username, task->records[i]->username, sizeof(username));
+        username[sizeof(username) - 1] = '\0';
+
+        Template *template = template_alloc();
+        if (!template) {
+            task->failed = 1;
+            break;
+        }
+        if (template_db_get(task->db, username, template) != 0) {
+            template_free(template);
+            task->skipped++;
+            continue;
+        }
+
+        uint8_t *blob = NULL;
+        size_t blob_size = 0;
+        int result = template_serialize(template, &blob, &blob_size);
+        template_free(template);
+        if (result != 0 || task_reserve(task, ARCHIVE_ENTRY_HEADER_SIZE + blob_size) != 0) {
+            if (blob) {
+                secure_wipe(blob, blob_size);
+                free(blob);
+            }
+            task->failed = 1;
+            break;
+        }
+
+        store_le32(task->buffer + task->size, (uint32_t)blob_size);
+        memcpy(task->buffer + task->size + ARCHIVE_ENTRY_HEADER_SIZE, blob, blob_size);
+        task->size += ARCHIVE_ENTRY_HEADER_SIZE + blob_size;
+        task->exported++;
+        secure_wipe(blob, blob_size);
+        free(blob);
+    }
+}
+
+static void export_task(void *arg) {
+    export_range((ExportTask*)arg);
+}
+
+/**
+ * Write every template in a database to an archive
+ */
+int archive_export(TemplateDB *db, const char *path, ArchiveStats *stats) {
+    if (!db || !path) {
+        log_message(NL_LOG_ERROR, "Invalid input for archive export");
+        return -1;
+    }
+
+    uint64_t start_ms = get_timestamp_ms();
+
+    RecordList list = {0};
+    if (template_db_foreach(db, collect_record, &list) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to enumerate template database");
+        free(list.records);
+        return -1;
+    }
+
+    char tmp_path[520];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        log_message(NL_LOG_ERROR, "Archive path too long: %s", path);
+        free(list.records);
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!file) {
+        if (fd >= 0) close(fd);
+        log_message(NL_LOG_ERROR, "Failed to create archive file: %s", tmp_path);
+        free(list.records);
+        return -1;
+    }
+
+    // Placeholder header; the real one is written once the count is known
+    uint8_t header[ARCHIVE_HEADER_SIZE] = {0};
+    int failed = fwrite(header, sizeof(header), 1, file) != 1;
+
+    size_t num_slices = archive_slice_count(list.count);
+    ExportTask *tasks = (ExportTask*)calloc(num_slices, sizeof(ExportTask));
+    TaskGroup *group = task_group_create(scheduler_shared());
+    failed = failed || !tasks || !group;
+
+    uint64_t exported = 0, skipped = 0, payload = 0;
+    size_t round = num_slices * ARCHIVE_BATCH_RECORDS;
+    for (size_t base = 0; base < list.count && !failed; base += round) {
+        for (size_t t = 0; t < num_slices; t++) {
+            ExportTask *task = &tasks[t];
+            task->db = db;
+            task->records = list.records;
+            task->begin = base + t * ARCHIVE_BATCH_RECORDS;
+            task->end = task->begin + ARCHIVE_BATCH_RECORDS;
+            if (task->end > list.count) task->end = list.count;
+            if (task->begin > task->end) task->begin = task->end;
+            task->size = 0;
+            task->exported = 0;
+            task->skipped = 0;
+        }
+
+        // Slices run on the shared scheduler; this thread serializes too while it waits
+        for (size_t t = 0; t < num_slices; t++) {
+            task_group_spawn(group, export_task, &tasks[t]);
+        }
+        task_group_wait(group);
+
+        // Slices are written in order so the archive follows slot order
+        for (size_t t = 0; t < num_slices && !failed; t++) {
+            failed = tasks[t].failed ||
+                     (tasks[t].size > 0 && fwrite(tasks[t].buffer, tasks[t].size, 1, file) != 1);
+            exported += tasks[t].exported;
+            skipped += tasks[t].skipped;
+            payload += tasks[t].size;
+            secure_wipe(tasks[t].buffer, tasks[t].size);
+        }
+    }
+
+    if (tasks) {
+        for (size_t t = 0; t < num_slices; t++) {
+            secure_wipe(tasks[t].buffer, tasks[t].size);
+            free(tasks[t].buffer);
+        }
+        free(tasks);
+    }
+    task_group_free(group);
+    free(list.records);
+
+    store_le32(header + 0, ARCHIVE_MAGIC);
+    store_le16(header + 4, ARCHIVE_VERSION);
+    store_le16(header + 6, ARCHIVE_HEADER_SIZE);
+    store_le32(header + 8, 0);
+    store_le64(header + 16, exported);
+    store_le64(header + 24, payload);
+    store_le32(header + 12, header_crc(header));
+
+    failed = failed || fseek(file, 0, SEEK_SET) != 0 || fwrite(header, sizeof(header), 1, file) != 1;
+    failed = failed || fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed = fclose(file) != 0 || failed;
+    if (failed || rename(tmp_path, path) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to write archive: %s", path);
+        unlink(tmp_path);
+        return -1;
+    }
+    if (sync_parent_directory(path) != 0) {
+        log_message(NL_LOG_WARNING, "Archive written but directory sync failed: %s", path);
+    }
+
+    if (skipped > 0) {
+        log_message(NL_LOG_WARNING, "%llu records changed during export and were skipped",
+                    (unsigned long long)skipped);
+    }
+    fill_stats(stats, exported, skipped, ARCHIVE_HEADER_SIZE + payload, start_ms, num_slices);
+    return 0;
+}
+
+/**
+ * Parse one entry and check it before it may reach the database
+ */
+static Template* parse_entry(const uint8_t *entry) {
+    uint32_t size = load_le32(entry);
+    Template *template = template_alloc();
+    if (!template) {
+        return NULL;
+    }
+
+    if (template_deserialize(entry + ARCHIVE_ENTRY_HEADER_SIZE, size, template) != 0) {
+        template_free(template);
+        return NULL;
+    }
+
+    if (template->username[0] == '\0' ||
+        !memchr(template->username, '\0', sizeof(template->username)) ||
+        template->features->size != FEATURE_VECTOR_SIZE ||
+        template->hash->hash_size != HASH_OUTPUT_SIZE || template->hash->salt_size > SALT_LENGTH ||
+        template->num_exemplars > TEMPLATE_MAX_EXEMPLARS ||
+        (template->variance && template->variance->size != template->features->size)) {
+        log_message(NL_LOG_ERROR, "Archive entry does not fit a database record");
+        template_free(template);
+        return NULL;
+    }
+
+    // The stored hash must still be the hash of the stored features
+    uint8_t digest[HASH_OUTPUT_SIZE];
+    uint8_t salt[SALT_LENGTH];
+    HashData fresh = { digest, sizeof(digest), salt, sizeof(salt) };
+    int matches = hash_features(template->features, template->hash->salt,
+                                template->hash->salt_size, &fresh) == 0 &&
+                  hash_compare(&fresh, template->hash);
+    secure_wipe(digest, sizeof(digest));
+    secure_wipe(salt, sizeof(salt));
+    if (!matches) {
+        log_message(NL_LOG_ERROR, "Archive entry for %s fails hash verification", template->username);
+        template_free(template);
+        return NULL;
+    }
+
+    return template;
+}
+
+static void import_range(ImportTask *task) {
+    for (size_t i = task->begin; i < task->end; i++) {
+        Template *template = parse_entry(task->archive + task->offsets[i]);
+        task->templates[i - task->begin] = template;
+        if (!template) {
+            task->rejected++;
+        }
+    }
+}
+
+static void import_task(void *arg) {
+    import_range((ImportTask*)arg);
+}
+
+/**
+ * Check the archive header and locate every entry
+ */
+static uint64_t* archive_index(const uint8_t *map, size_t size, uint64_t *count_out) {
+    if (size < ARCHIVE_HEADER_SIZE || load_le32(map) != ARCHIVE_MAGIC) {
+        log_message(NL_LOG_ERROR, "Not a NeuroLock archive (bad magic)");
+        return NULL;
+    }
+    if (load_le16(map + 4) != ARCHIVE_VERSION || load_le16(map + 6) != ARCHIVE_HEADER_SIZE) {
+        log_message(NL_LOG_ERROR, "Unsupported archive version %u", load_le16(map + 4));
+        return NULL;
+    }
+    if (header_crc(map) != load_le32(map + 12)) {
+        log_message(NL_LOG_ERROR, "Archive header checksum mismatch");
+        return NULL;
+    }
+
+    uint64_t count = load_le64(map + 16);
+    uint64_t payload = load_le64(map + 24);
+    if (payload != size - ARCHIVE_HEADER_SIZE ||
+        count > payload / (ARCHIVE_ENTRY_HEADER_SIZE + TEMPLATE_FILE_HEADER_SIZE)) {
+        log_message(NL_LOG_ERROR, "Archive is truncated or has trailing data");
+        return NULL;
+    }
+
+    uint64_t *offsets = (uint64_t*)malloc((count ? count : 1) * sizeof(uint64_t));
+    if (!offsets) {
+        log_message(NL_LOG_ERROR, "Failed to allocate archive index");
+        return NULL;
+    }
+
+    size_t pos = ARCHIVE_HEADER_SIZE;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t length = size - pos >= ARCHIVE_ENTRY_HEADER_SIZE ? load_le32(map + pos) : 0;
+        if (length < TEMPLATE_FILE_HEADER_SIZE || length > TEMPLATE_FILE_MAX_SIZE ||
+            length > size - pos - ARCHIVE_ENTRY_HEADER_SIZE) {
+            log_message(NL_LOG_ERROR, "Archive entry %llu is malformed", (unsigned long long)i);
+            free(offsets);
+            return NULL;
+        }
+        offsets[i] = pos;
+        pos += ARCHIVE_ENTRY_HEADER_SIZE + length;
+    }
+    if (pos != size) {
+        log_message(NL_LOG_ERROR, "Archive entries do not match the header");
+        free(offsets);
+        return NULL;
+    }
+
+    *count_out = count;
+    return offsets;
+}
+
+/**
+ * Load every template in an archive into a database
+ */
+int archive_import(TemplateDB *db, const char *path, ArchiveStats *stats) {
+    if (!db || !path) {
+        log_message(NL_LOG_ERROR, "Invalid input for archive import");
+        return -1;
+    }
+
+    uint64_t start_ms = get_timestamp_ms();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open archive: %s", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < ARCHIVE_HEADER_SIZE) {
+        log_message(NL_LOG_ERROR, "Not a NeuroLock archive: %s", path);
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    uint8_t *map = (uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_message(NL_LOG_ERROR, "Failed to map archive: %s", path);
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    uint64_t count = 0;
+    uint64_t *offsets = archive_index(map, size, &count);
+    if (!offsets) {
+        munmap(map, size);
+        return -1;
+    }
+
+    // Size the database once for the users it does not hold yet
+    size_t new_users = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        char username[64];
+        memcpy(username, map + offsets[i] + ARCHIVE_ENTRY_HEADER_SIZE + 48, sizeof(username));
+        username[sizeof(username) - 1] = '\0';
+        new_users += !template_db_contains(db, username);
+    }
+
+    size_t num_slices = archive_slice_count((size_t)count);
+    size_t round = num_slices * ARCHIVE_BATCH_RECORDS;
+    ImportTask *tasks = (ImportTask*)calloc(num_slices, sizeof(ImportTask));
+    Template **templates = (Template**)calloc(round, sizeof(Template*));
+    TaskGroup *group = task_group_create(scheduler_shared());
+    int failed = !tasks || !templates || !group ||
+                 template_db_reserve(db, template_db_count(db) + new_users) != 0;
+
+    uint64_t imported = 0, rejected = 0;
+    for (size_t base = 0; base < count && !failed; base += round) {
+        for (size_t t = 0; t < num_slices; t++) {
+            ImportTask *task = &tasks[t];
+            task->archive = map;
+            task->offsets = offsets;
+            task->begin = base + t * ARCHIVE_BATCH_RECORDS;
+            task->end = task->begin + ARCHIVE_BATCH_RECORDS;
+            if (task->end > count) task->end = (size_t)count;
+            if (task->begin > task->end) task->begin = task->end;
+            task->templates = templates + t * ARCHIVE_BATCH_RECORDS;
+            task->rejected = 0;
+        }
+
+        for (size_t t = 0; t < num_slices; t++) {
+            task_group_spawn(group, import_task, &tasks[t]);
+        }
+        task_group_wait(group);
+
+        // Single writer: store the survivors of this round in archive order
+        size_t parsed = (base + round < count ? base + round : (size_t)count) - base;
+        size_t valid = 0;
+        for (size_t i = 0; i < parsed; i++) {
+            if (templates[i]) {
+                templates[valid++] = templates[i];
+            }
+        }
+        for (size_t t = 0; t < num_slices; t++) {
+            rejected += tasks[t].rejected;
+        }
+
+        failed = template_db_put_batch(db, (const Template *const *)templates, valid) != 0;
+        if (!failed) {
+            imported += valid;
+        }
+        for (size_t i = 0; i < valid; i++) {
+            template_free(templates[i]);
+            templates[i] = NULL;
+        }
+    }
+
+    free(templates);
+    free(tasks);
+    task_group_free(group);
+    free(offsets);
+    munmap(map, size);
+
+    failed = template_db_sync(db) != 0 || failed;
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Archive import stopped after %llu templates: %s",
+                    (unsigned long long)imported, path);
+        return -1;
+    }
+
+    if (rejected > 0) {
+        log_message(NL_LOG_WARNING, "%llu archive entries failed validation and were skipped",
+                    (unsigned long long)rejected);
+    }
+    fill_stats(stats, imported, rejected, size, start_ms, num_slices);
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include "auth.h"
+#include "cohort.h"
+#include "lda.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+/**
+ * Authenticate a trial with the strongest matcher available for the template
+ */
+int auth_verify(const EEGData *trial, const Template *template, const MahalanobisModel *whitening,
+                const TemplateMatrix *cohort, AuthResult *result, AuthMatcher *matcher) {
+    if (!trial || !template || !result) {
+        log_message(NL_LOG_ERROR, "Invalid input for authentication");
+        return -1;
+    }
+
+    log_message(NL_LOG_INFO, "Authenticating against template for user: %s", template->username);
+
+    FeatureVector *probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    if (!probe) {
+        log_message(NL_LOG_ERROR, "Failed to allocate trial feature vector");
+        return -1;
+    }
+    if (extract_features(trial, probe) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to extract features from trial");
+        feature_vector_free(probe);
+        return -1;
+    }
+
+    AuthMatcher used;
+    int status = auth_verify_features(probe, template, whitening, cohort, result, &used);
+    feature_vector_free(probe);
+    if (status != 0) {
+        return status;
+    }
+
+    if (result->authenticated) {
+        log_message(NL_LOG_INFO, "Authentication SUCCESSFUL (score: %.3f)", result->normalized_score);
+    } else {
+        log_message(NL_LOG_WARNING, "Authentication FAILED (score: %.3f < %.3f)",
+                    result->normalized_score, auth_threshold(used));
+    }
+    if (matcher) {
+        *matcher = used;
+    }
+    return 0;
+}
+
+/**
+ * Decide on an already extracted probe
+ */
+int auth_verify_features(const FeatureVector *probe, const Template *template, const MahalanobisModel *whitening,
+                         const TemplateMatrix *cohort, AuthResult *result, AuthMatcher *matcher) {
+    if (!probe || !template || !result) {
+        log_message(NL_LOG_ERROR, "Invalid input for authentication");
+        return -1;
+    }
+
+    // Discriminant, then whitened distance, then normalized or raw cosine
+    AuthMatcher used;
+    float similarity, score;
+    if (LDA_MATCHER && template->lda_weights) {
+        used = AUTH_MATCHER_DISCRIMINANT;
+        similarity = template_similarity(template, probe);
+        score = lda_score(template, probe);
+        if (!isfinite(score)) {
+            return -1;
+        }
+    } else if (MAHALANOBIS_MATCHER && whitening) {
+        used = AUTH_MATCHER_WHITENED;
+        similarity = mahalanobis_similarity(whitening, template, probe);
+        score = similarity;
+        if (similarity < 0.0f) {
+            return -1;
+        }
+    } else if (cohort && SCORE_NORMALIZATION != SCORE_NORM_NONE) {
+        used = AUTH_MATCHER_NORMALIZED;
+        similarity = template_similarity(template, probe);
+        if (similarity < 0.0f ||
+            cohort_normalize(cohort, template, probe, similarity, (ScoreNorm)SCORE_NORMALIZATION, &score) != 0) {
+            return -1;
+        }
+    } else {
+        used = AUTH_MATCHER_COSINE;
+        similarity = template_similarity(template, probe);
+        score = similarity;
+    }
+
+    result->similarity_score = similarity;
+    result->normalized_score = score;
+    result->normalized = used == AUTH_MATCHER_DISCRIMINANT || used == AUTH_MATCHER_NORMALIZED;
+    result->authenticated = score >= auth_threshold(used);
+    result->timestamp = time(NULL);
+    result->attempts = 0;                   // Set by the caller from its attempt table
+
+    if (matcher) {
+        *matcher = used;
+    }
+    return 0;
+}
+
+/**
+ * Decision threshold of a matcher
+ */
+float auth_threshold(AuthMatcher matcher) {
+    switch (matcher) {
+        case AUTH_MATCHER_DISCRIMINANT:
+            return LDA_THRESHOLD;
+        case AUTH_MATCHER_WHITENED:
+            return MAHALANOBIS_THRESHOLD;
+        case AUTH_MATCHER_NORMALIZED:
+            return NORMALIZED_SCORE_THRESHOLD;
+        default:
+            return SIMILARITY_THRESHOLD;
+    }
+}
+
+/**
+ * Derive cohort statistics and the discriminant for a new template
+ */
+void auth_train(Template *template, const TemplateMatrix *cohort) {
+    if (!template || !cohort) {
+        return;
+    }
+    if (cohort_znorm(cohort, template, &template->znorm_mean, &template->znorm_std) != 0) {
+        log_message(NL_LOG_WARNING, "Enrolling without Z-norm statistics");
+    }
+    if (LDA_MATCHER && lda_train(template, cohort) != 0) {
+        log_message(NL_LOG_WARNING, "Enrolling without a discriminant");
+    }
+}
+
+/**
+ * Recompute what was derived from the template's old mean
+ */
+static void refresh_adapted(Template *template, const TemplateMatrix *cohort) {
+    if (!cohort) {
+        if (LDA_MATCHER && template->lda_weights) {
+            log_message(NL_LOG_WARNING, "No cohort; discriminant for %s left as trained", template->username);
+        }
+        return;
+    }
+    cohort_znorm(cohort, template, &template->znorm_mean, &template->znorm_std);
+
+    // The discriminant decides first, so it has to follow the mean
+    if (LDA_MATCHER && template->lda_weights && lda_train(template, cohort) != 0) {
+        log_message(NL_LOG_WARNING, "Keeping the previous discriminant for %s", template->username);
+    }
+}
+
+/**
+ * Fold an accepted trial into the template and refresh its cohort statistics
+ */
+int auth_adapt(Template *template, const EEGData *trial, const TemplateMatrix *cohort) {
+    if (template_update(template, trial) != 0) {
+        return -1;
+    }
+    refresh_adapted(template, cohort);
+    return 0;
+}
+
+/**
+ * Fold accepted features into the template and refresh its cohort statistics
+ */
+int auth_adapt_features(Template *template, const FeatureVector *sample, const TemplateMatrix *cohort) {
+    if (template_update_features(template, sample) != 0) {
+        return -1;
+    }
+    refresh_adapted(template, cohort);
+    return 0;
+}
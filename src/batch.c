@@ -0,0 +1,390 @@
+#define _DEFAULT_SOURCE
+#include "batch.h"
+#include "auth.h"
+#include "capture.h"
+#include "feature_extraction.h"
+#include "scheduler.h"
+#include "template.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* One manifest entry; strings point into the manifest text */
+typedef struct {
+    const char *recording;
+    const char *username;
+    MentalTask task;
+    uint32_t line;
+    size_t user;                    // Slot in the user table
+} BatchEntry;
+
+/* Decision for one entry */
+typedef struct {
+    uint8_t status;
+    uint8_t matcher;
+    uint8_t authenticated;
+    float similarity;
+    float score;
+} BatchResult;
+
+/* Entries [begin, end) decoded, extracted and scored by one task */
+typedef struct {
+    const BatchEntry *entries;
+    BatchResult *results;
+    size_t begin;
+    size_t end;
+    Template *const *templates;     // [users] NULL if not enrolled
+    const MahalanobisModel *whitening;
+    const TemplateMatrix *cohort;
+} ScoreTask;
+
+/* Users [begin, end) of the user table loaded by one task */
+typedef struct {
+    TemplateDB *db;
+    const char *const *names;
+    Template **templates;
+    size_t begin;
+    size_t end;
+} LoadTask;
+
+static const char *const status_names[] = {
+    "ok", "bad_recording", "unknown_user", "task_mismatch", "score_failed"
+};
+
+static const char *const matcher_names[] = {
+    "cosine", "normalized", "whitened", "discriminant"
+};
+
+static char* trim(char *text) {
+    while (isspace((unsigned char)*text)) text++;
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return text;
+}
+
+/**
+ * Split the manifest text in place into entries
+ */
+static BatchEntry* parse_manifest(char *text, size_t *count_out) {
+    size_t lines = 1;
+    for (const char *p = text; *p; p++) {
+        lines += *p == '\n';
+    }
+
+    BatchEntry *entries = (BatchEntry*)calloc(lines, sizeof(BatchEntry));
+    if (!entries) {
+        log_message(NL_LOG_ERROR, "Failed to allocate manifest entries");
+        return NULL;
+    }
+
+    size_t count = 0;
+    uint32_t line = 0;
+    char *next = text;
+    while (next) {
+        char *current = next;
+        next = strchr(current, '\n');
+        if (next) {
+            *next++ = '\0';
+        }
+        line++;
+
+        current = trim(current);
+        if (*current == '\0' || *current == '#') {
+            continue;
+        }
+
+        char *username = strchr(current, ',');
+        char *task = username ? strchr(username + 1, ',') : NULL;
+        if (!task) {
+            log_message(NL_LOG_ERROR, "Manifest line %u: expected recording,username,task", line);
+            free(entries);
+            return NULL;
+        }
+        *username++ = '\0';
+        *task++ = '\0';
+
+        BatchEntry *entry = &entries[count];
+        entry->recording = trim(current);
+        entry->username = trim(username);
+        task = trim(task);
+        char *end = NULL;
+        long value = strtol(task, &end, 10);
+        if (*entry->recording == '\0' || *entry->username == '\0' || strlen(entry->username) >= 64 ||
+            end == task || *end != '\0' || value < TASK_EYES_CLOSED_REST || value > TASK_VISUAL_IMAGERY) {
+            log_message(NL_LOG_ERROR, "Manifest line %u is malformed", line);
+            free(entries);
+            return NULL;
+        }
+        entry->task = (MentalTask)value;
+        entry->line = line;
+        count++;
+    }
+
+    *count_out = count;
+    return entries;
+}
+
+static int compare_entry_users(const void *a, const void *b) {
+    return strcmp((*(const BatchEntry *const *)a)->username, (*(const BatchEntry *const *)b)->username);
+}
+
+/**
+ * Give every entry a user slot and list the distinct usernames
+ */
+static const char** index_users(BatchEntry *entries, size_t count, size_t *users_out) {
+    BatchEntry **sorted = (BatchEntry**)malloc((count ? count : 1) * sizeof(BatchEntry*));
+    const char **names = (const char**)malloc((count ? count : 1) * sizeof(char*));
+    if (!sorted || !names) {
+        log_message(NL_LOG_ERROR, "Failed to allocate user table");
+        free(sorted);
+        free(names);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sorted[i] = &entries[i];
+    }
+    qsort(sorted, count, sizeof(BatchEntry*), compare_entry_users);
+
+    size_t users = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (users == 0 || strcmp(names[users - 1], sorted[i]->username) != 0) {
+            names[users++] = sorted[i]->username;
+        }
+        sorted[i]->user = users - 1;
+    }
+
+    free(sorted);
+    *users_out = users;
+    return names;
+}
+
+static void load_task(void *arg) {
+    LoadTask *task = (LoadTask*)arg;
+    for (size_t u = task->begin; u < task->end; u++) {
+        if (!template_db_contains(task->db, task->names[u])) {
+            continue;
+        }
+        Template *template = template_alloc();
+        if (template && template_db_get(task->db, task->names[u], template) != 0) {
+            template_free(template);
+            template = NULL;
+        }
+        task->templates[u] = template;
+    }
+}
+
+static void score_task(void *arg) {
+    ScoreTask *task = (ScoreTask*)arg;
+    EEGData *trials[BATCH_TASK_RECORDS] = {NULL};
+    FeatureVector *probes[BATCH_TASK_RECORDS] = {NULL};
+    size_t slots[BATCH_TASK_RECORDS];
+    int status[BATCH_TASK_RECORDS];
+    size_t n = 0;
+
+    // Decode the recordings that can be scored at all
+    for (size_t i = task->begin; i < task->end; i++) {
+        const BatchEntry *entry = &task->entries[i];
+        const Template *template = task->templates[entry->user];
+        BatchResult *result = &task->results[i];
+        if (!template) {
+            result->status = BATCH_UNKNOWN_USER;
+            continue;
+        }
+        if (template->task_type != entry->task) {
+            result->status = BATCH_TASK_MISMATCH;
+            continue;
+        }
+
+        EEGData *trial = eeg_data_load(entry->recording);
+        FeatureVector *probe = trial ? feature_vector_alloc(FEATURE_VECTOR_SIZE) : NULL;
+        if (!probe) {
+            result->status = trial ? BATCH_SCORE_FAILED : BATCH_BAD_RECORDING;
+            eeg_data_free(trial);
+            continue;
+        }
+        trial->task_type = entry->task;
+        trials[n] = trial;
+        probes[n] = probe;
+        slots[n] = i;
+        n++;
+    }
+
+    extract_features_batch((const EEGData *const *)trials, n, probes, status);
+
+    for (size_t j = 0; j < n; j++) {
+        const BatchEntry *entry = &task->entries[slots[j]];
+        BatchResult *result = &task->results[slots[j]];
+        AuthResult decision;
+        AuthMatcher matcher;
+        if (status[j] != 0 ||
+            auth_verify_features(probes[j], task->templates[entry->user], task->whitening, task->cohort,
+                                 &decision, &matcher) != 0) {
+            result->status = BATCH_SCORE_FAILED;
+        } else {
+            result->status = BATCH_OK;
+            result->matcher = (uint8_t)matcher;
+            result->authenticated = (uint8_t)(decision.authenticated != 0);
+            result->similarity = decision.similarity_score;
+            result->score = decision.normalized_score;
+        }
+        feature_vector_free(probes[j]);
+        eeg_data_free(trials[j]);
+    }
+}
+
+static int write_csv(FILE *file, const BatchEntry *entries, const BatchResult *results, size_t count) {
+    int failed = fprintf(file, "line,recording,username,task,status,matcher,similarity,score,authenticated\n") < 0;
+    for (size_t i = 0; i < count && !failed; i++) {
+        const BatchEntry *entry = &entries[i];
+        const BatchResult *result = &results[i];
+        if (result->status == BATCH_OK) {
+            failed = fprintf(file, "%u,%s,%s,%d,ok,%s,%.6f,%.6f,%u\n", entry->line, entry->recording,
+                             entry->username, (int)entry->task, matcher_names[result->matcher],
+                             result->similarity, result->score, result->authenticated) < 0;
+        } else {
+            failed = fprintf(file, "%u,%s,%s,%d,%s,,,,0\n", entry->line, entry->recording, entry->username,
+                             (int)entry->task, status_names[result->status]) < 0;
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+static int write_binary(FILE *file, const BatchEntry *entries, const BatchResult *results, size_t count) {
+    uint8_t header[BATCH_RESULT_HEADER_SIZE];
+    store_le32(header, BATCH_RESULT_MAGIC);
+    store_le16(header + 4, BATCH_RESULT_VERSION);
+    store_le16(header + 6, BATCH_RESULT_RECORD_SIZE);
+    store_le64(header + 8, (uint64_t)count);
+    int failed = fwrite(header, sizeof(header), 1, file) != 1;
+
+    for (size_t i = 0; i < count && !failed; i++) {
+        uint8_t record[BATCH_RESULT_RECORD_SIZE] = {0};
+        store_le32(record, entries[i].line);
+        record[4] = results[i].status;
+        record[5] = results[i].matcher;
+        record[6] = results[i].authenticated;
+        store_le_f32(record + 8, results[i].similarity);
+        store_le_f32(record + 12, results[i].score);
+        failed = fwrite(record, sizeof(record), 1, file) != 1;
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * Score every manifest entry and write the results
+ */
+int batch_score(TemplateDB *db, const MahalanobisModel *whitening, const TemplateMatrix *cohort,
+                const char *manifest_path, const char *output_path, BatchFormat format, BatchStats *stats) {
+    if (!db || !manifest_path || !output_path) {
+        log_message(NL_LOG_ERROR, "Invalid input for batch scoring");
+        return -1;
+    }
+
+    uint64_t start_ms = get_timestamp_ms();
+
+    // The manifest text is kept and NUL-terminated; entries point into it
+    uint8_t *raw = NULL;
+    size_t raw_size = 0;
+    if (read_file(manifest_path, &raw, &raw_size) != 0) {
+        return -1;
+    }
+    char *text = (char*)realloc(raw, raw_size + 1);
+    if (!text) {
+        log_message(NL_LOG_ERROR, "Failed to allocate manifest buffer");
+        free(raw);
+        return -1;
+    }
+    text[raw_size] = '\0';
+
+    size_t count = 0, num_users = 0;
+    BatchEntry *entries = parse_manifest(text, &count);
+    const char **names = entries ? index_users(entries, count, &num_users) : NULL;
+    Template **templates = names ? (Template**)calloc(num_users ? num_users : 1, sizeof(Template*)) : NULL;
+    BatchResult *results = templates ? (BatchResult*)calloc(count ? count : 1, sizeof(BatchResult)) : NULL;
+    size_t num_load = (num_users + BATCH_TASK_RECORDS - 1) / BATCH_TASK_RECORDS;
+    size_t num_score = (count + BATCH_TASK_RECORDS - 1) / BATCH_TASK_RECORDS;
+    LoadTask *loads = results ? (LoadTask*)calloc(num_load ? num_load : 1, sizeof(LoadTask)) : NULL;
+    ScoreTask *scores = loads ? (ScoreTask*)calloc(num_score ? num_score : 1, sizeof(ScoreTask)) : NULL;
+    Scheduler *sched = scheduler_shared();
+    TaskGroup *group = scores ? task_group_create(sched) : NULL;
+    int failed = !group;
+    if (names && !group) {
+        log_message(NL_LOG_ERROR, "Failed to allocate batch scoring buffers");
+    }
+
+    // Every distinct user's template is read once, in parallel
+    for (size_t t = 0; !failed && t < num_load; t++) {
+        loads[t].db = db;
+        loads[t].names = names;
+        loads[t].templates = templates;
+        loads[t].begin = t * BATCH_TASK_RECORDS;
+        loads[t].end = loads[t].begin + BATCH_TASK_RECORDS < num_users ? loads[t].begin + BATCH_TASK_RECORDS
+                                                                          : num_users;
+        task_group_spawn(group, load_task, &loads[t]);
+    }
+    if (!failed) {
+        task_group_wait(group);
+    }
+
+    // Then entries are decoded, extracted and scored in runs of BATCH_TASK_RECORDS
+    for (size_t t = 0; !failed && t < num_score; t++) {
+        scores[t].entries = entries;
+        scores[t].results = results;
+        scores[t].begin = t * BATCH_TASK_RECORDS;
+        scores[t].end = scores[t].begin + BATCH_TASK_RECORDS < count ? scores[t].begin + BATCH_TASK_RECORDS : count;
+        scores[t].templates = templates;
+        scores[t].whitening = whitening;
+        scores[t].cohort = cohort;
+        task_group_spawn(group, score_task, &scores[t]);
+    }
+    if (!failed) {
+        task_group_wait(group);
+    }
+
+    if (!failed) {
+        FILE *file = fopen(output_path, format == BATCH_FORMAT_BINARY ? "wb" : "w");
+        failed = !file ||
+                 (format == BATCH_FORMAT_BINARY ? write_binary(file, entries, results, count)
+                                                : write_csv(file, entries, results, count)) != 0;
+        if (file && fclose(file) != 0) {
+            failed = 1;
+        }
+        if (failed) {
+            log_message(NL_LOG_ERROR, "Failed to write batch results: %s", output_path);
+        }
+    }
+
+    if (!failed && stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->records = count;
+        stats->users = num_users;
+        for (size_t i = 0; i < count; i++) {
+            if (results[i].status != BATCH_OK) {
+                stats->failed++;
+            } else if (results[i].authenticated) {
+                stats->accepted++;
+            } else {
+                stats->rejected++;
+            }
+        }
+        stats->elapsed_ms = get_timestamp_ms() - start_ms;
+        stats->threads = scheduler_concurrency(sched);
+    }
+
+    task_group_free(group);
+    for (size_t u = 0; templates && u < num_users; u++) {
+        template_free(templates[u]);
+    }
+    free(scores);
+    free(loads);
+    free(results);
+    free(templates);
+    free(names);
+    free(entries);
+    free(text);
+    return failed ? -1 : 0;
+}
@@ -1,4 +1,5 @@
 #include "capture.h"
+#include "hashing.h"
 #include "utils.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,18 +9,20 @@
 /* Global device state */
 static DeviceStatus device_status = DEVICE_DISCONNECTED;
 static char device_name[256] = {0};
+static uint64_t stream_started_ms = 0;      // Streaming start, paces the simulated samples
+static uint64_t stream_frames = 0;          // Frames handed out by capture_read()
 
 /**
  * Initialize EEG capture device
  */
 int capture_init(void) {
-    log_message(LOG_INFO, "Initializing EEG capture system...");
+    log_message(NL_LOG_INFO, "Initializing EEG capture system...");
     
     // Initialize device communication buffers
     // TODO: Initialize device-specific drivers (OpenBCI, Muse, etc.)
     
     device_status = DEVICE_DISCONNECTED;
-    log_message(LOG_INFO, "EEG capture system initialized");
+    log_message(NL_LOG_INFO, "EEG capture system initialized");
     return 0;
 }
 
@@ -28,18 +31,18 @@ int capture_init(void) {
  */
 int capture_connect(const char *dev_name) {
     if (!dev_name) {
-        log_message(LOG_ERROR, "Device name is NULL");
+        log_message(NL_LOG_ERROR, "Device name is NULL");
         return -1;
     }
     
-    log_message(LOG_INFO, "Connecting to device: %s", dev_name);
+    log_message(NL_LOG_INFO, "Connecting to device: %s", dev_name);
     
     // TODO: Implement actual device connection
     // For now, simulate connection
     strncpy(device_name, dev_name, sizeof(device_name) - 1);
     device_status = DEVICE_CONNECTED;
     
-    log_message(LOG_INFO, "Connected to device: %s", dev_name);
+    log_message(NL_LOG_INFO, "Connected to device: %s", dev_name);
     return 0;
 }
 
@@ -55,16 +58,18 @@ DeviceStatus capture_get_status(void) {
  */
 int capture_start_streaming(void) {
     if (device_status != DEVICE_CONNECTED) {
-        log_message(LOG_ERROR, "Device not connected");
+        log_message(NL_LOG_ERROR, "Device not connected");
         return -1;
     }
     
-    log_message(LOG_INFO, "Starting EEG stream...");
+    log_message(NL_LOG_INFO, "Starting EEG stream...");
     
     // TODO: Send start streaming command to device
     device_status = DEVICE_STREAMING;
+    stream_started_ms = get_timestamp_ms();
+    stream_frames = 0;
     
-    log_message(LOG_INFO, "EEG streaming started");
+    log_message(NL_LOG_INFO, "EEG streaming started");
     return 0;
 }
 
@@ -73,16 +78,16 @@ int capture_start_streaming(void) {
  */
 int capture_stop_streaming(void) {
     if (device_status != DEVICE_STREAMING) {
-        log_message(LOG_WARNING, "Device not streaming");
+        log_message(NL_LOG_WARNING, "Device not streaming");
         return -1;
     }
     
-    log_message(LOG_INFO, "Stopping EEG stream...");
+    log_message(NL_LOG_INFO, "Stopping EEG stream...");
     
     // TODO: Send stop streaming command to device
     device_status = DEVICE_CONNECTED;
     
-    log_message(LOG_INFO, "EEG streaming stopped");
+    log_message(NL_LOG_INFO, "EEG streaming stopped");
     return 0;
 }
 
@@ -159,12 +164,12 @@ void capture_display_task_instructions(MentalTask task) {
  */
 int capture_record(float duration, MentalTask task, EEGData *output) {
     if (!output) {
-        log_message(LOG_ERROR, "Output pointer is NULL");
+        log_message(NL_LOG_ERROR, "Output pointer is NULL");
         return -1;
     }
     
     if (device_status != DEVICE_STREAMING) {
-        log_message(LOG_ERROR, "Device not streaming");
+        log_message(NL_LOG_ERROR, "Device not streaming");
         return -1;
     }
     
@@ -181,7 +186,7 @@ int capture_record(float duration, MentalTask task, EEGData *output) {
     // Allocate EEG data structure
     EEGData *data = eeg_data_alloc(num_channels, num_samples);
     if (!data) {
-        log_message(LOG_ERROR, "Failed to allocate EEG data");
+        log_message(NL_LOG_ERROR, "Failed to allocate EEG data");
         return -1;
     }
     
@@ -189,7 +194,7 @@ int capture_record(float duration, MentalTask task, EEGData *output) {
     data->task_type = task;
     data->timestamp = get_timestamp_ms();
     
-    log_message(LOG_INFO, "Recording EEG data for %.1f seconds...", duration);
+    log_message(NL_LOG_INFO, "Recording EEG data for %.1f seconds...", duration);
     
     // TODO: Actual data capture from device
     // For now, simulate with random data
@@ -205,7 +210,7 @@ int capture_record(float duration, MentalTask task, EEGData *output) {
     }
     
     printf("\n");
-    log_message(LOG_INFO, "EEG data capture complete");
+    log_message(NL_LOG_INFO, "EEG data capture complete");
     
     // Copy to output
     memcpy(output, data, sizeof(EEGData));
@@ -215,6 +220,32 @@ int capture_record(float duration, MentalTask task, EEGData *output) {
     return 0;
 }
 
+/**
+ * Read the samples that arrived since the last read, without blocking
+ */
+int capture_read(float *frames, size_t max_frames) {
+    if (!frames) {
+        log_message(NL_LOG_ERROR, "Output pointer is NULL");
+        return -1;
+    }
+    
+    if (device_status != DEVICE_STREAMING) {
+        log_message(NL_LOG_ERROR, "Device not streaming");
+        return -1;
+    }
+    
+    // TODO: Drain the device's sample queue
+    // For now, simulate a device delivering SAMPLING_RATE frames per second
+    uint64_t arrived = (get_timestamp_ms() - stream_started_ms) * SAMPLING_RATE / 1000;
+    size_t count = arrived - stream_frames < max_frames ? (size_t)(arrived - stream_frames) : max_frames;
+    for (size_t i = 0; i < count * NUM_CHANNELS; i++) {
+        frames[i] = ((float)rand() / RAND_MAX - 0.5f) * 100.0f;
+    }
+    stream_frames += count;
+    
+    return (int)count;
+}
+
 /**
  * Disconnect from EEG device
  */
@@ -223,13 +254,13 @@ int capture_disconnect(void) {
         capture_stop_streaming();
     }
     
-    log_message(LOG_INFO, "Disconnecting from device...");
+    log_message(NL_LOG_INFO, "Disconnecting from device...");
     
     // TODO: Actual device disconnection
     device_status = DEVICE_DISCONNECTED;
     memset(device_name, 0, sizeof(device_name));
     
-    log_message(LOG_INFO, "Device disconnected");
+    log_message(NL_LOG_INFO, "Device disconnected");
     return 0;
 }
 
@@ -241,7 +272,7 @@ void capture_cleanup(void) {
         capture_disconnect();
     }
     
-    log_message(LOG_INFO, "Capture system cleanup complete");
+    log_message(NL_LOG_INFO, "Capture system cleanup complete");
 }
 
 /**
@@ -250,13 +281,13 @@ void capture_cleanup(void) {
 EEGData* eeg_data_alloc(size_t num_channels, size_t num_samples) {
     EEGData *data = (EEGData*)malloc(sizeof(EEGData));
     if (!data) {
-        log_message(LOG_ERROR, "Failed to allocate EEGData structure");
+        log_message(NL_LOG_ERROR, "Failed to allocate EEGData structure");
         return NULL;
     }
     
     data->data = (float*)calloc(num_channels * num_samples, sizeof(float));
     if (!data->data) {
-        log_message(LOG_ERROR, "Failed to allocate EEG data buffer");
+        log_message(NL_LOG_ERROR, "Failed to allocate EEG data buffer");
         free(data);
         return NULL;
     }
@@ -282,3 +313,77 @@ void eeg_data_free(EEGData *data) {
         free(data);
     }
 }
+
+/**
+ * Write EEG data to a recording file
+ */
+int eeg_data_save(const EEGData *data, const char *path) {
+    if (!data || !data->data || !path || data->num_channels == 0 || data->num_samples == 0 ||
+        data->num_channels > UINT32_MAX || data->num_samples > UINT32_MAX) {
+        log_message(NL_LOG_ERROR, "Invalid input for recording save");
+        return -1;
+    }
+
+    size_t count = data->num_channels * data->num_samples;
+    size_t size = RECORDING_HEADER_SIZE + count * sizeof(float);
+    uint8_t *buffer = (uint8_t*)calloc(1, size);
+    if (!buffer) {
+        log_message(NL_LOG_ERROR, "Failed to allocate recording buffer");
+        return -1;
+    }
+
+    store_le32(buffer, RECORDING_MAGIC);
+    store_le16(buffer + 4, RECORDING_VERSION);
+    store_le16(buffer + 6, RECORDING_HEADER_SIZE);
+    store_le32(buffer + 8, (uint32_t)data->task_type);
+    store_le32(buffer + 12, (uint32_t)data->num_channels);
+    store_le32(buffer + 16, (uint32_t)data->num_samples);
+    store_le_f32(buffer + 20, data->sampling_rate);
+    store_le64(buffer + 24, data->timestamp);
+    for (size_t i = 0; i < count; i++) {
+        store_le_f32(buffer + RECORDING_HEADER_SIZE + 4 * i, data->data[i]);
+    }
+
+    int result = write_file(path, buffer, size);
+    secure_wipe(buffer, size);
+    free(buffer);
+    return result;
+}
+
+/**
+ * Read a recording file
+ */
+EEGData* eeg_data_load(const char *path) {
+    uint8_t *buffer = NULL;
+    size_t size = 0;
+    if (!path || read_file(path, &buffer, &size) != 0) {
+        return NULL;
+    }
+
+    uint32_t task = size >= RECORDING_HEADER_SIZE ? load_le32(buffer + 8) : 0;
+    size_t channels = size >= RECORDING_HEADER_SIZE ? load_le32(buffer + 12) : 0;
+    size_t samples = size >= RECORDING_HEADER_SIZE ? load_le32(buffer + 16) : 0;
+    if (size < RECORDING_HEADER_SIZE || load_le32(buffer) != RECORDING_MAGIC ||
+        load_le16(buffer + 4) != RECORDING_VERSION || load_le16(buffer + 6) != RECORDING_HEADER_SIZE ||
+        task > TASK_VISUAL_IMAGERY || channels == 0 || samples == 0 ||
+        (size - RECORDING_HEADER_SIZE) / sizeof(float) / channels != samples ||
+        (size - RECORDING_HEADER_SIZE) % (channels * sizeof(float)) != 0) {
+        log_message(NL_LOG_ERROR, "Not a valid recording: %s", path);
+        free(buffer);
+        return NULL;
+    }
+
+    EEGData *data = eeg_data_alloc(channels, samples);
+    if (data) {
+        data->task_type = (MentalTask)task;
+        data->sampling_rate = load_le_f32(buffer + 20);
+        data->timestamp = load_le64(buffer + 24);
+        for (size_t i = 0; i < channels * samples; i++) {
+            data->data[i] = load_le_f32(buffer + RECORDING_HEADER_SIZE + 4 * i);
+        }
+    }
+
+    secure_wipe(buffer, size);
+    free(buffer);
+    return data;
+}
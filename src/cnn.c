@@ -0,0 +1,361 @@
+#include "cnn.h"
+#include "vector_ops.h"
+#include "hashing.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * Model file layout (little-endian):
+ *   offset  field          type  notes
+ *    0      magic          u32   CNN_FILE_MAGIC
+ *    4      version        u16   CNN_FILE_VERSION
+ *    6      header_size    u16   CNN_FILE_HEADER_SIZE
+ *    8      layers         u32
+ *   12      crc32          u32   CRC of the whole file with this field taken as zero
+ *   16      channels       u32   EEG channels consumed
+ *   20      samples        u32   Samples per channel consumed
+ *   24      input_scale    f32   Step of the 7-bit signed input quantizer
+ *   28      reserved       4 bytes, zero
+ * followed by one entry per layer:
+ *    0      type           u32   CNNLayerType
+ *    4      flags          u32   CNN_LAYER_* flags
+ *    8      in_channels    u32
+ *   12      out_channels   u32
+ *   16      kernel         u32
+ *   20      stride         u32
+ *   24      output_scale   f32   Ignored for pooling and for the last layer
+ *   28      reserved       4 bytes, zero
+ * and, for convolutions only, int8 weights[out_channels][kernel][in_channels]
+ * zero padded to a multiple of 4 bytes, float32 weight_scales[out_channels]
+ * and float32 bias[out_channels].
+ */
+
+/* Zero point of 7-bit activations that may be negative */
+#define CNN_SIGNED_ZERO_POINT 64
+/* Bytes past the largest activation the padded weight rows may read */
+#define CNN_ACTIVATION_SLACK 8
+/* Longest input accepted from a model file, in samples */
+#define CNN_MAX_SAMPLES (1u << 20)
+
+static int output_zero_point(const CNNLayer *layer) {
+    return layer->flags & CNN_LAYER_RELU ? 0 : CNN_SIGNED_ZERO_POINT;
+}
+
+/**
+ * Parse one layer entry and fold the input quantization into its epilogue
+ */
+static int load_layer(CNNLayer *layer, const uint8_t *buffer, size_t size, size_t *offset,
+                      size_t channels, size_t length, float in_scale, int in_zero_point, int last) {
+    if (*offset + CNN_LAYER_HEADER_SIZE > size) {
+        return -1;
+    }
+
+    const uint8_t *entry = buffer + *offset;
+    *offset += CNN_LAYER_HEADER_SIZE;
+    layer->type = (CNNLayerType)load_le32(entry);
+    layer->flags = load_le32(entry + 4);
+    layer->in_channels = load_le32(entry + 8);
+    layer->out_channels = load_le32(entry + 12);
+    layer->kernel = load_le32(entry + 16);
+    layer->stride = load_le32(entry + 20);
+    layer->output_scale = load_le_f32(entry + 24);
+    layer->in_length = length;
+
+    if (layer->in_channels != channels || (layer->flags & ~CNN_LAYER_RELU) != 0) {
+        return -1;
+    }
+
+    switch (layer->type) {
+        case CNN_LAYER_CONV1D:
+            if (layer->out_channels == 0 || layer->out_channels > CNN_MAX_CHANNELS ||
+                layer->kernel == 0 || layer->kernel > length || layer->stride == 0 ||
+                (!last && !(layer->output_scale > 0.0f && isfinite(layer->output_scale)))) {
+                return -1;
+            }
+            break;
+        case CNN_LAYER_MAXPOOL:
+            if (last || layer->flags != 0 || layer->out_channels != channels ||
+                layer->kernel == 0 || layer->kernel > length || layer->stride == 0) {
+                return -1;
+            }
+            layer->output_scale = in_scale;
+            break;
+        case CNN_LAYER_GLOBAL_AVGPOOL:
+            if (last || layer->flags != 0 || layer->out_channels != channels) {
+                return -1;
+            }
+            layer->kernel = length;
+            layer->stride = 1;
+            layer->output_scale = in_scale;
+            break;
+        default:
+            return -1;
+    }
+    layer->out_length = (length - layer->kernel) / layer->stride + 1;
+
+    if (layer->type != CNN_LAYER_CONV1D) {
+        return 0;
+    }
+
+    size_t window = layer->kernel * channels;
+    size_t weight_bytes = (layer->out_channels * window + 3) & ~(size_t)3;
+    if (*offset + weight_bytes + 8 * layer->out_channels > size) {
+        return -1;
+    }
+
+    layer->row_bytes = (window + 7) & ~(size_t)7;
+    layer->weights = (int8_t*)calloc(layer->out_channels, layer->row_bytes);
+    layer->weight_scales = (float*)malloc(layer->out_channels * sizeof(float));
+    layer->bias = (float*)malloc(layer->out_channels * sizeof(float));
+    layer->multipliers = (float*)malloc(layer->out_channels * sizeof(float));
+    layer->offsets = (float*)malloc(layer->out_channels * sizeof(float));
+    if (!layer->weights || !layer->weight_scales || !layer->bias || !layer->multipliers || !layer->offsets) {
+        log_message(NL_LOG_ERROR, "Failed to allocate layer weights");
+        return -1;
+    }
+
+    // y = in_scale * w_scale * (acc - zero_point * sum(w)) + bias, in output steps
+    float out_scale = last ? 1.0f : layer->output_scale;
+    const uint8_t *scales = buffer + *offset + weight_bytes;
+    const uint8_t *bias = scales + 4 * layer->out_channels;
+    for (size_t o = 0; o < layer->out_channels; o++) {
+        int8_t *row = layer->weights + o * layer->row_bytes;
+        memcpy(row, buffer + *offset + o * window, window);
+        int32_t sum = 0;
+        for (size_t k = 0; k < window; k++) {
+            sum += row[k];
+        }
+        layer->weight_scales[o] = load_le_f32(scales + 4 * o);
+        layer->bias[o] = load_le_f32(bias + 4 * o);
+        if (!isfinite(layer->weight_scales[o]) || !isfinite(layer->bias[o])) {
+            return -1;
+        }
+        float step = in_scale * layer->weight_scales[o];
+        layer->multipliers[o] = step / out_scale;
+        layer->offsets[o] = (layer->bias[o] - step * (float)in_zero_point * (float)sum) / out_scale;
+    }
+    *offset += weight_bytes + 8 * layer->out_channels;
+    return 0;
+}
+
+/**
+ * Read a network from a model file
+ */
+CNNModel* cnn_load(const char *path) {
+    if (!path) {
+        log_message(NL_LOG_ERROR, "Invalid network model path");
+        return NULL;
+    }
+
+    uint8_t *buffer = NULL;
+    size_t size = 0;
+    if (read_file(path, &buffer, &size) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to read network model: %s", path);
+        return NULL;
+    }
+
+    uint32_t stored_crc = size >= CNN_FILE_HEADER_SIZE ? load_le32(buffer + 12) : 0;
+    if (size >= CNN_FILE_HEADER_SIZE) {
+        store_le32(buffer + 12, 0);
+    }
+
+    uint32_t num_layers = size >= CNN_FILE_HEADER_SIZE ? load_le32(buffer + 8) : 0;
+    uint32_t channels = size >= CNN_FILE_HEADER_SIZE ? load_le32(buffer + 16) : 0;
+    uint32_t samples = size >= CNN_FILE_HEADER_SIZE ? load_le32(buffer + 20) : 0;
+    float input_scale = size >= CNN_FILE_HEADER_SIZE ? load_le_f32(buffer + 24) : 0.0f;
+    if (size < CNN_FILE_HEADER_SIZE || load_le32(buffer) != CNN_FILE_MAGIC ||
+        load_le16(buffer + 4) != CNN_FILE_VERSION || load_le16(buffer + 6) != CNN_FILE_HEADER_SIZE ||
+        num_layers == 0 || num_layers > CNN_MAX_LAYERS || channels == 0 || channels > CNN_MAX_CHANNELS ||
+        samples == 0 || samples > CNN_MAX_SAMPLES || !(input_scale > 0.0f && isfinite(input_scale)) ||
+        crc32_update(0, buffer, size) != stored_crc) {
+        log_message(NL_LOG_ERROR, "Corrupt or incompatible network model: %s", path);
+        free(buffer);
+        return NULL;
+    }
+
+    CNNModel *model = (CNNModel*)calloc(1, sizeof(CNNModel));
+    if (model) {
+        model->layers = (CNNLayer*)calloc(num_layers, sizeof(CNNLayer));
+    }
+    if (!model || !model->layers) {
+        log_message(NL_LOG_ERROR, "Failed to allocate network model");
+        free(model);
+        free(buffer);
+        return NULL;
+    }
+
+    model->input_channels = channels;
+    model->input_samples = samples;
+    model->input_scale = input_scale;
+    model->num_layers = num_layers;
+    model->max_activation = (size_t)channels * samples;
+
+    // Walk the shapes through the network as the layers are read
+    size_t offset = CNN_FILE_HEADER_SIZE;
+    size_t length = samples;
+    float scale = input_scale;
+    int zero_point = CNN_SIGNED_ZERO_POINT;
+    int failed = 0;
+    for (size_t l = 0; l < num_layers && !failed; l++) {
+        CNNLayer *layer = &model->layers[l];
+        failed = load_layer(layer, buffer, size, &offset, channels, length, scale, zero_point,
+                            l + 1 == num_layers) != 0;
+        if (failed) {
+            log_message(NL_LOG_ERROR, "Invalid layer %zu in network model: %s", l, path);
+            break;
+        }
+
+        size_t values = layer->out_length * layer->out_channels;
+        if (values > model->max_activation) {
+            model->max_activation = values;
+        }
+        if (layer->type == CNN_LAYER_CONV1D) {
+            if (values > model->max_accumulators) {
+                model->max_accumulators = values;
+            }
+            scale = layer->output_scale;
+            zero_point = output_zero_point(layer);
+        }
+        channels = layer->out_channels;
+        length = layer->out_length;
+    }
+
+    if (!failed && offset != size) {
+        log_message(NL_LOG_ERROR, "Trailing data in network model: %s", path);
+        failed = 1;
+    }
+    free(buffer);
+    if (failed) {
+        cnn_free(model);
+        return NULL;
+    }
+
+    model->output_size = length * channels;
+    log_message(NL_LOG_INFO, "Loaded %zu-layer network (%zu x %zu in, %zu out) from %s",
+                model->num_layers, model->input_channels, model->input_samples, model->output_size, path);
+    return model;
+}
+
+/**
+ * Free a network
+ */
+void cnn_free(CNNModel *model) {
+    if (!model) {
+        return;
+    }
+    for (size_t l = 0; model->layers && l < model->num_layers; l++) {
+        CNNLayer *layer = &model->layers[l];
+        free(layer->weights);
+        free(layer->weight_scales);
+        free(layer->bias);
+        free(layer->multipliers);
+        free(layer->offsets);
+    }
+    free(model->layers);
+    free(model);
+}
+
+/**
+ * Convolution: one u8 x s8 product over in-place windows, then requantize
+ */
+static void run_conv(const CNNLayer *layer, const uint8_t *in, int32_t *acc, uint8_t *out, float *embedding) {
+    gemm_u8s8(in, layer->out_length, layer->stride * layer->in_channels, layer->weights,
+              layer->out_channels, layer->row_bytes, layer->row_bytes, acc);
+
+    int relu = (layer->flags & CNN_LAYER_RELU) != 0;
+    int zero_point = output_zero_point(layer);
+    for (size_t t = 0; t < layer->out_length; t++) {
+        const int32_t *row = acc + t * layer->out_channels;
+        for (size_t o = 0; o < layer->out_channels; o++) {
+            float y = (float)row[o] * layer->multipliers[o] + layer->offsets[o];
+            if (relu && y < 0.0f) {
+                y = 0.0f;
+            }
+            if (embedding) {
+                embedding[t * layer->out_channels + o] = y;
+                continue;
+            }
+            long q = lrintf(y) + zero_point;
+            out[t * layer->out_channels + o] = (uint8_t)(q < 0 ? 0 : q > 127 ? 127 : q);
+        }
+    }
+}
+
+/**
+ * Pooling on the quantized values (both commute with the affine dequantization)
+ */
+static void run_pool(const CNNLayer *layer, const uint8_t *in, uint8_t *out) {
+    size_t channels = layer->in_channels;
+    for (size_t t = 0; t < layer->out_length; t++) {
+        const uint8_t *window = in + t * layer->stride * channels;
+        for (size_t c = 0; c < channels; c++) {
+            uint32_t value = layer->type == CNN_LAYER_MAXPOOL ? 0 : (uint32_t)(layer->kernel / 2);
+            for (size_t k = 0; k < layer->kernel; k++) {
+                uint8_t v = window[k * channels + c];
+                if (layer->type == CNN_LAYER_MAXPOOL) {
+                    value = v > value ? v : value;
+                } else {
+                    value += v;
+                }
+            }
+            out[t * channels + c] = (uint8_t)(layer->type == CNN_LAYER_MAXPOOL ? value : value / layer->kernel);
+        }
+    }
+}
+
+/**
+ * Run the network on a preprocessed EEG window
+ */
+int cnn_embed(const CNNModel *model, const EEGData *data, float *embedding) {
+    if (!model || !data || !data->data || !embedding || data->num_channels != model->input_channels ||
+        data->num_samples < model->input_samples) {
+        log_message(NL_LOG_ERROR, "Invalid input for network inference");
+        return -1;
+    }
+
+    size_t buffer_size = model->max_activation + CNN_ACTIVATION_SLACK;
+    uint8_t *ping = (uint8_t*)calloc(buffer_size, 1);
+    uint8_t *pong = (uint8_t*)calloc(buffer_size, 1);
+    int32_t *acc = (int32_t*)malloc((model->max_accumulators > 0 ? model->max_accumulators : 1) * sizeof(int32_t));
+    if (!ping || !pong || !acc) {
+        log_message(NL_LOG_ERROR, "Failed to allocate inference buffers");
+        free(ping);
+        free(pong);
+        free(acc);
+        return -1;
+    }
+
+    // Quantize channel-major samples into channels-last 7-bit codes
+    float inverse = 1.0f / model->input_scale;
+    size_t channels = model->input_channels;
+    for (size_t c = 0; c < channels; c++) {
+        const float *signal = data->data + c * data->num_samples;
+        for (size_t t = 0; t < model->input_samples; t++) {
+            long q = lrintf(signal[t] * inverse);
+            q = q < -CNN_SIGNED_ZERO_POINT ? -CNN_SIGNED_ZERO_POINT : q > 127 - CNN_SIGNED_ZERO_POINT ?
+                127 - CNN_SIGNED_ZERO_POINT : q;
+            ping[t * channels + c] = (uint8_t)(q + CNN_SIGNED_ZERO_POINT);
+        }
+    }
+
+    for (size_t l = 0; l < model->num_layers; l++) {
+        const CNNLayer *layer = &model->layers[l];
+        if (layer->type == CNN_LAYER_CONV1D) {
+            run_conv(layer, ping, acc, pong, l + 1 == model->num_layers ? embedding : NULL);
+        } else {
+            run_pool(layer, ping, pong);
+        }
+        uint8_t *swap = ping;
+        ping = pong;
+        pong = swap;
+    }
+
+    secure_wipe(ping, buffer_size);
+    secure_wipe(pong, buffer_size);
+    free(ping);
+    free(pong);
+    free(acc);
+    return 0;
+}
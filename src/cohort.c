@@ -0,0 +1,369 @@
+#define _DEFAULT_SOURCE
+#include "cohort.h"
+#include "vector_ops.h"
+#include "hashing.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Cohort file layout (little-endian):
+ *   offset  field          type  notes
+ *    0      magic          u32   COHORT_FILE_MAGIC
+ *    4      version        u16   COHORT_FILE_VERSION
+ *    6      header_size    u16   COHORT_FILE_HEADER_SIZE
+ *    8      rows           u32
+ *   12      crc32          u32   CRC of the whole file with this field taken as zero
+ *   16      dim            u32
+ *   20      reserved       12 bytes, zero
+ * followed by rows x { username[64], float32[dim] unit-norm features }.
+ */
+#define COHORT_ROW_SIZE(dim) (64 + (size_t)(dim) * 4)
+
+/* Visitor state for cohort_build */
+typedef struct {
+    TemplateMatrix *cohort;
+    size_t step;                    // Take every step-th record
+    size_t seen;
+    size_t row;
+} SampleContext;
+
+static int sample_record(const TemplateRecord *record, void *ctx) {
+    SampleContext *sample = (SampleContext*)ctx;
+    TemplateMatrix *m = sample->cohort;
+
+    if (sample->row >= m->num_templates) {
+        return 1;
+    }
+    if (sample->seen++ % sample->step != 0 || record->feature_count != m->dim) {
+        return 0;
+    }
+
+    vector_normalize(record->features, m->matrix + sample->row * m->stride, m->dim);
+    memcpy(m->usernames[sample->row], record->username, 64);
+    m->usernames[sample->row][63] = '\0';
+    m->task_types[sample->row] = (MentalTask)record->task_type;
+    sample->row++;
+    return 0;
+}
+
+/**
+ * Sample evenly spaced templates from the database into a cohort
+ */
+TemplateMatrix* cohort_build(TemplateDB *db, size_t size) {
+    if (!db || size < 2) {
+        log_message(NL_LOG_ERROR, "Invalid input for cohort build");
+        return NULL;
+    }
+
+    size_t count = template_db_count(db);
+    if (count < 2) {
+        log_message(NL_LOG_ERROR, "Need at least 2 enrolled users to build a cohort (have %zu)", count);
+        return NULL;
+    }
+
+    TemplateMatrix *cohort = template_matrix_alloc(size < count ? size : count, FEATURE_VECTOR_SIZE);
+    if (!cohort) {
+        return NULL;
+    }
+
+    SampleContext sample = { cohort, count > size ? count / size : 1, 0, 0 };
+    template_db_foreach(db, sample_record, &sample);
+    cohort->num_templates = sample.row;
+
+    if (cohort->num_templates < 2) {
+        log_message(NL_LOG_ERROR, "Too few usable templates for a cohort (%zu)", cohort->num_templates);
+        template_matrix_free(cohort);
+        return NULL;
+    }
+
+    log_message(NL_LOG_INFO, "Sampled %zu of %zu templates into the cohort", cohort->num_templates, count);
+    return cohort;
+}
+
+/**
+ * Write a cohort to a file
+ */
+int cohort_save(const TemplateMatrix *cohort, const char *path) {
+    if (!cohort || !cohort->matrix || !path) {
+        log_message(NL_LOG_ERROR, "Invalid input for cohort save");
+        return -1;
+    }
+
+    size_t size = COHORT_FILE_HEADER_SIZE + cohort->num_templates * COHORT_ROW_SIZE(cohort->dim);
+    uint8_t *buffer = (uint8_t*)calloc(1, size);
+    if (!buffer) {
+        log_message(NL_LOG_ERROR, "Failed to allocate cohort buffer (%zu bytes)", size);
+        return -1;
+    }
+
+    store_le32(buffer, COHORT_FILE_MAGIC);
+    store_le16(buffer + 4, COHORT_FILE_VERSION);
+    store_le16(buffer + 6, COHORT_FILE_HEADER_SIZE);
+    store_le32(buffer + 8, (uint32_t)cohort->num_templates);
+    store_le32(buffer + 16, (uint32_t)cohort->dim);
+
+    uint8_t *p = buffer + COHORT_FILE_HEADER_SIZE;
+    for (size_t r = 0; r < cohort->num_templates; r++) {
+        memcpy(p, cohort->usernames[r], 64);
+        p += 64;
+        const float *row = cohort->matrix + r * cohort->stride;
+        for (size_t c = 0; c < cohort->dim; c++, p += 4) {
+            store_le_f32(p, row[c]);
+        }
+    }
+    store_le32(buffer + 12, crc32_update(0, buffer, size));
+
+    // Temp file + rename so readers never see a half-written cohort
+    char tmp_path[520];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        log_message(NL_LOG_ERROR, "Cohort path too long: %s", path);
+        secure_wipe(buffer, size);
+        free(buffer);
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open file for writing: %s", tmp_path);
+        secure_wipe(buffer, size);
+        free(buffer);
+        return -1;
+    }
+
+    ssize_t written = pwrite(fd, buffer, size, 0);
+    int sync_result = fsync(fd);
+    int close_result = close(fd);
+    secure_wipe(buffer, size);
+    free(buffer);
+
+    if (written != (ssize_t)size || sync_result != 0 || close_result != 0 ||
+        rename(tmp_path, path) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to write cohort: %s", path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (sync_parent_directory(path) != 0) {
+        log_message(NL_LOG_WARNING, "Failed to sync cohort directory for: %s", path);
+    }
+
+    log_message(NL_LOG_INFO, "Saved %zu-row cohort to %s", cohort->num_templates, path);
+    return 0;
+}
+
+/**
+ * Read a cohort written by cohort_save
+ */
+TemplateMatrix* cohort_load(const char *path) {
+    if (!path) {
+        log_message(NL_LOG_ERROR, "Invalid cohort path");
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open cohort: %s", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < COHORT_FILE_HEADER_SIZE ||
+        st.st_size > (off_t)(COHORT_FILE_HEADER_SIZE + (size_t)UINT32_MAX)) {
+        log_message(NL_LOG_ERROR, "Invalid cohort file size: %s", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    uint8_t *buffer = (uint8_t*)malloc(size);
+    if (!buffer) {
+        log_message(NL_LOG_ERROR, "Failed to allocate cohort buffer (%zu bytes)", size);
+        close(fd);
+        return NULL;
+    }
+
+    ssize_t got = pread(fd, buffer, size, 0);
+    close(fd);
+    if (got != (ssize_t)size) {
+        log_message(NL_LOG_ERROR, "Failed to read cohort: %s", path);
+        free(buffer);
+        return NULL;
+    }
+
+    uint32_t rows = load_le32(buffer + 8);
+    uint32_t dim = load_le32(buffer + 16);
+    uint32_t stored_crc = load_le32(buffer + 12);
+    store_le32(buffer + 12, 0);
+
+    if (load_le32(buffer) != COHORT_FILE_MAGIC || load_le16(buffer + 4) != COHORT_FILE_VERSION ||
+        load_le16(buffer + 6) != COHORT_FILE_HEADER_SIZE || dim != FEATURE_VECTOR_SIZE || rows < 2 ||
+        size != COHORT_FILE_HEADER_SIZE + (size_t)rows * COHORT_ROW_SIZE(dim) ||
+        crc32_update(0, buffer, size) != stored_crc) {
+        log_message(NL_LOG_ERROR, "Corrupt or incompatible cohort file: %s", path);
+        secure_wipe(buffer, size);
+        free(buffer);
+        return NULL;
+    }
+
+    TemplateMatrix *cohort = template_matrix_alloc(rows, dim);
+    if (!cohort) {
+        secure_wipe(buffer, size);
+        free(buffer);
+        return NULL;
+    }
+
+    const uint8_t *p = buffer + COHORT_FILE_HEADER_SIZE;
+    for (size_t r = 0; r < rows; r++) {
+        memcpy(cohort->usernames[r], p, 64);
+        cohort->usernames[r][63] = '\0';
+        p += 64;
+        float *row = cohort->matrix + r * cohort->stride;
+        for (size_t c = 0; c < dim; c++, p += 4) {
+            row[c] = load_le_f32(p);
+        }
+    }
+
+    secure_wipe(buffer, size);
+    free(buffer);
+    return cohort;
+}
+
+/** Mean and floored standard deviation of the scores not marked skipped */
+static int score_moments(const float *scores, size_t count, size_t skip, float *mean, float *std) {
+    double sum = 0.0, sum_sq = 0.0;
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == skip) {
+            continue;
+        }
+        sum += scores[i];
+        sum_sq += (double)scores[i] * scores[i];
+        n++;
+    }
+    if (n < 2) {
+        log_message(NL_LOG_ERROR, "Too few cohort scores for normalization (%zu)", n);
+        return -1;
+    }
+
+    double mu = sum / n;
+    double var = sum_sq / n - mu * mu;
+    double sigma = var > 0.0 ? sqrt(var) : 0.0;
+    *mean = (float)mu;
+    *std = sigma > COHORT_MIN_STD ? (float)sigma : (float)COHORT_MIN_STD;
+    return 0;
+}
+
+/** Row owned by username, or SIZE_MAX */
+static size_t cohort_find(const TemplateMatrix *cohort, const char *username) {
+    if (username) {
+        for (size_t r = 0; r < cohort->num_templates; r++) {
+            if (strncmp(cohort->usernames[r], username, 64) == 0) {
+                return r;
+            }
+        }
+    }
+    return SIZE_MAX;
+}
+
+/**
+ * Compute a template's Z-norm statistics against the cohort
+ */
+int cohort_znorm(const TemplateMatrix *cohort, const Template *template, float *mean, float *std) {
+    if (!cohort || !cohort->matrix || !template || !template->features || !mean || !std ||
+        template->features->size != cohort->dim) {
+        log_message(NL_LOG_ERROR, "Invalid input for Z-norm statistics");
+        return -1;
+    }
+
+    float *scores = (float*)malloc(cohort->num_templates * sizeof(float));
+    if (!scores) {
+        log_message(NL_LOG_ERROR, "Failed to allocate cohort scores");
+        return -1;
+    }
+
+    // Each cohort row plays an impostor probe against this template
+    FeatureVector view = { NULL, cohort->dim, template->task_type, 0 };
+    for (size_t r = 0; r < cohort->num_templates; r++) {
+        view.features = cohort->matrix + r * cohort->stride;
+        scores[r] = template_similarity(template, &view);
+    }
+
+    int result = score_moments(scores, cohort->num_templates,
+                               cohort_find(cohort, template->username), mean, std);
+    free(scores);
+    return result;
+}
+
+/**
+ * Compute a probe's T-norm statistics against the cohort
+ */
+int cohort_tnorm(const TemplateMatrix *cohort, const FeatureVector *probe, const char *exclude,
+                 float *mean, float *std) {
+    if (!cohort || !cohort->matrix || !probe || !probe->features || !mean || !std ||
+        probe->size != cohort->dim) {
+        log_message(NL_LOG_ERROR, "Invalid input for T-norm statistics");
+        return -1;
+    }
+
+    float *unit = (float*)malloc((cohort->stride + cohort->num_templates) * sizeof(float));
+    if (!unit) {
+        log_message(NL_LOG_ERROR, "Failed to allocate cohort scores");
+        return -1;
+    }
+    float *scores = unit + cohort->stride;
+
+    // Rows are unit-norm, so one matvec against the unit probe gives every cosine
+    if (vector_normalize(probe->features, unit, cohort->dim) <= 0.0f) {
+        free(unit);
+        return -1;
+    }
+    matvec_f32(cohort->matrix, cohort->num_templates, cohort->dim, cohort->stride, unit, scores);
+
+    // Same clamp as calculate_similarity so Z and T live on one scale
+    for (size_t r = 0; r < cohort->num_templates; r++) {
+        scores[r] = scores[r] < 0.0f ? 0.0f : (scores[r] > 1.0f ? 1.0f : scores[r]);
+    }
+
+    int result = score_moments(scores, cohort->num_templates, cohort_find(cohort, exclude), mean, std);
+    free(unit);
+    return result;
+}
+
+/**
+ * Normalize a raw similarity
+ */
+int cohort_normalize(const TemplateMatrix *cohort, const Template *template, const FeatureVector *probe,
+                     float raw, ScoreNorm rule, float *normalized) {
+    if (!cohort || !template || !probe || !normalized || rule == SCORE_NORM_NONE) {
+        log_message(NL_LOG_ERROR, "Invalid input for score normalization");
+        return -1;
+    }
+
+    float z = 0.0f, t = 0.0f;
+
+    if (rule == SCORE_NORM_Z || rule == SCORE_NORM_S) {
+        float mean = template->znorm_mean, std = template->znorm_std;
+        if (std <= 0.0f && cohort_znorm(cohort, template, &mean, &std) != 0) {
+            return -1;
+        }
+        z = (raw - mean) / std;
+    }
+
+    if (rule == SCORE_NORM_T || rule == SCORE_NORM_S) {
+        float mean, std;
+        if (cohort_tnorm(cohort, probe, template->username, &mean, &std) != 0) {
+            return -1;
+        }
+        t = (raw - mean) / std;
+    }
+
+    *normalized = rule == SCORE_NORM_S ? 0.5f * (z + t) : (rule == SCORE_NORM_Z ? z : t);
+    return 0;
+}
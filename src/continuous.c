@@ -0,0 +1,336 @@
+#define _DEFAULT_SOURCE
+#include "continuous.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define WINDOW_SAMPLES ((size_t)SAMPLING_RATE * CAPTURE_DURATION)
+#define NUM_BANDS 5
+
+#if WINDOW_SIZE > SAMPLING_RATE * CAPTURE_DURATION
+#error "WINDOW_SIZE must fit in a CAPTURE_DURATION window"
+#endif
+
+/* Band edges, turned into bins exactly as extract_band_power() does */
+static const double band_edges[NUM_BANDS][2] = {
+    {DELTA_LOW, DELTA_HIGH}, {THETA_LOW, THETA_HIGH}, {ALPHA_LOW, ALPHA_HIGH},
+    {BETA_LOW, BETA_HIGH}, {GAMMA_LOW, GAMMA_HIGH}
+};
+
+struct ContinuousMonitor {
+    const Template *template;
+    const MahalanobisModel *whitening;
+    const TemplateMatrix *cohort;
+    size_t cadence;                 // Frames between scores
+    size_t band_lo[NUM_BANDS];      // Bins [band_lo, band_hi) of each band
+    size_t band_hi[NUM_BANDS];
+    size_t bins;                    // Bins tracked, from 0 to the highest band edge
+    float *ring;                    // [NUM_CHANNELS][WINDOW_SAMPLES] current window
+    size_t head;                    // Oldest sample, overwritten by the next one
+    size_t filled;
+    size_t since_score;             // Frames pushed since the last score
+    double sum[NUM_CHANNELS];       // Running sum and sum of squares over the window
+    double sumsq[NUM_CHANNELS];
+    double *re;                     // [NUM_CHANNELS][bins] DFT of the window's first WINDOW_SIZE samples
+    double *im;
+    double *cos_table;              // [WINDOW_SIZE] cos(2 pi m / WINDOW_SIZE)
+    double *sin_table;
+    double *segment;                // [WINDOW_SIZE] resync scratch
+    FeatureVector *probe;
+    EEGData *scratch;               // Window copy for the embedding network, allocated on demand
+    ContinuousStats stats;
+};
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Recompute the running sums and the DFT bins from the window
+ */
+static void resync(ContinuousMonitor *monitor) {
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        const float *x = monitor->ring + ch * WINDOW_SAMPLES;
+        double sum = 0.0, sumsq = 0.0;
+        for (size_t n = 0; n < WINDOW_SAMPLES; n++) {
+            sum += x[n];
+            sumsq += (double)x[n] * x[n];
+        }
+        monitor->sum[ch] = sum;
+        monitor->sumsq[ch] = sumsq;
+
+        for (size_t n = 0; n < WINDOW_SIZE; n++) {
+            monitor->segment[n] = x[(monitor->head + n) % WINDOW_SAMPLES];
+        }
+        double *re = monitor->re + ch * monitor->bins;
+        double *im = monitor->im + ch * monitor->bins;
+        for (size_t k = 0; k < monitor->bins; k++) {
+            double real = 0.0, imag = 0.0;
+            size_t phase = 0;
+            for (size_t n = 0; n < WINDOW_SIZE; n++) {
+                real += monitor->segment[n] * monitor->cos_table[phase];
+                imag -= monitor->segment[n] * monitor->sin_table[phase];
+                phase = (phase + k) % WINDOW_SIZE;
+            }
+            re[k] = real;
+            im[k] = imag;
+        }
+    }
+}
+
+/**
+ * Slide the window by one frame
+ */
+static void push_frame(ContinuousMonitor *monitor, const float *frame) {
+    int full = monitor->filled == WINDOW_SAMPLES;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        float *x = monitor->ring + ch * WINDOW_SAMPLES;
+        float in = frame[ch];
+        if (full) {
+            // The DFT segment loses the oldest sample and gains the one WINDOW_SIZE later
+            float out = x[monitor->head];
+            float enter = WINDOW_SIZE < WINDOW_SAMPLES ? x[(monitor->head + WINDOW_SIZE) % WINDOW_SAMPLES] : in;
+            monitor->sum[ch] += (double)in - out;
+            monitor->sumsq[ch] += (double)in * in - (double)out * out;
+
+            double delta = (double)enter - out;
+            double *re = monitor->re + ch * monitor->bins;
+            double *im = monitor->im + ch * monitor->bins;
+            for (size_t k = 0; k < monitor->bins; k++) {
+                double real = re[k] + delta;
+                re[k] = real * monitor->cos_table[k] - im[k] * monitor->sin_table[k];
+                im[k] = real * monitor->sin_table[k] + im[k] * monitor->cos_table[k];
+            }
+        } else {
+            monitor->sum[ch] += in;
+            monitor->sumsq[ch] += (double)in * in;
+        }
+        x[monitor->head] = in;
+    }
+
+    if (!full) {
+        monitor->filled++;
+    }
+    monitor->head = (monitor->head + 1) % WINDOW_SAMPLES;
+
+    // Once per window length: the first time the window fills, then against drift
+    if (monitor->head == 0) {
+        resync(monitor);
+    }
+}
+
+/**
+ * Band powers of the normalized window, from the running state
+ */
+static void band_features(const ContinuousMonitor *monitor, FeatureVector *output) {
+    size_t feature_idx = 0;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        // Normalizing only rescales the bins and removes the mean from bin 0
+        double mean = monitor->sum[ch] / (double)WINDOW_SAMPLES;
+        double variance = monitor->sumsq[ch] / (double)WINDOW_SAMPLES - mean * mean;
+        double std_dev = variance > 0.0 ? sqrt(variance) : 0.0;
+        if (std_dev < 1e-6) {
+            std_dev = 1.0;
+        }
+        double scale = 1.0 / (std_dev * std_dev);
+
+        const double *re = monitor->re + ch * monitor->bins;
+        const double *im = monitor->im + ch * monitor->bins;
+        for (size_t b = 0; b < NUM_BANDS && feature_idx < output->size; b++) {
+            double power = 0.0;
+            for (size_t k = monitor->band_lo[b]; k < monitor->band_hi[b]; k++) {
+                double real = k == 0 ? re[k] - mean * WINDOW_SIZE : re[k];
+                power += real * real + im[k] * im[k];
+            }
+            output->features[feature_idx++] = (float)(power * scale);
+        }
+    }
+}
+
+static int window_features(ContinuousMonitor *monitor, FeatureVector *output) {
+    if (monitor->filled < WINDOW_SAMPLES) {
+        return -1;
+    }
+
+    if (!CNN_EMBEDDING) {
+        band_features(monitor, output);
+        output->task_type = monitor->template->task_type;
+        output->timestamp = get_timestamp_ms();
+        return 0;
+    }
+
+    // The network needs the samples themselves, oldest first
+    if (!monitor->scratch) {
+        monitor->scratch = eeg_data_alloc(NUM_CHANNELS, WINDOW_SAMPLES);
+        if (!monitor->scratch) {
+            log_message(NL_LOG_ERROR, "Failed to allocate window copy");
+            return -1;
+        }
+        monitor->scratch->sampling_rate = SAMPLING_RATE;
+    }
+    size_t older = WINDOW_SAMPLES - monitor->head;
+    for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+        const float *x = monitor->ring + ch * WINDOW_SAMPLES;
+        float *copy = monitor->scratch->data + ch * WINDOW_SAMPLES;
+        memcpy(copy, x + monitor->head, older * sizeof(float));
+        memcpy(copy + older, x, monitor->head * sizeof(float));
+    }
+    monitor->scratch->task_type = monitor->template->task_type;
+    return extract_features(monitor->scratch, output);
+}
+
+static int score_window(ContinuousMonitor *monitor) {
+    AuthResult result;
+    AuthMatcher matcher;
+    if (window_features(monitor, monitor->probe) != 0 ||
+        auth_verify_features(monitor->probe, monitor->template, monitor->whitening, monitor->cohort,
+                             &result, &matcher) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to score window for %s", monitor->template->username);
+        return -1;
+    }
+
+    ContinuousStats *stats = &monitor->stats;
+    stats->windows++;
+    stats->last = result;
+    stats->matcher = matcher;
+    if (result.authenticated) {
+        stats->low_streak = 0;
+        return CONTINUOUS_ACCEPTED;
+    }
+
+    stats->rejected++;
+    stats->low_streak++;
+    if (!stats->deauthenticated && stats->low_streak >= CONTINUOUS_DEAUTH_WINDOWS) {
+        stats->deauthenticated = 1;
+        log_message(NL_LOG_WARNING, "De-authenticating %s: %u windows in a row below threshold",
+                   monitor->template->username, stats->low_streak);
+        return CONTINUOUS_DEAUTH;
+    }
+    return CONTINUOUS_LOW;
+}
+
+/**
+ * Start monitoring a wearer
+ */
+ContinuousMonitor* continuous_create(const Template *template, const MahalanobisModel *whitening,
+                                     const TemplateMatrix *cohort, uint32_t cadence_ms) {
+    if (!template || !template->features) {
+        log_message(NL_LOG_ERROR, "Invalid template for continuous authentication");
+        return NULL;
+    }
+
+    ContinuousMonitor *monitor = (ContinuousMonitor*)calloc(1, sizeof(ContinuousMonitor));
+    if (!monitor) {
+        log_message(NL_LOG_ERROR, "Failed to allocate continuous monitor");
+        return NULL;
+    }
+    monitor->template = template;
+    monitor->whitening = whitening;
+    monitor->cohort = cohort;
+    if (cadence_ms == 0) {
+        cadence_ms = CONTINUOUS_CADENCE_MS;
+    }
+    monitor->cadence = (size_t)cadence_ms * SAMPLING_RATE / 1000;
+    if (monitor->cadence == 0) {
+        monitor->cadence = 1;
+    }
+
+    float freq_resolution = (float)SAMPLING_RATE / (float)WINDOW_SIZE;
+    for (size_t b = 0; b < NUM_BANDS; b++) {
+        size_t lo = (size_t)(band_edges[b][0] / freq_resolution);
+        size_t hi = (size_t)(band_edges[b][1] / freq_resolution);
+        monitor->band_hi[b] = hi < WINDOW_SIZE / 2 ? hi : WINDOW_SIZE / 2;
+        monitor->band_lo[b] = lo < monitor->band_hi[b] ? lo : monitor->band_hi[b];
+        if (monitor->band_hi[b] > monitor->bins) {
+            monitor->bins = monitor->band_hi[b];
+        }
+    }
+
+    monitor->ring = (float*)calloc(NUM_CHANNELS * WINDOW_SAMPLES, sizeof(float));
+    monitor->re = (double*)calloc(NUM_CHANNELS * monitor->bins + 1, sizeof(double));
+    monitor->im = (double*)calloc(NUM_CHANNELS * monitor->bins + 1, sizeof(double));
+    monitor->cos_table = (double*)malloc(WINDOW_SIZE * sizeof(double));
+    monitor->sin_table = (double*)malloc(WINDOW_SIZE * sizeof(double));
+    monitor->segment = (double*)malloc(WINDOW_SIZE * sizeof(double));
+    monitor->probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    if (!monitor->ring || !monitor->re || !monitor->im || !monitor->cos_table || !monitor->sin_table ||
+        !monitor->segment || !monitor->probe) {
+        log_message(NL_LOG_ERROR, "Failed to allocate continuous monitor");
+        continuous_free(monitor);
+        return NULL;
+    }
+    for (size_t m = 0; m < WINDOW_SIZE; m++) {
+        double angle = 2.0 * M_PI * (double)m / (double)WINDOW_SIZE;
+        monitor->cos_table[m] = cos(angle);
+        monitor->sin_table[m] = sin(angle);
+    }
+    return monitor;
+}
+
+/**
+ * Free a monitor
+ */
+void continuous_free(ContinuousMonitor *monitor) {
+    if (!monitor) {
+        return;
+    }
+    free(monitor->ring);
+    free(monitor->re);
+    free(monitor->im);
+    free(monitor->cos_table);
+    free(monitor->sin_table);
+    free(monitor->segment);
+    feature_vector_free(monitor->probe);
+    eeg_data_free(monitor->scratch);
+    free(monitor);
+}
+
+/**
+ * Feed samples, re-scoring if a cadence has passed since the last score
+ */
+int continuous_push(ContinuousMonitor *monitor, const float *frames, size_t count) {
+    if (!monitor || (!frames && count > 0)) {
+        log_message(NL_LOG_ERROR, "Invalid input for continuous authentication");
+        return -1;
+    }
+
+    uint64_t start = thread_cpu_ns();
+    for (size_t i = 0; i < count; i++) {
+        push_frame(monitor, frames + i * NUM_CHANNELS);
+    }
+    monitor->stats.samples += count;
+    monitor->since_score += count;
+
+    // A backlog is scored once, on its latest window
+    int event = CONTINUOUS_IDLE;
+    if (monitor->filled == WINDOW_SAMPLES && monitor->since_score >= monitor->cadence) {
+        monitor->since_score = 0;
+        event = score_window(monitor);
+    }
+    monitor->stats.busy_ns += thread_cpu_ns() - start;
+    return event;
+}
+
+/**
+ * Features of the current window
+ */
+int continuous_features(ContinuousMonitor *monitor, FeatureVector *output) {
+    if (!monitor || !output || !output->features || output->size < FEATURE_VECTOR_SIZE) {
+        log_message(NL_LOG_ERROR, "Invalid input for continuous features");
+        return -1;
+    }
+    return window_features(monitor, output);
+}
+
+/**
+ * Counters and the latest decision
+ */
+void continuous_stats(const ContinuousMonitor *monitor, ContinuousStats *stats) {
+    if (monitor && stats) {
+        *stats = monitor->stats;
+    }
+}
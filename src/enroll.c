@@ -0,0 +1,261 @@
+#include "enroll.h"
+#include "scheduler.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* One submitted trial */
+typedef struct {
+    EnrollSession *session;
+    EEGData *data;                  // Freed once extracted
+    FeatureVector *features;        // Kept while accepted
+    int extracted;                  // 0 pending, 1 extracted, -1 failed
+    EnrollTrialStatus status;
+    float consistency;
+} EnrollTrial;
+
+struct EnrollSession {
+    char username[64];
+    MentalTask task;
+    TaskGroup *group;               // NULL: trials are extracted on submit
+    pthread_mutex_t lock;           // Guards everything below
+    EnrollTrial *trials;            // [max_trials]
+    size_t max_trials;
+    size_t submitted;
+    size_t folded;                  // Trials [0, folded) have their final status
+    FeatureVector **accepted;       // Accepted trials in order, [max_trials]
+    size_t num_accepted;
+    double *mean;                   // Running mean and sum of squared deviations
+    double *m2;
+    FeatureVector *reference;       // Running mean as floats, for the consistency check
+};
+
+/**
+ * Settle one extracted trial: compare it with the running mean and fold it in
+ */
+static void fold_trial(EnrollSession *session, EnrollTrial *trial) {
+    if (trial->extracted < 0) {
+        trial->status = ENROLL_TRIAL_FAILED;
+        return;
+    }
+
+    size_t dim = trial->features->size;
+    trial->consistency = session->num_accepted > 0 ?
+        calculate_similarity(trial->features, session->reference) : 1.0f;
+    if (trial->consistency < ENROLL_MIN_CONSISTENCY) {
+        log_message(NL_LOG_INFO, "Enrolment trial %zu inconsistent (similarity %.3f)",
+                    (size_t)(trial - session->trials), trial->consistency);
+        feature_vector_free(trial->features);
+        trial->features = NULL;
+        trial->status = ENROLL_TRIAL_INCONSISTENT;
+        return;
+    }
+
+    // Welford update
+    session->accepted[session->num_accepted++] = trial->features;
+    double n = (double)session->num_accepted;
+    for (size_t j = 0; j < dim; j++) {
+        double x = trial->features->features[j];
+        double delta = x - session->mean[j];
+        session->mean[j] += delta / n;
+        session->m2[j] += delta * (x - session->mean[j]);
+        session->reference->features[j] = (float)session->mean[j];
+    }
+    trial->status = ENROLL_TRIAL_ACCEPTED;
+}
+
+static void extract_trial(void *arg) {
+    EnrollTrial *trial = (EnrollTrial*)arg;
+    EnrollSession *session = trial->session;
+
+    FeatureVector *features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    int ok = features && extract_features(trial->data, features) == 0;
+    eeg_data_free(trial->data);
+    trial->data = NULL;
+    if (!ok) {
+        feature_vector_free(features);
+        features = NULL;
+    }
+
+    // Trials are folded in submission order, whichever finishes extracting first
+    pthread_mutex_lock(&session->lock);
+    trial->features = features;
+    trial->extracted = ok ? 1 : -1;
+    while (session->folded < session->submitted && session->trials[session->folded].extracted != 0) {
+        fold_trial(session, &session->trials[session->folded]);
+        session->folded++;
+    }
+    pthread_mutex_unlock(&session->lock);
+}
+
+/**
+ * Start an enrolment session
+ */
+EnrollSession* enroll_session_create(const char *username, MentalTask task, size_t max_trials) {
+    if (!username || max_trials == 0) {
+        log_message(NL_LOG_ERROR, "Invalid input for enrolment session");
+        return NULL;
+    }
+
+    EnrollSession *session = (EnrollSession*)calloc(1, sizeof(EnrollSession));
+    if (!session) {
+        log_message(NL_LOG_ERROR, "Failed to allocate enrolment session");
+        return NULL;
+    }
+    pthread_mutex_init(&session->lock, NULL);
+    strncpy(session->username, username, sizeof(session->username) - 1);
+    session->task = task;
+    session->max_trials = max_trials;
+    session->trials = (EnrollTrial*)calloc(max_trials, sizeof(EnrollTrial));
+    session->accepted = (FeatureVector**)calloc(max_trials, sizeof(FeatureVector*));
+    session->mean = (double*)calloc(FEATURE_VECTOR_SIZE, sizeof(double));
+    session->m2 = (double*)calloc(FEATURE_VECTOR_SIZE, sizeof(double));
+    session->reference = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    if (!session->trials || !session->accepted || !session->mean || !session->m2 || !session->reference) {
+        log_message(NL_LOG_ERROR, "Failed to allocate enrolment session");
+        enroll_session_free(session);
+        return NULL;
+    }
+    session->group = task_group_create(scheduler_shared());
+    return session;
+}
+
+/**
+ * Hand a captured trial over for extraction
+ */
+int enroll_session_submit(EnrollSession *session, EEGData *trial) {
+    if (!session || !trial) {
+        log_message(NL_LOG_ERROR, "Invalid input for enrolment trial");
+        eeg_data_free(trial);
+        return -1;
+    }
+
+    pthread_mutex_lock(&session->lock);
+    if (session->submitted >= session->max_trials) {
+        pthread_mutex_unlock(&session->lock);
+        log_message(NL_LOG_ERROR, "Enrolment session takes at most %zu trials", session->max_trials);
+        eeg_data_free(trial);
+        return -1;
+    }
+    size_t index = session->submitted++;
+    EnrollTrial *slot = &session->trials[index];
+    slot->session = session;
+    slot->data = trial;
+    pthread_mutex_unlock(&session->lock);
+
+    if (session->group) {
+        task_group_spawn(session->group, extract_trial, slot);
+    } else {
+        extract_trial(slot);
+    }
+    return (int)index;
+}
+
+/**
+ * Wait until every submitted trial has been checked
+ */
+void enroll_session_wait(EnrollSession *session) {
+    if (session && session->group) {
+        task_group_wait(session->group);
+    }
+}
+
+/**
+ * State of a submitted trial, without waiting
+ */
+EnrollTrialStatus enroll_session_trial(EnrollSession *session, int index, float *consistency) {
+    if (!session || index < 0) {
+        return ENROLL_TRIAL_FAILED;
+    }
+
+    pthread_mutex_lock(&session->lock);
+    EnrollTrialStatus status = ENROLL_TRIAL_FAILED;
+    if ((size_t)index < session->submitted) {
+        status = session->trials[index].status;
+        if (consistency) {
+            *consistency = session->trials[index].consistency;
+        }
+    }
+    pthread_mutex_unlock(&session->lock);
+    return status;
+}
+
+/**
+ * Number of trials folded into the running statistics
+ */
+size_t enroll_session_accepted(EnrollSession *session) {
+    if (!session) {
+        return 0;
+    }
+    pthread_mutex_lock(&session->lock);
+    size_t accepted = session->num_accepted;
+    pthread_mutex_unlock(&session->lock);
+    return accepted;
+}
+
+/**
+ * Build the template from the accepted trials
+ */
+int enroll_session_finish(EnrollSession *session, Template *output) {
+    if (!session || !output) {
+        log_message(NL_LOG_ERROR, "Invalid input for enrolment");
+        return -1;
+    }
+
+    enroll_session_wait(session);
+    if (session->num_accepted == 0) {
+        log_message(NL_LOG_ERROR, "No consistent enrolment trial for %s", session->username);
+        return -1;
+    }
+
+    FeatureVector *mean = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    FeatureVector *variance = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    if (!mean) {
+        log_message(NL_LOG_ERROR, "Failed to allocate averaged feature vector");
+        feature_vector_free(variance);
+        return -1;
+    }
+    for (size_t j = 0; j < FEATURE_VECTOR_SIZE; j++) {
+        mean->features[j] = (float)session->mean[j];
+        if (variance) {
+            variance->features[j] = (float)(session->m2[j] / (double)session->num_accepted);
+        }
+    }
+    mean->task_type = session->task;
+    mean->timestamp = get_timestamp_ms();
+    if (variance) {
+        variance->task_type = session->task;
+    } else {
+        log_message(NL_LOG_WARNING, "Failed to allocate template variance");
+    }
+
+    log_message(NL_LOG_INFO, "Creating template for user: %s", session->username);
+    return template_from_features(session->username, session->task, (const FeatureVector**)session->accepted,
+                                  session->num_accepted, mean, variance, output);
+}
+
+/**
+ * Free a session, waiting for outstanding trials
+ */
+void enroll_session_free(EnrollSession *session) {
+    if (!session) {
+        return;
+    }
+
+    if (session->group) {
+        task_group_wait(session->group);
+        task_group_free(session->group);
+    }
+    pthread_mutex_destroy(&session->lock);
+    for (size_t i = 0; session->trials && i < session->submitted; i++) {
+        eeg_data_free(session->trials[i].data);
+        feature_vector_free(session->trials[i].features);
+    }
+    free(session->trials);
+    free(session->accepted);
+    free(session->mean);
+    free(session->m2);
+    feature_vector_free(session->reference);
+    free(session);
+}
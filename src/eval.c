@@ -0,0 +1,391 @@
+#define _DEFAULT_SOURCE
+#include "eval.h"
+#include "vector_ops.h"
+#include "utils.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Templates per packed panel; the transposed panel (dim x block) stays in L2 */
+#define EVAL_GALLERY_BLOCK 256
+
+/* Probes per GEMM call; the score tile (rows x block) stays in L1/L2 */
+#define EVAL_PROBE_BLOCK 48
+
+/* Gallery blocks claimed by the scoring tasks */
+typedef struct {
+    const TemplateMatrix *probes;
+    const TemplateMatrix *gallery;
+    const int32_t *labels;          // [probes] gallery row of the probe's owner, -1 if none
+    size_t *next_block;             // Shared block counter
+    size_t num_blocks;
+    size_t bins;
+    uint64_t *genuine;              // Private histograms, merged by the caller
+    uint64_t *impostor;
+    int failed;
+} EvalTask;
+
+/**
+ * Allocate an empty score histogram
+ */
+ScoreHistogram* eval_histogram_alloc(size_t bins) {
+    if (bins < 2) {
+        log_message(NL_LOG_ERROR, "Invalid histogram size: %zu", bins);
+        return NULL;
+    }
+
+    ScoreHistogram *hist = (ScoreHistogram*)calloc(1, sizeof(ScoreHistogram));
+    if (hist) {
+        hist->genuine = (uint64_t*)calloc(bins, sizeof(uint64_t));
+        hist->impostor = (uint64_t*)calloc(bins, sizeof(uint64_t));
+    }
+    if (!hist || !hist->genuine || !hist->impostor) {
+        log_message(NL_LOG_ERROR, "Failed to allocate score histogram (%zu bins)", bins);
+        eval_histogram_free(hist);
+        return NULL;
+    }
+    hist->bins = bins;
+    return hist;
+}
+
+/**
+ * Free a score histogram
+ */
+void eval_histogram_free(ScoreHistogram *hist) {
+    if (!hist) {
+        return;
+    }
+    free(hist->genuine);
+    free(hist->impostor);
+    free(hist);
+}
+
+/* Visitor state for eval_probe_matrix */
+typedef struct {
+    TemplateMatrix *matrix;
+    size_t row;
+} ProbeContext;
+
+static int pack_exemplars(const TemplateRecord *record, void *ctx) {
+    ProbeContext *pack = (ProbeContext*)ctx;
+    TemplateMatrix *m = pack->matrix;
+
+    if (record->feature_count != m->dim) {
+        return 0;
+    }
+    for (uint32_t e = 0; e < record->exemplar_count && e < TEMPLATE_MAX_EXEMPLARS; e++) {
+        if (pack->row >= m->num_templates) {
+            return 1;
+        }
+        vector_normalize(record->exemplars + e * m->dim, m->matrix + pack->row * m->stride, m->dim);
+        memcpy(m->usernames[pack->row], record->username, 64);
+        m->usernames[pack->row][63] = '\0';
+        m->task_types[pack->row] = (MentalTask)record->task_type;
+        pack->row++;
+    }
+    return 0;
+}
+
+/**
+ * Pack every stored exemplar (enrolment trial) as a probe row
+ */
+TemplateMatrix* eval_probe_matrix(TemplateDB *db) {
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Invalid template database for probe matrix");
+        return NULL;
+    }
+
+    TemplateMatrix *m = template_matrix_alloc(template_db_count(db) * TEMPLATE_MAX_EXEMPLARS, FEATURE_VECTOR_SIZE);
+    if (!m) {
+        return NULL;
+    }
+
+    ProbeContext pack = { m, 0 };
+    template_db_foreach(db, pack_exemplars, &pack);
+    m->num_templates = pack.row;
+    return m;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strncmp(*(const char* const*)a, *(const char* const*)b, 64);
+}
+
+/**
+ * Map each probe to the gallery row with the same username (-1 if none)
+ */
+static int32_t* label_probes(const TemplateMatrix *probes, const TemplateMatrix *gallery) {
+    const char **names = (const char**)malloc((gallery->num_templates + 1) * sizeof(char*));
+    int32_t *labels = (int32_t*)malloc((probes->num_templates + 1) * sizeof(int32_t));
+    if (!names || !labels) {
+        free(names);
+        free(labels);
+        return NULL;
+    }
+
+    for (size_t g = 0; g < gallery->num_templates; g++) {
+        names[g] = gallery->usernames[g];
+    }
+    qsort(names, gallery->num_templates, sizeof(char*), compare_names);
+
+    for (size_t p = 0; p < probes->num_templates; p++) {
+        const char *key = probes->usernames[p];
+        const char **found = (const char**)bsearch(&key, names, gallery->num_templates, sizeof(char*),
+                                                   compare_names);
+        labels[p] = found ? (int32_t)((*found - gallery->usernames[0]) / 64) : -1;
+    }
+
+    free(names);
+    return labels;
+}
+
+/**
+ * Score gallery blocks until none are left
+ */
+static void eval_task(void *arg) {
+    EvalTask *task = (EvalTask*)arg;
+    const TemplateMatrix *probes = task->probes;
+    const TemplateMatrix *gallery = task->gallery;
+    size_t dim = gallery->dim;
+    const float scale = 0.5f * (float)task->bins;     // Bins per unit score over [-1, 1]
+    const int32_t top = (int32_t)task->bins - 1;
+
+    float *panel = (float*)aligned_alloc(32, dim * EVAL_GALLERY_BLOCK * sizeof(float));
+    float *tile = (float*)aligned_alloc(32, EVAL_PROBE_BLOCK * EVAL_GALLERY_BLOCK * sizeof(float));
+    int32_t *bins = (int32_t*)malloc(EVAL_GALLERY_BLOCK * sizeof(int32_t));
+    if (!panel || !tile || !bins) {
+        free(panel);
+        free(tile);
+        free(bins);
+        task->failed = 1;
+        return;
+    }
+
+    for (;;) {
+        size_t block = __atomic_fetch_add(task->next_block, 1, __ATOMIC_RELAXED);
+        if (block >= task->num_blocks) {
+            break;
+        }
+
+        // Pack the block transposed and zero padded to a multiple of 16 columns
+        size_t first = block * EVAL_GALLERY_BLOCK;
+        size_t n = gallery->num_templates - first < EVAL_GALLERY_BLOCK ?
+                   gallery->num_templates - first : EVAL_GALLERY_BLOCK;
+        size_t width = (n + 15) & ~(size_t)15;
+        for (size_t d = 0; d < dim; d++) {
+            float *column = panel + d * width;
+            for (size_t j = 0; j < n; j++) {
+                column[j] = gallery->matrix[(first + j) * gallery->stride + d];
+            }
+            memset(column + n, 0, (width - n) * sizeof(float));
+        }
+
+        for (size_t p0 = 0; p0 < probes->num_templates; p0 += EVAL_PROBE_BLOCK) {
+            size_t m = probes->num_templates - p0 < EVAL_PROBE_BLOCK ? probes->num_templates - p0 : EVAL_PROBE_BLOCK;
+            gemm_t_f32(probes->matrix + p0 * probes->stride, m, probes->stride, panel, width, dim, tile);
+
+            // Bin everything as impostor, then move the rare genuine pair over
+            for (size_t i = 0; i < m; i++) {
+                bin_index_f32(tile + i * width, n, -1.0f, scale, top, bins);
+                for (size_t j = 0; j < n; j++) {
+                    task->impostor[bins[j]]++;
+                }
+
+                int32_t owner = task->labels[p0 + i];
+                if (owner >= 0 && (size_t)owner >= first && (size_t)owner < first + n) {
+                    int32_t bin = bins[owner - first];
+                    task->impostor[bin]--;
+                    task->genuine[bin]++;
+                }
+            }
+        }
+    }
+
+    free(panel);
+    free(tile);
+    free(bins);
+}
+
+static size_t eval_task_count(size_t blocks) {
+    size_t tasks = EVAL_MAX_THREADS > 0 ? (size_t)EVAL_MAX_THREADS
+                                        : scheduler_concurrency(scheduler_shared());
+    return blocks < tasks ? (blocks > 0 ? blocks : 1) : tasks;
+}
+
+/**
+ * Score every probe against every template into the histograms
+ */
+int eval_score_matrix(const TemplateMatrix *probes, const TemplateMatrix *gallery, ScoreHistogram *hist) {
+    if (!probes || !gallery || !hist || !probes->matrix || !gallery->matrix || probes->dim != gallery->dim) {
+        log_message(NL_LOG_ERROR, "Invalid input for score matrix evaluation");
+        return -1;
+    }
+    if (probes->num_templates == 0 || gallery->num_templates == 0) {
+        return 0;
+    }
+
+    int32_t *labels = label_probes(probes, gallery);
+    size_t num_blocks = (gallery->num_templates + EVAL_GALLERY_BLOCK - 1) / EVAL_GALLERY_BLOCK;
+    size_t num_tasks = eval_task_count(num_blocks);
+    EvalTask *tasks = (EvalTask*)calloc(num_tasks, sizeof(EvalTask));
+    uint64_t *counts = (uint64_t*)calloc(2 * num_tasks * hist->bins, sizeof(uint64_t));
+    TaskGroup *group = task_group_create(scheduler_shared());
+    if (!labels || !tasks || !counts || !group) {
+        log_message(NL_LOG_ERROR, "Failed to allocate evaluation buffers");
+        task_group_free(group);
+        free(labels);
+        free(tasks);
+        free(counts);
+        return -1;
+    }
+
+    size_t next_block = 0;
+    for (size_t t = 0; t < num_tasks; t++) {
+        tasks[t].probes = probes;
+        tasks[t].gallery = gallery;
+        tasks[t].labels = labels;
+        tasks[t].next_block = &next_block;
+        tasks[t].num_blocks = num_blocks;
+        tasks[t].bins = hist->bins;
+        tasks[t].genuine = counts + 2 * t * hist->bins;
+        tasks[t].impostor = tasks[t].genuine + hist->bins;
+    }
+
+    // Tasks run on the shared scheduler and this thread; blocks are claimed, not assigned
+    for (size_t t = 0; t < num_tasks; t++) {
+        task_group_spawn(group, eval_task, &tasks[t]);
+    }
+    task_group_wait(group);
+    task_group_free(group);
+    int failed = 0;
+    for (size_t t = 0; t < num_tasks; t++) {
+        failed |= tasks[t].failed;
+    }
+
+    for (size_t t = 0; !failed && t < num_tasks; t++) {
+        for (size_t b = 0; b < hist->bins; b++) {
+            hist->genuine[b] += tasks[t].genuine[b];
+            hist->impostor[b] += tasks[t].impostor[b];
+            hist->genuine_count += tasks[t].genuine[b];
+            hist->impostor_count += tasks[t].impostor[b];
+        }
+    }
+
+    free(labels);
+    free(tasks);
+    free(counts);
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Score matrix evaluation failed");
+        return -1;
+    }
+    return 0;
+}
+
+static float bin_edge(const ScoreHistogram *hist, size_t bin) {
+    return -1.0f + 2.0f * (float)bin / (float)hist->bins;
+}
+
+/**
+ * Error rates when accepting scores at or above a threshold
+ */
+void eval_rates(const ScoreHistogram *hist, float threshold, double *far, double *frr) {
+    if (!hist || !far || !frr) {
+        return;
+    }
+
+    int32_t first;
+    bin_index_f32(&threshold, 1, -1.0f, 0.5f * (float)hist->bins, (int32_t)hist->bins - 1, &first);
+    uint64_t accepted = 0, rejected = 0;
+    for (size_t b = 0; b < hist->bins; b++) {
+        if (b >= (size_t)first) {
+            accepted += hist->impostor[b];
+        } else {
+            rejected += hist->genuine[b];
+        }
+    }
+    *far = hist->impostor_count ? (double)accepted / (double)hist->impostor_count : 0.0;
+    *frr = hist->genuine_count ? (double)rejected / (double)hist->genuine_count : 0.0;
+}
+
+/**
+ * Find the threshold where the false accept and false reject rates meet
+ */
+float eval_equal_error(const ScoreHistogram *hist, double *eer) {
+    if (!hist || !eer || hist->genuine_count == 0 || hist->impostor_count == 0) {
+        if (eer) {
+            *eer = 0.0;
+        }
+        return 0.0f;
+    }
+
+    // Raising the threshold past bin b accepts fewer impostors and rejects more genuines
+    uint64_t accepted = hist->impostor_count, rejected = 0;
+    double best_gap = 2.0;
+    size_t best_bin = 0;
+    for (size_t b = 0; b < hist->bins; b++) {
+        double far = (double)accepted / (double)hist->impostor_count;
+        double frr = (double)rejected / (double)hist->genuine_count;
+        double gap = far > frr ? far - frr : frr - far;
+        if (gap < best_gap) {
+            best_gap = gap;
+            best_bin = b;
+            *eer = (far + frr) / 2.0;
+        }
+        accepted -= hist->impostor[b];
+        rejected += hist->genuine[b];
+    }
+    return bin_edge(hist, best_bin);
+}
+
+/**
+ * Find the lowest threshold whose false accept rate is at most a target
+ */
+float eval_threshold_at_far(const ScoreHistogram *hist, double far) {
+    if (!hist || hist->impostor_count == 0) {
+        return -1.0f;
+    }
+
+    uint64_t accepted = hist->impostor_count;
+    for (size_t b = 0; b < hist->bins; b++) {
+        if ((double)accepted / (double)hist->impostor_count <= far) {
+            return bin_edge(hist, b);
+        }
+        accepted -= hist->impostor[b];
+    }
+    return 1.0f;
+}
+
+/**
+ * Write the DET curve as CSV, one line per occupied bin
+ */
+int eval_write_det(const ScoreHistogram *hist, const char *path) {
+    if (!hist || !path) {
+        log_message(NL_LOG_ERROR, "Invalid input for DET curve");
+        return -1;
+    }
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        log_message(NL_LOG_ERROR, "Failed to open DET curve file: %s", path);
+        return -1;
+    }
+
+    double impostors = hist->impostor_count ? (double)hist->impostor_count : 1.0;
+    double genuines = hist->genuine_count ? (double)hist->genuine_count : 1.0;
+    uint64_t accepted = hist->impostor_count, rejected = 0;
+    fprintf(file, "threshold,far,frr\n");
+    for (size_t b = 0; b < hist->bins; b++) {
+        if (hist->genuine[b] != 0 || hist->impostor[b] != 0) {
+            fprintf(file, "%.5f,%.9f,%.9f\n", bin_edge(hist, b), accepted / impostors, rejected / genuines);
+        }
+        accepted -= hist->impostor[b];
+        rejected += hist->genuine[b];
+    }
+
+    int result = ferror(file) ? -1 : 0;
+    if (fclose(file) != 0 || result != 0) {
+        log_message(NL_LOG_ERROR, "Failed to write DET curve: %s", path);
+        return -1;
+    }
+    return 0;
+}
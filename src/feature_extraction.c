@@ -1,5 +1,7 @@
 #include "feature_extraction.h"
+#include "hashing.h"
 #include "utils.h"
+#include "scheduler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,16 +11,26 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+/* Embedding network replacing band powers, NULL when none is set */
+static const CNNModel *embedding_model = NULL;
+
+/* One recording of an extract_features_batch() call */
+typedef struct {
+    const EEGData *data;
+    FeatureVector *output;
+    int status;
+} ExtractJob;
+
 /**
  * Apply bandpass filter to EEG data
  */
 int filter_bandpass(EEGData *data, float low_freq, float high_freq) {
     if (!data || !data->data) {
-        log_message(LOG_ERROR, "Invalid EEG data for filtering");
+        log_message(NL_LOG_ERROR, "Invalid EEG data for filtering");
         return -1;
     }
     
-    log_message(LOG_INFO, "Applying bandpass filter (%.1f-%.1f Hz)", low_freq, high_freq);
+    log_message(NL_LOG_INFO, "Applying bandpass filter (%.1f-%.1f Hz)", low_freq, high_freq);
     
     // TODO: Implement proper IIR or FIR bandpass filter
     // For now, this is a placeholder
@@ -32,11 +44,11 @@ int filter_bandpass(EEGData *data, float low_freq, float high_freq) {
  */
 int filter_notch(EEGData *data, float notch_freq) {
     if (!data || !data->data) {
-        log_message(LOG_ERROR, "Invalid EEG data for filtering");
+        log_message(NL_LOG_ERROR, "Invalid EEG data for filtering");
         return -1;
     }
     
-    log_message(LOG_INFO, "Applying notch filter at %.1f Hz", notch_freq);
+    log_message(NL_LOG_INFO, "Applying notch filter at %.1f Hz", notch_freq);
     
     // TODO: Implement proper notch filter (IIR notch)
     // For now, this is a placeholder
@@ -49,11 +61,11 @@ int filter_notch(EEGData *data, float notch_freq) {
  */
 int remove_eye_artifacts(EEGData *data) {
     if (!data || !data->data) {
-        log_message(LOG_ERROR, "Invalid EEG data for artifact removal");
+        log_message(NL_LOG_ERROR, "Invalid EEG data for artifact removal");
         return -1;
     }
     
-    log_message(LOG_INFO, "Removing eye blink artifacts");
+    log_message(NL_LOG_INFO, "Removing eye blink artifacts");
     
     // TODO: Implement EOG artifact rejection
     // Methods: threshold-based rejection, ICA, or regression
@@ -66,11 +78,11 @@ int remove_eye_artifacts(EEGData *data) {
  */
 int normalize_signal(EEGData *data) {
     if (!data || !data->data) {
-        log_message(LOG_ERROR, "Invalid EEG data for normalization");
+        log_message(NL_LOG_ERROR, "Invalid EEG data for normalization");
         return -1;
     }
     
-    log_message(LOG_DEBUG, "Normalizing EEG signal");
+    log_message(NL_LOG_DEBUG, "Normalizing EEG signal");
     
     size_t total_samples = data->num_channels * data->num_samples;
     
@@ -92,7 +104,7 @@ int normalize_signal(EEGData *data) {
         }
     }
     
-    log_message(LOG_DEBUG, "Signal normalization complete");
+    log_message(NL_LOG_DEBUG, "Signal normalization complete");
     return 0;
 }
 
@@ -101,7 +113,7 @@ int normalize_signal(EEGData *data) {
  */
 int compute_fft(const float *input, float *output, size_t size) {
     if (!input || !output) {
-        log_message(LOG_ERROR, "Invalid FFT input/output");
+        log_message(NL_LOG_ERROR, "Invalid FFT input/output");
         return -1;
     }
     
@@ -131,17 +143,17 @@ int compute_fft(const float *input, float *output, size_t size) {
  */
 int extract_band_power(const EEGData *data, FeatureVector *output) {
     if (!data || !data->data || !output) {
-        log_message(LOG_ERROR, "Invalid input for band power extraction");
+        log_message(NL_LOG_ERROR, "Invalid input for band power extraction");
         return -1;
     }
     
-    log_message(LOG_INFO, "Extracting frequency band power features");
+    log_message(NL_LOG_INFO, "Extracting frequency band power features");
     
     // Allocate FFT output buffer
     size_t fft_size = WINDOW_SIZE / 2;
     float *fft_output = (float*)malloc(fft_size * sizeof(float));
     if (!fft_output) {
-        log_message(LOG_ERROR, "Failed to allocate FFT output buffer");
+        log_message(NL_LOG_ERROR, "Failed to allocate FFT output buffer");
         return -1;
     }
     
@@ -202,7 +214,7 @@ int extract_band_power(const EEGData *data, FeatureVector *output) {
     
     free(fft_output);
     
-    log_message(LOG_INFO, "Extracted %zu band power features", feature_idx);
+    log_message(NL_LOG_INFO, "Extracted %zu band power features", feature_idx);
     return 0;
 }
 
@@ -219,35 +231,49 @@ int extract_psd_features(const EEGData *data, FeatureVector *output) {
  */
 int extract_wavelet_features(const EEGData *data, FeatureVector *output) {
     if (!data || !data->data || !output) {
-        log_message(LOG_ERROR, "Invalid input for wavelet feature extraction");
+        log_message(NL_LOG_ERROR, "Invalid input for wavelet feature extraction");
         return -1;
     }
     
-    log_message(LOG_INFO, "Extracting wavelet transform features");
+    log_message(NL_LOG_INFO, "Extracting wavelet transform features");
     
     // TODO: Implement discrete wavelet transform (DWT)
     // Use Daubechies or Morlet wavelets
     // For now, this is a placeholder
     
-    log_message(LOG_WARNING, "Wavelet feature extraction not yet implemented");
+    log_message(NL_LOG_WARNING, "Wavelet feature extraction not yet implemented");
     return -1;
 }
 
+/**
+ * Use an embedding network instead of band powers in extract_features
+ */
+int feature_extraction_set_model(const CNNModel *model) {
+    if (model && (model->output_size != FEATURE_VECTOR_SIZE || model->input_channels != NUM_CHANNELS ||
+                  model->input_samples > (size_t)SAMPLING_RATE * CAPTURE_DURATION)) {
+        log_message(NL_LOG_ERROR, "Network shape (%zu x %zu in, %zu out) does not fit the pipeline",
+                   model->input_channels, model->input_samples, model->output_size);
+        return -1;
+    }
+    embedding_model = model;
+    return 0;
+}
+
 /**
  * Complete feature extraction pipeline
  */
 int extract_features(const EEGData *data, FeatureVector *output) {
     if (!data || !data->data || !output) {
-        log_message(LOG_ERROR, "Invalid input for feature extraction");
+        log_message(NL_LOG_ERROR, "Invalid input for feature extraction");
         return -1;
     }
     
-    log_message(LOG_INFO, "Starting feature extraction pipeline");
+    log_message(NL_LOG_DEBUG, "Starting feature extraction pipeline");
     
     // Create working copy of data for filtering
     EEGData *filtered_data = eeg_data_alloc(data->num_channels, data->num_samples);
     if (!filtered_data) {
-        log_message(LOG_ERROR, "Failed to allocate filtered data");
+        log_message(NL_LOG_ERROR, "Failed to allocate filtered data");
         return -1;
     }
     
@@ -264,7 +290,16 @@ int extract_features(const EEGData *data, FeatureVector *output) {
     normalize_signal(filtered_data);
     
     // Extract features
-    int result = extract_band_power(filtered_data, output);
+    int result;
+    if (!embedding_model) {
+        result = extract_band_power(filtered_data, output);
+    } else if (output->size != embedding_model->output_size) {
+        log_message(NL_LOG_ERROR, "Feature vector size %zu does not match the network output (%zu)",
+                   output->size, embedding_model->output_size);
+        result = -1;
+    } else {
+        result = cnn_embed(embedding_model, filtered_data, output->features);
+    }
     
     output->task_type = data->task_type;
     output->timestamp = get_timestamp_ms();
@@ -273,25 +308,76 @@ int extract_features(const EEGData *data, FeatureVector *output) {
     eeg_data_free(filtered_data);
     
     if (result == 0) {
-        log_message(LOG_INFO, "Feature extraction complete");
+        log_message(NL_LOG_DEBUG, "Feature extraction complete");
     }
     
     return result;
 }
 
+static void extract_job(void *arg) {
+    ExtractJob *job = (ExtractJob*)arg;
+    job->status = extract_features(job->data, job->output);
+}
+
+/**
+ * Run the feature extraction pipeline over several recordings at once
+ */
+size_t extract_features_batch(const EEGData *const *data, size_t count, FeatureVector *const *outputs,
+                              int *status) {
+    if (!data || !outputs) {
+        log_message(NL_LOG_ERROR, "Invalid input for batch feature extraction");
+        return count;
+    }
+    
+    ExtractJob *jobs = (ExtractJob*)calloc(count ? count : 1, sizeof(ExtractJob));
+    if (!jobs) {
+        log_message(NL_LOG_ERROR, "Failed to allocate batch feature extraction");
+        for (size_t i = 0; status && i < count; i++) {
+            status[i] = -1;
+        }
+        return count;
+    }
+    
+    // A single recording (or no group) runs on this thread
+    TaskGroup *group = count > 1 ? task_group_create(scheduler_shared()) : NULL;
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].data = data[i];
+        jobs[i].output = outputs[i];
+        if (group) {
+            task_group_spawn(group, extract_job, &jobs[i]);
+        } else {
+            extract_job(&jobs[i]);
+        }
+    }
+    if (group) {
+        task_group_wait(group);
+        task_group_free(group);
+    }
+    
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (status) {
+            status[i] = jobs[i].status;
+        }
+        failed += jobs[i].status != 0;
+    }
+    free(jobs);
+    return failed;
+}
+
 /**
  * Allocate memory for FeatureVector
  */
 FeatureVector* feature_vector_alloc(size_t size) {
     FeatureVector *vector = (FeatureVector*)malloc(sizeof(FeatureVector));
     if (!vector) {
-        log_message(LOG_ERROR, "Failed to allocate FeatureVector structure");
+        log_message(NL_LOG_ERROR, "Failed to allocate FeatureVector structure");
         return NULL;
     }
     
     vector->features = (float*)calloc(size, sizeof(float));
     if (!vector->features) {
-        log_message(LOG_ERROR, "Failed to allocate feature array");
+        log_message(NL_LOG_ERROR, "Failed to allocate feature array");
         free(vector);
         return NULL;
     }
@@ -321,7 +407,7 @@ void feature_vector_free(FeatureVector *vector) {
  */
 int average_feature_vectors(const FeatureVector **vectors, size_t num_vectors, FeatureVector *output) {
     if (!vectors || !output || num_vectors == 0) {
-        log_message(LOG_ERROR, "Invalid input for vector averaging");
+        log_message(NL_LOG_ERROR, "Invalid input for vector averaging");
         return -1;
     }
     
@@ -330,7 +416,7 @@ int average_feature_vectors(const FeatureVector **vectors, size_t num_vectors, F
     // Verify all vectors have same size
     for (size_t i = 1; i < num_vectors; i++) {
         if (vectors[i]->size != size) {
-            log_message(LOG_ERROR, "Feature vectors have different sizes");
+            log_message(NL_LOG_ERROR, "Feature vectors have different sizes");
             return -1;
         }
     }
@@ -348,6 +434,6 @@ int average_feature_vectors(const FeatureVector **vectors, size_t num_vectors, F
     output->task_type = vectors[0]->task_type;
     output->timestamp = get_timestamp_ms();
     
-    log_message(LOG_INFO, "Averaged %zu feature vectors", num_vectors);
+    log_message(NL_LOG_INFO, "Averaged %zu feature vectors", num_vectors);
     return 0;
 }
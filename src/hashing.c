@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE
 #include "hashing.h"
 #include "utils.h"
 #include <stdio.h>
@@ -20,22 +21,22 @@
  */
 int generate_salt(uint8_t *salt, size_t salt_size) {
     if (!salt || salt_size == 0) {
-        log_message(LOG_ERROR, "Invalid salt buffer");
+        log_message(NL_LOG_ERROR, "Invalid salt buffer");
         return -1;
     }
     
-    log_message(LOG_DEBUG, "Generating %zu-byte random salt", salt_size);
+    log_message(NL_LOG_DEBUG, "Generating %zu-byte random salt", salt_size);
     
     #ifdef _WIN32
     // Use Windows Crypto API
     HCRYPTPROV hCryptProv;
     if (!CryptAcquireContext(&hCryptProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) {
-        log_message(LOG_ERROR, "Failed to acquire crypto context");
+        log_message(NL_LOG_ERROR, "Failed to acquire crypto context");
         return -1;
     }
     
     if (!CryptGenRandom(hCryptProv, salt_size, salt)) {
-        log_message(LOG_ERROR, "Failed to generate random salt");
+        log_message(NL_LOG_ERROR, "Failed to generate random salt");
         CryptReleaseContext(hCryptProv, 0);
         return -1;
     }
@@ -45,7 +46,7 @@ int generate_salt(uint8_t *salt, size_t salt_size) {
     // Use /dev/urandom on Unix-like systems
     int fd = open("/dev/urandom", O_RDONLY);
     if (fd < 0) {
-        log_message(LOG_ERROR, "Failed to open /dev/urandom");
+        log_message(NL_LOG_ERROR, "Failed to open /dev/urandom");
         return -1;
     }
     
@@ -53,12 +54,12 @@ int generate_salt(uint8_t *salt, size_t salt_size) {
     close(fd);
     
     if (result != (ssize_t)salt_size) {
-        log_message(LOG_ERROR, "Failed to read random data");
+        log_message(NL_LOG_ERROR, "Failed to read random data");
         return -1;
     }
     #endif
     
-    log_message(LOG_DEBUG, "Salt generated successfully");
+    log_message(NL_LOG_DEBUG, "Salt generated successfully");
     return 0;
 }
 
@@ -67,35 +68,35 @@ int generate_salt(uint8_t *salt, size_t salt_size) {
  */
 int hash_features_sha256(const FeatureVector *features, const uint8_t *salt, size_t salt_size, HashData *output) {
     if (!features || !features->features || !salt || !output) {
-        log_message(LOG_ERROR, "Invalid input for SHA-256 hashing");
+        log_message(NL_LOG_ERROR, "Invalid input for SHA-256 hashing");
         return -1;
     }
     
-    log_message(LOG_DEBUG, "Hashing features with SHA-256");
+    log_message(NL_LOG_DEBUG, "Hashing features with SHA-256");
     
     // Create SHA-256 context
     EVP_MD_CTX *ctx = EVP_MD_CTX_new();
     if (!ctx) {
-        log_message(LOG_ERROR, "Failed to create SHA-256 context");
+        log_message(NL_LOG_ERROR, "Failed to create SHA-256 context");
         return -1;
     }
     
     if (EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
-        log_message(LOG_ERROR, "Failed to initialize SHA-256");
+        log_message(NL_LOG_ERROR, "Failed to initialize SHA-256");
         EVP_MD_CTX_free(ctx);
         return -1;
     }
     
     // Hash feature vector
     if (EVP_DigestUpdate(ctx, features->features, features->size * sizeof(float)) != 1) {
-        log_message(LOG_ERROR, "Failed to hash features");
+        log_message(NL_LOG_ERROR, "Failed to hash features");
         EVP_MD_CTX_free(ctx);
         return -1;
     }
     
     // Hash salt
     if (EVP_DigestUpdate(ctx, salt, salt_size) != 1) {
-        log_message(LOG_ERROR, "Failed to hash salt");
+        log_message(NL_LOG_ERROR, "Failed to hash salt");
         EVP_MD_CTX_free(ctx);
         return -1;
     }
@@ -103,7 +104,7 @@ int hash_features_sha256(const FeatureVector *features, const uint8_t *salt, siz
     // Finalize hash
     unsigned int hash_len;
     if (EVP_DigestFinal_ex(ctx, output->hash, &hash_len) != 1) {
-        log_message(LOG_ERROR, "Failed to finalize hash");
+        log_message(NL_LOG_ERROR, "Failed to finalize hash");
         EVP_MD_CTX_free(ctx);
         return -1;
     }
@@ -114,7 +115,7 @@ int hash_features_sha256(const FeatureVector *features, const uint8_t *salt, siz
     memcpy(output->salt, salt, salt_size);
     output->salt_size = salt_size;
     
-    log_message(LOG_DEBUG, "SHA-256 hash complete (%u bytes)", hash_len);
+    log_message(NL_LOG_DEBUG, "SHA-256 hash complete (%u bytes)", hash_len);
     return 0;
 }
 
@@ -124,7 +125,7 @@ int hash_features_sha256(const FeatureVector *features, const uint8_t *salt, siz
 int hash_features_blake3(const FeatureVector *features, const uint8_t *salt, size_t salt_size, HashData *output) {
     // TODO: Implement BLAKE3 hashing
     // Requires BLAKE3 library
-    log_message(LOG_WARNING, "BLAKE3 hashing not yet implemented");
+    log_message(NL_LOG_WARNING, "BLAKE3 hashing not yet implemented");
     return -1;
 }
 
@@ -144,7 +145,7 @@ int hash_features(const FeatureVector *features, const uint8_t *salt, size_t sal
  */
 int hash_compare(const HashData *hash1, const HashData *hash2) {
     if (!hash1 || !hash2) {
-        log_message(LOG_ERROR, "Invalid hash for comparison");
+        log_message(NL_LOG_ERROR, "Invalid hash for comparison");
         return 0;
     }
     
@@ -167,20 +168,20 @@ int hash_compare(const HashData *hash1, const HashData *hash2) {
 HashData* hash_data_alloc(size_t hash_size, size_t salt_size) {
     HashData *data = (HashData*)malloc(sizeof(HashData));
     if (!data) {
-        log_message(LOG_ERROR, "Failed to allocate HashData structure");
+        log_message(NL_LOG_ERROR, "Failed to allocate HashData structure");
         return NULL;
     }
     
     data->hash = (uint8_t*)calloc(hash_size, sizeof(uint8_t));
     if (!data->hash) {
-        log_message(LOG_ERROR, "Failed to allocate hash buffer");
+        log_message(NL_LOG_ERROR, "Failed to allocate hash buffer");
         free(data);
         return NULL;
     }
     
     data->salt = (uint8_t*)calloc(salt_size, sizeof(uint8_t));
     if (!data->salt) {
-        log_message(LOG_ERROR, "Failed to allocate salt buffer");
+        log_message(NL_LOG_ERROR, "Failed to allocate salt buffer");
         free(data->hash);
         free(data);
         return NULL;
@@ -214,7 +215,7 @@ void hash_data_free(HashData *data) {
  */
 int hash_to_hex(const HashData *hash, char *output) {
     if (!hash || !hash->hash || !output) {
-        log_message(LOG_ERROR, "Invalid input for hex conversion");
+        log_message(NL_LOG_ERROR, "Invalid input for hex conversion");
         return -1;
     }
     
@@ -234,18 +235,15 @@ void secure_wipe(void *ptr, size_t size) {
         return;
     }
     
+    #ifdef _WIN32
+    SecureZeroMemory(ptr, size);
+    #elif defined(__GLIBC__)
+    explicit_bzero(ptr, size);
+    #else
     // Use volatile to prevent compiler optimization
     volatile uint8_t *p = (volatile uint8_t *)ptr;
     while (size--) {
         *p++ = 0;
     }
-    
-    #ifdef _WIN32
-    SecureZeroMemory(ptr, size);
-    #else
-    // Additional explicit_bzero on systems that support it
-    #ifdef __GLIBC__
-    explicit_bzero(ptr, size);
-    #endif
     #endif
 }
@@ -0,0 +1,1129 @@
+#define _DEFAULT_SOURCE
+#include "hnsw.h"
+#include "vector_ops.h"
+#include "hashing.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define HNSW_FILE_MAGIC 0x4E484C4E      // "NLHN" little-endian
+#define HNSW_FILE_VERSION 1
+#define HNSW_FILE_HEADER_SIZE 64
+#define HNSW_MAX_LEVEL 16
+#define HNSW_INITIAL_CAPACITY 1024
+
+/* Username map slots: 0 = empty, otherwise node + 1. Tombstoned nodes keep
+ * their entry so re-inserting the user reuses the node. */
+#define MAP_EMPTY 0u
+
+struct HNSWIndex {
+    size_t dim;
+    size_t stride;                  // dim rounded up to 8
+    size_t m;                       // Max neighbours on layers >= 1
+    size_t m0;                      // Max neighbours on layer 0
+    size_t ef_construction;
+    double level_mult;              // 1 / ln(m)
+
+    size_t count;                   // Nodes, including tombstoned ones
+    size_t capacity;
+    size_t deleted;
+    uint32_t entry_point;
+    int max_level;                  // -1 while empty
+
+    float *vectors;                 // [capacity * stride], unit norm
+    char (*usernames)[64];          // [capacity]
+    uint8_t *levels;                // [capacity]
+    uint8_t *tombstones;            // [capacity]
+    uint32_t *links0;               // [capacity * (m0 + 1)], slot 0 holds the count
+    uint32_t **links_upper;         // [capacity], level * (m + 1) entries each
+
+    uint32_t *map;                  // Username -> node, open addressing
+    size_t map_slots;               // Power of two
+    size_t map_used;                // Occupied slots
+
+    uint64_t rng_state;
+};
+
+/* Scored node, used by both candidate and result heaps */
+typedef struct {
+    float score;
+    uint32_t node;
+} HeapItem;
+
+/* Binary min-heap on score; max-heaps store negated scores */
+typedef struct {
+    HeapItem *items;
+    size_t count;
+    size_t capacity;
+} Heap;
+
+/* Per-search visited set (open addressing over node + 1) */
+typedef struct {
+    uint32_t *slots;
+    size_t mask;
+    size_t used;
+} VisitedSet;
+
+/**
+ * FNV-1a hash of a username
+ */
+static uint32_t hash_username(const char *username) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)username; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_node(uint32_t node) {
+    node ^= node >> 16;
+    node *= 0x7FEB352Du;
+    node ^= node >> 15;
+    return node;
+}
+
+static uint64_t next_random(HNSWIndex *index) {
+    uint64_t x = index->rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    index->rng_state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Draw a node level from the geometric distribution floor(-ln(U) / ln(m))
+ */
+static int random_level(HNSWIndex *index) {
+    double u = ((next_random(index) >> 11) + 1.0) * (1.0 / 9007199254740993.0);
+    int level = (int)(-log(u) * index->level_mult);
+    return level > HNSW_MAX_LEVEL ? HNSW_MAX_LEVEL : level;
+}
+
+static inline const float* node_vector(const HNSWIndex *index, uint32_t node) {
+    return index->vectors + (size_t)node * index->stride;
+}
+
+/**
+ * Neighbour list of a node on a layer: [count, ids...]
+ */
+static inline uint32_t* node_links(const HNSWIndex *index, uint32_t node, int level) {
+    if (level == 0) {
+        return index->links0 + (size_t)node * (index->m0 + 1);
+    }
+    return index->links_upper[node] + (size_t)(level - 1) * (index->m + 1);
+}
+
+static inline float similarity(const HNSWIndex *index, const float *query, uint32_t node) {
+    return dot_f32(query, node_vector(index, node), index->stride);
+}
+
+/* ---- Heaps ---- */
+
+static int heap_init(Heap *heap, size_t capacity) {
+    heap->items = (HeapItem*)malloc(capacity * sizeof(HeapItem));
+    heap->count = 0;
+    heap->capacity = capacity;
+    return heap->items ? 0 : -1;
+}
+
+static int heap_push(Heap *heap, float score, uint32_t node) {
+    if (heap->count == heap->capacity) {
+        size_t capacity = heap->capacity * 2;
+        HeapItem *items = (HeapItem*)realloc(heap->items, capacity * sizeof(HeapItem));
+        if (!items) {
+            return -1;
+        }
+        heap->items = items;
+        heap->capacity = capacity;
+    }
+
+    size_t i = heap->count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap->items[parent].score <= score) break;
+        heap->items[i] = heap->items[parent];
+        i = parent;
+    }
+    heap->items[i].score = score;
+    heap->items[i].node = node;
+    return 0;
+}
+
+static HeapItem heap_pop(Heap *heap) {
+    HeapItem top = heap->items[0];
+    HeapItem last = heap->items[--heap->count];
+    size_t n = heap->count;
+    size_t i = 0;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && heap->items[child + 1].score < heap->items[child].score) child++;
+        if (last.score <= heap->items[child].score) break;
+        heap->items[i] = heap->items[child];
+        i = child;
+    }
+    if (n > 0) {
+        heap->items[i] = last;
+    }
+    return top;
+}
+
+/* ---- Visited set ---- */
+
+static int visited_init(VisitedSet *set, size_t expected) {
+    size_t slots = 256;
+    while (slots < expected * 2) slots <<= 1;
+    set->slots = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    set->mask = slots - 1;
+    set->used = 0;
+    return set->slots ? 0 : -1;
+}
+
+/**
+ * Mark a node visited
+ * Returns: 1 if newly inserted, 0 if already present, -1 on allocation failure
+ */
+static int visited_insert(VisitedSet *set, uint32_t node) {
+    if ((set->used + 1) * 2 > set->mask + 1) {
+        size_t slots = (set->mask + 1) * 2;
+        uint32_t *grown = (uint32_t*)calloc(slots, sizeof(uint32_t));
+        if (!grown) {
+            return -1;
+        }
+        for (size_t i = 0; i <= set->mask; i++) {
+            uint32_t key = set->slots[i];
+            if (key == 0) continue;
+            size_t pos = hash_node(key - 1) & (slots - 1);
+            while (grown[pos]) pos = (pos + 1) & (slots - 1);
+            grown[pos] = key;
+        }
+        free(set->slots);
+        set->slots = grown;
+        set->mask = slots - 1;
+    }
+
+    uint32_t key = node + 1;
+    size_t pos = hash_node(node) & set->mask;
+    while (set->slots[pos]) {
+        if (set->slots[pos] == key) {
+            return 0;
+        }
+        pos = (pos + 1) & set->mask;
+    }
+    set->slots[pos] = key;
+    set->used++;
+    return 1;
+}
+
+/* ---- Username map ---- */
+
+static size_t map_find_slot(const HNSWIndex *index, const char *username) {
+    size_t mask = index->map_slots - 1;
+    size_t pos = hash_username(username) & mask;
+
+    for (size_t probes = 0; probes < index->map_slots; probes++) {
+        uint32_t slot = index->map[pos];
+        if (slot == MAP_EMPTY) {
+            return SIZE_MAX;
+        }
+        if (strncmp(index->usernames[slot - 1], username, 64) == 0) {
+            return pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return SIZE_MAX;
+}
+
+static int map_insert(HNSWIndex *index, uint32_t node);
+
+static int map_rehash(HNSWIndex *index, size_t slots) {
+    uint32_t *old = index->map;
+    size_t old_slots = index->map_slots;
+
+    index->map = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    if (!index->map) {
+        index->map = old;
+        return -1;
+    }
+    index->map_slots = slots;
+    index->map_used = 0;
+
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old[i] != MAP_EMPTY) {
+            map_insert(index, old[i] - 1);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static int map_insert(HNSWIndex *index, uint32_t node) {
+    if ((index->map_used + 1) * 4 > index->map_slots * 3) {
+        if (map_rehash(index, index->map_slots * 2) != 0) {
+            return -1;
+        }
+    }
+
+    size_t mask = index->map_slots - 1;
+    size_t pos = hash_username(index->usernames[node]) & mask;
+    while (index->map[pos] != MAP_EMPTY) {
+        pos = (pos + 1) & mask;
+    }
+    index->map_used++;
+    index->map[pos] = node + 1;
+    return 0;
+}
+
+/* ---- Graph ---- */
+
+static int ensure_capacity(HNSWIndex *index, size_t needed) {
+    if (needed <= index->capacity) {
+        return 0;
+    }
+
+    size_t capacity = index->capacity ? index->capacity : HNSW_INITIAL_CAPACITY;
+    while (capacity < needed) capacity *= 2;
+
+    float *vectors = (float*)aligned_alloc(32, capacity * index->stride * sizeof(float));
+    if (!vectors) {
+        return -1;
+    }
+    if (index->vectors) {
+        memcpy(vectors, index->vectors, index->count * index->stride * sizeof(float));
+        secure_wipe(index->vectors, index->count * index->stride * sizeof(float));
+        free(index->vectors);
+    }
+    index->vectors = vectors;
+
+    void *usernames = realloc(index->usernames, capacity * sizeof(*index->usernames));
+    if (usernames) index->usernames = usernames;
+    uint8_t *levels = (uint8_t*)realloc(index->levels, capacity);
+    if (levels) index->levels = levels;
+    uint8_t *tombstones = (uint8_t*)realloc(index->tombstones, capacity);
+    if (tombstones) index->tombstones = tombstones;
+    uint32_t *links0 = (uint32_t*)realloc(index->links0, capacity * (index->m0 + 1) * sizeof(uint32_t));
+    if (links0) index->links0 = links0;
+    uint32_t **links_upper = (uint32_t**)realloc(index->links_upper, capacity * sizeof(uint32_t*));
+    if (links_upper) index->links_upper = links_upper;
+
+    if (!usernames || !levels || !tombstones || !links0 || !links_upper) {
+        return -1;
+    }
+
+    index->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Greedy walk towards the query on one layer (ef = 1)
+ */
+static uint32_t greedy_search(const HNSWIndex *index, const float *query, uint32_t entry,
+                              float *entry_score, int level) {
+    uint32_t current = entry;
+    float best = *entry_score;
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+        const uint32_t *links = node_links(index, current, level);
+        for (uint32_t i = 1; i <= links[0]; i++) {
+            float score = similarity(index, query, links[i]);
+            if (score > best) {
+                best = score;
+                current = links[i];
+                changed = 1;
+            }
+        }
+    }
+
+    *entry_score = best;
+    return current;
+}
+
+/**
+ * Beam search on one layer
+ * On entry results holds the entry points; on return it holds up to ef nearest
+ * nodes as a min-heap on similarity (worst first).
+ */
+static int search_layer(const HNSWIndex *index, const float *query, Heap *results,
+                        size_t ef, int level) {
+    Heap candidates;
+    VisitedSet visited;
+    if (heap_init(&candidates, ef * 2) != 0) {
+        return -1;
+    }
+    if (visited_init(&visited, ef * index->m0) != 0) {
+        free(candidates.items);
+        return -1;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < results->count && !failed; i++) {
+        failed = visited_insert(&visited, results->items[i].node) < 0 ||
+                 heap_push(&candidates, -results->items[i].score, results->items[i].node) != 0;
+    }
+
+    while (!failed && candidates.count > 0) {
+        HeapItem nearest = heap_pop(&candidates);
+        if (results->count >= ef && -nearest.score < results->items[0].score) {
+            break;
+        }
+
+        const uint32_t *links = node_links(index, nearest.node, level);
+        for (uint32_t i = 1; i <= links[0]; i++) {
+            uint32_t neighbour = links[i];
+            int fresh = visited_insert(&visited, neighbour);
+            if (fresh <= 0) {
+                failed = fresh < 0;
+                if (failed) break;
+                continue;
+            }
+
+            float score = similarity(index, query, neighbour);
+            if (results->count < ef || score > results->items[0].score) {
+                if (heap_push(&candidates, -score, neighbour) != 0 ||
+                    heap_push(results, score, neighbour) != 0) {
+                    failed = 1;
+                    break;
+                }
+                if (results->count > ef) {
+                    heap_pop(results);
+                }
+            }
+        }
+    }
+
+    free(candidates.items);
+    free(visited.slots);
+    return failed ? -1 : 0;
+}
+
+static int compare_desc(const void *a, const void *b) {
+    float sa = ((const HeapItem*)a)->score;
+    float sb = ((const HeapItem*)b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * Neighbour selection heuristic: keep a candidate only if it is closer to the
+ * base than to every neighbour already kept, which preserves links between
+ * clusters. Candidates are sorted in place; selected nodes are written to out.
+ */
+static size_t select_neighbours(const HNSWIndex *index, HeapItem *candidates, size_t n,
+                                size_t max_links, uint32_t *out) {
+    qsort(candidates, n, sizeof(HeapItem), compare_desc);
+
+    size_t selected = 0;
+    for (size_t i = 0; i < n && selected < max_links; i++) {
+        const float *vec = node_vector(index, candidates[i].node);
+        int keep = 1;
+        for (size_t j = 0; j < selected; j++) {
+            if (similarity(index, vec, out[j]) > candidates[i].score) {
+                keep = 0;
+                break;
+            }
+        }
+        if (keep) {
+            out[selected++] = candidates[i].node;
+        }
+    }
+    return selected;
+}
+
+/**
+ * Add a back-link from neighbour to node, pruning the neighbour's list if full
+ */
+static int link_back(HNSWIndex *index, uint32_t neighbour, uint32_t node, int level) {
+    size_t max_links = level == 0 ? index->m0 : index->m;
+    uint32_t *links = node_links(index, neighbour, level);
+
+    // A re-inserted node may still be linked from its old position
+    for (uint32_t i = 1; i <= links[0]; i++) {
+        if (links[i] == node) {
+            return 0;
+        }
+    }
+
+    if (links[0] < max_links) {
+        links[++links[0]] = node;
+        return 0;
+    }
+
+    HeapItem candidates[2 * HNSW_M + 1];
+    HeapItem *pool = candidates;
+    if (max_links + 1 > sizeof(candidates) / sizeof(candidates[0])) {
+        pool = (HeapItem*)malloc((max_links + 1) * sizeof(HeapItem));
+        if (!pool) {
+            return -1;
+        }
+    }
+
+    const float *base = node_vector(index, neighbour);
+    size_t n = 0;
+    for (uint32_t i = 1; i <= links[0]; i++) {
+        pool[n].node = links[i];
+        pool[n].score = similarity(index, base, links[i]);
+        n++;
+    }
+    pool[n].node = node;
+    pool[n].score = similarity(index, base, node);
+    n++;
+
+    links[0] = (uint32_t)select_neighbours(index, pool, n, max_links, links + 1);
+
+    if (pool != candidates) {
+        free(pool);
+    }
+    return 0;
+}
+
+/**
+ * Wire a stored node into the graph. A reused node keeps its old out-links
+ * until they are replaced, so searches starting from it still route.
+ */
+static int connect_node(HNSWIndex *index, uint32_t node, int level) {
+    const float *query = node_vector(index, node);
+
+    if (index->max_level < 0) {
+        index->entry_point = node;
+        index->max_level = level;
+        return 0;
+    }
+
+    uint32_t entry = index->entry_point;
+    float entry_score = similarity(index, query, entry);
+    for (int l = index->max_level; l > level; l--) {
+        entry = greedy_search(index, query, entry, &entry_score, l);
+    }
+
+    Heap results;
+    if (heap_init(&results, index->ef_construction + 1) != 0) {
+        return -1;
+    }
+    heap_push(&results, entry_score, entry);
+
+    uint32_t *selected = (uint32_t*)malloc(index->m * sizeof(uint32_t));
+    if (!selected) {
+        free(results.items);
+        return -1;
+    }
+
+    int failed = 0;
+    int top = level < index->max_level ? level : index->max_level;
+    for (int l = top; l >= 0 && !failed; l--) {
+        if (search_layer(index, query, &results, index->ef_construction, l) != 0) {
+            failed = 1;
+            break;
+        }
+
+        // Results become the next layer's entry points, so select from a copy
+        HeapItem *pool = (HeapItem*)malloc(results.count * sizeof(HeapItem));
+        if (!pool) {
+            failed = 1;
+            break;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < results.count; i++) {
+            if (results.items[i].node != node) {
+                pool[n++] = results.items[i];
+            }
+        }
+
+        uint32_t *links = node_links(index, node, l);
+        links[0] = (uint32_t)select_neighbours(index, pool, n, index->m, selected);
+        free(pool);
+        memcpy(links + 1, selected, links[0] * sizeof(uint32_t));
+
+        for (size_t i = 0; i < links[0] && !failed; i++) {
+            failed = link_back(index, selected[i], node, l) != 0;
+        }
+    }
+
+    free(selected);
+    free(results.items);
+    if (failed) {
+        return -1;
+    }
+
+    if (level > index->max_level) {
+        index->entry_point = node;
+        index->max_level = level;
+    }
+    return 0;
+}
+
+/**
+ * Append a node (already normalized) with the given level
+ */
+static int append_node(HNSWIndex *index, const char *username, const float *unit, int level) {
+    if (index->count >= UINT32_MAX - 1 || ensure_capacity(index, index->count + 1) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to grow HNSW index beyond %zu nodes", index->count);
+        return -1;
+    }
+
+    uint32_t node = (uint32_t)index->count;
+    float *vec = index->vectors + (size_t)node * index->stride;
+    memset(vec, 0, index->stride * sizeof(float));
+    memcpy(vec, unit, index->dim * sizeof(float));
+
+    memset(index->usernames[node], 0, sizeof(index->usernames[node]));
+    strncpy(index->usernames[node], username, sizeof(index->usernames[node]) - 1);
+    index->levels[node] = (uint8_t)level;
+    index->tombstones[node] = 0;
+    node_links(index, node, 0)[0] = 0;
+    index->links_upper[node] = NULL;
+
+    if (level > 0) {
+        index->links_upper[node] = (uint32_t*)calloc((size_t)level * (index->m + 1), sizeof(uint32_t));
+        if (!index->links_upper[node]) {
+            return -1;
+        }
+    }
+
+    index->count++;
+    return 0;
+}
+
+/**
+ * Create an empty index
+ */
+HNSWIndex* hnsw_create(size_t dim, size_t m, size_t ef_construction) {
+    if (dim == 0 || m < 2 || ef_construction == 0) {
+        log_message(NL_LOG_ERROR, "Invalid HNSW parameters");
+        return NULL;
+    }
+
+    HNSWIndex *index = (HNSWIndex*)calloc(1, sizeof(HNSWIndex));
+    if (!index) {
+        log_message(NL_LOG_ERROR, "Failed to allocate HNSWIndex structure");
+        return NULL;
+    }
+
+    index->dim = dim;
+    index->stride = (dim + 7) & ~(size_t)7;
+    index->m = m;
+    index->m0 = 2 * m;
+    index->ef_construction = ef_construction;
+    index->level_mult = 1.0 / log((double)m);
+    index->max_level = -1;
+    index->rng_state = 0x9E3779B97F4A7C15ULL;
+    index->map_slots = 1024;
+    index->map = (uint32_t*)calloc(index->map_slots, sizeof(uint32_t));
+
+    if (!index->map || ensure_capacity(index, HNSW_INITIAL_CAPACITY) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to allocate HNSW index");
+        hnsw_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+/**
+ * Free an index
+ */
+void hnsw_free(HNSWIndex *index) {
+    if (index) {
+        if (index->vectors) {
+            secure_wipe(index->vectors, index->count * index->stride * sizeof(float));
+            free(index->vectors);
+        }
+        if (index->links_upper) {
+            for (size_t i = 0; i < index->count; i++) {
+                free(index->links_upper[i]);
+            }
+            free(index->links_upper);
+        }
+        free(index->usernames);
+        free(index->levels);
+        free(index->tombstones);
+        free(index->links0);
+        free(index->map);
+        free(index);
+    }
+}
+
+/**
+ * Insert or replace a user's vector
+ */
+int hnsw_insert(HNSWIndex *index, const char *username, const float *features) {
+    if (!index || !username || !features || username[0] == '\0') {
+        log_message(NL_LOG_ERROR, "Invalid input for HNSW insert");
+        return -1;
+    }
+
+    float unit[index->dim];
+    if (vector_normalize(features, unit, index->dim) < 1e-6f) {
+        log_message(NL_LOG_ERROR, "Refusing to index zero magnitude vector for %s", username);
+        return -1;
+    }
+
+    // Re-enrolment reuses the user's node: same level, new vector and links
+    size_t slot = map_find_slot(index, username);
+    if (slot != SIZE_MAX) {
+        uint32_t node = index->map[slot] - 1;
+        memcpy(index->vectors + (size_t)node * index->stride, unit, sizeof(unit));
+        if (index->tombstones[node]) {
+            index->tombstones[node] = 0;
+            index->deleted--;
+        }
+
+        int result = connect_node(index, node, index->levels[node]);
+        if (result != 0) {
+            log_message(NL_LOG_ERROR, "Failed to re-index template for %s", username);
+            index->tombstones[node] = 1;
+            index->deleted++;
+        }
+        secure_wipe(unit, sizeof(unit));
+        return result;
+    }
+
+    uint32_t node = (uint32_t)index->count;
+    if (append_node(index, username, unit, random_level(index)) != 0 ||
+        connect_node(index, node, index->levels[node]) != 0 ||
+        map_insert(index, node) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to index template for %s", username);
+        if (index->count > node && !index->tombstones[node]) {
+            // Partially linked node: keep it for routing but never return it
+            index->tombstones[node] = 1;
+            index->deleted++;
+        }
+        secure_wipe(unit, sizeof(unit));
+        return -1;
+    }
+
+    secure_wipe(unit, sizeof(unit));
+    return 0;
+}
+
+/**
+ * Rebuild the graph from its live nodes once tombstones pass
+ * HNSW_COMPACT_PERCENT, so the node count and the search-time beam widening
+ * stay bounded. Nodes keep their levels. On failure the graph is left as is.
+ */
+static void compact_if_needed(HNSWIndex *index) {
+    if (index->count < HNSW_COMPACT_MIN_NODES ||
+        index->deleted * 100 <= index->count * HNSW_COMPACT_PERCENT) {
+        return;
+    }
+
+    HNSWIndex *fresh = hnsw_create(index->dim, index->m, index->ef_construction);
+    int failed = !fresh || ensure_capacity(fresh, index->count - index->deleted) != 0;
+
+    for (size_t node = 0; node < index->count && !failed; node++) {
+        if (index->tombstones[node]) continue;
+
+        uint32_t copy = (uint32_t)fresh->count;
+        failed = append_node(fresh, index->usernames[node], node_vector(index, (uint32_t)node),
+                             index->levels[node]) != 0 ||
+                 connect_node(fresh, copy, fresh->levels[copy]) != 0 ||
+                 map_insert(fresh, copy) != 0;
+    }
+
+    if (failed) {
+        log_message(NL_LOG_WARNING, "Failed to compact HNSW index, keeping %zu tombstones", index->deleted);
+        hnsw_free(fresh);
+        return;
+    }
+
+    size_t dropped = index->deleted;
+    fresh->rng_state = index->rng_state;
+
+    // Swap contents so callers' pointers stay valid, then free the old graph
+    HNSWIndex old = *index;
+    *index = *fresh;
+    *fresh = old;
+    hnsw_free(fresh);
+
+    log_message(NL_LOG_INFO, "Compacted HNSW index, dropped %zu tombstoned nodes", dropped);
+}
+
+/**
+ * Tombstone a user's vector
+ */
+int hnsw_remove(HNSWIndex *index, const char *username) {
+    if (!index || !username) {
+        return -1;
+    }
+
+    size_t slot = map_find_slot(index, username);
+    if (slot == SIZE_MAX || index->tombstones[index->map[slot] - 1]) {
+        return -1;
+    }
+
+    index->tombstones[index->map[slot] - 1] = 1;
+    index->deleted++;
+    compact_if_needed(index);
+    return 0;
+}
+
+/**
+ * Find the k nearest live vectors to a probe
+ */
+int hnsw_search(const HNSWIndex *index, const FeatureVector *probe, size_t k, size_t ef,
+                IdentifyMatch *matches, size_t *num_matches) {
+    if (!index || !probe || !probe->features || !matches || !num_matches || k == 0) {
+        log_message(NL_LOG_ERROR, "Invalid input for HNSW search");
+        return -1;
+    }
+
+    if (probe->size != index->dim) {
+        log_message(NL_LOG_ERROR, "Probe has %zu features, index has %zu", probe->size, index->dim);
+        return -1;
+    }
+
+    *num_matches = 0;
+    if (index->max_level < 0 || index->count == index->deleted) {
+        return 0;
+    }
+
+    float query[index->stride];
+    memset(query, 0, sizeof(query));
+    if (vector_normalize(probe->features, query, index->dim) < 1e-6f) {
+        log_message(NL_LOG_ERROR, "Zero magnitude probe");
+        return -1;
+    }
+
+    // Widen the beam by the tombstone ratio so deleted nodes don't crowd out results
+    if (ef < k) ef = k;
+    ef += ef * index->deleted / index->count;
+
+    uint32_t entry = index->entry_point;
+    float entry_score = similarity(index, query, entry);
+    for (int l = index->max_level; l > 0; l--) {
+        entry = greedy_search(index, query, entry, &entry_score, l);
+    }
+
+    Heap results;
+    if (heap_init(&results, ef + 1) != 0) {
+        return -1;
+    }
+    heap_push(&results, entry_score, entry);
+
+    int result = search_layer(index, query, &results, ef, 0);
+    if (result == 0) {
+        qsort(results.items, results.count, sizeof(HeapItem), compare_desc);
+
+        size_t found = 0;
+        for (size_t i = 0; i < results.count && found < k; i++) {
+            uint32_t node = results.items[i].node;
+            if (index->tombstones[node]) continue;
+
+            float score = results.items[i].score;
+            if (score < 0.0f) score = 0.0f;
+            if (score > 1.0f) score = 1.0f;
+
+            memcpy(matches[found].username, index->usernames[node], sizeof(matches[found].username));
+            matches[found].similarity = score;
+            matches[found].index = node;
+            found++;
+        }
+        *num_matches = found;
+    }
+
+    secure_wipe(query, sizeof(query));
+    free(results.items);
+    return result;
+}
+
+/**
+ * Number of live (non-deleted) vectors
+ */
+size_t hnsw_count(const HNSWIndex *index) {
+    return index ? index->count - index->deleted : 0;
+}
+
+/**
+ * Features per indexed vector
+ */
+size_t hnsw_dim(const HNSWIndex *index) {
+    return index ? index->dim : 0;
+}
+
+/* Visitor state for hnsw_build */
+typedef struct {
+    HNSWIndex *index;
+    int failed;
+} BuildContext;
+
+static int index_record(const TemplateRecord *record, void *ctx) {
+    BuildContext *build = (BuildContext*)ctx;
+
+    if (record->feature_count != build->index->dim) {
+        log_message(NL_LOG_WARNING, "Skipping template with %u features: %.64s",
+                    record->feature_count, record->username);
+        return 0;
+    }
+
+    char username[64];
+    memcpy(username, record->username, sizeof(username));
+    username[63] = '\0';
+    if (hnsw_insert(build->index, username, record->features) != 0) {
+        build->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Build an index from every template in the database
+ */
+HNSWIndex* hnsw_build(TemplateDB *db) {
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Invalid template database for HNSW build");
+        return NULL;
+    }
+
+    HNSWIndex *index = hnsw_create(FEATURE_VECTOR_SIZE, HNSW_M, HNSW_EF_CONSTRUCTION);
+    if (!index) {
+        return NULL;
+    }
+    if (ensure_capacity(index, template_db_count(db)) != 0) {
+        hnsw_free(index);
+        return NULL;
+    }
+
+    BuildContext build = { index, 0 };
+    template_db_foreach(db, index_record, &build);
+    if (build.failed) {
+        hnsw_free(index);
+        return NULL;
+    }
+
+    log_message(NL_LOG_INFO, "Built HNSW index over %zu templates", hnsw_count(index));
+    return index;
+}
+
+/* ---- Serialization ---- */
+
+/*
+ * File layout (little-endian):
+ *   header (64 bytes): magic, version, dim, m, ef_construction, count,
+ *                      entry_point, max_level (i32), deleted, rng_state (u64)
+ *   per node: username[64], level u8, tombstone u8, reserved u16,
+ *             features f32[dim], then for each layer 0..level:
+ *             count u32, links u32[capacity] (capacity = 2m on layer 0, else m)
+ */
+
+static size_t node_record_size(const HNSWIndex *index, int level) {
+    return 68 + index->dim * 4 + (index->m0 + 1) * 4 + (size_t)level * (index->m + 1) * 4;
+}
+
+/**
+ * Write the index to a file (temp file + rename)
+ */
+int hnsw_save(const HNSWIndex *index, const char *path) {
+    if (!index || !path) {
+        return -1;
+    }
+
+    char tmp_path[520];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        log_message(NL_LOG_ERROR, "HNSW index path too long: %s", path);
+        return -1;
+    }
+
+    // Vectors are template material, so keep the file private like the database
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!file) {
+        if (fd >= 0) close(fd);
+        log_message(NL_LOG_ERROR, "Failed to create HNSW index file: %s", tmp_path);
+        return -1;
+    }
+
+    uint8_t header[HNSW_FILE_HEADER_SIZE] = {0};
+    store_le32(header + 0, HNSW_FILE_MAGIC);
+    store_le32(header + 4, HNSW_FILE_VERSION);
+    store_le32(header + 8, (uint32_t)index->dim);
+    store_le32(header + 12, (uint32_t)index->m);
+    store_le32(header + 16, (uint32_t)index->ef_construction);
+    store_le32(header + 20, (uint32_t)index->count);
+    store_le32(header + 24, index->entry_point);
+    store_le32(header + 28, (uint32_t)index->max_level);
+    store_le32(header + 32, (uint32_t)index->deleted);
+    store_le64(header + 36, index->rng_state);
+
+    uint8_t *buffer = (uint8_t*)malloc(node_record_size(index, HNSW_MAX_LEVEL));
+    int failed = !buffer || fwrite(header, sizeof(header), 1, file) != 1;
+
+    for (size_t node = 0; node < index->count && !failed; node++) {
+        int level = index->levels[node];
+        uint8_t *p = buffer;
+
+        memcpy(p, index->usernames[node], 64);
+        p[64] = (uint8_t)level;
+        p[65] = index->tombstones[node];
+        p[66] = p[67] = 0;
+        p += 68;
+
+        const float *vec = node_vector(index, (uint32_t)node);
+        for (size_t i = 0; i < index->dim; i++, p += 4) {
+            store_le_f32(p, vec[i]);
+        }
+        for (int l = 0; l <= level; l++) {
+            const uint32_t *links = node_links(index, (uint32_t)node, l);
+            size_t slots = (l == 0 ? index->m0 : index->m) + 1;
+            for (size_t i = 0; i < slots; i++, p += 4) {
+                store_le32(p, i <= links[0] ? links[i] : 0);
+            }
+        }
+
+        failed = fwrite(buffer, (size_t)(p - buffer), 1, file) != 1;
+    }
+
+    if (buffer) {
+        secure_wipe(buffer, node_record_size(index, HNSW_MAX_LEVEL));
+        free(buffer);
+    }
+
+    failed = failed || fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed = fclose(file) != 0 || failed;
+    if (failed || rename(tmp_path, path) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to write HNSW index: %s", path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Read an index written by hnsw_save
+ */
+HNSWIndex* hnsw_load(const char *path) {
+    if (!path) {
+        return NULL;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        log_message(NL_LOG_ERROR, "Failed to open HNSW index file: %s", path);
+        return NULL;
+    }
+
+    uint8_t header[HNSW_FILE_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+        load_le32(header) != HNSW_FILE_MAGIC || load_le32(header + 4) != HNSW_FILE_VERSION) {
+        log_message(NL_LOG_ERROR, "Not a NeuroLock HNSW index: %s", path);
+        fclose(file);
+        return NULL;
+    }
+
+    size_t count = load_le32(header + 20);
+    HNSWIndex *index = hnsw_create(load_le32(header + 8), load_le32(header + 12), load_le32(header + 16));
+    if (!index || ensure_capacity(index, count) != 0) {
+        hnsw_free(index);
+        fclose(file);
+        return NULL;
+    }
+
+    uint32_t entry_point = load_le32(header + 24);
+    int max_level = (int32_t)load_le32(header + 28);
+    size_t deleted = load_le32(header + 32);
+    index->rng_state = load_le64(header + 36);
+
+    uint8_t *buffer = (uint8_t*)malloc(node_record_size(index, HNSW_MAX_LEVEL));
+    float *unit = (float*)malloc(index->dim * sizeof(float));
+    int failed = !buffer || !unit;
+
+    for (size_t node = 0; node < count && !failed; node++) {
+        if (fread(buffer, 68, 1, file) != 1 || buffer[64] > HNSW_MAX_LEVEL) {
+            failed = 1;
+            break;
+        }
+
+        int level = buffer[64];
+        size_t body = node_record_size(index, level) - 68;
+        if (fread(buffer + 68, body, 1, file) != 1) {
+            failed = 1;
+            break;
+        }
+
+        char username[64];
+        memcpy(username, buffer, sizeof(username));
+        username[63] = '\0';
+
+        const uint8_t *p = buffer + 68;
+        for (size_t i = 0; i < index->dim; i++, p += 4) {
+            unit[i] = load_le_f32(p);
+        }
+        if (append_node(index, username, unit, level) != 0) {
+            failed = 1;
+            break;
+        }
+        index->tombstones[node] = buffer[65] ? 1 : 0;
+
+        for (int l = 0; l <= level && !failed; l++) {
+            uint32_t *links = node_links(index, (uint32_t)node, l);
+            size_t max_links = l == 0 ? index->m0 : index->m;
+            links[0] = load_le32(p);
+            failed = links[0] > max_links;
+            for (size_t i = 1; i <= max_links; i++) {
+                links[i] = load_le32(p + i * 4);
+                if (i <= links[0] && links[i] >= count) failed = 1;
+            }
+            p += (max_links + 1) * 4;
+        }
+
+        // A failed insert can leave a tombstoned copy of a user ahead of
+        // their live node; the map points at the live one
+        size_t slot = failed ? SIZE_MAX : map_find_slot(index, username);
+        if (!failed && slot == SIZE_MAX) {
+            failed = map_insert(index, (uint32_t)node) != 0;
+        } else if (!failed && !index->tombstones[node]) {
+            failed = !index->tombstones[index->map[slot] - 1];
+            index->map[slot] = (uint32_t)node + 1;
+        }
+    }
+
+    if (buffer) {
+        secure_wipe(buffer, node_record_size(index, HNSW_MAX_LEVEL));
+        free(buffer);
+    }
+    if (unit) {
+        secure_wipe(unit, index->dim * sizeof(float));
+        free(unit);
+    }
+    fclose(file);
+
+    if (!failed && count > 0 && (entry_point >= count || max_level != index->levels[entry_point])) {
+        failed = 1;
+    }
+
+    // Upper-layer links must point at nodes that exist on that layer, and the
+    // header's deleted count must match the tombstones actually stored
+    size_t tombstoned = 0;
+    for (size_t node = 0; node < index->count && !failed; node++) {
+        tombstoned += index->tombstones[node];
+        for (int l = 1; l <= index->levels[node] && !failed; l++) {
+            const uint32_t *links = node_links(index, (uint32_t)node, l);
+            for (uint32_t i = 1; i <= links[0]; i++) {
+                if (index->levels[links[i]] < l) {
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+    }
+    if (!failed && deleted != tombstoned) {
+        failed = 1;
+    }
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Corrupt HNSW index file: %s", path);
+        hnsw_free(index);
+        return NULL;
+    }
+
+    index->entry_point = entry_point;
+    index->max_level = count > 0 ? max_level : -1;
+    index->deleted = deleted;
+    return index;
+}
@@ -0,0 +1,442 @@
+#define _DEFAULT_SOURCE
+#include "identify.h"
+#include "vector_ops.h"
+#include "template.h"
+#include "utils.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Rows scored per matvec call; scores for a block stay in L1 */
+#define IDENTIFY_BLOCK_ROWS 1024
+
+/* Min-heap entry for per-slice top-k selection */
+typedef struct {
+    float score;
+    size_t index;
+} HeapItem;
+
+/* Slice of the matrix scanned by one task */
+typedef struct {
+    const TemplateMatrix *matrix;
+    const float *probe;
+    const int8_t *probe_codes;      // Quantized probe (quantized matrices only)
+    float probe_scale;
+    float probe_sum;                // Sum of probe codes, pairs with zero points
+    size_t begin;
+    size_t end;
+    size_t k;
+    HeapItem *heap;
+    size_t count;
+} ScanTask;
+
+static void heap_sift_down(HeapItem *heap, size_t n, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t l = 2 * i + 1;
+        size_t r = l + 1;
+        if (l < n && heap[l].score < heap[smallest].score) smallest = l;
+        if (r < n && heap[r].score < heap[smallest].score) smallest = r;
+        if (smallest == i) return;
+        HeapItem tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/**
+ * Offer a candidate to a bounded min-heap holding the k best scores
+ */
+static void heap_offer(HeapItem *heap, size_t *count, size_t k, float score, size_t index) {
+    if (*count < k) {
+        size_t i = (*count)++;
+        heap[i].score = score;
+        heap[i].index = index;
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent].score <= heap[i].score) break;
+            HeapItem tmp = heap[i];
+            heap[i] = heap[parent];
+            heap[parent] = tmp;
+            i = parent;
+        }
+    } else if (score > heap[0].score) {
+        heap[0].score = score;
+        heap[0].index = index;
+        heap_sift_down(heap, k, 0);
+    }
+}
+
+/**
+ * Score a block of quantized rows
+ * dot(x, p) = probe_scale * (scale * sum(code * p_code) + zero_point * sum(p_code))
+ */
+static void score_quantized(const ScanTask *task, size_t block, size_t n, float *scores) {
+    const TemplateMatrix *m = task->matrix;
+    int32_t dots[IDENTIFY_BLOCK_ROWS];
+
+    matvec_u8s8(m->codes + block * m->stride, n, m->stride, m->stride, task->probe_codes, dots);
+    for (size_t i = 0; i < n; i++) {
+        scores[i] = task->probe_scale *
+                    (m->scales[block + i] * (float)dots[i] + m->zero_points[block + i] * task->probe_sum);
+    }
+}
+
+static void scan_range(ScanTask *task) {
+    const TemplateMatrix *m = task->matrix;
+    float scores[IDENTIFY_BLOCK_ROWS];
+
+    for (size_t block = task->begin; block < task->end; block += IDENTIFY_BLOCK_ROWS) {
+        size_t n = task->end - block;
+        if (n > IDENTIFY_BLOCK_ROWS) n = IDENTIFY_BLOCK_ROWS;
+
+        if (m->codes) {
+            score_quantized(task, block, n, scores);
+        } else {
+            matvec_f32(m->matrix + block * m->stride, n, m->stride, m->stride, task->probe, scores);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (task->count < task->k || scores[i] > task->heap[0].score) {
+                heap_offer(task->heap, &task->count, task->k, scores[i], block + i);
+            }
+        }
+    }
+}
+
+static void scan_task(void *arg) {
+    scan_range((ScanTask*)arg);
+}
+
+static size_t identify_slice_count(size_t rows) {
+    size_t slices = IDENTIFY_MAX_THREADS > 0 ? (size_t)IDENTIFY_MAX_THREADS
+                                             : scheduler_concurrency(scheduler_shared());
+
+    size_t by_work = rows / IDENTIFY_MIN_ROWS_PER_THREAD;
+    if (by_work < 1) by_work = 1;
+
+    return by_work < slices ? by_work : slices;
+}
+
+/* Visitor state for template_matrix_build */
+typedef struct {
+    TemplateMatrix *matrix;
+    size_t row;
+} BuildContext;
+
+static int pack_record(const TemplateRecord *record, void *ctx) {
+    BuildContext *build = (BuildContext*)ctx;
+    TemplateMatrix *m = build->matrix;
+
+    if (build->row >= m->num_templates) {
+        return 1;
+    }
+    if (record->feature_count != m->dim) {
+        log_message(NL_LOG_WARNING, "Skipping template with %u features: %.64s",
+                    record->feature_count, record->username);
+        return 0;
+    }
+
+    float *row = m->matrix + build->row * m->stride;
+    vector_normalize(record->features, row, m->dim);
+    memcpy(m->usernames[build->row], record->username, 64);
+    m->usernames[build->row][63] = '\0';
+    m->task_types[build->row] = (MentalTask)record->task_type;
+    build->row++;
+    return 0;
+}
+
+/**
+ * Allocate an empty template matrix
+ */
+TemplateMatrix* template_matrix_alloc(size_t rows, size_t dim) {
+    TemplateMatrix *m = (TemplateMatrix*)calloc(1, sizeof(TemplateMatrix));
+    if (!m) {
+        log_message(NL_LOG_ERROR, "Failed to allocate TemplateMatrix structure");
+        return NULL;
+    }
+
+    m->dim = dim;
+    m->stride = (dim + 7) & ~(size_t)7;
+    m->num_templates = rows;
+
+    size_t alloc_rows = rows > 0 ? rows : 1;
+    m->matrix = (float*)aligned_alloc(32, alloc_rows * m->stride * sizeof(float));
+    m->usernames = calloc(alloc_rows, sizeof(*m->usernames));
+    m->task_types = (MentalTask*)calloc(alloc_rows, sizeof(MentalTask));
+    if (!m->matrix || !m->usernames || !m->task_types) {
+        log_message(NL_LOG_ERROR, "Failed to allocate template matrix (%zu rows)", rows);
+        template_matrix_free(m);
+        return NULL;
+    }
+    memset(m->matrix, 0, alloc_rows * m->stride * sizeof(float));
+
+    return m;
+}
+
+/**
+ * Pack every template in the database into a normalized feature matrix
+ */
+TemplateMatrix* template_matrix_build(TemplateDB *db) {
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Invalid template database for matrix build");
+        return NULL;
+    }
+
+    TemplateMatrix *m = template_matrix_alloc(template_db_count(db), FEATURE_VECTOR_SIZE);
+    if (!m) {
+        return NULL;
+    }
+
+    BuildContext build = { m, 0 };
+    template_db_foreach(db, pack_record, &build);
+    m->num_templates = build.row;
+
+    log_message(NL_LOG_INFO, "Packed %zu templates for identification", m->num_templates);
+    return m;
+}
+
+/**
+ * Free a template matrix
+ */
+void template_matrix_free(TemplateMatrix *matrix) {
+    if (matrix) {
+        if (matrix->matrix) {
+            secure_wipe(matrix->matrix, matrix->num_templates * matrix->stride * sizeof(float));
+            free(matrix->matrix);
+        }
+        if (matrix->codes) {
+            secure_wipe(matrix->codes, matrix->num_templates * matrix->stride);
+            free(matrix->codes);
+        }
+        free(matrix->scales);
+        free(matrix->zero_points);
+        free(matrix->usernames);
+        free(matrix->task_types);
+        free(matrix);
+    }
+}
+
+/**
+ * Replace the float rows with per-template affine int8 codes
+ */
+int template_matrix_quantize(TemplateMatrix *matrix) {
+    if (!matrix || !matrix->matrix) {
+        log_message(NL_LOG_ERROR, "Invalid matrix for quantization");
+        return -1;
+    }
+
+    size_t rows = matrix->num_templates > 0 ? matrix->num_templates : 1;
+    uint8_t *codes = (uint8_t*)aligned_alloc(32, ((rows * matrix->stride + 31) & ~(size_t)31));
+    float *scales = (float*)malloc(rows * sizeof(float));
+    float *zero_points = (float*)malloc(rows * sizeof(float));
+    if (!codes || !scales || !zero_points) {
+        log_message(NL_LOG_ERROR, "Failed to allocate quantized matrix (%zu rows)", matrix->num_templates);
+        free(codes);
+        free(scales);
+        free(zero_points);
+        return -1;
+    }
+    memset(codes, 0, rows * matrix->stride);
+
+    for (size_t r = 0; r < matrix->num_templates; r++) {
+        const float *row = matrix->matrix + r * matrix->stride;
+        float lo = row[0], hi = row[0];
+        for (size_t c = 1; c < matrix->dim; c++) {
+            if (row[c] < lo) lo = row[c];
+            if (row[c] > hi) hi = row[c];
+        }
+
+        // Affine map [lo, hi] -> [0, QUANT_TEMPLATE_MAX]; padding stays 0 and
+        // is multiplied by zero probe padding
+        float scale = hi > lo ? (hi - lo) / QUANT_TEMPLATE_MAX : 1.0f;
+        uint8_t *code = codes + r * matrix->stride;
+        for (size_t c = 0; c < matrix->dim; c++) {
+            long q = lroundf((row[c] - lo) / scale);
+            code[c] = (uint8_t)(q < 0 ? 0 : q > QUANT_TEMPLATE_MAX ? QUANT_TEMPLATE_MAX : q);
+        }
+        scales[r] = scale;
+        zero_points[r] = lo;
+    }
+
+    secure_wipe(matrix->matrix, matrix->num_templates * matrix->stride * sizeof(float));
+    free(matrix->matrix);
+    matrix->matrix = NULL;
+    matrix->codes = codes;
+    matrix->scales = scales;
+    matrix->zero_points = zero_points;
+    return 0;
+}
+
+static int compare_matches(const void *a, const void *b) {
+    float sa = ((const HeapItem*)a)->score;
+    float sb = ((const HeapItem*)b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * Identify the k most similar enrolled users for a probe (1:N)
+ */
+int template_identify(const TemplateMatrix *matrix, const FeatureVector *probe, size_t k,
+                      IdentifyMatch *matches, size_t *num_matches) {
+    if (!matrix || !probe || !probe->features || !matches || !num_matches || k == 0) {
+        log_message(NL_LOG_ERROR, "Invalid input for identification");
+        return -1;
+    }
+
+    if (probe->size != matrix->dim) {
+        log_message(NL_LOG_ERROR, "Probe has %zu features, templates have %zu", probe->size, matrix->dim);
+        return -1;
+    }
+
+    *num_matches = 0;
+    if (matrix->num_templates == 0) {
+        return 0;
+    }
+    if (k > matrix->num_templates) {
+        k = matrix->num_templates;
+    }
+
+    // Normalized, zero-padded probe so each score is a plain dot product
+    float *unit_probe = (float*)aligned_alloc(32, matrix->stride * sizeof(float));
+    if (!unit_probe) {
+        return -1;
+    }
+    memset(unit_probe, 0, matrix->stride * sizeof(float));
+    if (vector_normalize(probe->features, unit_probe, matrix->dim) < 1e-6f) {
+        log_message(NL_LOG_ERROR, "Zero magnitude probe");
+        free(unit_probe);
+        return -1;
+    }
+
+    // Symmetric int8 probe for quantized matrices
+    int8_t *probe_codes = NULL;
+    float probe_scale = 0.0f;
+    float probe_sum = 0.0f;
+    if (matrix->codes) {
+        probe_codes = (int8_t*)calloc(matrix->stride, 1);
+        if (!probe_codes) {
+            free(unit_probe);
+            return -1;
+        }
+        float peak = 0.0f;
+        for (size_t c = 0; c < matrix->dim; c++) {
+            if (fabsf(unit_probe[c]) > peak) peak = fabsf(unit_probe[c]);
+        }
+        probe_scale = peak / QUANT_PROBE_MAX;
+        int32_t sum = 0;
+        for (size_t c = 0; c < matrix->dim; c++) {
+            probe_codes[c] = (int8_t)lroundf(unit_probe[c] / probe_scale);
+            sum += probe_codes[c];
+        }
+        probe_sum = (float)sum;
+    }
+
+    size_t num_slices = identify_slice_count(matrix->num_templates);
+    ScanTask *tasks = (ScanTask*)calloc(num_slices, sizeof(ScanTask));
+    HeapItem *heaps = (HeapItem*)malloc(num_slices * k * sizeof(HeapItem));
+    TaskGroup *group = task_group_create(scheduler_shared());
+    if (!tasks || !heaps || !group) {
+        task_group_free(group);
+        free(tasks);
+        free(heaps);
+        free(unit_probe);
+        free(probe_codes);
+        return -1;
+    }
+
+    size_t per_slice = (matrix->num_templates + num_slices - 1) / num_slices;
+    for (size_t t = 0; t < num_slices; t++) {
+        tasks[t].matrix = matrix;
+        tasks[t].probe = unit_probe;
+        tasks[t].probe_codes = probe_codes;
+        tasks[t].probe_scale = probe_scale;
+        tasks[t].probe_sum = probe_sum;
+        tasks[t].begin = t * per_slice;
+        tasks[t].end = tasks[t].begin + per_slice;
+        if (tasks[t].end > matrix->num_templates) tasks[t].end = matrix->num_templates;
+        if (tasks[t].begin > tasks[t].end) tasks[t].begin = tasks[t].end;
+        tasks[t].k = k;
+        tasks[t].heap = heaps + t * k;
+    }
+
+    // Slices run on the shared scheduler; this thread scans too while it waits
+    for (size_t t = 0; t < num_slices; t++) {
+        task_group_spawn(group, scan_task, &tasks[t]);
+    }
+    task_group_wait(group);
+    task_group_free(group);
+
+    // Merge per-slice heaps
+    size_t total = 0;
+    for (size_t t = 0; t < num_slices; t++) {
+        memmove(heaps + total, tasks[t].heap, tasks[t].count * sizeof(HeapItem));
+        total += tasks[t].count;
+    }
+    qsort(heaps, total, sizeof(HeapItem), compare_matches);
+    if (total > k) total = k;
+
+    for (size_t i = 0; i < total; i++) {
+        float similarity = heaps[i].score;
+        if (similarity < 0.0f) similarity = 0.0f;
+        if (similarity > 1.0f) similarity = 1.0f;
+
+        memcpy(matches[i].username, matrix->usernames[heaps[i].index], sizeof(matches[i].username));
+        matches[i].similarity = similarity;
+        matches[i].index = heaps[i].index;
+    }
+    *num_matches = total;
+
+    secure_wipe(unit_probe, matrix->stride * sizeof(float));
+    free(unit_probe);
+    if (probe_codes) {
+        secure_wipe(probe_codes, matrix->stride);
+        free(probe_codes);
+    }
+    free(tasks);
+    free(heaps);
+    return 0;
+}
+
+static int compare_identify_matches(const void *a, const void *b) {
+    float sa = ((const IdentifyMatch*)a)->similarity;
+    float sb = ((const IdentifyMatch*)b)->similarity;
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * Rescore approximate candidates with exact cosine similarity from the database
+ */
+int template_rerank(TemplateDB *db, const FeatureVector *probe, IdentifyMatch *matches,
+                    size_t *num_matches, size_t k) {
+    if (!db || !probe || !matches || !num_matches) {
+        log_message(NL_LOG_ERROR, "Invalid input for rerank");
+        return -1;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < *num_matches; i++) {
+        const TemplateRecord *record = template_db_find(db, matches[i].username);
+        if (!record || record->feature_count != probe->size) {
+            continue;
+        }
+
+        FeatureVector enrolled = { .features = (float*)record->features, .size = record->feature_count };
+        float similarity = fused_similarity(&enrolled, record->exemplars, record->exemplar_count, probe,
+                                            (FusionRule)TEMPLATE_FUSION_RULE);
+        if (similarity < 0.0f) {
+            continue;
+        }
+
+        matches[kept] = matches[i];
+        matches[kept].similarity = similarity;
+        kept++;
+    }
+
+    qsort(matches, kept, sizeof(IdentifyMatch), compare_identify_matches);
+    *num_matches = kept < k ? kept : k;
+    return 0;
+}
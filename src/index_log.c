@@ -0,0 +1,563 @@
+#define _DEFAULT_SOURCE
+#include "index_log.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+/*
+ * Record layout (little-endian):
+ *   op u32, crc u32 (over the record with this field skipped),
+ *   username[64], features f32[FEATURE_VECTOR_SIZE] (zero for a delete)
+ */
+#define INDEX_LOG_RECORD_SIZE (72 + FEATURE_VECTOR_SIZE * 4)
+
+/* Logged operations */
+typedef enum {
+    INDEX_LOG_OP_PUT = 1,
+    INDEX_LOG_OP_DELETE = 2
+} IndexLogOp;
+
+/* What the log needs from each kind of index */
+typedef struct {
+    const char *name;               // For messages
+    const char *type;               // Argument to 'neurolock index'
+    void* (*load)(const char *path);
+    int (*save)(const void *index, const char *path);
+    void (*destroy)(void *index);
+    size_t (*dim)(const void *index);
+    int (*put)(void *index, const char *username, const float *features);
+    int (*remove)(void *index, const char *username);
+} IndexOps;
+
+/* One resident index and how far into its log it has read */
+typedef struct {
+    const IndexOps *ops;
+    char *path;                     // Index file, NULL if not configured
+    void *index;                    // NULL until the file exists and loads
+    uint32_t generation;            // Log generation the index follows
+    off_t applied;                  // Log bytes already applied
+} ResidentIndex;
+
+struct IndexSet {
+    ResidentIndex hnsw;
+    ResidentIndex pq;
+};
+
+/* ---- Index adapters ---- */
+
+static void* load_hnsw(const char *path) {
+    return hnsw_load(path);
+}
+
+static int save_hnsw(const void *index, const char *path) {
+    return hnsw_save((const HNSWIndex*)index, path);
+}
+
+static void free_hnsw(void *index) {
+    hnsw_free((HNSWIndex*)index);
+}
+
+static size_t dim_hnsw(const void *index) {
+    return hnsw_dim((const HNSWIndex*)index);
+}
+
+static int put_hnsw(void *index, const char *username, const float *features) {
+    return hnsw_insert((HNSWIndex*)index, username, features);
+}
+
+static int remove_hnsw(void *index, const char *username) {
+    return hnsw_remove((HNSWIndex*)index, username);
+}
+
+static void* load_pq(const char *path) {
+    return pq_load(path);
+}
+
+static int save_pq(const void *index, const char *path) {
+    return pq_save((const PQIndex*)index, path);
+}
+
+static void free_pq(void *index) {
+    pq_free((PQIndex*)index);
+}
+
+static size_t dim_pq(const void *index) {
+    return ((const PQIndex*)index)->dim;
+}
+
+static int put_pq(void *index, const char *username, const float *features) {
+    return pq_add((PQIndex*)index, username, features);
+}
+
+static int remove_pq(void *index, const char *username) {
+    return pq_remove((PQIndex*)index, username);
+}
+
+static const IndexOps HNSW_OPS = {
+    "HNSW", "hnsw", load_hnsw, save_hnsw, free_hnsw, dim_hnsw, put_hnsw, remove_hnsw
+};
+static const IndexOps PQ_OPS = {
+    "PQ", "pq", load_pq, save_pq, free_pq, dim_pq, put_pq, remove_pq
+};
+
+/* ---- Log file ---- */
+
+static uint32_t record_crc(const uint8_t *record) {
+    uint32_t crc = crc32_update(0, record, 4);
+    return crc32_update(crc, record + 8, INDEX_LOG_RECORD_SIZE - 8);
+}
+
+static int write_header(int fd, uint32_t generation) {
+    uint8_t header[INDEX_LOG_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    store_le32(header, INDEX_LOG_MAGIC);
+    store_le32(header + 4, INDEX_LOG_VERSION);
+    store_le32(header + 8, FEATURE_VECTOR_SIZE);
+    store_le32(header + 12, generation);
+
+    if (pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        ftruncate(fd, INDEX_LOG_HEADER_SIZE) != 0 || fdatasync(fd) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Open "<index>.log" under an exclusive lock, formatting it if it has no
+ * valid header
+ * A new log takes its generation from the clock so it never matches the one
+ * a reader followed in a log that was deleted.
+ * Returns: Locked descriptor, negative on error
+ */
+static int log_open(const char *index_path, uint32_t *generation) {
+    char path[520];
+    if (snprintf(path, sizeof(path), "%s.log", index_path) >= (int)sizeof(path)) {
+        log_message(NL_LOG_ERROR, "Index path too long: %s", index_path);
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open index log: %s", path);
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to lock index log: %s", path);
+        close(fd);
+        return -1;
+    }
+
+    uint8_t header[INDEX_LOG_HEADER_SIZE];
+    if (pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        load_le32(header) == INDEX_LOG_MAGIC && load_le32(header + 4) == INDEX_LOG_VERSION &&
+        load_le32(header + 8) == FEATURE_VECTOR_SIZE) {
+        *generation = load_le32(header + 12);
+        return fd;
+    }
+
+    *generation = (uint32_t)get_timestamp_ms();
+    if (write_header(fd, *generation) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to format index log: %s", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void log_close(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/**
+ * Apply one change; failures leave the index stale but usable
+ */
+static void apply_change(const IndexOps *ops, void *index, const char *username, const float *features) {
+    if (!features) {
+        // Removing a user the index never held is a no-op
+        ops->remove(index, username);
+    } else if (ops->put(index, username, features) != 0) {
+        log_message(NL_LOG_WARNING, "Failed to update %s index for %s; run 'index %s' to rebuild it",
+                    ops->name, username, ops->type);
+    }
+}
+
+/**
+ * Apply whole records from *offset to the end of the log, stopping at a torn
+ * or corrupt tail, and advance *offset past them
+ * index may be NULL to only find the end of the valid records.
+ * Returns: Number of records read
+ */
+static size_t log_replay(int fd, const IndexOps *ops, void *index, off_t *offset) {
+    uint8_t record[INDEX_LOG_RECORD_SIZE];
+    float features[FEATURE_VECTOR_SIZE];
+    size_t count = 0;
+
+    while (pread(fd, record, sizeof(record), *offset) == (ssize_t)sizeof(record)) {
+        uint32_t op = load_le32(record);
+        if ((op != INDEX_LOG_OP_PUT && op != INDEX_LOG_OP_DELETE) ||
+            record_crc(record) != load_le32(record + 4)) {
+            break;
+        }
+
+        if (index) {
+            char username[64];
+            memcpy(username, record + 8, sizeof(username));
+            username[63] = '\0';
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                features[i] = load_le_f32(record + 72 + i * 4);
+            }
+            apply_change(ops, index, username, op == INDEX_LOG_OP_PUT ? features : NULL);
+        }
+        *offset += INDEX_LOG_RECORD_SIZE;
+        count++;
+    }
+
+    secure_wipe(record, sizeof(record));
+    secure_wipe(features, sizeof(features));
+    return count;
+}
+
+/**
+ * Append one record at offset, dropping any torn tail beyond it
+ */
+static int log_append(int fd, off_t offset, const char *username, const float *features) {
+    uint8_t record[INDEX_LOG_RECORD_SIZE];
+    memset(record, 0, sizeof(record));
+    store_le32(record, features ? INDEX_LOG_OP_PUT : INDEX_LOG_OP_DELETE);
+    strncpy((char*)record + 8, username, 63);
+    for (size_t i = 0; features && i < FEATURE_VECTOR_SIZE; i++) {
+        store_le_f32(record + 72 + i * 4, features[i]);
+    }
+    store_le32(record + 4, record_crc(record));
+
+    int failed = ftruncate(fd, offset) != 0 ||
+                 pwrite(fd, record, sizeof(record), offset) != (ssize_t)sizeof(record) ||
+                 fdatasync(fd) != 0;
+    secure_wipe(record, sizeof(record));
+    return failed ? -1 : 0;
+}
+
+/**
+ * Load an index file and replay its whole log
+ * Caller holds the log lock.
+ */
+static void* load_locked(int fd, const IndexOps *ops, const char *path, off_t *applied) {
+    void *index = ops->load(path);
+    if (!index) {
+        return NULL;
+    }
+    if (ops->dim(index) != FEATURE_VECTOR_SIZE) {
+        log_message(NL_LOG_ERROR, "%s index has %zu features, templates have %d: %s",
+                    ops->name, ops->dim(index), FEATURE_VECTOR_SIZE, path);
+        ops->destroy(index);
+        return NULL;
+    }
+
+    *applied = INDEX_LOG_HEADER_SIZE;
+    log_replay(fd, ops, index, applied);
+    return index;
+}
+
+/**
+ * Save an index with the rest of the log applied, then cut the log back to
+ * its header under the next generation
+ * Caller holds the log lock. A crash between the two steps only leaves
+ * records that replay onto the new file without effect.
+ */
+static int snapshot_locked(int fd, const IndexOps *ops, const char *path, void *index,
+                           off_t *applied, uint32_t *generation) {
+    log_replay(fd, ops, index, applied);
+    if (ops->save(index, path) != 0) {
+        return -1;
+    }
+    if (write_header(fd, *generation + 1) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to truncate %s index log: %s.log", ops->name, path);
+        return -1;
+    }
+    *generation += 1;
+    *applied = INDEX_LOG_HEADER_SIZE;
+    return 0;
+}
+
+/* ---- One-shot access ---- */
+
+static void* load_logged(const IndexOps *ops, const char *path) {
+    uint32_t generation;
+    int fd = log_open(path, &generation);
+    if (fd < 0) {
+        log_message(NL_LOG_WARNING, "Loading %s index without its change log", ops->name);
+        return ops->load(path);
+    }
+
+    off_t applied;
+    void *index = load_locked(fd, ops, path, &applied);
+    log_close(fd);
+    return index;
+}
+
+static int save_logged(const IndexOps *ops, const char *path, void *index) {
+    if (!path || !index) {
+        return -1;
+    }
+
+    uint32_t generation;
+    int fd = log_open(path, &generation);
+    if (fd < 0) {
+        // Stale records replay harmlessly onto the new file
+        return ops->save(index, path);
+    }
+
+    off_t applied = INDEX_LOG_HEADER_SIZE;
+    int result = snapshot_locked(fd, ops, path, index, &applied, &generation);
+    log_close(fd);
+    return result;
+}
+
+/**
+ * Append a change to one index's log, snapshotting it once the log is long
+ */
+static int record_logged(const IndexOps *ops, const char *path, const char *username,
+                         const float *features) {
+    uint32_t generation;
+    int fd = log_open(path, &generation);
+    if (fd < 0) {
+        return -1;
+    }
+
+    off_t end = INDEX_LOG_HEADER_SIZE;
+    size_t records = log_replay(fd, ops, NULL, &end);
+    if (log_append(fd, end, username, features) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to log %s index change: %s.log", ops->name, path);
+        log_close(fd);
+        return -1;
+    }
+
+    if (records + 1 >= INDEX_LOG_SNAPSHOT_RECORDS) {
+        off_t applied;
+        void *index = load_locked(fd, ops, path, &applied);
+        if (!index || snapshot_locked(fd, ops, path, index, &applied, &generation) != 0) {
+            log_message(NL_LOG_WARNING, "Failed to snapshot %s index; its log keeps growing", ops->name);
+        }
+        if (index) {
+            ops->destroy(index);
+        }
+    }
+
+    log_close(fd);
+    return 0;
+}
+
+/**
+ * Log a template change against every index that exists
+ */
+int index_log_record(const char *hnsw_path, const char *pq_path, const char *username,
+                     const float *features) {
+    if (!username || username[0] == '\0') {
+        log_message(NL_LOG_ERROR, "Invalid input for index log");
+        return -1;
+    }
+
+    int result = 0;
+    if (hnsw_path && file_exists(hnsw_path) && record_logged(&HNSW_OPS, hnsw_path, username, features) != 0) {
+        result = -1;
+    }
+    if (pq_path && file_exists(pq_path) && record_logged(&PQ_OPS, pq_path, username, features) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * Load an HNSW index and replay its log
+ */
+HNSWIndex* index_log_load_hnsw(const char *path) {
+    return path ? (HNSWIndex*)load_logged(&HNSW_OPS, path) : NULL;
+}
+
+/**
+ * Load a PQ index and replay its log
+ */
+PQIndex* index_log_load_pq(const char *path) {
+    return path ? (PQIndex*)load_logged(&PQ_OPS, path) : NULL;
+}
+
+/**
+ * Snapshot a freshly built HNSW index
+ */
+int index_log_save_hnsw(const char *path, HNSWIndex *index) {
+    return save_logged(&HNSW_OPS, path, index);
+}
+
+/**
+ * Snapshot a freshly trained PQ index
+ */
+int index_log_save_pq(const char *path, PQIndex *index) {
+    return save_logged(&PQ_OPS, path, index);
+}
+
+/* ---- Resident indexes ---- */
+
+/**
+ * Bring a resident index up to the end of the log
+ * Reloads from the file if another process snapshotted it or it was never
+ * loaded. Caller holds the log lock.
+ */
+static void resident_sync_locked(ResidentIndex *resident, int fd, uint32_t generation) {
+    struct stat st;
+    if (resident->index && (generation != resident->generation ||
+                            fstat(fd, &st) != 0 || st.st_size < resident->applied)) {
+        resident->ops->destroy(resident->index);
+        resident->index = NULL;
+    }
+
+    if (!resident->index) {
+        resident->index = load_locked(fd, resident->ops, resident->path, &resident->applied);
+        resident->generation = generation;
+    } else {
+        log_replay(fd, resident->ops, resident->index, &resident->applied);
+    }
+}
+
+/**
+ * Log and apply one change to a resident index
+ */
+static int resident_update(ResidentIndex *resident, const char *username, const float *features) {
+    if (!resident->path || (!resident->index && !file_exists(resident->path))) {
+        return 0;
+    }
+
+    uint32_t generation;
+    int fd = log_open(resident->path, &generation);
+    if (fd < 0) {
+        return -1;
+    }
+    resident_sync_locked(resident, fd, generation);
+
+    // Without a usable index the record is still logged for later loads
+    off_t end = resident->applied;
+    if (!resident->index) {
+        end = INDEX_LOG_HEADER_SIZE;
+        log_replay(fd, resident->ops, NULL, &end);
+    }
+    if (log_append(fd, end, username, features) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to log %s index change: %s.log", resident->ops->name, resident->path);
+        log_close(fd);
+        return -1;
+    }
+    if (!resident->index) {
+        log_close(fd);
+        return 0;
+    }
+
+    apply_change(resident->ops, resident->index, username, features);
+    resident->applied = end + INDEX_LOG_RECORD_SIZE;
+
+    off_t snapshot_at = INDEX_LOG_HEADER_SIZE + (off_t)INDEX_LOG_SNAPSHOT_RECORDS * INDEX_LOG_RECORD_SIZE;
+    if (resident->applied >= snapshot_at &&
+        snapshot_locked(fd, resident->ops, resident->path, resident->index,
+                        &resident->applied, &resident->generation) != 0) {
+        log_message(NL_LOG_WARNING, "Failed to snapshot %s index; its log keeps growing", resident->ops->name);
+    }
+
+    log_close(fd);
+    return 0;
+}
+
+/**
+ * Snapshot a resident index if its log holds records, then free it
+ */
+static void resident_close(ResidentIndex *resident) {
+    if (resident->index) {
+        uint32_t generation;
+        int fd = log_open(resident->path, &generation);
+        if (fd >= 0) {
+            resident_sync_locked(resident, fd, generation);
+            if (resident->index && resident->applied > INDEX_LOG_HEADER_SIZE &&
+                snapshot_locked(fd, resident->ops, resident->path, resident->index,
+                                &resident->applied, &resident->generation) != 0) {
+                log_message(NL_LOG_WARNING, "Failed to snapshot %s index on close", resident->ops->name);
+            }
+            log_close(fd);
+        }
+        if (resident->index) {
+            resident->ops->destroy(resident->index);
+        }
+    }
+    free(resident->path);
+}
+
+/**
+ * Load whichever indexes exist and keep them resident
+ */
+IndexSet* index_set_open(const char *hnsw_path, const char *pq_path) {
+    IndexSet *set = (IndexSet*)calloc(1, sizeof(IndexSet));
+    if (!set) {
+        log_message(NL_LOG_ERROR, "Failed to allocate IndexSet structure");
+        return NULL;
+    }
+
+    set->hnsw.ops = &HNSW_OPS;
+    set->pq.ops = &PQ_OPS;
+    set->hnsw.path = hnsw_path ? strdup(hnsw_path) : NULL;
+    set->pq.path = pq_path ? strdup(pq_path) : NULL;
+    if ((hnsw_path && !set->hnsw.path) || (pq_path && !set->pq.path)) {
+        log_message(NL_LOG_ERROR, "Failed to allocate index paths");
+        index_set_close(set);
+        return NULL;
+    }
+
+    ResidentIndex *residents[] = { &set->hnsw, &set->pq };
+    for (size_t i = 0; i < sizeof(residents) / sizeof(residents[0]); i++) {
+        ResidentIndex *resident = residents[i];
+        if (!resident->path || !file_exists(resident->path)) {
+            continue;
+        }
+
+        uint32_t generation;
+        int fd = log_open(resident->path, &generation);
+        if (fd >= 0) {
+            resident_sync_locked(resident, fd, generation);
+            log_close(fd);
+        }
+        if (resident->index) {
+            log_message(NL_LOG_INFO, "Loaded %s index: %s", resident->ops->name, resident->path);
+        }
+    }
+    return set;
+}
+
+/**
+ * Log a template change and apply it to the resident indexes
+ */
+int index_set_update(IndexSet *set, const char *username, const float *features) {
+    if (!set || !username || username[0] == '\0') {
+        log_message(NL_LOG_ERROR, "Invalid input for index update");
+        return -1;
+    }
+
+    int result = 0;
+    if (resident_update(&set->hnsw, username, features) != 0) {
+        result = -1;
+    }
+    if (resident_update(&set->pq, username, features) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * Snapshot indexes with unsaved changes and free the set
+ */
+void index_set_close(IndexSet *set) {
+    if (set) {
+        resident_close(&set->hnsw);
+        resident_close(&set->pq);
+        free(set);
+    }
+}
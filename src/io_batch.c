@@ -0,0 +1,448 @@
+#define _DEFAULT_SOURCE
+#include "io_batch.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if IO_BATCH_URING && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define IO_BATCH_HAVE_URING 1
+#endif
+#endif
+#endif
+
+/* Largest single transfer handed to the kernel (sqe->len is 32 bits) */
+#define IO_BATCH_MAX_TRANSFER (1u << 30)
+
+/* One queued request; buffer/size/offset advance as bytes arrive */
+typedef struct {
+    int fd;
+    uint8_t *buffer;
+    size_t size;
+    uint64_t offset;
+    int write;
+} IOBatchOp;
+
+struct IOBatch {
+    IOBatchOp *ops;                 // Requests since the last wait
+    size_t num_ops;
+    size_t capacity;
+    size_t next;                    // First request not yet submitted
+    size_t *retry;                  // Short transfers to submit again
+    size_t num_retry;
+    unsigned depth;
+    unsigned in_flight;
+    int failed;
+    int registered_fd;              // -1 if none
+    uint8_t *registered_buffer;
+    size_t registered_size;
+#ifdef IO_BATCH_HAVE_URING
+    int ring_fd;                    // -1: synchronous fallback
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    int fixed_file;                 // registered_fd is slot 0 of the file table
+    int fixed_buffer;               // registered_buffer is buffer 0
+#endif
+};
+
+/**
+ * Run one request with pread()/pwrite(), retrying short transfers
+ */
+static int run_sync(const IOBatchOp *op) {
+    uint8_t *buffer = op->buffer;
+    size_t size = op->size;
+    off_t offset = (off_t)op->offset;
+    while (size > 0) {
+        ssize_t n = op->write ? pwrite(op->fd, buffer, size, offset) : pread(op->fd, buffer, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+        buffer += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+#ifdef IO_BATCH_HAVE_URING
+
+static void ring_close(IOBatch *io) {
+    if (io->sqes) {
+        munmap(io->sqes, io->sqes_size);
+    }
+    if (io->cq_map && io->cq_map != io->sq_map) {
+        munmap(io->cq_map, io->cq_map_size);
+    }
+    if (io->sq_map) {
+        munmap(io->sq_map, io->sq_map_size);
+    }
+    if (io->ring_fd >= 0) {
+        close(io->ring_fd);
+    }
+    io->sqes = NULL;
+    io->sq_map = io->cq_map = NULL;
+    io->ring_fd = -1;
+}
+
+/**
+ * Set up the rings; leaves ring_fd at -1 if the kernel says no
+ */
+static void ring_open(IOBatch *io) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    io->ring_fd = (int)syscall(__NR_io_uring_setup, io->depth, &params);
+    if (io->ring_fd < 0) {
+        log_message(NL_LOG_DEBUG, "io_uring unavailable (%s), using synchronous I/O", strerror(errno));
+        io->ring_fd = -1;
+        return;
+    }
+
+    // IORING_OP_READ/WRITE arrived together with this feature bit (5.6)
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        log_message(NL_LOG_DEBUG, "io_uring too old for plain reads and writes, using synchronous I/O");
+        ring_close(io);
+        return;
+    }
+
+    io->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && io->cq_map_size > io->sq_map_size) {
+        io->sq_map_size = io->cq_map_size;
+    }
+
+    io->sq_map = mmap(NULL, io->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      io->ring_fd, IORING_OFF_SQ_RING);
+    if (io->sq_map == MAP_FAILED) {
+        io->sq_map = NULL;
+        ring_close(io);
+        return;
+    }
+    io->cq_map = single ? io->sq_map :
+                 mmap(NULL, io->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      io->ring_fd, IORING_OFF_CQ_RING);
+    if (io->cq_map == MAP_FAILED) {
+        io->cq_map = NULL;
+        ring_close(io);
+        return;
+    }
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = (struct io_uring_sqe*)mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED) {
+        io->sqes = NULL;
+        ring_close(io);
+        return;
+    }
+
+    uint8_t *sq = (uint8_t*)io->sq_map;
+    uint8_t *cq = (uint8_t*)io->cq_map;
+    io->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    io->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    io->sq_array = (unsigned*)(sq + params.sq_off.array);
+    io->cq_head = (unsigned*)(cq + params.cq_off.head);
+    io->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    io->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    if (params.sq_entries < io->depth) {
+        io->depth = params.sq_entries;
+    }
+}
+
+/**
+ * Put one request in the submission ring
+ */
+static void ring_prepare(IOBatch *io, size_t index) {
+    const IOBatchOp *op = &io->ops[index];
+    unsigned tail = *io->sq_tail;
+    unsigned slot = tail & *io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+
+    int fixed = io->fixed_buffer && op->buffer >= io->registered_buffer &&
+                op->buffer + op->size <= io->registered_buffer + io->registered_size;
+    if (fixed) {
+        sqe->opcode = op->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    if (io->fixed_file && op->fd == io->registered_fd) {
+        sqe->fd = 0;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = op->fd;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)op->buffer;
+    sqe->len = op->size < IO_BATCH_MAX_TRANSFER ? (uint32_t)op->size : IO_BATCH_MAX_TRANSFER;
+    sqe->off = op->offset;
+    sqe->user_data = index;
+
+    io->sq_array[slot] = slot;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->in_flight++;
+}
+
+/**
+ * Take completions off the ring; short transfers go back on the retry list
+ */
+static void ring_reap(IOBatch *io) {
+    unsigned head = *io->cq_head;
+    unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+        IOBatchOp *op = &io->ops[cqe->user_data];
+        int res = cqe->res;
+        io->in_flight--;
+        head++;
+
+        if (res == -EAGAIN || res == -EINTR) {
+            io->retry[io->num_retry++] = (size_t)cqe->user_data;
+        } else if (res <= 0) {
+            io->failed = 1;
+        } else if ((size_t)res < op->size) {
+            op->buffer += res;
+            op->size -= (size_t)res;
+            op->offset += (uint64_t)res;
+            io->retry[io->num_retry++] = (size_t)cqe->user_data;
+        }
+    }
+    __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Keep the ring full: submit what fits, and wait for completions while more
+ * is queued than fits (or, with drain, until nothing is in flight)
+ */
+static void ring_pump(IOBatch *io, int drain) {
+    unsigned to_submit = 0;
+    for (;;) {
+        while (io->in_flight < io->depth && (io->num_retry > 0 || io->next < io->num_ops)) {
+            ring_prepare(io, io->num_retry > 0 ? io->retry[--io->num_retry] : io->next++);
+            to_submit++;
+        }
+
+        int backlog = io->num_retry > 0 || io->next < io->num_ops;
+        unsigned wait = (drain ? io->in_flight > 0 : backlog) ? 1u : 0u;
+        if (to_submit == 0 && !wait) {
+            return;
+        }
+
+        long submitted = syscall(__NR_io_uring_enter, io->ring_fd, to_submit, wait,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                ring_reap(io);
+                continue;
+            }
+            // The kernel state is unknown; stop rather than spin
+            log_message(NL_LOG_ERROR, "io_uring_enter failed: %s", strerror(errno));
+            io->failed = 1;
+            io->in_flight = 0;
+            io->next = io->num_ops;
+            io->num_retry = 0;
+            return;
+        }
+        to_submit -= (unsigned)submitted;
+        ring_reap(io);
+    }
+}
+
+#endif /* IO_BATCH_HAVE_URING */
+
+/**
+ * Create a batch queue
+ */
+IOBatch* io_batch_create(unsigned depth) {
+    IOBatch *io = (IOBatch*)calloc(1, sizeof(IOBatch));
+    if (!io) {
+        log_message(NL_LOG_ERROR, "Failed to allocate I/O batch");
+        return NULL;
+    }
+
+    io->depth = 1;
+    while (io->depth < depth && io->depth < 4096) {
+        io->depth <<= 1;
+    }
+    io->registered_fd = -1;
+#ifdef IO_BATCH_HAVE_URING
+    io->ring_fd = -1;
+    ring_open(io);
+#endif
+    return io;
+}
+
+/**
+ * Release a batch queue (pending requests are waited for first)
+ */
+void io_batch_free(IOBatch *io) {
+    if (!io) {
+        return;
+    }
+    io_batch_wait(io);
+#ifdef IO_BATCH_HAVE_URING
+    ring_close(io);
+#endif
+    free(io->ops);
+    free(io->retry);
+    free(io);
+}
+
+/**
+ * Whether requests go through io_uring
+ */
+int io_batch_async(const IOBatch *io) {
+#ifdef IO_BATCH_HAVE_URING
+    return io && io->ring_fd >= 0;
+#else
+    (void)io;
+    return 0;
+#endif
+}
+
+/**
+ * Register the file most requests go to
+ */
+int io_batch_register_file(IOBatch *io, int fd) {
+    if (!io || fd < 0) {
+        return -1;
+    }
+    io_batch_wait(io);
+    io->registered_fd = fd;
+#ifdef IO_BATCH_HAVE_URING
+    if (io->ring_fd >= 0) {
+        if (io->fixed_file) {
+            syscall(__NR_io_uring_register, io->ring_fd, IORING_UNREGISTER_FILES, NULL, 0);
+        }
+        io->fixed_file = syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_FILES, &fd, 1) == 0;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Register the buffer most requests read into or write from
+ */
+int io_batch_register_buffer(IOBatch *io, void *buffer, size_t size) {
+    if (!io || !buffer || size == 0) {
+        return -1;
+    }
+    io_batch_wait(io);
+    io->registered_buffer = (uint8_t*)buffer;
+    io->registered_size = size;
+#ifdef IO_BATCH_HAVE_URING
+    if (io->ring_fd >= 0) {
+        if (io->fixed_buffer) {
+            syscall(__NR_io_uring_register, io->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        }
+        // Pinning may exceed RLIMIT_MEMLOCK; plain reads and writes still work
+        struct iovec iov = { buffer, size };
+        io->fixed_buffer = size <= IO_BATCH_MAX_TRANSFER &&
+                           syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Append a request, growing the queue as needed
+ */
+static int queue_op(IOBatch *io, int fd, void *buffer, size_t size, uint64_t offset, int write) {
+    if (!io || fd < 0 || (!buffer && size > 0)) {
+        log_message(NL_LOG_ERROR, "Invalid input for batched I/O");
+        return -1;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    IOBatchOp op = { fd, (uint8_t*)buffer, size, offset, write };
+    if (!io_batch_async(io)) {
+        if (run_sync(&op) != 0) {
+            io->failed = 1;
+        }
+        return 0;
+    }
+
+    if (io->num_ops == io->capacity) {
+        size_t capacity = io->capacity ? io->capacity * 2 : 256;
+        IOBatchOp *ops = (IOBatchOp*)realloc(io->ops, capacity * sizeof(IOBatchOp));
+        if (!ops) {
+            log_message(NL_LOG_ERROR, "Failed to grow I/O batch");
+            return -1;
+        }
+        io->ops = ops;
+        size_t *retry = (size_t*)realloc(io->retry, capacity * sizeof(size_t));
+        if (!retry) {
+            log_message(NL_LOG_ERROR, "Failed to grow I/O batch");
+            return -1;
+        }
+        io->retry = retry;
+        io->capacity = capacity;
+    }
+    io->ops[io->num_ops++] = op;
+
+#ifdef IO_BATCH_HAVE_URING
+    // Start on a full window instead of letting requests pile up
+    if (io->num_ops - io->next >= io->depth) {
+        ring_pump(io, 0);
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Queue a read of size bytes at offset
+ */
+int io_batch_read(IOBatch *io, int fd, void *buffer, size_t size, uint64_t offset) {
+    return queue_op(io, fd, buffer, size, offset, 0);
+}
+
+/**
+ * Queue a write of size bytes at offset
+ */
+int io_batch_write(IOBatch *io, int fd, const void *buffer, size_t size, uint64_t offset) {
+    return queue_op(io, fd, (void*)buffer, size, offset, 1);
+}
+
+/**
+ * Run every queued request to completion
+ */
+int io_batch_wait(IOBatch *io) {
+    if (!io) {
+        return -1;
+    }
+#ifdef IO_BATCH_HAVE_URING
+    if (io->ring_fd >= 0) {
+        ring_pump(io, 1);
+    }
+#endif
+    int result = io->failed ? -1 : 0;
+    io->num_ops = 0;
+    io->next = 0;
+    io->num_retry = 0;
+    io->failed = 0;
+    return result;
+}
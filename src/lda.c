@@ -0,0 +1,176 @@
+#include "lda.h"
+#include "linalg.h"
+#include "vector_ops.h"
+#include "hashing.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+/** Mean of rows [begin, end) of a matrix, skipping row skip */
+static void row_mean(const float *rows, size_t begin, size_t end, size_t skip, size_t dim, size_t stride,
+                     double *mean) {
+    memset(mean, 0, dim * sizeof(double));
+    size_t n = 0;
+    for (size_t r = begin; r < end; r++) {
+        if (r == skip) {
+            continue;
+        }
+        const float *row = rows + r * stride;
+        for (size_t c = 0; c < dim; c++) {
+            mean[c] += row[c];
+        }
+        n++;
+    }
+    for (size_t c = 0; n > 0 && c < dim; c++) {
+        mean[c] /= (double)n;
+    }
+}
+
+/**
+ * Train a template's discriminant against the cohort
+ */
+int lda_train(Template *template, const TemplateMatrix *cohort) {
+    if (!template || !template->features || !cohort || !cohort->matrix ||
+        template->features->size != cohort->dim) {
+        log_message(NL_LOG_ERROR, "Invalid input for discriminant training");
+        return -1;
+    }
+
+    size_t dim = cohort->dim;
+
+    // The user's own cohort row, if sampled, must not count as an impostor
+    size_t skip = SIZE_MAX;
+    for (size_t r = 0; r < cohort->num_templates; r++) {
+        if (strncmp(cohort->usernames[r], template->username, 64) == 0) {
+            skip = r;
+            break;
+        }
+    }
+    size_t negatives = cohort->num_templates - (skip != SIZE_MAX ? 1 : 0);
+
+    double *scatter = (double*)calloc(dim * dim, sizeof(double));
+    double *mean_pos = (double*)malloc(dim * sizeof(double));
+    double *mean_neg = (double*)malloc(dim * sizeof(double));
+    double *w = (double*)malloc(dim * sizeof(double));
+    float *center = (float*)malloc(dim * sizeof(float));
+    size_t num_positives = (template->exemplars ? template->num_exemplars : 0) + 1;
+    float *positives = (float*)malloc(num_positives * dim * sizeof(float));
+    if (!scatter || !mean_pos || !mean_neg || !w || !center || !positives) {
+        log_message(NL_LOG_ERROR, "Failed to allocate discriminant training buffers");
+        free(scatter);
+        free(mean_pos);
+        free(mean_neg);
+        free(w);
+        free(center);
+        free(positives);
+        return -1;
+    }
+
+    // User class: the enrolment trials plus the current mean, which is all
+    // adaptive updates move and all older templates have
+    if (num_positives > 1) {
+        memcpy(positives, template->exemplars, (num_positives - 1) * dim * sizeof(float));
+    }
+    vector_normalize(template->features->features, positives + (num_positives - 1) * dim, dim);
+
+    row_mean(positives, 0, num_positives, SIZE_MAX, dim, dim, mean_pos);
+    row_mean(cohort->matrix, 0, cohort->num_templates, skip, dim, cohort->stride, mean_neg);
+
+    // Pooled within-class scatter; the cohort is accumulated around the skipped row
+    int failed = negatives < 2;
+    for (size_t c = 0; c < dim; c++) {
+        center[c] = (float)mean_pos[c];
+    }
+    failed = failed || linalg_gram_accumulate(scatter, dim, positives, num_positives, dim, center) != 0;
+    for (size_t c = 0; c < dim; c++) {
+        center[c] = (float)mean_neg[c];
+    }
+    size_t split = skip != SIZE_MAX ? skip : cohort->num_templates;
+    failed = failed ||
+             linalg_gram_accumulate(scatter, dim, cohort->matrix, split, cohort->stride, center) != 0 ||
+             (split + 1 < cohort->num_templates &&
+              linalg_gram_accumulate(scatter, dim, cohort->matrix + (split + 1) * cohort->stride,
+                                     cohort->num_templates - split - 1, cohort->stride, center) != 0);
+
+    if (!failed) {
+        double dof = (double)(num_positives + negatives - 2);
+        for (size_t i = 0; i < dim * dim; i++) {
+            scatter[i] /= dof;
+        }
+        linalg_shrink(scatter, dim, LDA_SHRINKAGE);
+        failed = linalg_cholesky(scatter, dim) != 0;
+    }
+
+    // w = Sw^-1 (mu_user - mu_impostor), two triangular solves
+    if (!failed) {
+        for (size_t c = 0; c < dim; c++) {
+            w[c] = mean_pos[c] - mean_neg[c];
+        }
+        linalg_cholesky_solve(scatter, dim, w, w);
+    }
+
+    // Calibrate on the impostor projections so scores read as standard deviations
+    double sum = 0.0, sum_sq = 0.0;
+    for (size_t r = 0; !failed && r < cohort->num_templates; r++) {
+        if (r == skip) {
+            continue;
+        }
+        const float *row = cohort->matrix + r * cohort->stride;
+        double s = 0.0;
+        for (size_t c = 0; c < dim; c++) {
+            s += w[c] * row[c];
+        }
+        sum += s;
+        sum_sq += s * s;
+    }
+    double mu = failed ? 0.0 : sum / negatives;
+    double var = failed ? 0.0 : sum_sq / negatives - mu * mu;
+    if (!failed && !(var > 0.0)) {
+        failed = 1;
+    }
+
+    if (!failed && !template->lda_weights) {
+        template->lda_weights = (float*)malloc(dim * sizeof(float));
+        failed = !template->lda_weights;
+    }
+    if (!failed) {
+        double sigma = sqrt(var);
+        for (size_t c = 0; c < dim; c++) {
+            template->lda_weights[c] = (float)(w[c] / sigma);
+        }
+        template->lda_bias = (float)(-mu / sigma);
+    } else {
+        log_message(NL_LOG_ERROR, "Failed to train discriminant for %s", template->username);
+    }
+
+    secure_wipe(mean_pos, dim * sizeof(double));
+    secure_wipe(w, dim * sizeof(double));
+    secure_wipe(positives, num_positives * dim * sizeof(float));
+    free(scatter);
+    free(mean_pos);
+    free(mean_neg);
+    free(w);
+    free(center);
+    free(positives);
+    return failed ? -1 : 0;
+}
+
+/**
+ * Score a probe with a template's discriminant
+ */
+float lda_score(const Template *template, const FeatureVector *probe) {
+    if (!template || !template->lda_weights || !template->features || !probe ||
+        probe->size != template->features->size) {
+        log_message(NL_LOG_ERROR, "Invalid input for discriminant score");
+        return -INFINITY;
+    }
+
+    // Same unit-norm space the discriminant was trained in
+    float magnitude = vector_magnitude(probe->features, probe->size);
+    if (magnitude <= 0.0f) {
+        return -INFINITY;
+    }
+    return dot_product(template->lda_weights, probe->features, probe->size) / magnitude + template->lda_bias;
+}
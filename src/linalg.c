@@ -0,0 +1,195 @@
+#include "linalg.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define LINALG_X86 1
+#endif
+
+/* Rows folded into the Gram matrix per pass over it */
+#define GRAM_ROW_BLOCK 4
+
+/**
+ * Fold up to GRAM_ROW_BLOCK rows into the lower triangle
+ */
+static void gram_block_scalar(double *gram, size_t dim, const double *x, size_t rows) {
+    for (size_t i = 0; i < dim; i++) {
+        double *g = gram + i * dim;
+        for (size_t j = 0; j <= i; j++) {
+            double s = 0.0;
+            for (size_t r = 0; r < rows; r++) {
+                s += x[r * dim + i] * x[r * dim + j];
+            }
+            g[j] += s;
+        }
+    }
+}
+
+#ifdef LINALG_X86
+
+/**
+ * AVX2/FMA kernel for a full block (dim must be a multiple of 4)
+ * Row i is updated up to the next multiple of 4 past the diagonal; the few
+ * upper-triangle entries this touches are overwritten by the final mirror.
+ */
+__attribute__((target("avx2,fma")))
+static void gram_block_avx2(double *gram, size_t dim, const double *x) {
+    const double *x0 = x;
+    const double *x1 = x0 + dim;
+    const double *x2 = x1 + dim;
+    const double *x3 = x2 + dim;
+    for (size_t i = 0; i < dim; i++) {
+        __m256d a0 = _mm256_set1_pd(x0[i]);
+        __m256d a1 = _mm256_set1_pd(x1[i]);
+        __m256d a2 = _mm256_set1_pd(x2[i]);
+        __m256d a3 = _mm256_set1_pd(x3[i]);
+        double *g = gram + i * dim;
+        size_t end = (i + 4) & ~(size_t)3;
+        for (size_t j = 0; j < end; j += 4) {
+            __m256d acc = _mm256_loadu_pd(g + j);
+            acc = _mm256_fmadd_pd(a0, _mm256_loadu_pd(x0 + j), acc);
+            acc = _mm256_fmadd_pd(a1, _mm256_loadu_pd(x1 + j), acc);
+            acc = _mm256_fmadd_pd(a2, _mm256_loadu_pd(x2 + j), acc);
+            acc = _mm256_fmadd_pd(a3, _mm256_loadu_pd(x3 + j), acc);
+            _mm256_storeu_pd(g + j, acc);
+        }
+    }
+}
+
+#endif
+
+/**
+ * Accumulate centered outer products into a symmetric matrix
+ */
+int linalg_gram_accumulate(double *gram, size_t dim, const float *rows, size_t count, size_t stride,
+                           const float *center) {
+    if (!gram || (!rows && count > 0) || stride < dim) {
+        log_message(NL_LOG_ERROR, "Invalid input for Gram accumulation");
+        return -1;
+    }
+
+    double *x = (double*)malloc(GRAM_ROW_BLOCK * dim * sizeof(double));
+    if (!x) {
+        log_message(NL_LOG_ERROR, "Failed to allocate Gram row buffer");
+        return -1;
+    }
+
+#ifdef LINALG_X86
+    int use_avx2 = dim % 4 == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+
+    // Centered rows are widened to double a block at a time, so each pass over
+    // the Gram matrix folds in GRAM_ROW_BLOCK rank-1 updates
+    for (size_t r = 0; r < count; r += GRAM_ROW_BLOCK) {
+        size_t block = count - r < GRAM_ROW_BLOCK ? count - r : GRAM_ROW_BLOCK;
+        for (size_t b = 0; b < block; b++) {
+            const float *row = rows + (r + b) * stride;
+            for (size_t c = 0; c < dim; c++) {
+                x[b * dim + c] = (double)row[c] - (center ? (double)center[c] : 0.0);
+            }
+        }
+#ifdef LINALG_X86
+        if (use_avx2 && block == GRAM_ROW_BLOCK) {
+            gram_block_avx2(gram, dim, x);
+            continue;
+        }
+#endif
+        gram_block_scalar(gram, dim, x, block);
+    }
+
+    for (size_t i = 0; i < dim; i++) {
+        for (size_t j = i + 1; j < dim; j++) {
+            gram[i * dim + j] = gram[j * dim + i];
+        }
+    }
+
+    free(x);
+    return 0;
+}
+
+/**
+ * Shrink a covariance matrix toward a scaled identity
+ */
+void linalg_shrink(double *cov, size_t n, double shrinkage) {
+    double trace = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        trace += cov[i * n + i];
+    }
+    double target = n > 0 ? trace / n : 0.0;
+
+    for (size_t i = 0; i < n * n; i++) {
+        cov[i] *= 1.0 - shrinkage;
+    }
+    for (size_t i = 0; i < n; i++) {
+        cov[i * n + i] += shrinkage * target;
+    }
+}
+
+/**
+ * Cholesky factorization A = L * L^T
+ */
+int linalg_cholesky(double *a, size_t n) {
+    for (size_t j = 0; j < n; j++) {
+        double *row_j = a + j * n;
+        double d = row_j[j];
+        for (size_t k = 0; k < j; k++) {
+            d -= row_j[k] * row_j[k];
+        }
+        if (!(d > 0.0)) {
+            log_message(NL_LOG_ERROR, "Matrix is not positive definite (pivot %zu)", j);
+            return -1;
+        }
+        d = sqrt(d);
+        row_j[j] = d;
+
+        for (size_t i = j + 1; i < n; i++) {
+            double *row_i = a + i * n;
+            double s = row_i[j];
+            for (size_t k = 0; k < j; k++) {
+                s -= row_i[k] * row_j[k];
+            }
+            row_i[j] = s / d;
+        }
+        for (size_t k = j + 1; k < n; k++) {
+            row_j[k] = 0.0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Solve L * x = b by forward substitution
+ */
+void linalg_solve_lower(const double *l, size_t n, const double *b, double *x) {
+    for (size_t i = 0; i < n; i++) {
+        const double *row = l + i * n;
+        double s = b[i];
+        for (size_t k = 0; k < i; k++) {
+            s -= row[k] * x[k];
+        }
+        x[i] = s / row[i];
+    }
+}
+
+/**
+ * Solve L^T * x = b by back substitution
+ */
+void linalg_solve_lower_transposed(const double *l, size_t n, const double *b, double *x) {
+    for (size_t i = n; i-- > 0;) {
+        double s = b[i];
+        for (size_t k = i + 1; k < n; k++) {
+            s -= l[k * n + i] * x[k];
+        }
+        x[i] = s / l[i * n + i];
+    }
+}
+
+/**
+ * Solve A * x = b given the Cholesky factor of A
+ */
+void linalg_cholesky_solve(const double *l, size_t n, const double *b, double *x) {
+    linalg_solve_lower(l, n, b, x);
+    linalg_solve_lower_transposed(l, n, x, x);
+}
@@ -0,0 +1,389 @@
+#define _DEFAULT_SOURCE
+#include "lockout.h"
+#include "hashing.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if MAX_AUTH_ATTEMPTS < 1 || MAX_AUTH_ATTEMPTS > 254
+#error "MAX_AUTH_ATTEMPTS must be between 1 and 254"
+#endif
+
+/*
+ * Slot state, 0 when the user has no failures:
+ *   bits  0-47  window start, or lockout start once failures reach the limit (ms)
+ *   bits 48-55  failures, STATE_RECLAIMING while the slot changes owner
+ *   bits 56-63  fingerprint tag, so a write that raced a reclaim is recognised
+ */
+#define STATE_TIME_MASK 0xFFFFFFFFFFFFull
+#define STATE_RECLAIMING 0xFFu
+#define WINDOW_MS ((uint64_t)AUTH_TIMEOUT * 1000)
+
+/*
+ * Shared table file: one 64-byte header line, then the slots as in memory
+ *   magic u32, version u32, shard_size u32, shards u32, seed u64
+ */
+#define LOCKOUT_FILE_MAGIC 0x544C4C4E       // "NLLT" little-endian
+#define LOCKOUT_FILE_VERSION 1
+#define LOCKOUT_FILE_HEADER_SIZE 64
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t key;  // Username fingerprint, 0 if free
+    _Atomic uint64_t state;
+} AttemptSlot;
+
+struct AttemptTable {
+    AttemptSlot *slots;             // LOCKOUT_SHARDS runs of shard_size slots
+    size_t shard_size;              // Power of two
+    void *mapping;                  // Shared file mapping, NULL if slots are private
+    size_t mapping_size;
+    uint64_t seed;                  // Keys the fingerprint, so collisions cannot be chosen
+    atomic_ullong refusals;
+    atomic_int overflowed;          // Set once the table-full warning was logged
+};
+
+static uint64_t pack_state(unsigned failures, uint64_t fingerprint, uint64_t time_ms) {
+    return ((fingerprint >> 56) << 56) | ((uint64_t)failures << 48) | (time_ms & STATE_TIME_MASK);
+}
+
+static unsigned state_failures(uint64_t state) {
+    return (unsigned)((state >> 48) & 0xFF);
+}
+
+static uint64_t state_time(uint64_t state) {
+    return state & STATE_TIME_MASK;
+}
+
+/**
+ * Failures still in force: none once the window (or lockout) has passed,
+ * or if the state was left by another user's write racing a reclaim
+ */
+static unsigned live_failures(uint64_t state, uint64_t fingerprint, uint64_t now_ms) {
+    if (state == 0 || (state >> 56) != (fingerprint >> 56) ||
+        (now_ms & STATE_TIME_MASK) >= state_time(state) + WINDOW_MS) {
+        return 0;
+    }
+    return state_failures(state);
+}
+
+static uint64_t fingerprint(const AttemptTable *table, const char *username) {
+    uint64_t h = 1469598103934665603ULL ^ table->seed;
+    for (size_t i = 0; i < 64 && username[i]; i++) {
+        h ^= (uint8_t)username[i];
+        h *= 1099511628211ULL;
+    }
+    // splitmix64 finalizer, so shard, slot and tag bits all depend on every byte
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h ? h : 1;
+}
+
+static AttemptSlot* shard_of(const AttemptTable *table, uint64_t fp) {
+    return table->slots + ((fp >> 32) % LOCKOUT_SHARDS) * table->shard_size;
+}
+
+/**
+ * Find the user's slot without claiming one
+ */
+static AttemptSlot* find_slot(const AttemptTable *table, uint64_t fp) {
+    AttemptSlot *shard = shard_of(table, fp);
+    size_t mask = table->shard_size - 1;
+    for (size_t i = 0; i < table->shard_size; i++) {
+        AttemptSlot *slot = &shard[(fp + i) & mask];
+        uint64_t key = atomic_load_explicit(&slot->key, memory_order_acquire);
+        if (key == fp) {
+            return slot;
+        }
+        if (key == 0) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the user's slot, taking a free one or reclaiming an expired one
+ * Returns: Slot, NULL if the shard is full of live users
+ */
+static AttemptSlot* claim_slot(AttemptTable *table, uint64_t fp, uint64_t now_ms) {
+    AttemptSlot *shard = shard_of(table, fp);
+    size_t mask = table->shard_size - 1;
+    for (size_t i = 0; i < table->shard_size; i++) {
+        AttemptSlot *slot = &shard[(fp + i) & mask];
+        uint64_t key = atomic_load_explicit(&slot->key, memory_order_acquire);
+        if (key == fp) {
+            return slot;
+        }
+        if (key == 0) {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong(&slot->key, &expected, fp) || expected == fp) {
+                return slot;
+            }
+        }
+    }
+
+    // Free slots run out only under many live users; take over one whose window passed
+    for (size_t i = 0; i < table->shard_size; i++) {
+        AttemptSlot *slot = &shard[(fp + i) & mask];
+        uint64_t key = atomic_load_explicit(&slot->key, memory_order_acquire);
+        uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        if (key == fp) {
+            return slot;
+        }
+        if (state_failures(state) == STATE_RECLAIMING || live_failures(state, key, now_ms) != 0) {
+            continue;
+        }
+        if (atomic_compare_exchange_strong(&slot->state, &state, pack_state(STATE_RECLAIMING, key, 0))) {
+            atomic_store_explicit(&slot->key, fp, memory_order_release);
+            atomic_store_explicit(&slot->state, 0, memory_order_release);
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Time until the first live slot in a full shard lapses
+ */
+static uint64_t shard_retry_ms(const AttemptTable *table, uint64_t fp, uint64_t now_ms) {
+    const AttemptSlot *shard = shard_of(table, fp);
+    uint64_t now = now_ms & STATE_TIME_MASK;
+    uint64_t retry = WINDOW_MS;
+    for (size_t i = 0; i < table->shard_size; i++) {
+        uint64_t state = atomic_load_explicit(&shard[i].state, memory_order_acquire);
+        uint64_t end = state_time(state) + WINDOW_MS;
+        if (state_failures(state) != STATE_RECLAIMING && end > now && end - now < retry) {
+            retry = end - now;
+        }
+    }
+    return retry;
+}
+
+static size_t shard_size_for(size_t capacity) {
+    size_t shard_size = 1;
+    while (shard_size * LOCKOUT_SHARDS < (capacity ? capacity : LOCKOUT_TABLE_SIZE)) {
+        shard_size *= 2;
+    }
+    return shard_size;
+}
+
+/**
+ * Create an attempt table
+ */
+AttemptTable* lockout_create(size_t capacity) {
+    AttemptTable *table = (AttemptTable*)calloc(1, sizeof(AttemptTable));
+    if (!table) {
+        log_message(NL_LOG_ERROR, "Failed to allocate attempt table");
+        return NULL;
+    }
+
+    table->shard_size = shard_size_for(capacity);
+    size_t size = table->shard_size * LOCKOUT_SHARDS * sizeof(AttemptSlot);
+    table->slots = (AttemptSlot*)aligned_alloc(64, size);
+    if (!table->slots || generate_salt((uint8_t*)&table->seed, sizeof(table->seed)) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to allocate attempt table");
+        free(table->slots);
+        free(table);
+        return NULL;
+    }
+    memset(table->slots, 0, size);
+    atomic_init(&table->refusals, 0);
+    atomic_init(&table->overflowed, 0);
+    return table;
+}
+
+/**
+ * Write the header and size a new table file
+ * Caller holds the file lock.
+ */
+static int format_table_file(int fd, size_t shard_size) {
+    uint64_t seed;
+    if (generate_salt((uint8_t*)&seed, sizeof(seed)) != 0) {
+        return -1;
+    }
+
+    uint8_t header[LOCKOUT_FILE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    store_le32(header, LOCKOUT_FILE_MAGIC);
+    store_le32(header + 4, LOCKOUT_FILE_VERSION);
+    store_le32(header + 8, (uint32_t)shard_size);
+    store_le32(header + 12, LOCKOUT_SHARDS);
+    store_le64(header + 16, seed);
+    secure_wipe(&seed, sizeof(seed));
+
+    off_t size = LOCKOUT_FILE_HEADER_SIZE + (off_t)(shard_size * LOCKOUT_SHARDS * sizeof(AttemptSlot));
+    int failed = ftruncate(fd, size) != 0 ||
+                 pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                 fsync(fd) != 0;
+    secure_wipe(header, sizeof(header));
+    return failed ? -1 : 0;
+}
+
+/**
+ * Open (or create) an attempt table shared through a file
+ */
+AttemptTable* lockout_open(const char *path, size_t capacity) {
+    if (!path) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open attempt table: %s", path);
+        return NULL;
+    }
+
+    // Whoever creates the file formats it; everyone else waits for that
+    struct stat st;
+    int failed = flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0 ||
+                 (st.st_size == 0 && format_table_file(fd, shard_size_for(capacity)) != 0);
+
+    uint8_t header[LOCKOUT_FILE_HEADER_SIZE];
+    size_t shard_size = 0;
+    if (!failed && pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        load_le32(header) == LOCKOUT_FILE_MAGIC && load_le32(header + 4) == LOCKOUT_FILE_VERSION &&
+        load_le32(header + 12) == LOCKOUT_SHARDS) {
+        shard_size = load_le32(header + 8);
+    }
+
+    size_t mapping_size = LOCKOUT_FILE_HEADER_SIZE + shard_size * LOCKOUT_SHARDS * sizeof(AttemptSlot);
+    if (!failed && (shard_size == 0 || (shard_size & (shard_size - 1)) != 0 ||
+                    fstat(fd, &st) != 0 || (size_t)st.st_size != mapping_size)) {
+        log_message(NL_LOG_ERROR, "Invalid attempt table: %s", path);
+        failed = 1;
+    }
+
+    void *mapping = failed ? MAP_FAILED :
+                    mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    AttemptTable *table = mapping != MAP_FAILED ? (AttemptTable*)calloc(1, sizeof(AttemptTable)) : NULL;
+    if (!table) {
+        log_message(NL_LOG_ERROR, "Failed to map attempt table: %s", path);
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, mapping_size);
+        }
+        secure_wipe(header, sizeof(header));
+        return NULL;
+    }
+
+    table->mapping = mapping;
+    table->mapping_size = mapping_size;
+    table->slots = (AttemptSlot*)((uint8_t*)mapping + LOCKOUT_FILE_HEADER_SIZE);
+    table->shard_size = shard_size;
+    table->seed = load_le64(header + 16);
+    secure_wipe(header, sizeof(header));
+    atomic_init(&table->refusals, 0);
+    atomic_init(&table->overflowed, 0);
+    return table;
+}
+
+/**
+ * Free an attempt table
+ */
+void lockout_destroy(AttemptTable *table) {
+    if (table) {
+        if (table->mapping) {
+            munmap(table->mapping, table->mapping_size);
+        } else {
+            free(table->slots);
+        }
+        free(table);
+    }
+}
+
+/**
+ * Count an attempt for a user unless the user is locked out
+ */
+int lockout_acquire(AttemptTable *table, const char *username, uint64_t now_ms, int *attempt,
+                    uint64_t *retry_ms) {
+    if (!table || !username || !attempt) {
+        return 0;
+    }
+
+    uint64_t fp = fingerprint(table, username);
+    for (;;) {
+        AttemptSlot *slot = claim_slot(table, fp, now_ms);
+        if (!slot) {
+            // Fail closed: a user who cannot be counted is refused, not waved through
+            if (atomic_exchange(&table->overflowed, 1) == 0) {
+                log_message(NL_LOG_WARNING, "Attempt table shard full; refusing untracked users until a window passes");
+            }
+            if (retry_ms) {
+                *retry_ms = shard_retry_ms(table, fp, now_ms);
+            }
+            atomic_fetch_add_explicit(&table->refusals, 1, memory_order_relaxed);
+            return 1;
+        }
+
+        uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        for (;;) {
+            // The slot changed owner under us: look again
+            if (state_failures(state) == STATE_RECLAIMING ||
+                atomic_load_explicit(&slot->key, memory_order_acquire) != fp) {
+                break;
+            }
+
+            unsigned failures = live_failures(state, fp, now_ms);
+            if (failures >= MAX_AUTH_ATTEMPTS) {
+                uint64_t end = state_time(state) + WINDOW_MS;
+                uint64_t now = now_ms & STATE_TIME_MASK;
+                if (retry_ms) {
+                    *retry_ms = end - now < WINDOW_MS ? end - now : WINDOW_MS;
+                }
+                atomic_fetch_add_explicit(&table->refusals, 1, memory_order_relaxed);
+                return 1;
+            }
+
+            // The first failure opens the window; the last one starts the lockout
+            failures++;
+            uint64_t start = failures == 1 || failures == MAX_AUTH_ATTEMPTS ? now_ms : state_time(state);
+            if (atomic_compare_exchange_weak(&slot->state, &state, pack_state(failures, fp, start))) {
+                *attempt = (int)failures;
+                return 0;
+            }
+        }
+    }
+}
+
+/**
+ * Settle an attempt taken with lockout_acquire()
+ */
+void lockout_finish(AttemptTable *table, const char *username, AttemptOutcome outcome) {
+    if (!table || !username || outcome == ATTEMPT_REJECTED) {
+        return;
+    }
+
+    AttemptSlot *slot = find_slot(table, fingerprint(table, username));
+    if (!slot) {
+        return;
+    }
+    uint64_t fp = atomic_load_explicit(&slot->key, memory_order_relaxed);
+    uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+    while (state != 0 && (state >> 56) == (fp >> 56) && state_failures(state) != STATE_RECLAIMING) {
+        uint64_t next = 0;
+        if (outcome == ATTEMPT_ABORTED && state_failures(state) > 1) {
+            next = pack_state(state_failures(state) - 1, fp, state_time(state));
+        }
+        if (atomic_compare_exchange_weak(&slot->state, &state, next)) {
+            return;
+        }
+    }
+}
+
+/**
+ * Attempts refused because the user was locked out
+ */
+uint64_t lockout_refusals(const AttemptTable *table) {
+    return table ? atomic_load_explicit(&table->refusals, memory_order_relaxed) : 0;
+}
@@ -0,0 +1,304 @@
+#define _DEFAULT_SOURCE
+#include "mahalanobis.h"
+#include "linalg.h"
+#include "vector_ops.h"
+#include "hashing.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Model file layout (little-endian):
+ *   offset  field          type  notes
+ *    0      magic          u32   MAHALANOBIS_FILE_MAGIC
+ *    4      version        u16   MAHALANOBIS_FILE_VERSION
+ *    6      header_size    u16   MAHALANOBIS_FILE_HEADER_SIZE
+ *    8      dim            u32
+ *   12      crc32          u32   CRC of the whole file with this field taken as zero
+ *   16      samples        u64
+ *   24      reserved       8 bytes, zero
+ * followed by the dim x dim factor as float64, row-major.
+ */
+
+/* Visitor state for mahalanobis_train */
+typedef struct {
+    double *scatter;                // [dim * dim] within-user scatter
+    float *centroid;                // [dim] scratch
+    size_t dim;
+    uint64_t samples;
+    int failed;
+} ScatterContext;
+
+static int accumulate_record(const TemplateRecord *record, void *ctx) {
+    ScatterContext *scatter = (ScatterContext*)ctx;
+    size_t dim = scatter->dim;
+    size_t count = record->exemplar_count;
+
+    if (record->feature_count != dim || count < 2 || count > TEMPLATE_MAX_EXEMPLARS) {
+        return 0;
+    }
+
+    // Exemplars are unit-norm trials; their spread around the user's own
+    // centroid is the within-user noise the matcher should discount
+    memset(scatter->centroid, 0, dim * sizeof(float));
+    for (size_t e = 0; e < count; e++) {
+        const float *row = record->exemplars + e * dim;
+        for (size_t c = 0; c < dim; c++) {
+            scatter->centroid[c] += row[c] / (float)count;
+        }
+    }
+
+    if (linalg_gram_accumulate(scatter->scatter, dim, record->exemplars, count, dim, scatter->centroid) != 0) {
+        scatter->failed = 1;
+        return 1;
+    }
+    scatter->samples += count - 1;
+    return 0;
+}
+
+/**
+ * Estimate the pooled within-user covariance and factor it
+ */
+MahalanobisModel* mahalanobis_train(TemplateDB *db) {
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Invalid template database for Mahalanobis training");
+        return NULL;
+    }
+
+    size_t dim = FEATURE_VECTOR_SIZE;
+    MahalanobisModel *model = (MahalanobisModel*)calloc(1, sizeof(MahalanobisModel));
+    float *centroid = (float*)malloc(dim * sizeof(float));
+    if (!model || !centroid) {
+        log_message(NL_LOG_ERROR, "Failed to allocate Mahalanobis model");
+        free(model);
+        free(centroid);
+        return NULL;
+    }
+    model->dim = dim;
+    model->factor = (double*)calloc(dim * dim, sizeof(double));
+    if (!model->factor) {
+        log_message(NL_LOG_ERROR, "Failed to allocate Mahalanobis model");
+        free(centroid);
+        mahalanobis_free(model);
+        return NULL;
+    }
+
+    ScatterContext scatter = { model->factor, centroid, dim, 0, 0 };
+    template_db_foreach(db, accumulate_record, &scatter);
+    free(centroid);
+
+    if (scatter.failed || scatter.samples < 2) {
+        log_message(NL_LOG_ERROR, "Too few enrolment exemplars to estimate a covariance (%llu)",
+                    (unsigned long long)scatter.samples);
+        mahalanobis_free(model);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < dim * dim; i++) {
+        model->factor[i] /= (double)scatter.samples;
+    }
+    linalg_shrink(model->factor, dim, MAHALANOBIS_SHRINKAGE);
+
+    if (linalg_cholesky(model->factor, dim) != 0) {
+        mahalanobis_free(model);
+        return NULL;
+    }
+    model->samples = scatter.samples;
+
+    log_message(NL_LOG_INFO, "Pooled within-user covariance over %llu trial deviations",
+                (unsigned long long)model->samples);
+    return model;
+}
+
+/**
+ * Write a model to a file
+ */
+int mahalanobis_save(const MahalanobisModel *model, const char *path) {
+    if (!model || !model->factor || !path) {
+        log_message(NL_LOG_ERROR, "Invalid input for Mahalanobis model save");
+        return -1;
+    }
+
+    size_t size = MAHALANOBIS_FILE_HEADER_SIZE + model->dim * model->dim * sizeof(double);
+    uint8_t *buffer = (uint8_t*)calloc(1, size);
+    if (!buffer) {
+        log_message(NL_LOG_ERROR, "Failed to allocate model buffer (%zu bytes)", size);
+        return -1;
+    }
+
+    store_le32(buffer, MAHALANOBIS_FILE_MAGIC);
+    store_le16(buffer + 4, MAHALANOBIS_FILE_VERSION);
+    store_le16(buffer + 6, MAHALANOBIS_FILE_HEADER_SIZE);
+    store_le32(buffer + 8, (uint32_t)model->dim);
+    store_le64(buffer + 16, model->samples);
+
+    uint8_t *p = buffer + MAHALANOBIS_FILE_HEADER_SIZE;
+    for (size_t i = 0; i < model->dim * model->dim; i++, p += 8) {
+        uint64_t bits;
+        memcpy(&bits, &model->factor[i], sizeof(bits));
+        store_le64(p, bits);
+    }
+    store_le32(buffer + 12, crc32_update(0, buffer, size));
+
+    // Temp file + rename so readers never see a half-written model
+    char tmp_path[520];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        log_message(NL_LOG_ERROR, "Model path too long: %s", path);
+        free(buffer);
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open file for writing: %s", tmp_path);
+        free(buffer);
+        return -1;
+    }
+
+    ssize_t written = pwrite(fd, buffer, size, 0);
+    int sync_result = fsync(fd);
+    int close_result = close(fd);
+    free(buffer);
+
+    if (written != (ssize_t)size || sync_result != 0 || close_result != 0 ||
+        rename(tmp_path, path) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to write Mahalanobis model: %s", path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (sync_parent_directory(path) != 0) {
+        log_message(NL_LOG_WARNING, "Failed to sync model directory for: %s", path);
+    }
+
+    log_message(NL_LOG_INFO, "Saved Mahalanobis model to %s", path);
+    return 0;
+}
+
+/**
+ * Read a model written by mahalanobis_save
+ */
+MahalanobisModel* mahalanobis_load(const char *path) {
+    if (!path) {
+        log_message(NL_LOG_ERROR, "Invalid Mahalanobis model path");
+        return NULL;
+    }
+
+    uint8_t *buffer = NULL;
+    size_t size = 0;
+    if (read_file(path, &buffer, &size) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to read Mahalanobis model: %s", path);
+        return NULL;
+    }
+
+    uint32_t dim = size >= MAHALANOBIS_FILE_HEADER_SIZE ? load_le32(buffer + 8) : 0;
+    uint32_t stored_crc = size >= MAHALANOBIS_FILE_HEADER_SIZE ? load_le32(buffer + 12) : 0;
+    if (size >= MAHALANOBIS_FILE_HEADER_SIZE) {
+        store_le32(buffer + 12, 0);
+    }
+
+    if (size < MAHALANOBIS_FILE_HEADER_SIZE || load_le32(buffer) != MAHALANOBIS_FILE_MAGIC ||
+        load_le16(buffer + 4) != MAHALANOBIS_FILE_VERSION ||
+        load_le16(buffer + 6) != MAHALANOBIS_FILE_HEADER_SIZE || dim != FEATURE_VECTOR_SIZE ||
+        size != MAHALANOBIS_FILE_HEADER_SIZE + (size_t)dim * dim * sizeof(double) ||
+        crc32_update(0, buffer, size) != stored_crc) {
+        log_message(NL_LOG_ERROR, "Corrupt or incompatible Mahalanobis model: %s", path);
+        free(buffer);
+        return NULL;
+    }
+
+    MahalanobisModel *model = (MahalanobisModel*)calloc(1, sizeof(MahalanobisModel));
+    if (model) {
+        model->factor = (double*)malloc((size_t)dim * dim * sizeof(double));
+    }
+    if (!model || !model->factor) {
+        log_message(NL_LOG_ERROR, "Failed to allocate Mahalanobis model");
+        mahalanobis_free(model);
+        free(buffer);
+        return NULL;
+    }
+
+    model->dim = dim;
+    model->samples = load_le64(buffer + 16);
+    const uint8_t *p = buffer + MAHALANOBIS_FILE_HEADER_SIZE;
+    for (size_t i = 0; i < (size_t)dim * dim; i++, p += 8) {
+        uint64_t bits = load_le64(p);
+        memcpy(&model->factor[i], &bits, sizeof(bits));
+    }
+
+    // A factor with a non-positive diagonal would divide by zero in every solve
+    for (size_t i = 0; i < dim; i++) {
+        if (!(model->factor[i * dim + i] > 0.0)) {
+            log_message(NL_LOG_ERROR, "Invalid Mahalanobis factor in: %s", path);
+            mahalanobis_free(model);
+            free(buffer);
+            return NULL;
+        }
+    }
+
+    free(buffer);
+    return model;
+}
+
+/**
+ * Free a model
+ */
+void mahalanobis_free(MahalanobisModel *model) {
+    if (model) {
+        free(model->factor);
+        free(model);
+    }
+}
+
+/**
+ * Squared Mahalanobis distance between two unit-normalized vectors, per feature
+ */
+float mahalanobis_distance(const MahalanobisModel *model, const float *a, const float *b) {
+    if (!model || !model->factor || !a || !b) {
+        log_message(NL_LOG_ERROR, "Invalid input for Mahalanobis distance");
+        return -1.0f;
+    }
+
+    size_t dim = model->dim;
+    float na = vector_magnitude(a, dim);
+    float nb = vector_magnitude(b, dim);
+    double *diff = (double*)malloc(dim * sizeof(double));
+    if (!diff || na <= 0.0f || nb <= 0.0f) {
+        free(diff);
+        return -1.0f;
+    }
+
+    for (size_t c = 0; c < dim; c++) {
+        diff[c] = (double)a[c] / na - (double)b[c] / nb;
+    }
+
+    // d^2 = |L^-1 diff|^2: one forward substitution, no inverse
+    linalg_solve_lower(model->factor, dim, diff, diff);
+    double d2 = 0.0;
+    for (size_t c = 0; c < dim; c++) {
+        d2 += diff[c] * diff[c];
+    }
+
+    free(diff);
+    return (float)(d2 / dim);
+}
+
+/**
+ * Score a probe against a template mean with the whitened distance
+ */
+float mahalanobis_similarity(const MahalanobisModel *model, const Template *template, const FeatureVector *probe) {
+    if (!model || !template || !template->features || !probe ||
+        template->features->size != model->dim || probe->size != model->dim) {
+        log_message(NL_LOG_ERROR, "Invalid input for Mahalanobis similarity");
+        return -1.0f;
+    }
+
+    float d2 = mahalanobis_distance(model, probe->features, template->features->features);
+    return d2 < 0.0f ? -1.0f : expf(-0.5f * d2);
+}
@@ -2,11 +2,42 @@
 #include "feature_extraction.h"
 #include "hashing.h"
 #include "template.h"
+#include "template_db.h"
+#include "template_cache.h"
+#include "enroll.h"
+#include "continuous.h"
+#include "identify.h"
+#include "io_batch.h"
+#include "hnsw.h"
+#include "pq.h"
+#include "index_log.h"
+#include "wal.h"
+#include "archive.h"
+#include "snapshot.h"
+#include "cohort.h"
+#include "mahalanobis.h"
+#include "lda.h"
+#include "cnn.h"
+#include "eval.h"
+#include "auth.h"
+#include "protocol.h"
+#include "server.h"
+#include "batch.h"
+#include "lockout.h"
+#include "scheduler.h"
+#include "linalg.h"
+#include "vector_ops.h"
 #include "utils.h"
 #include "config.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 void print_banner(void) {
     printf("\n");
@@ -25,8 +56,19 @@ void print_usage(const char *program_name) {
     printf("Commands:\n");
     printf("  enroll <username>       Enroll a new user\n");
     printf("  auth <username>         Authenticate a user\n");
+    printf("  monitor <username> [ms] Keep verifying the wearer; exits with 2 on de-authentication\n");
+    printf("  identify                Identify the wearer among enrolled users\n");
+    printf("  index [hnsw|pq]         Build an approximate index used by identify\n");
+    printf("  publish                 Share identification snapshots with other processes\n");
+    printf("  cohort [size]           Build the impostor cohort used for score normalization\n");
+    printf("  whiten                  Train the covariance model for whitened matching\n");
+    printf("  eval [probe_db]         Score all probes against all templates; report FAR/FRR/EER\n");
     printf("  delete <username>       Delete user template\n");
     printf("  list                    List enrolled users\n");
+    printf("  export <file>           Write all templates to a migration archive\n");
+    printf("  import <file>           Load templates from a migration archive\n");
+    printf("  record <file>           Capture one trial to a recording file\n");
+    printf("  batch <manifest> [out]  Score recordings listed in a manifest (out.bin: binary results)\n");
     printf("  test                    Run system test\n");
     printf("  help                    Show this help message\n");
     printf("\n");
@@ -51,130 +93,154 @@ int cmd_enroll(const char *username, const char *device_name, MentalTask task) {
     printf("========================================\n\n");
     
     // Check if user already exists
-    if (template_exists(username)) {
+    if (create_directory(TEMPLATE_DIR) != 0) {
+        return -1;
+    }
+    
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    if (template_db_contains(db, username)) {
         printf("Error: User '%s' already enrolled.\n", username);
         printf("Delete existing template first with: neurolock delete %s\n", username);
+        template_db_close(db);
         return -1;
     }
     
     // Initialize capture system
     if (capture_init() != 0) {
-        log_message(LOG_ERROR, "Failed to initialize capture system");
+        log_message(NL_LOG_ERROR, "Failed to initialize capture system");
+        template_db_close(db);
         return -1;
     }
     
     // Connect to device
     if (capture_connect(device_name) != 0) {
-        log_message(LOG_ERROR, "Failed to connect to device");
+        log_message(NL_LOG_ERROR, "Failed to connect to device");
         capture_cleanup();
+        template_db_close(db);
         return -1;
     }
     
     // Start streaming
     if (capture_start_streaming() != 0) {
-        log_message(LOG_ERROR, "Failed to start streaming");
+        log_message(NL_LOG_ERROR, "Failed to start streaming");
         capture_cleanup();
+        template_db_close(db);
         return -1;
     }
     
-    // Capture multiple trials
-    EEGData **trials = (EEGData**)malloc(NUM_ENROLMENT_TRIALS * sizeof(EEGData*));
-    if (!trials) {
-        log_message(LOG_ERROR, "Failed to allocate trial array");
+    // Each trial is extracted and checked while the user rests before the next one
+    EnrollSession *session = enroll_session_create(username, task, NUM_ENROLMENT_TRIALS + ENROLL_MAX_REDOS);
+    if (!session) {
         capture_cleanup();
+        template_db_close(db);
         return -1;
     }
     
     printf("You will perform %d trials. Try to maintain consistency.\n\n", NUM_ENROLMENT_TRIALS);
     
-    for (int i = 0; i < NUM_ENROLMENT_TRIALS; i++) {
-        printf("=== Trial %d/%d ===\n", i + 1, NUM_ENROLMENT_TRIALS);
+    int redos = 0;
+    while (enroll_session_accepted(session) < NUM_ENROLMENT_TRIALS) {
+        printf("=== Trial %zu/%d ===\n", enroll_session_accepted(session) + 1, NUM_ENROLMENT_TRIALS);
         
-        trials[i] = eeg_data_alloc(NUM_CHANNELS, SAMPLING_RATE * CAPTURE_DURATION);
-        if (!trials[i]) {
-            log_message(LOG_ERROR, "Failed to allocate trial data");
-            // Cleanup previous trials
-            for (int j = 0; j < i; j++) {
-                eeg_data_free(trials[j]);
-            }
-            free(trials);
+        EEGData *trial = eeg_data_alloc(NUM_CHANNELS, SAMPLING_RATE * CAPTURE_DURATION);
+        if (!trial || capture_record(CAPTURE_DURATION, task, trial) != 0) {
+            log_message(NL_LOG_ERROR, "Failed to capture trial");
+            eeg_data_free(trial);
+            enroll_session_free(session);
             capture_cleanup();
+            template_db_close(db);
             return -1;
         }
+        uint64_t captured_at = get_timestamp_ms();
+        int index = enroll_session_submit(session, trial);
+        
+        printf("\n");
         
-        if (capture_record(CAPTURE_DURATION, task, trials[i]) != 0) {
-            log_message(LOG_ERROR, "Failed to capture trial");
-            // Cleanup
-            for (int j = 0; j <= i; j++) {
-                eeg_data_free(trials[j]);
+        float consistency = 0.0f;
+        enroll_session_wait(session);
+        EnrollTrialStatus status = enroll_session_trial(session, index, &consistency);
+        if (status == ENROLL_TRIAL_ACCEPTED) {
+            printf("  ✓ Trial consistent (similarity %.2f)\n", consistency);
+        } else {
+            if (status == ENROLL_TRIAL_INCONSISTENT) {
+                printf("  ✗ Trial differs from the previous ones (similarity %.2f < %.2f); please repeat it\n",
+                       consistency, ENROLL_MIN_CONSISTENCY);
+            } else {
+                printf("  ✗ Trial could not be processed; please repeat it\n");
+            }
+            if (++redos > ENROLL_MAX_REDOS) {
+                printf("\nError: Too many inconsistent trials. Please try enrolling again.\n");
+                enroll_session_free(session);
+                capture_cleanup();
+                template_db_close(db);
+                return -1;
             }
-            free(trials);
-            capture_cleanup();
-            return -1;
         }
         
-        printf("\n");
-        
-        if (i < NUM_ENROLMENT_TRIALS - 1) {
-            printf("Rest for 10 seconds before next trial...\n");
-            sleep_ms(10000);
+        if (enroll_session_accepted(session) < NUM_ENROLMENT_TRIALS) {
+            printf("Rest for %d seconds before next trial...\n", ENROLL_REST_MS / 1000);
+            uint64_t elapsed = get_timestamp_ms() - captured_at;
+            if (elapsed < ENROLL_REST_MS) {
+                sleep_ms((uint32_t)(ENROLL_REST_MS - elapsed));
+            }
         }
     }
     
-    // Create template
+    // Running statistics are complete: only hashing remains
     printf("\nCreating template...\n");
     Template *template = template_alloc();
     if (!template) {
-        log_message(LOG_ERROR, "Failed to allocate template");
-        // Cleanup
-        for (int i = 0; i < NUM_ENROLMENT_TRIALS; i++) {
-            eeg_data_free(trials[i]);
-        }
-        free(trials);
+        log_message(NL_LOG_ERROR, "Failed to allocate template");
+        enroll_session_free(session);
         capture_cleanup();
+        template_db_close(db);
         return -1;
     }
     
-    if (template_create(username, (const EEGData**)trials, NUM_ENROLMENT_TRIALS, task, template) != 0) {
-        log_message(LOG_ERROR, "Failed to create template");
+    if (enroll_session_finish(session, template) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to create template");
         template_free(template);
-        for (int i = 0; i < NUM_ENROLMENT_TRIALS; i++) {
-            eeg_data_free(trials[i]);
-        }
-        free(trials);
+        enroll_session_free(session);
         capture_cleanup();
+        template_db_close(db);
         return -1;
     }
+    enroll_session_free(session);
     
-    // Save template
-    char filepath[512];
-    template_get_filepath(username, filepath, sizeof(filepath));
+    // Precompute Z-norm statistics and train the discriminant if a cohort has been built
+    TemplateMatrix *cohort = file_exists(COHORT_PATH) ? cohort_load(COHORT_PATH) : NULL;
+    auth_train(template, cohort);
+    template_matrix_free(cohort);
     
-    if (template_save(template, filepath) != 0) {
-        log_message(LOG_ERROR, "Failed to save template");
+    // Save template; returns once the log record is durable and applied
+    TemplateWAL *wal = wal_open(WAL_PATH, db);
+    int saved = wal && wal_put(wal, template) == 0;
+    wal_close(wal);
+    if (!saved) {
+        log_message(NL_LOG_ERROR, "Failed to save template");
         template_free(template);
-        for (int i = 0; i < NUM_ENROLMENT_TRIALS; i++) {
-            eeg_data_free(trials[i]);
-        }
-        free(trials);
         capture_cleanup();
+        template_db_close(db);
         return -1;
     }
+    index_log_record(HNSW_INDEX_PATH, PQ_INDEX_PATH, username, template->features->features);
     
     printf("\n");
     printf("========================================\n");
     printf("  ✓ ENROLMENT SUCCESSFUL\n");
     printf("========================================\n");
-    printf("Template saved to: %s\n", filepath);
+    printf("Template saved to: %s\n", TEMPLATE_DB_PATH);
     printf("\n");
     
     // Cleanup
     template_free(template);
-    for (int i = 0; i < NUM_ENROLMENT_TRIALS; i++) {
-        eeg_data_free(trials[i]);
-    }
-    free(trials);
     capture_cleanup();
+    template_db_close(db);
     
     return 0;
 }
@@ -188,38 +254,40 @@ int cmd_authenticate(const char *username, const char *device_name, MentalTask t
     printf("========================================\n\n");
     
     // Check if user exists
-    if (!template_exists(username)) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db || !template_db_contains(db, username)) {
         printf("Error: User '%s' not enrolled.\n", username);
         printf("Enroll first with: neurolock enroll %s\n", username);
+        template_db_close(db);
         return -1;
     }
     
     // Load template
     Template *template = template_alloc();
     if (!template) {
-        log_message(LOG_ERROR, "Failed to allocate template");
+        log_message(NL_LOG_ERROR, "Failed to allocate template");
+        template_db_close(db);
         return -1;
     }
     
-    char filepath[512];
-    template_get_filepath(username, filepath, sizeof(filepath));
-    
-    if (template_load(filepath, template) != 0) {
-        log_message(LOG_ERROR, "Failed to load template");
+    if (template_db_get(db, username, template) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to load template");
         template_free(template);
+        template_db_close(db);
         return -1;
     }
+    template_db_close(db);
     
     // Initialize capture system
     if (capture_init() != 0) {
-        log_message(LOG_ERROR, "Failed to initialize capture system");
+        log_message(NL_LOG_ERROR, "Failed to initialize capture system");
         template_free(template);
         return -1;
     }
     
     // Connect to device
     if (capture_connect(device_name) != 0) {
-        log_message(LOG_ERROR, "Failed to connect to device");
+        log_message(NL_LOG_ERROR, "Failed to connect to device");
         template_free(template);
         capture_cleanup();
         return -1;
@@ -227,7 +295,7 @@ int cmd_authenticate(const char *username, const char *device_name, MentalTask t
     
     // Start streaming
     if (capture_start_streaming() != 0) {
-        log_message(LOG_ERROR, "Failed to start streaming");
+        log_message(NL_LOG_ERROR, "Failed to start streaming");
         template_free(template);
         capture_cleanup();
         return -1;
@@ -236,49 +304,110 @@ int cmd_authenticate(const char *username, const char *device_name, MentalTask t
     // Capture authentication trial
     EEGData *trial = eeg_data_alloc(NUM_CHANNELS, SAMPLING_RATE * CAPTURE_DURATION);
     if (!trial) {
-        log_message(LOG_ERROR, "Failed to allocate trial data");
+        log_message(NL_LOG_ERROR, "Failed to allocate trial data");
         template_free(template);
         capture_cleanup();
         return -1;
     }
     
     if (capture_record(CAPTURE_DURATION, template->task_type, trial) != 0) {
-        log_message(LOG_ERROR, "Failed to capture trial");
+        log_message(NL_LOG_ERROR, "Failed to capture trial");
         eeg_data_free(trial);
         template_free(template);
         capture_cleanup();
         return -1;
     }
     
-    // Authenticate
+    // Authenticate with the user's discriminant if one was trained, then the whitened
+    // matcher if a model has been trained, otherwise with cosine similarity normalized
+    // against the impostor cohort when there is one
     printf("\nAuthenticating...\n");
     AuthResult result;
+    AuthMatcher matcher;
+    int discriminant = LDA_MATCHER && template->lda_weights != NULL;
+    MahalanobisModel *whitening = !discriminant && MAHALANOBIS_MATCHER && file_exists(MAHALANOBIS_PATH) ?
+                                  mahalanobis_load(MAHALANOBIS_PATH) : NULL;
+    TemplateMatrix *cohort = file_exists(COHORT_PATH) ? cohort_load(COHORT_PATH) : NULL;
+    
+    // Counted in the table the daemon uses, so the CLI is held to the same limit
+    AttemptTable *attempts = lockout_open(LOCKOUT_PATH, LOCKOUT_TABLE_SIZE);
+    int attempt = 1;
+    uint64_t retry_ms = 0;
+    if (!attempts || lockout_acquire(attempts, username, get_timestamp_ms(), &attempt, &retry_ms) != 0) {
+        if (attempts) {
+            printf("Error: Too many failed attempts. Try again in %llu s.\n",
+                   (unsigned long long)((retry_ms + 999) / 1000));
+        } else {
+            log_message(NL_LOG_ERROR, "Cannot track attempts; refusing to authenticate");
+        }
+        lockout_destroy(attempts);
+        mahalanobis_free(whitening);
+        template_matrix_free(cohort);
+        eeg_data_free(trial);
+        template_free(template);
+        capture_cleanup();
+        return -1;
+    }
     
-    if (template_authenticate(trial, template, &result) != 0) {
-        log_message(LOG_ERROR, "Authentication process failed");
+    int auth_status = auth_verify(trial, template, whitening, cohort, &result, &matcher);
+    mahalanobis_free(whitening);
+    if (auth_status != 0) {
+        log_message(NL_LOG_ERROR, "Authentication process failed");
+        lockout_finish(attempts, username, ATTEMPT_ABORTED);
+        lockout_destroy(attempts);
+        template_matrix_free(cohort);
         eeg_data_free(trial);
         template_free(template);
         capture_cleanup();
         return -1;
     }
+    result.attempts = attempt;
+    lockout_finish(attempts, username, result.authenticated ? ATTEMPT_ACCEPTED : ATTEMPT_REJECTED);
+    lockout_destroy(attempts);
     
     printf("\n");
     printf("========================================\n");
     if (result.authenticated) {
         printf("  ✓ AUTHENTICATION SUCCESSFUL\n");
-        printf("========================================\n");
-        printf("Similarity score: %.3f\n", result.similarity_score);
-        printf("Threshold: %.3f\n", SIMILARITY_THRESHOLD);
     } else {
         printf("  ✗ AUTHENTICATION FAILED\n");
-        printf("========================================\n");
-        printf("Similarity score: %.3f\n", result.similarity_score);
-        printf("Threshold: %.3f\n", SIMILARITY_THRESHOLD);
+    }
+    printf("========================================\n");
+    printf("Similarity score: %.3f\n", result.similarity_score);
+    if (matcher == AUTH_MATCHER_DISCRIMINANT) {
+        printf("Discriminant score: %.2f\n", result.normalized_score);
+        printf("Threshold: %.2f (discriminant)\n", auth_threshold(matcher));
+    } else if (matcher == AUTH_MATCHER_NORMALIZED) {
+        printf("Normalized score: %.2f\n", result.normalized_score);
+        printf("Threshold: %.2f\n", auth_threshold(matcher));
+    } else if (matcher == AUTH_MATCHER_WHITENED) {
+        printf("Threshold: %.3f (whitened)\n", auth_threshold(matcher));
+    } else {
+        printf("Threshold: %.3f\n", auth_threshold(matcher));
+    }
+    if (!result.authenticated) {
         printf("Access denied.\n");
+        if (attempt == MAX_AUTH_ATTEMPTS) {
+            printf("Too many failed attempts: locked out for %d s.\n", AUTH_TIMEOUT);
+        } else {
+            printf("Attempts left: %d\n", MAX_AUTH_ATTEMPTS - attempt);
+        }
     }
     printf("\n");
     
+    // Fold the accepted trial into the template so it follows slow drift
+    if (result.authenticated && auth_adapt(template, trial, cohort) == 0) {
+        db = template_db_open(TEMPLATE_DB_PATH);
+        TemplateWAL *wal = db ? wal_open(WAL_PATH, db) : NULL;
+        if (!wal || wal_put_async(wal, template) != 0) {
+            log_message(NL_LOG_WARNING, "Failed to persist template update");
+        }
+        wal_close(wal);
+        template_db_close(db);
+    }
+    
     // Cleanup
+    template_matrix_free(cohort);
     eeg_data_free(trial);
     template_free(template);
     capture_cleanup();
@@ -286,142 +415,3120 @@ int cmd_authenticate(const char *username, const char *device_name, MentalTask t
     return result.authenticated ? 0 : -1;
 }
 
-int cmd_delete(const char *username) {
-    printf("\nDeleting template for user: %s\n", username);
+static volatile sig_atomic_t monitor_stop = 0;
+
+static void stop_monitoring(int signum) {
+    (void)signum;
+    monitor_stop = 1;
+}
+
+int cmd_monitor(const char *username, const char *device_name, uint32_t cadence_ms) {
+    if (cadence_ms == 0) {
+        cadence_ms = CONTINUOUS_CADENCE_MS;
+    }
+    
+    printf("\n");
+    printf("========================================\n");
+    printf("      CONTINUOUS AUTHENTICATION\n");
+    printf("========================================\n");
+    printf("Username: %s\n", username);
+    printf("Re-score every: %u ms\n", cadence_ms);
+    printf("De-authenticate after: %d low windows\n", CONTINUOUS_DEAUTH_WINDOWS);
+    printf("========================================\n\n");
     
-    if (!template_exists(username)) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db || !template_db_contains(db, username)) {
         printf("Error: User '%s' not enrolled.\n", username);
+        template_db_close(db);
         return -1;
     }
     
-    char confirm[10];
-    printf("Are you sure? (yes/no): ");
-    if (get_user_input("", confirm, sizeof(confirm))) {
-        if (strcmp(confirm, "yes") == 0) {
-            if (template_delete(username) == 0) {
-                printf("Template deleted successfully.\n");
-                return 0;
-            } else {
-                printf("Failed to delete template.\n");
-                return -1;
+    Template *template = template_alloc();
+    if (!template || template_db_get(db, username, template) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to load template");
+        template_free(template);
+        template_db_close(db);
+        return -1;
+    }
+    template_db_close(db);
+    
+    // Same matcher as auth; the stream never adapts the template
+    int discriminant = LDA_MATCHER && template->lda_weights != NULL;
+    MahalanobisModel *whitening = !discriminant && MAHALANOBIS_MATCHER && file_exists(MAHALANOBIS_PATH) ?
+                                  mahalanobis_load(MAHALANOBIS_PATH) : NULL;
+    TemplateMatrix *cohort = file_exists(COHORT_PATH) ? cohort_load(COHORT_PATH) : NULL;
+    ContinuousMonitor *monitor = continuous_create(template, whitening, cohort, cadence_ms);
+    float *frames = (float*)malloc((size_t)SAMPLING_RATE * NUM_CHANNELS * sizeof(float));
+    if (!monitor || !frames || capture_init() != 0 || capture_connect(device_name) != 0 ||
+        capture_start_streaming() != 0) {
+        log_message(NL_LOG_ERROR, "Failed to start continuous authentication");
+        free(frames);
+        continuous_free(monitor);
+        template_matrix_free(cohort);
+        mahalanobis_free(whitening);
+        template_free(template);
+        capture_cleanup();
+        return -1;
+    }
+    
+    signal(SIGINT, stop_monitoring);
+    signal(SIGTERM, stop_monitoring);
+    printf("\nMonitoring %s (Ctrl+C to stop)\n\n", username);
+    
+    // Wake once per cadence and drain what the headset buffered meanwhile
+    uint64_t started = get_timestamp_ms();
+    uint64_t last_sample = started;
+    int result = 0;
+    while (!monitor_stop) {
+        sleep_ms(cadence_ms);
+        
+        int count = 0;
+        int event = CONTINUOUS_IDLE;
+        size_t drained = 0;
+        do {
+            count = capture_read(frames, SAMPLING_RATE);
+            int pushed = count > 0 ? continuous_push(monitor, frames, (size_t)count) : CONTINUOUS_IDLE;
+            if (pushed < 0) {
+                count = -1;
+            } else if (pushed != CONTINUOUS_IDLE) {
+                event = pushed;
             }
+            drained += count > 0 ? (size_t)count : 0;
+        } while (count == SAMPLING_RATE);
+        if (count < 0) {
+            log_message(NL_LOG_ERROR, "EEG stream failed");
+            result = -1;
+            break;
+        }
+        
+        uint64_t now = get_timestamp_ms();
+        if (drained > 0) {
+            last_sample = now;
+        } else if (now - last_sample >= CONTINUOUS_SIGNAL_TIMEOUT_MS) {
+            printf("  ✗ No EEG signal for %llu ms\n", (unsigned long long)(now - last_sample));
+            event = CONTINUOUS_DEAUTH;
         } else {
-            printf("Deletion cancelled.\n");
-            return 0;
+            continue;
+        }
+        
+        if (event != CONTINUOUS_IDLE && drained > 0) {
+            ContinuousStats stats;
+            continuous_stats(monitor, &stats);
+            float score = stats.last.normalized ? stats.last.normalized_score : stats.last.similarity_score;
+            printf("  [%5llu s] score %.3f (threshold %.3f) %s\n", (unsigned long long)((now - started) / 1000),
+                   score, auth_threshold(stats.matcher), stats.last.authenticated ? "✓" : "✗");
+        }
+        if (event == CONTINUOUS_DEAUTH) {
+            printf("\n");
+            printf("========================================\n");
+            printf("  ✗ DE-AUTHENTICATED\n");
+            printf("========================================\n");
+            printf("The wearer no longer matches %s; lock the session.\n", username);
+            result = 2;
+            break;
         }
     }
     
-    return -1;
+    ContinuousStats stats;
+    continuous_stats(monitor, &stats);
+    uint64_t elapsed = get_timestamp_ms() - started;
+    printf("\nWindows scored: %llu (%llu below threshold)\n",
+           (unsigned long long)stats.windows, (unsigned long long)stats.rejected);
+    printf("Monitor CPU: %.2f%% of a core over %llu s\n",
+           elapsed > 0 ? (double)stats.busy_ns / 1e4 / (double)elapsed : 0.0, (unsigned long long)(elapsed / 1000));
+    printf("\n");
+    
+    // Cleanup
+    free(frames);
+    continuous_free(monitor);
+    template_matrix_free(cohort);
+    mahalanobis_free(whitening);
+    template_free(template);
+    capture_cleanup();
+    
+    return result;
 }
 
-int cmd_test(void) {
+int cmd_identify(const char *device_name, MentalTask task) {
     printf("\n");
     printf("========================================\n");
-    printf("         SYSTEM TEST\n");
+    printf("         USER IDENTIFICATION\n");
     printf("========================================\n\n");
     
-    printf("Testing capture system...\n");
-    if (capture_init() == 0) {
-        printf("  ✓ Capture initialization: OK\n");
-        capture_cleanup();
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    // Prefer the HNSW graph, then PQ codes, then an exhaustive scan of a
+    // published snapshot or of a private matrix
+    HNSWIndex *graph = NULL;
+    PQIndex *codes = NULL;
+    SnapshotReader *snapshot = NULL;
+    TemplateMatrix *matrix = NULL;
+    const TemplateMatrix *scan = NULL;
+    const char *method = "exhaustive";
+    size_t num_templates = 0;
+    
+    if (file_exists(HNSW_INDEX_PATH) && (graph = index_log_load_hnsw(HNSW_INDEX_PATH)) != NULL) {
+        method = "HNSW";
+        num_templates = hnsw_count(graph);
+    } else if (file_exists(PQ_INDEX_PATH) && (codes = index_log_load_pq(PQ_INDEX_PATH)) != NULL) {
+        method = "PQ";
+        num_templates = codes->num_templates;
+    } else if (file_exists(SNAPSHOT_CONTROL_PATH) &&
+               (snapshot = snapshot_reader_open(SNAPSHOT_CONTROL_PATH)) != NULL) {
+        scan = snapshot_matrix(snapshot);
+        method = scan->codes ? "int8 shared snapshot" : "shared snapshot";
+        num_templates = scan->num_templates;
     } else {
-        printf("  ✗ Capture initialization: FAILED\n");
+        matrix = template_matrix_build(db);
+        if (!matrix || (IDENTIFY_QUANTIZED && template_matrix_quantize(matrix) != 0)) {
+            template_matrix_free(matrix);
+            template_db_close(db);
+            return -1;
+        }
+        scan = matrix;
+        method = matrix->codes ? "int8 exhaustive" : "exhaustive";
+        num_templates = matrix->num_templates;
     }
     
-    printf("\nTesting feature extraction...\n");
-    EEGData *test_data = eeg_data_alloc(NUM_CHANNELS, SAMPLING_RATE * 2);
-    if (test_data) {
-        // Fill with test data
-        for (size_t i = 0; i < test_data->num_channels * test_data->num_samples; i++) {
-            test_data->data[i] = ((float)rand() / RAND_MAX - 0.5f) * 100.0f;
+    if (num_templates == 0) {
+        printf("Error: No users enrolled.\n");
+        template_matrix_free(matrix);
+        snapshot_reader_close(snapshot);
+        hnsw_free(graph);
+        pq_free(codes);
+        template_db_close(db);
+        return -1;
+    }
+    
+    if (capture_init() != 0 || capture_connect(device_name) != 0 || capture_start_streaming() != 0) {
+        log_message(NL_LOG_ERROR, "Failed to start EEG capture");
+        template_matrix_free(matrix);
+        snapshot_reader_close(snapshot);
+        hnsw_free(graph);
+        pq_free(codes);
+        template_db_close(db);
+        capture_cleanup();
+        return -1;
+    }
+    
+    EEGData *trial = eeg_data_alloc(NUM_CHANNELS, SAMPLING_RATE * CAPTURE_DURATION);
+    FeatureVector *probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    if (!trial || !probe ||
+        capture_record(CAPTURE_DURATION, task, trial) != 0 ||
+        extract_features(trial, probe) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to capture identification trial");
+        feature_vector_free(probe);
+        eeg_data_free(trial);
+        template_matrix_free(matrix);
+        snapshot_reader_close(snapshot);
+        hnsw_free(graph);
+        pq_free(codes);
+        template_db_close(db);
+        capture_cleanup();
+        return -1;
+    }
+    
+    IdentifyMatch matches[IDENTIFY_RERANK_CANDIDATES > IDENTIFY_TOP_K ? IDENTIFY_RERANK_CANDIDATES : IDENTIFY_TOP_K];
+    size_t num_matches = 0;
+    int result;
+    uint64_t start = get_timestamp_ms();
+    if (graph) {
+        result = hnsw_search(graph, probe, IDENTIFY_TOP_K, HNSW_EF_SEARCH, matches, &num_matches);
+    } else if (codes) {
+        // PQ scores are approximate: shortlist, then rescore exactly from the database
+        result = pq_search(codes, probe, IDENTIFY_RERANK_CANDIDATES, matches, &num_matches);
+        if (result == 0) {
+            result = template_rerank(db, probe, matches, &num_matches, IDENTIFY_TOP_K);
         }
-        
-        FeatureVector *features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
-        if (features && extract_features(test_data, features) == 0) {
-            printf("  ✓ Feature extraction: OK\n");
-            feature_vector_free(features);
-        } else {
-            printf("  ✗ Feature extraction: FAILED\n");
+    } else if (scan->codes || snapshot) {
+        // int8 scores carry quantization error and a snapshot may trail the
+        // database by one poll: shortlist, then rescore exactly
+        result = template_identify(scan, probe, IDENTIFY_RERANK_CANDIDATES, matches, &num_matches);
+        if (result == 0) {
+            result = template_rerank(db, probe, matches, &num_matches, IDENTIFY_TOP_K);
         }
-        
-        eeg_data_free(test_data);
     } else {
-        printf("  ✗ Data allocation: FAILED\n");
+        result = template_identify(scan, probe, IDENTIFY_TOP_K, matches, &num_matches);
     }
+    uint64_t elapsed = get_timestamp_ms() - start;
     
-    printf("\nTesting hashing...\n");
-    uint8_t salt[SALT_LENGTH];
-    if (generate_salt(salt, SALT_LENGTH) == 0) {
-        printf("  ✓ Salt generation: OK\n");
-    } else {
-        printf("  ✗ Salt generation: FAILED\n");
+    if (result == 0) {
+        printf("\nTop candidates (%zu templates, %s search in %llu ms):\n",
+               num_templates, method, (unsigned long long)elapsed);
+        for (size_t i = 0; i < num_matches; i++) {
+            printf("  %zu. %-32s %.3f%s\n", i + 1, matches[i].username, matches[i].similarity,
+                   matches[i].similarity >= SIMILARITY_THRESHOLD ? "  (match)" : "");
+        }
+        printf("\n");
+        result = (num_matches > 0 && matches[0].similarity >= SIMILARITY_THRESHOLD) ? 0 : -1;
     }
     
-    printf("\n========================================\n");
-    printf("  SYSTEM TEST COMPLETE\n");
-    printf("========================================\n\n");
-    
-    return 0;
+    feature_vector_free(probe);
+    eeg_data_free(trial);
+    template_matrix_free(matrix);
+    snapshot_reader_close(snapshot);
+    hnsw_free(graph);
+    pq_free(codes);
+    template_db_close(db);
+    capture_cleanup();
+    return result;
 }
 
-int main(int argc, char *argv[]) {
-    print_banner();
+int cmd_index(const char *type) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
     
-    if (argc < 2) {
-        print_usage(argv[0]);
+    int result = -1;
+    size_t indexed = 0;
+    const char *path = NULL;
+    uint64_t start = get_timestamp_ms();
+    
+    if (strcmp(type, "hnsw") == 0) {
+        HNSWIndex *graph = hnsw_build(db);
+        if (graph) {
+            path = HNSW_INDEX_PATH;
+            indexed = hnsw_count(graph);
+            result = index_log_save_hnsw(path, graph);
+            hnsw_free(graph);
+        }
+    } else if (strcmp(type, "pq") == 0) {
+        TemplateMatrix *matrix = template_matrix_build(db);
+        PQIndex *codes = pq_train(matrix, PQ_NUM_SUBSPACES);
+        template_matrix_free(matrix);
+        if (codes) {
+            path = PQ_INDEX_PATH;
+            indexed = codes->num_templates;
+            result = index_log_save_pq(path, codes);
+            pq_free(codes);
+        }
+    } else {
+        printf("Error: Unknown index type '%s' (expected hnsw or pq)\n", type);
+    }
+    template_db_close(db);
+    
+    if (result == 0) {
+        printf("\nIndexed %zu templates in %llu ms: %s\n\n", indexed,
+               (unsigned long long)(get_timestamp_ms() - start), path);
+    }
+    return result;
+}
+
+/* Usernames gathered by cmd_cohort before rewriting their records */
+typedef struct {
+    char (*names)[64];
+    size_t count;
+    size_t capacity;
+} UserList;
+
+static int collect_username(const TemplateRecord *record, void *ctx) {
+    UserList *users = (UserList*)ctx;
+    if (users->count == users->capacity) {
         return 1;
     }
+    memcpy(users->names[users->count], record->username, 64);
+    users->names[users->count][63] = '\0';
+    users->count++;
+    return 0;
+}
+
+int cmd_cohort(size_t size) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
     
-    const char *command = argv[1];
-    const char *device_name = "default_eeg_device"; // Default device
-    MentalTask task = TASK_EYES_CLOSED_REST; // Default task
+    // Sample from the same state the log would give everyone else
+    TemplateWAL *wal = wal_open(WAL_PATH, db);
+    wal_close(wal);
     
-    // Parse options
-    for (int i = 2; i < argc; i++) {
-        if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
-            device_name = argv[++i];
-        } else if (strcmp(argv[i], "--task") == 0 && i + 1 < argc) {
-            task = (MentalTask)atoi(argv[++i]);
+    uint64_t start = get_timestamp_ms();
+    TemplateMatrix *cohort = wal ? cohort_build(db, size) : NULL;
+    if (!cohort || cohort_save(cohort, COHORT_PATH) != 0) {
+        printf("Cohort build failed.\n");
+        template_matrix_free(cohort);
+        template_db_close(db);
+        return -1;
+    }
+    
+    // Store Z-norm statistics and discriminants for everyone enrolled before the cohort existed
+    UserList users = { NULL, 0, template_db_count(db) };
+    users.names = calloc(users.capacity > 0 ? users.capacity : 1, sizeof(*users.names));
+    size_t updated = 0;
+    if (users.names) {
+        template_db_foreach(db, collect_username, &users);
+    }
+    for (size_t i = 0; i < users.count; i++) {
+        Template *template = template_alloc();
+        if (template && template_db_get(db, users.names[i], template) == 0 &&
+            cohort_znorm(cohort, template, &template->znorm_mean, &template->znorm_std) == 0) {
+            // A user the cohort cannot separate keeps the normalized cosine matcher
+            if (LDA_MATCHER && lda_train(template, cohort) != 0) {
+                log_message(NL_LOG_WARNING, "Keeping %s without a discriminant", template->username);
+            }
+            if (template_db_put(db, template) == 0) {
+                updated++;
+            }
         }
+        template_free(template);
     }
+    int result = template_db_sync(db);
     
-    // Execute command
-    if (strcmp(command, "enroll") == 0) {
-        if (argc < 3) {
-            printf("Error: Username required\n");
-            print_usage(argv[0]);
-            return 1;
+    printf("\nBuilt %zu-row cohort and normalized %zu of %zu templates in %llu ms: %s\n\n",
+           cohort->num_templates, updated, users.count,
+           (unsigned long long)(get_timestamp_ms() - start), COHORT_PATH);
+    
+    free(users.names);
+    template_matrix_free(cohort);
+    template_db_close(db);
+    return result;
+}
+
+int cmd_eval(const char *probe_path) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    TemplateWAL *wal = wal_open(WAL_PATH, db);
+    wal_close(wal);
+    
+    // Probes from a later session's database when given, else the stored trials
+    TemplateDB *probe_db = probe_path ? template_db_open(probe_path) : NULL;
+    TemplateMatrix *gallery = wal ? template_matrix_build(db) : NULL;
+    TemplateMatrix *probes = !probe_path ? eval_probe_matrix(db) : probe_db ? template_matrix_build(probe_db) : NULL;
+    ScoreHistogram *hist = eval_histogram_alloc(EVAL_HISTOGRAM_BINS);
+    template_db_close(probe_db);
+    template_db_close(db);
+    
+    if (!gallery || !probes || !hist) {
+        printf("Evaluation setup failed.\n");
+        template_matrix_free(gallery);
+        template_matrix_free(probes);
+        eval_histogram_free(hist);
+        return -1;
+    }
+    
+    printf("\nScoring %zu probes against %zu templates...\n", probes->num_templates, gallery->num_templates);
+    uint64_t start = get_timestamp_ms();
+    int result = eval_score_matrix(probes, gallery, hist);
+    uint64_t elapsed = get_timestamp_ms() - start;
+    
+    if (result == 0 && (hist->genuine_count == 0 || hist->impostor_count == 0)) {
+        printf("Need both genuine and impostor pairs (have %llu and %llu).\n",
+               (unsigned long long)hist->genuine_count, (unsigned long long)hist->impostor_count);
+        result = -1;
+    }
+    
+    if (result == 0) {
+        double scores = (double)hist->genuine_count + (double)hist->impostor_count;
+        printf("Scored %.0f pairs (%llu genuine, %llu impostor) in %llu ms (%.1f M scores/s)\n",
+               scores, (unsigned long long)hist->genuine_count, (unsigned long long)hist->impostor_count,
+               (unsigned long long)elapsed, scores / 1000.0 / (double)(elapsed > 0 ? elapsed : 1));
+        if (!probe_path) {
+            printf("Probes are the enrolment trials, so genuine scores are optimistic;\n"
+                   "pass a database from a later session for held-out rates.\n");
         }
-        return cmd_enroll(argv[2], device_name, task);
         
-    } else if (strcmp(command, "auth") == 0 || strcmp(command, "authenticate") == 0) {
-        if (argc < 3) {
-            printf("Error: Username required\n");
-            print_usage(argv[0]);
-            return 1;
-        }
-        return cmd_authenticate(argv[2], device_name, task);
+        double eer, far, frr;
+        float eer_threshold = eval_equal_error(hist, &eer);
+        printf("\nEER: %.3f%% at threshold %.4f\n", eer * 100.0, eer_threshold);
+        eval_rates(hist, SIMILARITY_THRESHOLD, &far, &frr);
+        printf("At SIMILARITY_THRESHOLD %.3f: FAR %.4f%%, FRR %.3f%%\n", SIMILARITY_THRESHOLD, far * 100.0, frr * 100.0);
         
-    } else if (strcmp(command, "delete") == 0) {
-        if (argc < 3) {
-            printf("Error: Username required\n");
-            print_usage(argv[0]);
-            return 1;
+        const double targets[] = { 1e-2, 1e-3, 1e-4 };
+        for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+            float threshold = eval_threshold_at_far(hist, targets[i]);
+            eval_rates(hist, threshold, &far, &frr);
+            printf("FAR <= %g%%: threshold %.4f, FRR %.3f%%\n", targets[i] * 100.0, threshold, frr * 100.0);
         }
-        return cmd_delete(argv[2]);
-        
-    } else if (strcmp(command, "test") == 0) {
-        return cmd_test();
-        
-    } else if (strcmp(command, "help") == 0) {
-        print_usage(argv[0]);
-        return 0;
         
+        result = eval_write_det(hist, EVAL_DET_PATH);
+        if (result == 0) {
+            printf("\nDET curve: %s\n\n", EVAL_DET_PATH);
+        }
+    }
+    
+    template_matrix_free(gallery);
+    template_matrix_free(probes);
+    eval_histogram_free(hist);
+    return result;
+}
+
+int cmd_whiten(void) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    TemplateWAL *wal = wal_open(WAL_PATH, db);
+    wal_close(wal);
+    
+    uint64_t start = get_timestamp_ms();
+    MahalanobisModel *model = wal ? mahalanobis_train(db) : NULL;
+    int result = model ? mahalanobis_save(model, MAHALANOBIS_PATH) : -1;
+    if (result == 0) {
+        printf("\nFactored pooled covariance of %llu trial deviations in %llu ms: %s\n\n",
+               (unsigned long long)model->samples, (unsigned long long)(get_timestamp_ms() - start),
+               MAHALANOBIS_PATH);
     } else {
-        printf("Error: Unknown command '%s'\n", command);
-        print_usage(argv[0]);
-        return 1;
+        printf("Whitening model build failed.\n");
     }
     
-    return 0;
+    mahalanobis_free(model);
+    template_db_close(db);
+    return result;
+}
+
+static volatile sig_atomic_t publish_stop = 0;
+
+static void stop_publishing(int signum) {
+    (void)signum;
+    publish_stop = 1;
+}
+
+int cmd_publish(void) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    SnapshotPublisher *publisher = snapshot_publisher_open(SNAPSHOT_CONTROL_PATH);
+    if (!publisher) {
+        template_db_close(db);
+        return -1;
+    }
+    
+    signal(SIGINT, stop_publishing);
+    signal(SIGTERM, stop_publishing);
+    printf("\nPublishing identification snapshots to %s (Ctrl+C to stop)\n", SNAPSHOT_CONTROL_PATH);
+    
+    // Rebuild whenever a committed write moves the database generation
+    int result = 0;
+    int published = 0;
+    uint64_t published_generation = 0;
+    while (!publish_stop) {
+        template_db_refresh(db);
+        uint64_t generation = template_db_generation(db);
+        if (!published || generation != published_generation) {
+            uint64_t start = get_timestamp_ms();
+            TemplateMatrix *matrix = template_matrix_build(db);
+            if (!matrix || (IDENTIFY_QUANTIZED && template_matrix_quantize(matrix) != 0) ||
+                snapshot_publish(publisher, matrix, generation) != 0) {
+                template_matrix_free(matrix);
+                result = -1;
+                break;
+            }
+            printf("  Published %zu templates (database generation %llu) in %llu ms\n",
+                   matrix->num_templates, (unsigned long long)generation,
+                   (unsigned long long)(get_timestamp_ms() - start));
+            template_matrix_free(matrix);
+            published = 1;
+            published_generation = generation;
+        }
+        sleep_ms(SNAPSHOT_POLL_MS);
+    }
+    
+    snapshot_publisher_close(publisher);
+    template_db_close(db);
+    printf("Snapshot withdrawn.\n\n");
+    return result;
+}
+
+int cmd_delete(const char *username) {
+    printf("\nDeleting template for user: %s\n", username);
+    
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db || !template_db_contains(db, username)) {
+        printf("Error: User '%s' not enrolled.\n", username);
+        template_db_close(db);
+        return -1;
+    }
+    
+    int result = -1;
+    char confirm[10];
+    printf("Are you sure? (yes/no): ");
+    if (get_user_input("", confirm, sizeof(confirm))) {
+        if (strcmp(confirm, "yes") == 0) {
+            TemplateWAL *wal = wal_open(WAL_PATH, db);
+            int removed = wal && wal_delete(wal, username) == 0;
+            wal_close(wal);
+            if (removed) {
+                index_log_record(HNSW_INDEX_PATH, PQ_INDEX_PATH, username, NULL);
+                printf("Template deleted successfully.\n");
+                result = 0;
+            } else {
+                printf("Failed to delete template.\n");
+            }
+        } else {
+            printf("Deletion cancelled.\n");
+            result = 0;
+        }
+    }
+    
+    template_db_close(db);
+    return result;
+}
+
+static int print_enrolled_user(const TemplateRecord *record, void *ctx) {
+    (void)ctx;
+    char created[32];
+    time_t created_at = (time_t)record->created_at;
+    strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&created_at));
+    printf("  %-32.64s task %u  enrolled %s\n", record->username, record->task_type, created);
+    return 0;
+}
+
+int cmd_list(void) {
+    if (!file_exists(TEMPLATE_DB_PATH)) {
+        printf("\nNo users enrolled.\n\n");
+        return 0;
+    }
+    
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    printf("\nEnrolled users (%zu):\n", template_db_count(db));
+    template_db_foreach(db, print_enrolled_user, NULL);
+    printf("\n");
+    
+    template_db_close(db);
+    return 0;
+}
+
+static void print_archive_stats(const char *verb, const ArchiveStats *stats) {
+    double seconds = stats->elapsed_ms > 0 ? stats->elapsed_ms / 1000.0 : 0.001;
+    printf("\n%s %llu templates (%.1f MB) in %.2f s on %zu threads: %.0f templates/s, %.1f MB/s\n",
+           verb, (unsigned long long)stats->templates, stats->bytes / 1e6, seconds, stats->threads,
+           stats->templates / seconds, stats->bytes / 1e6 / seconds);
+    if (stats->rejected > 0) {
+        printf("Skipped %llu entries (see log)\n", (unsigned long long)stats->rejected);
+    }
+}
+
+int cmd_export(const char *path) {
+    if (!file_exists(TEMPLATE_DB_PATH)) {
+        printf("\nNo users enrolled.\n\n");
+        return -1;
+    }
+    
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    // Fold in anything a crashed writer left in the log first
+    TemplateWAL *wal = wal_open(WAL_PATH, db);
+    wal_close(wal);
+    
+    ArchiveStats stats;
+    int result = wal ? archive_export(db, path, &stats) : -1;
+    if (result == 0) {
+        print_archive_stats("Exported", &stats);
+        printf("Archive: %s\n\n", path);
+    } else {
+        printf("Export failed.\n");
+    }
+    
+    template_db_close(db);
+    return result;
+}
+
+int cmd_import(const char *path) {
+    if (create_directory(TEMPLATE_DIR) != 0) {
+        return -1;
+    }
+    
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    // Replay the log before bulk writes so older logged records cannot overwrite imported ones
+    TemplateWAL *wal = wal_open(WAL_PATH, db);
+    wal_close(wal);
+    
+    ArchiveStats stats;
+    int result = wal ? archive_import(db, path, &stats) : -1;
+    if (result == 0) {
+        print_archive_stats("Imported", &stats);
+        printf("Enrolled users: %zu\n", template_db_count(db));
+        if (file_exists(HNSW_INDEX_PATH) || file_exists(PQ_INDEX_PATH)) {
+            printf("Approximate indexes are now stale; rebuild them with 'index'.\n");
+        }
+        printf("\n");
+    } else {
+        printf("Import failed.\n");
+    }
+    
+    template_db_close(db);
+    return result;
+}
+
+int cmd_record(const char *path, const char *device_name, MentalTask task) {
+    if (capture_init() != 0 || capture_connect(device_name) != 0 || capture_start_streaming() != 0) {
+        log_message(NL_LOG_ERROR, "Failed to start capture");
+        capture_cleanup();
+        return -1;
+    }
+    
+    capture_display_task_instructions(task);
+    EEGData *trial = eeg_data_alloc(NUM_CHANNELS, SAMPLING_RATE * CAPTURE_DURATION);
+    int result = trial && capture_record(CAPTURE_DURATION, task, trial) == 0 ? eeg_data_save(trial, path) : -1;
+    if (result == 0) {
+        printf("\nRecording: %s\n\n", path);
+    } else {
+        printf("Recording failed.\n");
+    }
+    
+    eeg_data_free(trial);
+    capture_cleanup();
+    return result;
+}
+
+int cmd_batch(const char *manifest_path, const char *output_path) {
+    TemplateDB *db = template_db_open(TEMPLATE_DB_PATH);
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to open template database");
+        return -1;
+    }
+    
+    // Fold in anything a crashed writer left in the log first
+    TemplateWAL *wal = wal_open(WAL_PATH, db);
+    wal_close(wal);
+    
+    // Same models as auth, so offline decisions match live ones
+    MahalanobisModel *whitening = MAHALANOBIS_MATCHER && file_exists(MAHALANOBIS_PATH) ?
+                                  mahalanobis_load(MAHALANOBIS_PATH) : NULL;
+    TemplateMatrix *cohort = file_exists(COHORT_PATH) ? cohort_load(COHORT_PATH) : NULL;
+    size_t length = strlen(output_path);
+    BatchFormat format = length > 4 && strcmp(output_path + length - 4, ".bin") == 0 ?
+                         BATCH_FORMAT_BINARY : BATCH_FORMAT_CSV;
+    
+    printf("\nScoring %s...\n", manifest_path);
+    BatchStats stats;
+    int result = wal ? batch_score(db, whitening, cohort, manifest_path, output_path, format, &stats) : -1;
+    if (result == 0) {
+        double seconds = stats.elapsed_ms > 0 ? stats.elapsed_ms / 1000.0 : 0.001;
+        printf("Scored %llu records for %llu users in %.2f s on %zu threads: %.0f records/s\n",
+               (unsigned long long)stats.records, (unsigned long long)stats.users, seconds, stats.threads,
+               stats.records / seconds);
+        printf("Accepted %llu, rejected %llu, not scored %llu\n", (unsigned long long)stats.accepted,
+               (unsigned long long)stats.rejected, (unsigned long long)stats.failed);
+        printf("Results: %s\n\n", output_path);
+    } else {
+        printf("Batch scoring failed.\n");
+    }
+    
+    template_matrix_free(cohort);
+    mahalanobis_free(whitening);
+    template_db_close(db);
+    return result;
+}
+
+/**
+ * Template with random features for the storage and index tests
+ */
+static Template* make_test_template(const char *username, uint32_t version) {
+    Template *template = template_alloc();
+    if (!template) {
+        return NULL;
+    }
+    snprintf(template->username, sizeof(template->username), "%s", username);
+    template->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    template->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
+    template->version = version;
+    if (!template->features || !template->hash) {
+        template_free(template);
+        return NULL;
+    }
+    for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+        template->features->features[i] = (float)rand() / RAND_MAX;
+    }
+    return template;
+}
+
+/** Size of a file, or -1 */
+static long test_file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/** Whether a stored template carries the same features as the original */
+static int test_stored_matches(TemplateDB *db, const Template *original, uint32_t version) {
+    Template *stored = template_alloc();
+    int match = stored && template_db_get(db, original->username, stored) == 0 && stored->version == version &&
+                memcmp(stored->features->features, original->features->features,
+                       FEATURE_VECTOR_SIZE * sizeof(float)) == 0;
+    template_free(stored);
+    return match;
+}
+
+/**
+ * Fill a database past its initial capacity so it grows, delete and
+ * reinsert a user through the tombstone, then check a reopened handle
+ */
+static int test_template_db(void) {
+    char db_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_grow.nldb", (int)getpid());
+    
+    const size_t count = TEMPLATE_DB_INITIAL_CAPACITY + 1;
+    TemplateDB *db = template_db_open(db_path);
+    long initial_size = test_file_size(db_path);
+    Template *first = make_test_template("db_user_0", 1);
+    Template *last = NULL;
+    int ok = db && first && initial_size > 0 && template_db_put(db, first) == 0;
+    for (size_t u = 1; ok && u < count; u++) {
+        char username[64];
+        snprintf(username, sizeof(username), "db_user_%zu", u);
+        Template *template = make_test_template(username, 1);
+        ok = template && template_db_put(db, template) == 0;
+        if (u + 1 == count) {
+            last = template;
+        } else {
+            template_free(template);
+        }
+    }
+    ok = ok && template_db_count(db) == count && test_file_size(db_path) > initial_size;
+    
+    // The freed slot and its tombstone take the user back
+    ok = ok && template_db_remove(db, first->username) == 0 && !template_db_contains(db, first->username) &&
+         template_db_remove(db, first->username) != 0 && template_db_count(db) == count - 1;
+    first->version = 2;
+    ok = ok && template_db_put(db, first) == 0 && template_db_count(db) == count;
+    template_db_close(db);
+    
+    // A fresh handle maps the grown file
+    db = ok ? template_db_open(db_path) : NULL;
+    int result = db && template_db_count(db) == count && test_stored_matches(db, first, 2) &&
+                 test_stored_matches(db, last, 1) ? 0 : -1;
+    
+    template_db_close(db);
+    template_free(first);
+    template_free(last);
+    unlink(db_path);
+    return result;
+}
+
+/**
+ * Round-trip a template through the file format and check that a flipped
+ * payload byte and a foreign format version are both rejected
+ */
+static int test_template_format(void) {
+    Template *template = make_test_template("format_user", 3);
+    Template *parsed = template_alloc();
+    uint8_t *buffer = NULL;
+    size_t size = 0;
+    int ok = template && parsed && template_serialize(template, &buffer, &size) == 0 &&
+             template_deserialize(buffer, size, parsed) == 0 && parsed->version == 3 &&
+             strcmp(parsed->username, template->username) == 0 &&
+             memcmp(parsed->features->features, template->features->features, FEATURE_VECTOR_SIZE * sizeof(float)) == 0;
+    template_free(parsed);
+    
+    // A corrupted feature byte fails the CRC
+    parsed = ok ? template_alloc() : NULL;
+    if (parsed) {
+        buffer[size - 1] ^= 0x01;
+        ok = template_deserialize(buffer, size, parsed) != 0;
+        buffer[size - 1] ^= 0x01;
+    }
+    template_free(parsed);
+    
+    // So does a file from another format version, even with a valid CRC
+    parsed = ok ? template_alloc() : NULL;
+    if (parsed) {
+        static const uint8_t zero_crc[4] = {0, 0, 0, 0};
+        store_le16(buffer + 4, TEMPLATE_FILE_VERSION + 1);
+        uint32_t crc = crc32_update(0, buffer, 12);
+        crc = crc32_update(crc, zero_crc, sizeof(zero_crc));
+        store_le32(buffer + 12, crc32_update(crc, buffer + 16, size - 16));
+        ok = template_deserialize(buffer, size, parsed) != 0;
+    }
+    template_free(parsed);
+    
+    free(buffer);
+    template_free(template);
+    return ok ? 0 : -1;
+}
+
+/* A thread reading one user through the cache while it is invalidated and rewritten */
+typedef struct {
+    TemplateCache *cache;
+    const Template *expected;
+    int failed;
+} CacheReader;
+
+static void* read_cache_burst(void *arg) {
+    CacheReader *reader = (CacheReader*)arg;
+    for (size_t i = 0; i < 2000 && !reader->failed; i++) {
+        Template copy = {0};
+        if (template_cache_get(reader->cache, reader->expected->username, &copy) != 0 ||
+            strcmp(copy.username, reader->expected->username) != 0 || !copy.features || !copy.lda_weights ||
+            memcmp(copy.features->features, reader->expected->features->features,
+                   FEATURE_VECTOR_SIZE * sizeof(float)) != 0) {
+            reader->failed = 1;
+        }
+        template_clear(&copy);
+    }
+    return NULL;
+}
+
+/**
+ * Drive the template cache through a miss and a hit, eviction at capacity,
+ * invalidation after the database file changes, and readers that keep
+ * reading while their entry is invalidated and reloaded
+ */
+static int test_template_cache(void) {
+    char db_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_cache.nldb", (int)getpid());
+    
+    Template *users[3] = {NULL};
+    TemplateDB *db = template_db_open(db_path);
+    int ok = db != NULL;
+    for (size_t u = 0; ok && u < 3; u++) {
+        char username[64];
+        snprintf(username, sizeof(username), "cache_user_%zu", u);
+        users[u] = make_test_template(username, 1);
+        ok = users[u] && template_db_put(db, users[u]) == 0;
+    }
+    
+    // The user churned below owns every optional field, so a partial teardown leaks
+    if (ok) {
+        users[2]->variance = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+        users[2]->exemplars = (float*)calloc(NUM_ENROLMENT_TRIALS * FEATURE_VECTOR_SIZE, sizeof(float));
+        users[2]->num_exemplars = NUM_ENROLMENT_TRIALS;
+        users[2]->lda_weights = (float*)calloc(FEATURE_VECTOR_SIZE, sizeof(float));
+        ok = users[2]->variance && users[2]->exemplars && users[2]->lda_weights &&
+             template_db_put(db, users[2]) == 0;
+    }
+    
+    TemplateCache *cache = ok ? template_cache_create(db, 2) : NULL;
+    TemplateCacheStats stats = {0};
+    Template copy = {0};
+    ok = cache && template_cache_get(cache, users[0]->username, &copy) == 0;
+    template_clear(&copy);
+    ok = ok && template_cache_get(cache, users[0]->username, &copy) == 0 && copy.version == 1;
+    template_clear(&copy);
+    if (cache) {
+        template_cache_get_stats(cache, &stats);
+    }
+    ok = ok && stats.hits == 1 && stats.misses == 1 && template_cache_get(cache, "cache_nobody", &copy) != 0;
+    
+    // A third user does not fit
+    ok = ok && template_cache_get(cache, users[1]->username, &copy) == 0;
+    template_clear(&copy);
+    ok = ok && template_cache_get(cache, users[2]->username, &copy) == 0;
+    template_clear(&copy);
+    if (cache) {
+        template_cache_get_stats(cache, &stats);
+    }
+    ok = ok && stats.entries == 2 && stats.evictions == 1;
+    
+    // Rewriting a record through the file is noticed and the new version served
+    users[2]->version = 2;
+    ok = ok && template_cache_watch(cache, db_path) == 0 && template_db_put(db, users[2]) == 0 &&
+         template_cache_poll(cache) == 1 && template_cache_get(cache, users[2]->username, &copy) == 0 &&
+         copy.version == 2;
+    template_clear(&copy);
+    
+    // Readers copying the entry must never see it half freed
+    CacheReader readers[2];
+    pthread_t threads[2];
+    size_t started = 0;
+    for (size_t t = 0; ok && t < 2; t++) {
+        readers[t] = (CacheReader){ cache, users[2], 0 };
+        if (pthread_create(&threads[t], NULL, read_cache_burst, &readers[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    for (uint32_t round = 0; started == 2 && round < 200; round++) {
+        users[2]->version = 3 + round;
+        ok = ok && template_db_put(db, users[2]) == 0;
+        template_cache_invalidate(cache, users[2]->username);
+    }
+    for (size_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+        ok = ok && !readers[t].failed;
+    }
+    int result = ok && started == 2 && template_cache_get(cache, users[2]->username, &copy) == 0 &&
+                 copy.version == 202 ? 0 : -1;
+    template_clear(&copy);
+    
+    template_cache_destroy(cache);
+    template_db_close(db);
+    for (size_t u = 0; u < 3; u++) {
+        template_free(users[u]);
+    }
+    unlink(db_path);
+    return result;
+}
+
+/**
+ * Random unit-norm gallery for the index tests, packed from a scratch
+ * database; every row belongs to a user named prefix_N
+ */
+static TemplateMatrix* make_test_gallery(size_t rows, const char *prefix) {
+    char db_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_%s.nldb", (int)getpid(), prefix);
+    
+    TemplateDB *db = template_db_open(db_path);
+    int ok = db != NULL;
+    for (size_t r = 0; ok && r < rows; r++) {
+        char username[64];
+        snprintf(username, sizeof(username), "%s_%zu", prefix, r);
+        Template *template = make_test_template(username, 1);
+        for (size_t i = 0; template && i < FEATURE_VECTOR_SIZE; i++) {
+            template->features->features[i] -= 0.5f;
+        }
+        ok = template && template_db_put(db, template) == 0;
+        template_free(template);
+    }
+    TemplateMatrix *gallery = ok ? template_matrix_build(db) : NULL;
+    
+    template_db_close(db);
+    unlink(db_path);
+    return gallery;
+}
+
+/** A probe close to one gallery row */
+static void make_test_probe(const TemplateMatrix *gallery, size_t row, FeatureVector *probe) {
+    for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+        probe->features[i] = gallery->matrix[row * gallery->stride + i] + 0.05f * ((float)rand() / RAND_MAX - 0.5f);
+    }
+}
+
+/**
+ * Build an HNSW graph over a random gallery, compare its top-k against the
+ * exhaustive scan, then remove a user and check a saved and reloaded graph
+ * answers the same and a tampered header is rejected. Re-inserting reuses
+ * the user's node, and enough removals compact the graph.
+ */
+static int test_hnsw_index(void) {
+    char index_path[64];
+    snprintf(index_path, sizeof(index_path), "/tmp/neurolock_test_%d.hnsw", (int)getpid());
+    
+    const size_t rows = HNSW_COMPACT_MIN_NODES + 200, probes = 50, k = IDENTIFY_TOP_K;
+    TemplateMatrix *gallery = make_test_gallery(rows, "hnsw_user");
+    HNSWIndex *index = gallery ? hnsw_create(FEATURE_VECTOR_SIZE, HNSW_M, HNSW_EF_CONSTRUCTION) : NULL;
+    FeatureVector *probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    int ok = index && probe && gallery->num_templates == rows;
+    for (size_t r = 0; ok && r < rows; r++) {
+        ok = hnsw_insert(index, gallery->usernames[r], gallery->matrix + r * gallery->stride) == 0;
+    }
+    ok = ok && hnsw_count(index) == rows;
+    
+    // Recall@k against template_identify() on probes near random rows
+    size_t found = 0;
+    for (size_t p = 0; ok && p < probes; p++) {
+        IdentifyMatch exact[IDENTIFY_TOP_K], approx[IDENTIFY_TOP_K];
+        size_t num_exact = 0, num_approx = 0;
+        make_test_probe(gallery, (size_t)rand() % rows, probe);
+        ok = template_identify(gallery, probe, k, exact, &num_exact) == 0 && num_exact == k &&
+             hnsw_search(index, probe, k, HNSW_EF_SEARCH, approx, &num_approx) == 0 && num_approx == k;
+        for (size_t i = 0; ok && i < k; i++) {
+            for (size_t j = 0; j < k; j++) {
+                found += strcmp(exact[i].username, approx[j].username) == 0;
+            }
+        }
+    }
+    ok = ok && found * 100 >= probes * k * 95;
+    
+    // A removed user is never returned, before or after a save and load
+    IdentifyMatch before[IDENTIFY_TOP_K], after[IDENTIFY_TOP_K];
+    size_t num_before = 0, num_after = 0;
+    if (ok) {
+        make_test_probe(gallery, 0, probe);
+    }
+    ok = ok && hnsw_remove(index, gallery->usernames[0]) == 0 && hnsw_remove(index, gallery->usernames[0]) != 0 &&
+         hnsw_count(index) == rows - 1 &&
+         hnsw_search(index, probe, k, HNSW_EF_SEARCH, before, &num_before) == 0 && num_before == k;
+    HNSWIndex *loaded = ok && hnsw_save(index, index_path) == 0 ? hnsw_load(index_path) : NULL;
+    ok = ok && loaded && hnsw_count(loaded) == rows - 1 &&
+         hnsw_search(loaded, probe, k, HNSW_EF_SEARCH, after, &num_after) == 0 && num_after == num_before;
+    for (size_t i = 0; ok && i < num_before; i++) {
+        ok = strcmp(before[i].username, gallery->usernames[0]) != 0 &&
+             strcmp(before[i].username, after[i].username) == 0 && before[i].similarity == after[i].similarity;
+    }
+    
+    // A header whose deleted count disagrees with the stored tombstones is rejected
+    FILE *file = ok ? fopen(index_path, "r+b") : NULL;
+    uint8_t deleted[4];
+    store_le32(deleted, 2);
+    ok = ok && file && fseek(file, 32, SEEK_SET) == 0 && fwrite(deleted, sizeof(deleted), 1, file) == 1;
+    if (file) fclose(file);
+    HNSWIndex *tampered = ok ? hnsw_load(index_path) : NULL;
+    ok = ok && !tampered;
+    hnsw_free(tampered);
+    
+    // The reloaded graph takes the user back into their old node
+    ok = ok && hnsw_insert(loaded, gallery->usernames[0], gallery->matrix) == 0 &&
+         hnsw_count(loaded) == rows &&
+         hnsw_search(loaded, probe, k, HNSW_EF_SEARCH, after, &num_after) == 0 && num_after > 0 &&
+         strcmp(after[0].username, gallery->usernames[0]) == 0 && after[0].index == 0;
+    
+    // Crossing the tombstone threshold compacts the graph: node numbers drop
+    // below the live count and the survivors are still found
+    const size_t removed = rows * HNSW_COMPACT_PERCENT / 100 + 1;
+    for (size_t r = 1; ok && r <= removed; r++) {
+        ok = hnsw_remove(loaded, gallery->usernames[r]) == 0;
+    }
+    ok = ok && hnsw_count(loaded) == rows - removed;
+    for (size_t p = 0; ok && p < probes; p++) {
+        size_t row = removed + 1 + (size_t)rand() % (rows - removed - 1);
+        make_test_probe(gallery, row, probe);
+        ok = hnsw_search(loaded, probe, k, HNSW_EF_SEARCH, after, &num_after) == 0 && num_after == k;
+        for (size_t i = 0; ok && i < num_after; i++) {
+            ok = after[i].index < rows - removed &&
+                 (i > 0 || strcmp(after[i].username, gallery->usernames[row]) == 0);
+        }
+    }
+    int result = ok ? 0 : -1;
+    
+    hnsw_free(loaded);
+    hnsw_free(index);
+    feature_vector_free(probe);
+    template_matrix_free(gallery);
+    unlink(index_path);
+    return result;
+}
+
+/**
+ * Train product quantization codes on a random gallery, check the stored
+ * codes against pq_encode() and the PQ ranking against exact cosine
+ */
+static int test_pq_index(void) {
+    char index_path[64];
+    snprintf(index_path, sizeof(index_path), "/tmp/neurolock_test_%d.pq", (int)getpid());
+    
+    const size_t rows = 1000, probes = 50, k = 10;
+    TemplateMatrix *gallery = make_test_gallery(rows, "pq_user");
+    PQIndex *index = gallery && gallery->num_templates == rows ? pq_train(gallery, PQ_NUM_SUBSPACES) : NULL;
+    FeatureVector *probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    int ok = index && probe && index->num_templates == rows;
+    
+    // Training encodes every row exactly as pq_encode() does
+    uint8_t code[PQ_NUM_SUBSPACES];
+    for (size_t r = 0; ok && r < rows; r++) {
+        ok = pq_encode(index, gallery->matrix + r * gallery->stride, code) == 0 &&
+             memcmp(code, index->codes + r * PQ_NUM_SUBSPACES, PQ_NUM_SUBSPACES) == 0;
+    }
+    
+    // The exact best match is among the PQ top-k and its approximate score is close
+    size_t found = 0;
+    float max_error = 0.0f;
+    for (size_t p = 0; ok && p < probes; p++) {
+        IdentifyMatch exact, approx[10];
+        size_t num_exact = 0, num_approx = 0;
+        make_test_probe(gallery, (size_t)rand() % rows, probe);
+        ok = template_identify(gallery, probe, 1, &exact, &num_exact) == 0 && num_exact == 1 &&
+             pq_search(index, probe, k, approx, &num_approx) == 0 && num_approx == k;
+        for (size_t j = 0; ok && j < k; j++) {
+            if (strcmp(exact.username, approx[j].username) == 0) {
+                float error = fabsf(exact.similarity - approx[j].similarity);
+                if (error > max_error) max_error = error;
+                found++;
+            }
+        }
+    }
+    ok = ok && found * 100 >= probes * 95 && max_error < 0.2f;
+    
+    // Removed codes are not returned, and a saved index reloads with the same codes
+    PQIndex *loaded = NULL;
+    IdentifyMatch matches[10];
+    size_t num_matches = 0;
+    if (ok) {
+        make_test_probe(gallery, 0, probe);
+    }
+    ok = ok && pq_remove(index, gallery->usernames[0]) == 0 && pq_remove(index, gallery->usernames[0]) != 0 &&
+         pq_search(index, probe, k, matches, &num_matches) == 0 && num_matches == k;
+    for (size_t j = 0; ok && j < num_matches; j++) {
+        ok = strcmp(matches[j].username, gallery->usernames[0]) != 0;
+    }
+    loaded = ok && pq_save(index, index_path) == 0 ? pq_load(index_path) : NULL;
+    int result = ok && loaded && loaded->num_templates == rows - 1 &&
+                 memcmp(loaded->codes, index->codes, (rows - 1) * PQ_NUM_SUBSPACES) == 0 &&
+                 pq_add(loaded, gallery->usernames[0], gallery->matrix) == 0 &&
+                 pq_search(loaded, probe, k, matches, &num_matches) == 0 && num_matches == k &&
+                 strcmp(matches[0].username, gallery->usernames[0]) == 0 &&
+                 pq_add(loaded, gallery->usernames[0], gallery->matrix) == 0 && loaded->num_templates == rows &&
+                 pq_remove(loaded, gallery->usernames[rows - 1]) == 0 && loaded->num_templates == rows - 1 &&
+                 pq_remove(loaded, gallery->usernames[rows - 1]) != 0 ? 0 : -1;
+    
+    pq_free(loaded);
+    pq_free(index);
+    feature_vector_free(probe);
+    template_matrix_free(gallery);
+    unlink(index_path);
+    return result;
+}
+
+/**
+ * Log enrolments and deletions from a resident index set and from the
+ * one-shot CLI path, check the index file is only rewritten by a snapshot,
+ * and that a torn log tail is dropped
+ */
+static int test_index_log(void) {
+    char index_path[64], log_path[72];
+    snprintf(index_path, sizeof(index_path), "/tmp/neurolock_test_%d.log.hnsw", (int)getpid());
+    snprintf(log_path, sizeof(log_path), "%s.log", index_path);
+    
+    const size_t rows = 200;
+    TemplateMatrix *gallery = make_test_gallery(rows, "log_user");
+    HNSWIndex *index = gallery ? hnsw_create(FEATURE_VECTOR_SIZE, HNSW_M, HNSW_EF_CONSTRUCTION) : NULL;
+    FeatureVector *probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    int ok = index && probe && gallery->num_templates == rows;
+    for (size_t r = 0; ok && r < rows - 1; r++) {
+        ok = hnsw_insert(index, gallery->usernames[r], gallery->matrix + r * gallery->stride) == 0;
+    }
+    ok = ok && index_log_save_hnsw(index_path, index) == 0;
+    hnsw_free(index);
+    
+    // The daemon removes a user while the CLI enrols the last row; neither
+    // rewrites the index file, and a fresh load sees both changes
+    struct stat before, after;
+    IndexSet *set = ok ? index_set_open(index_path, NULL) : NULL;
+    ok = ok && set && stat(index_path, &before) == 0 &&
+         index_log_record(index_path, NULL, gallery->usernames[rows - 1],
+                          gallery->matrix + (rows - 1) * gallery->stride) == 0 &&
+         index_set_update(set, gallery->usernames[0], NULL) == 0 &&
+         stat(index_path, &after) == 0 && before.st_ino == after.st_ino;
+    
+    IdentifyMatch matches[IDENTIFY_TOP_K];
+    size_t num_matches = 0;
+    HNSWIndex *loaded = ok ? index_log_load_hnsw(index_path) : NULL;
+    if (ok) {
+        make_test_probe(gallery, rows - 1, probe);
+    }
+    ok = ok && loaded && hnsw_count(loaded) == rows - 1 &&
+         hnsw_search(loaded, probe, IDENTIFY_TOP_K, HNSW_EF_SEARCH, matches, &num_matches) == 0 &&
+         num_matches > 0 && strcmp(matches[0].username, gallery->usernames[rows - 1]) == 0;
+    hnsw_free(loaded);
+    
+    // Closing the set snapshots the index and cuts the log back to its header
+    index_set_close(set);
+    ok = ok && stat(index_path, &after) == 0 && before.st_ino != after.st_ino &&
+         stat(log_path, &after) == 0 && after.st_size == INDEX_LOG_HEADER_SIZE;
+    
+    // A torn tail is dropped before the next record is appended
+    int fd = ok ? open(log_path, O_WRONLY | O_APPEND) : -1;
+    ok = ok && fd >= 0 && write(fd, "torn", 4) == 4;
+    if (fd >= 0) close(fd);
+    ok = ok && index_log_record(index_path, NULL, gallery->usernames[0], gallery->matrix) == 0;
+    loaded = ok ? index_log_load_hnsw(index_path) : NULL;
+    if (ok) {
+        make_test_probe(gallery, 0, probe);
+    }
+    int result = ok && loaded && hnsw_count(loaded) == rows &&
+                 hnsw_search(loaded, probe, IDENTIFY_TOP_K, HNSW_EF_SEARCH, matches, &num_matches) == 0 &&
+                 num_matches > 0 && strcmp(matches[0].username, gallery->usernames[0]) == 0 ? 0 : -1;
+    
+    hnsw_free(loaded);
+    feature_vector_free(probe);
+    template_matrix_free(gallery);
+    unlink(index_path);
+    unlink(log_path);
+    return result;
+}
+
+/**
+ * Compare int8 identification scores against float scores on random templates
+ * Each score must stay within the analytic bound
+ *   0.5 * scale * |p|_1 + 0.5 * probe_scale * (|x|_1 + dim * scale / 2)
+ */
+static int test_quantized_scoring(void) {
+    const size_t rows = 512;
+    TemplateMatrix *exact = template_matrix_alloc(rows, FEATURE_VECTOR_SIZE);
+    TemplateMatrix *quant = template_matrix_alloc(rows, FEATURE_VECTOR_SIZE);
+    FeatureVector *probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    IdentifyMatch *exact_matches = (IdentifyMatch*)malloc(rows * sizeof(IdentifyMatch));
+    IdentifyMatch *quant_matches = (IdentifyMatch*)malloc(rows * sizeof(IdentifyMatch));
+    float *row_l1 = (float*)calloc(rows, sizeof(float));
+    float *float_scores = (float*)malloc(rows * sizeof(float));
+    int result = -1;
+    
+    if (exact && quant && probe && exact_matches && quant_matches && row_l1 && float_scores) {
+        for (size_t r = 0; r < rows; r++) {
+            float *row = exact->matrix + r * exact->stride;
+            for (size_t c = 0; c < exact->dim; c++) {
+                row[c] = (float)rand() / RAND_MAX;
+            }
+            vector_normalize(row, row, exact->dim);
+            memcpy(quant->matrix + r * quant->stride, row, exact->stride * sizeof(float));
+            for (size_t c = 0; c < exact->dim; c++) {
+                row_l1[r] += fabsf(row[c]);
+            }
+        }
+        
+        for (size_t c = 0; c < probe->size; c++) {
+            probe->features[c] = (float)rand() / RAND_MAX;
+        }
+        float magnitude = vector_magnitude(probe->features, probe->size);
+        float probe_l1 = 0.0f, probe_peak = 0.0f;
+        for (size_t c = 0; c < probe->size; c++) {
+            float v = fabsf(probe->features[c]) / magnitude;
+            probe_l1 += v;
+            if (v > probe_peak) probe_peak = v;
+        }
+        float probe_scale = probe_peak / QUANT_PROBE_MAX;
+        
+        size_t n_exact = 0, n_quant = 0;
+        if (template_identify(exact, probe, rows, exact_matches, &n_exact) == 0 &&
+            template_matrix_quantize(quant) == 0 &&
+            template_identify(quant, probe, rows, quant_matches, &n_quant) == 0 &&
+            n_exact == rows && n_quant == rows) {
+            float max_error = 0.0f, max_bound = 0.0f, sum_error = 0.0f;
+            result = 0;
+            
+            for (size_t i = 0; i < rows; i++) {
+                float_scores[exact_matches[i].index] = exact_matches[i].similarity;
+            }
+            for (size_t i = 0; i < rows; i++) {
+                size_t r = quant_matches[i].index;
+                float scale = quant->scales[r];
+                float error = fabsf(quant_matches[i].similarity - float_scores[r]);
+                float bound = 0.5f * scale * probe_l1 +
+                              0.5f * probe_scale * (row_l1[r] + quant->dim * scale * 0.5f);
+                if (error > bound) result = -1;
+                if (error > max_error) max_error = error;
+                if (bound > max_bound) max_bound = bound;
+                sum_error += error;
+            }
+            
+            printf("  Score error over %zu templates: max %.5f, mean %.5f (bound %.5f)\n",
+                   rows, max_error, sum_error / rows, max_bound);
+        }
+    }
+    
+    free(float_scores);
+    free(row_l1);
+    free(quant_matches);
+    free(exact_matches);
+    feature_vector_free(probe);
+    template_matrix_free(quant);
+    template_matrix_free(exact);
+    return result;
+}
+
+/* One of the threads storing through a shared log */
+typedef struct {
+    TemplateWAL *wal;
+    size_t thread;
+    int failed;
+} WalWriter;
+
+static void* write_wal_burst(void *arg) {
+    WalWriter *writer = (WalWriter*)arg;
+    for (size_t i = 0; i < 8; i++) {
+        char username[64];
+        snprintf(username, sizeof(username), "wal_burst_%zu_%zu", writer->thread, i);
+        Template *template = make_test_template(username, 1);
+        if (!template || wal_put(writer->wal, template) != 0) {
+            writer->failed = 1;
+        }
+        template_free(template);
+    }
+    return NULL;
+}
+
+/**
+ * Checkpoint a log, replay an already applied delete, recover a log with a
+ * torn last record and group-commit puts from several threads
+ */
+static int test_wal_recovery(void) {
+    char db_path[64], torn_path[64], wal_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_wal.nldb", (int)getpid());
+    snprintf(torn_path, sizeof(torn_path), "/tmp/neurolock_test_%d_torn.nldb", (int)getpid());
+    snprintf(wal_path, sizeof(wal_path), "/tmp/neurolock_test_%d.wal", (int)getpid());
+    
+    Template *a = make_test_template("wal_user_a", 1);
+    Template *b = make_test_template("wal_user_b", 1);
+    TemplateDB *db = a && b ? template_db_open(db_path) : NULL;
+    TemplateWAL *wal = db ? wal_open(wal_path, db) : NULL;
+    uint8_t *puts = NULL, *deletes = NULL;
+    size_t puts_size = 0, deletes_size = 0;
+    WalStats stats;
+    
+    // Keep a copy of the two put records, then checkpoint back to the header
+    int ok = wal && wal_put(wal, a) == 0 && wal_put(wal, b) == 0 &&
+             read_file(wal_path, &puts, &puts_size) == 0 && puts_size > WAL_HEADER_SIZE &&
+             wal_checkpoint(wal) == 0 && test_file_size(wal_path) == WAL_HEADER_SIZE;
+    
+    // A log holding a delete that already reached the database replays as a no-op
+    ok = ok && wal_delete(wal, a->username) == 0 && read_file(wal_path, &deletes, &deletes_size) == 0;
+    wal_close(wal);
+    wal = ok && write_file(wal_path, deletes, deletes_size) == 0 ? wal_open(wal_path, db) : NULL;
+    if (wal) {
+        wal_get_stats(wal, &stats);
+    }
+    ok = ok && wal && stats.replayed == 1 && !template_db_contains(db, a->username) &&
+         template_db_contains(db, b->username) && test_file_size(wal_path) == WAL_HEADER_SIZE;
+    wal_close(wal);
+    template_db_close(db);
+    
+    // Replay stops at a torn last record and the log is truncated behind it
+    db = ok ? template_db_open(torn_path) : NULL;
+    wal = db && write_file(wal_path, puts, puts_size - 5) == 0 ? wal_open(wal_path, db) : NULL;
+    if (wal) {
+        wal_get_stats(wal, &stats);
+    }
+    ok = ok && wal && stats.replayed == 1 && template_db_contains(db, a->username) &&
+         !template_db_contains(db, b->username) && test_file_size(wal_path) == WAL_HEADER_SIZE;
+    
+    // Writers that arrive while a flush is in progress share the next one
+    WalWriter writers[4];
+    pthread_t threads[4];
+    size_t started = 0;
+    for (size_t t = 0; ok && t < 4; t++) {
+        writers[t] = (WalWriter){ wal, t, 0 };
+        if (pthread_create(&threads[t], NULL, write_wal_burst, &writers[t]) != 0) {
+            break;
+        }
+        started++;
+    }
+    for (size_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+        ok = ok && !writers[t].failed;
+    }
+    if (wal) {
+        wal_get_stats(wal, &stats);
+    }
+    int result = ok && started == 4 && stats.records == 32 && stats.batches < stats.records &&
+                 template_db_count(db) == 33 ? 0 : -1;
+    
+    wal_close(wal);
+    template_db_close(db);
+    free(puts);
+    free(deletes);
+    template_free(a);
+    template_free(b);
+    unlink(db_path);
+    unlink(torn_path);
+    unlink(wal_path);
+    return result;
+}
+
+/* Whether an exemplar row holds the unit-norm copy of a vector */
+static int unit_row_matches(const float *row, const float *vec) {
+    float magnitude = vector_magnitude(vec, FEATURE_VECTOR_SIZE);
+    for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+        if (fabsf(row[i] - vec[i] / magnitude) > 1e-6f) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Check one adaptive update against the EWMA recurrences by hand, then check
+ * that accepted samples fill the free exemplar row and later replace the
+ * nearest exemplar while the others stay put
+ */
+static int test_template_update(void) {
+    Template *template = template_alloc();
+    FeatureVector *sample = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    int result = -1;
+    
+    if (template && sample) {
+        template->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+        template->variance = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+        template->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
+        template->exemplars = (float*)calloc(TEMPLATE_MAX_EXEMPLARS * FEATURE_VECTOR_SIZE, sizeof(float));
+    }
+    
+    // One row short of the limit, each far from the positive samples below
+    const size_t far_rows = TEMPLATE_MAX_EXEMPLARS - 1;
+    for (size_t e = 0; template && template->exemplars && e < far_rows; e++) {
+        for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+            template->exemplars[e * FEATURE_VECTOR_SIZE + i] =
+                ((i + e) % 2 ? 1.0f : -1.0f) / sqrtf((float)FEATURE_VECTOR_SIZE);
+        }
+        template->num_exemplars++;
+    }
+    
+    if (template && sample && template->features && template->variance && template->hash && template->exemplars &&
+        generate_salt(template->hash->salt, SALT_LENGTH) == 0 &&
+        hash_features(template->features, template->hash->salt, SALT_LENGTH, template->hash) == 0) {
+        float old_mean[FEATURE_VECTOR_SIZE], old_var[FEATURE_VECTOR_SIZE];
+        uint8_t old_hash[HASH_OUTPUT_SIZE], old_salt[SALT_LENGTH];
+        for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+            old_mean[i] = template->features->features[i] = 1.0f + (float)rand() / RAND_MAX;
+            old_var[i] = template->variance->features[i] = 0.01f;
+            sample->features[i] = old_mean[i] * (1.0f + 0.05f * ((float)rand() / RAND_MAX - 0.5f));
+        }
+        memcpy(old_hash, template->hash->hash, HASH_OUTPUT_SIZE);
+        memcpy(old_salt, template->hash->salt, SALT_LENGTH);
+        template->version = 1;
+        
+        if (template_update_features(template, sample) == 0 && template->version == 2 &&
+            memcmp(old_hash, template->hash->hash, HASH_OUTPUT_SIZE) != 0 &&
+            template->hash->salt_size == SALT_LENGTH &&
+            memcmp(old_salt, template->hash->salt, SALT_LENGTH) == 0) {
+            const float a = (float)TEMPLATE_UPDATE_ALPHA;
+            float max_error = 0.0f;
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                float d = sample->features[i] - old_mean[i];
+                float mean_error = fabsf(template->features->features[i] - (old_mean[i] + a * d));
+                float var_error = fabsf(template->variance->features[i] - (1.0f - a) * (old_var[i] + a * d * d));
+                if (mean_error > max_error) max_error = mean_error;
+                if (var_error > max_error) max_error = var_error;
+            }
+            
+            float first[FEATURE_VECTOR_SIZE];
+            memcpy(first, sample->features, sizeof(first));
+            
+            // An unrelated sample must be rejected and leave the template alone
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                sample->features[i] = (i % 2) ? 1.0f : -1.0f;
+            }
+            int ok = max_error < 1e-6f && template_update_features(template, sample) == 1 && template->version == 2 &&
+                     template->num_exemplars == TEMPLATE_MAX_EXEMPLARS &&
+                     unit_row_matches(template->exemplars + far_rows * FEATURE_VECTOR_SIZE, first);
+            
+            // A second close sample replaces the first one's row, the nearest; the far rows stay
+            float far_first = template->exemplars[0];
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                sample->features[i] = old_mean[i] * (1.0f + 0.05f * ((float)rand() / RAND_MAX - 0.5f));
+            }
+            ok = ok && template_update_features(template, sample) == 0 &&
+                 template->num_exemplars == TEMPLATE_MAX_EXEMPLARS && template->exemplars[0] == far_first &&
+                 unit_row_matches(template->exemplars + far_rows * FEATURE_VECTOR_SIZE, sample->features);
+            if (ok) {
+                result = 0;
+            }
+        }
+    }
+    
+    feature_vector_free(sample);
+    template_free(template);
+    return result;
+}
+
+/**
+ * Export a few synthetic templates, import them into a fresh database and
+ * check that a tampered entry is rejected by hash verification
+ */
+static int test_archive_roundtrip(void) {
+    char src_path[64], dst_path[64], archive_path[64];
+    snprintf(src_path, sizeof(src_path), "/tmp/neurolock_test_%d_src.nldb", (int)getpid());
+    snprintf(dst_path, sizeof(dst_path), "/tmp/neurolock_test_%d_dst.nldb", (int)getpid());
+    snprintf(archive_path, sizeof(archive_path), "/tmp/neurolock_test_%d.nlar", (int)getpid());
+    
+    const size_t count = 3;
+    TemplateDB *src = template_db_open(src_path);
+    int stored = 0;
+    for (size_t n = 0; src && n < count; n++) {
+        Template *template = template_alloc();
+        if (template) {
+            snprintf(template->username, sizeof(template->username), "archive_user_%zu", n);
+            template->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+            template->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
+            template->version = 1;
+        }
+        if (template && template->features && template->hash) {
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                template->features->features[i] = (float)rand() / RAND_MAX;
+            }
+            if (generate_salt(template->hash->salt, SALT_LENGTH) == 0 &&
+                hash_features(template->features, template->hash->salt, SALT_LENGTH, template->hash) == 0 &&
+                template_db_put(src, template) == 0) {
+                stored++;
+            }
+        }
+        template_free(template);
+    }
+    
+    ArchiveStats exported = {0}, imported = {0}, tampered = {0};
+    int result = -1;
+    if (stored == (int)count && archive_export(src, archive_path, &exported) == 0 &&
+        exported.templates == count) {
+        TemplateDB *dst = template_db_open(dst_path);
+        if (dst && archive_import(dst, archive_path, &imported) == 0 &&
+            imported.templates == count && imported.rejected == 0 && template_db_count(dst) == count) {
+            Template a = {0}, b = {0};
+            int same = template_db_get(src, "archive_user_1", &a) == 0 &&
+                       template_db_get(dst, "archive_user_1", &b) == 0 &&
+                       memcmp(a.features->features, b.features->features,
+                              FEATURE_VECTOR_SIZE * sizeof(float)) == 0;
+            template_clear(&a);
+            template_clear(&b);
+            
+            // Flip one feature bit in the first entry and fix up its CRC so only the hash can catch it
+            uint8_t *bytes = NULL;
+            size_t size = 0;
+            if (same && read_file(archive_path, &bytes, &size) == 0) {
+                uint8_t *blob = bytes + ARCHIVE_HEADER_SIZE + ARCHIVE_ENTRY_HEADER_SIZE;
+                size_t blob_size = load_le32(bytes + ARCHIVE_HEADER_SIZE);
+                blob[load_le32(blob + TEMPLATE_FILE_HEADER_SIZE + 4)] ^= 0x01;
+                static const uint8_t zero_crc[4] = {0, 0, 0, 0};
+                uint32_t crc = crc32_update(0, blob, 12);
+                crc = crc32_update(crc, zero_crc, sizeof(zero_crc));
+                crc = crc32_update(crc, blob + 16, blob_size - 16);
+                store_le32(blob + 12, crc);
+                if (write_file(archive_path, bytes, size) == 0 &&
+                    archive_import(dst, archive_path, &tampered) == 0 &&
+                    tampered.templates == count - 1 && tampered.rejected == 1) {
+                    result = 0;
+                }
+                free(bytes);
+            }
+        }
+        template_db_close(dst);
+    }
+    
+    template_db_close(src);
+    unlink(src_path);
+    unlink(dst_path);
+    unlink(archive_path);
+    return result;
+}
+
+static int test_score_normalization(void) {
+    char db_path[64], cohort_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_norm.nldb", (int)getpid());
+    snprintf(cohort_path, sizeof(cohort_path), "/tmp/neurolock_test_%d.nlc", (int)getpid());
+    
+    const size_t count = 32;
+    TemplateDB *db = template_db_open(db_path);
+    int stored = 0;
+    for (size_t n = 0; db && n < count; n++) {
+        Template *template = template_alloc();
+        if (template) {
+            snprintf(template->username, sizeof(template->username), "norm_user_%zu", n);
+            template->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+            template->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
+            template->version = 1;
+        }
+        if (template && template->features && template->hash) {
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                template->features->features[i] = (float)rand() / RAND_MAX;
+            }
+            if (generate_salt(template->hash->salt, SALT_LENGTH) == 0 &&
+                hash_features(template->features, template->hash->salt, SALT_LENGTH, template->hash) == 0 &&
+                template_db_put(db, template) == 0) {
+                stored++;
+            }
+        }
+        template_free(template);
+    }
+    
+    int result = -1;
+    TemplateMatrix *built = stored == (int)count ? cohort_build(db, count / 2) : NULL;
+    TemplateMatrix *cohort = built && cohort_save(built, cohort_path) == 0 ? cohort_load(cohort_path) : NULL;
+    Template *claimed = template_alloc();
+    Template *stored_back = template_alloc();
+    Template *other = template_alloc();
+    if (cohort && claimed && stored_back && other && cohort->num_templates == built->num_templates &&
+        memcmp(cohort->usernames, built->usernames, built->num_templates * 64) == 0 &&
+        memcmp(cohort->matrix, built->matrix, built->num_templates * built->stride * sizeof(float)) == 0 &&
+        template_db_get(db, "norm_user_0", claimed) == 0 &&
+        template_db_get(db, "norm_user_1", other) == 0 &&
+        cohort_znorm(cohort, claimed, &claimed->znorm_mean, &claimed->znorm_std) == 0 &&
+        template_db_put(db, claimed) == 0 && template_db_get(db, "norm_user_0", stored_back) == 0 &&
+        stored_back->znorm_mean == claimed->znorm_mean && stored_back->znorm_std == claimed->znorm_std) {
+        // The owner's own features must clear the threshold and another user's must not
+        float genuine, impostor;
+        float raw_genuine = template_similarity(claimed, claimed->features);
+        float raw_impostor = template_similarity(claimed, other->features);
+        if (cohort_normalize(cohort, claimed, claimed->features, raw_genuine, SCORE_NORM_S, &genuine) == 0 &&
+            cohort_normalize(cohort, claimed, other->features, raw_impostor, SCORE_NORM_S, &impostor) == 0 &&
+            genuine >= NORMALIZED_SCORE_THRESHOLD && impostor < NORMALIZED_SCORE_THRESHOLD) {
+            result = 0;
+        }
+    }
+    
+    template_free(claimed);
+    template_free(stored_back);
+    template_free(other);
+    template_matrix_free(built);
+    template_matrix_free(cohort);
+    template_db_close(db);
+    unlink(db_path);
+    unlink(cohort_path);
+    return result;
+}
+
+static int test_whitened_matching(void) {
+    // Cholesky solve of a known SPD system: A = B * B^T + n * I
+    const size_t n = 6;
+    double a[36], l[36], b[6], x[6];
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            double s = i == j ? (double)n : 0.0;
+            for (size_t k = 0; k < n; k++) {
+                s += (double)((i * 7 + k * 3) % 5) * (double)((j * 7 + k * 3) % 5);
+            }
+            a[i * n + j] = s;
+        }
+        b[i] = (double)i - 2.5;
+    }
+    memcpy(l, a, sizeof(a));
+    if (linalg_cholesky(l, n) != 0) {
+        return -1;
+    }
+    linalg_cholesky_solve(l, n, b, x);
+    for (size_t i = 0; i < n; i++) {
+        double r = -b[i];
+        for (size_t j = 0; j < n; j++) {
+            r += a[i * n + j] * x[j];
+        }
+        if (fabs(r) > 1e-9) {
+            return -1;
+        }
+    }
+    
+    char db_path[64], model_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_whiten.nldb", (int)getpid());
+    snprintf(model_path, sizeof(model_path), "/tmp/neurolock_test_%d.nlw", (int)getpid());
+    
+    // Users with three noisy trials each, stored as exemplars
+    const size_t count = 8;
+    TemplateDB *db = template_db_open(db_path);
+    Template *templates[8] = {0};
+    int stored = 0;
+    for (size_t u = 0; db && u < count; u++) {
+        Template *template = template_alloc();
+        templates[u] = template;
+        if (template) {
+            snprintf(template->username, sizeof(template->username), "whiten_user_%zu", u);
+            template->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+            template->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
+            template->exemplars = (float*)calloc(NUM_ENROLMENT_TRIALS * FEATURE_VECTOR_SIZE, sizeof(float));
+            template->num_exemplars = NUM_ENROLMENT_TRIALS;
+            template->version = 1;
+        }
+        if (template && template->features && template->hash && template->exemplars) {
+            float trial[FEATURE_VECTOR_SIZE];
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                template->features->features[i] = 0.5f + (float)rand() / RAND_MAX;
+            }
+            for (size_t e = 0; e < NUM_ENROLMENT_TRIALS; e++) {
+                for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                    trial[i] = template->features->features[i] * (1.0f + 0.05f * ((float)rand() / RAND_MAX - 0.5f));
+                }
+                vector_normalize(trial, template->exemplars + e * FEATURE_VECTOR_SIZE, FEATURE_VECTOR_SIZE);
+            }
+            if (generate_salt(template->hash->salt, SALT_LENGTH) == 0 &&
+                hash_features(template->features, template->hash->salt, SALT_LENGTH, template->hash) == 0 &&
+                template_db_put(db, template) == 0) {
+                stored++;
+            }
+        }
+    }
+    
+    int result = -1;
+    MahalanobisModel *trained = stored == (int)count ? mahalanobis_train(db) : NULL;
+    MahalanobisModel *loaded = trained && mahalanobis_save(trained, model_path) == 0 ?
+                               mahalanobis_load(model_path) : NULL;
+    if (loaded && loaded->samples == count * (NUM_ENROLMENT_TRIALS - 1) &&
+        memcmp(loaded->factor, trained->factor, trained->dim * trained->dim * sizeof(double)) == 0) {
+        // A user's own trial must score above another user's, and a vector against itself is distance 0
+        FeatureVector own = { templates[0]->exemplars, FEATURE_VECTOR_SIZE, 0, 0 };
+        FeatureVector other = { templates[1]->exemplars, FEATURE_VECTOR_SIZE, 0, 0 };
+        float genuine = mahalanobis_similarity(loaded, templates[0], &own);
+        float impostor = mahalanobis_similarity(loaded, templates[0], &other);
+        float self = mahalanobis_distance(loaded, own.features, own.features);
+        if (genuine > impostor && impostor >= 0.0f && self == 0.0f) {
+            result = 0;
+        }
+    }
+    
+    for (size_t u = 0; u < count; u++) {
+        template_free(templates[u]);
+    }
+    mahalanobis_free(trained);
+    mahalanobis_free(loaded);
+    template_db_close(db);
+    unlink(db_path);
+    unlink(model_path);
+    return result;
+}
+
+static int test_lda_discriminant(void) {
+    // Blocked Gram accumulation must match the plain triple loop
+    const size_t rows = 7;
+    float data[7 * FEATURE_VECTOR_SIZE], center[FEATURE_VECTOR_SIZE];
+    for (size_t i = 0; i < rows * FEATURE_VECTOR_SIZE; i++) {
+        data[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+    for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+        center[i] = 0.1f;
+    }
+    double *gram = (double*)calloc(FEATURE_VECTOR_SIZE * FEATURE_VECTOR_SIZE, sizeof(double));
+    if (!gram || linalg_gram_accumulate(gram, FEATURE_VECTOR_SIZE, data, rows, FEATURE_VECTOR_SIZE, center) != 0) {
+        free(gram);
+        return -1;
+    }
+    for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+        for (size_t j = 0; j < FEATURE_VECTOR_SIZE; j++) {
+            double s = 0.0;
+            for (size_t r = 0; r < rows; r++) {
+                s += (double)(data[r * FEATURE_VECTOR_SIZE + i] - center[i]) *
+                     (double)(data[r * FEATURE_VECTOR_SIZE + j] - center[j]);
+            }
+            if (fabs(gram[i * FEATURE_VECTOR_SIZE + j] - s) > 1e-5) {
+                free(gram);
+                return -1;
+            }
+        }
+    }
+    free(gram);
+    
+    char db_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_lda.nldb", (int)getpid());
+    
+    // Users with three noisy trials each, stored as exemplars
+    const size_t count = 16;
+    TemplateDB *db = template_db_open(db_path);
+    Template *templates[16] = {0};
+    int stored = 0;
+    for (size_t u = 0; db && u < count; u++) {
+        Template *template = template_alloc();
+        templates[u] = template;
+        if (template) {
+            snprintf(template->username, sizeof(template->username), "lda_user_%zu", u);
+            template->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+            template->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
+            template->exemplars = (float*)calloc(NUM_ENROLMENT_TRIALS * FEATURE_VECTOR_SIZE, sizeof(float));
+            template->num_exemplars = NUM_ENROLMENT_TRIALS;
+            template->version = 1;
+        }
+        if (template && template->features && template->hash && template->exemplars) {
+            float trial[FEATURE_VECTOR_SIZE];
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                template->features->features[i] = 0.5f + (float)rand() / RAND_MAX;
+            }
+            for (size_t e = 0; e < NUM_ENROLMENT_TRIALS; e++) {
+                for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                    trial[i] = template->features->features[i] * (1.0f + 0.05f * ((float)rand() / RAND_MAX - 0.5f));
+                }
+                vector_normalize(trial, template->exemplars + e * FEATURE_VECTOR_SIZE, FEATURE_VECTOR_SIZE);
+            }
+            if (generate_salt(template->hash->salt, SALT_LENGTH) == 0 &&
+                hash_features(template->features, template->hash->salt, SALT_LENGTH, template->hash) == 0 &&
+                template_db_put(db, template) == 0) {
+                stored++;
+            }
+        }
+    }
+    
+    int result = -1;
+    TemplateMatrix *cohort = stored == (int)count ? cohort_build(db, count) : NULL;
+    Template *stored_back = template_alloc();
+    if (cohort && stored_back && lda_train(templates[0], cohort) == 0 &&
+        template_db_put(db, templates[0]) == 0 &&
+        template_db_get(db, templates[0]->username, stored_back) == 0 && stored_back->lda_weights &&
+        memcmp(stored_back->lda_weights, templates[0]->lda_weights, FEATURE_VECTOR_SIZE * sizeof(float)) == 0 &&
+        stored_back->lda_bias == templates[0]->lda_bias) {
+        // The user's own trial must clear the threshold and another user's must not
+        FeatureVector own = { templates[0]->exemplars, FEATURE_VECTOR_SIZE, 0, 0 };
+        FeatureVector other = { templates[1]->exemplars, FEATURE_VECTOR_SIZE, 0, 0 };
+        if (lda_score(stored_back, &own) >= LDA_THRESHOLD && lda_score(stored_back, &other) < LDA_THRESHOLD) {
+            result = 0;
+        }
+    }
+    
+    // An adaptive update has to move the discriminant along with the mean
+    FeatureVector *drifted = result == 0 ? feature_vector_alloc(FEATURE_VECTOR_SIZE) : NULL;
+    result = -1;
+    if (drifted) {
+        float old_weights[FEATURE_VECTOR_SIZE];
+        memcpy(old_weights, templates[0]->lda_weights, sizeof(old_weights));
+        float old_bias = templates[0]->lda_bias;
+        for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+            drifted->features[i] = templates[0]->features->features[i] * (1.0f + 0.1f * ((float)rand() / RAND_MAX - 0.5f));
+        }
+        FeatureVector own = { templates[0]->exemplars, FEATURE_VECTOR_SIZE, 0, 0 };
+        if (auth_adapt_features(templates[0], drifted, cohort) == 0 &&
+            (memcmp(old_weights, templates[0]->lda_weights, sizeof(old_weights)) != 0 ||
+             old_bias != templates[0]->lda_bias) &&
+            lda_score(templates[0], &own) >= LDA_THRESHOLD) {
+            result = 0;
+        }
+    }
+    feature_vector_free(drifted);
+    
+    for (size_t u = 0; u < count; u++) {
+        template_free(templates[u]);
+    }
+    template_free(stored_back);
+    template_matrix_free(cohort);
+    template_db_close(db);
+    unlink(db_path);
+    return result;
+}
+
+/* Layers of the network written by write_test_network: type, flags, in, out, kernel, stride */
+static const uint32_t test_network_layers[][6] = {
+    { CNN_LAYER_CONV1D, CNN_LAYER_RELU, NUM_CHANNELS, 16, 8, 4 },
+    { CNN_LAYER_CONV1D, CNN_LAYER_RELU, 16, 24, 5, 2 },
+    { CNN_LAYER_MAXPOOL, 0, 24, 24, 2, 2 },
+    { CNN_LAYER_GLOBAL_AVGPOOL, 0, 24, 24, 0, 0 },
+    { CNN_LAYER_CONV1D, 0, 24, FEATURE_VECTOR_SIZE, 1, 1 }
+};
+
+/* Write a randomly initialized network in the model file format */
+static int write_test_network(const char *path, size_t samples) {
+    const size_t num_layers = sizeof(test_network_layers) / sizeof(test_network_layers[0]);
+    size_t size = CNN_FILE_HEADER_SIZE;
+    for (size_t l = 0; l < num_layers; l++) {
+        const uint32_t *spec = test_network_layers[l];
+        size += CNN_LAYER_HEADER_SIZE;
+        if (spec[0] == CNN_LAYER_CONV1D) {
+            size += ((spec[3] * spec[4] * spec[2] + 3) & ~3u) + 8 * spec[3];
+        }
+    }
+    
+    uint8_t *buffer = (uint8_t*)calloc(1, size);
+    if (!buffer) {
+        return -1;
+    }
+    store_le32(buffer, CNN_FILE_MAGIC);
+    store_le16(buffer + 4, CNN_FILE_VERSION);
+    store_le16(buffer + 6, CNN_FILE_HEADER_SIZE);
+    store_le32(buffer + 8, (uint32_t)num_layers);
+    store_le32(buffer + 16, NUM_CHANNELS);
+    store_le32(buffer + 20, (uint32_t)samples);
+    store_le_f32(buffer + 24, 4.0f / 64.0f);
+    
+    uint8_t *p = buffer + CNN_FILE_HEADER_SIZE;
+    for (size_t l = 0; l < num_layers; l++) {
+        const uint32_t *spec = test_network_layers[l];
+        for (size_t f = 0; f < 6; f++) {
+            store_le32(p + 4 * f, spec[f]);
+        }
+        store_le_f32(p + 24, 0.05f);
+        p += CNN_LAYER_HEADER_SIZE;
+        if (spec[0] != CNN_LAYER_CONV1D) {
+            continue;
+        }
+        size_t window = spec[4] * spec[2];
+        for (size_t i = 0; i < spec[3] * window; i++) {
+            p[i] = (uint8_t)(int8_t)(rand() % 255 - 127);
+        }
+        p += (spec[3] * window + 3) & ~(size_t)3;
+        for (size_t o = 0; o < spec[3]; o++) {
+            store_le_f32(p + 4 * o, 1.0f / (127.0f * sqrtf((float)window)));
+            store_le_f32(p + 4 * (spec[3] + o), 0.01f * (float)o);
+        }
+        p += 8 * spec[3];
+    }
+    store_le32(buffer + 12, crc32_update(0, buffer, size));
+    
+    int result = write_file(path, buffer, size);
+    free(buffer);
+    return result;
+}
+
+static int test_cnn_embedding(void) {
+    // The blocked u8 x s8 product must match the plain loop, including overlapping rows
+    uint8_t a[256];
+    int8_t b[7 * 72];
+    int32_t out[9 * 7];
+    for (size_t i = 0; i < sizeof(a); i++) {
+        a[i] = (uint8_t)(rand() % 128);
+    }
+    for (size_t i = 0; i < sizeof(b); i++) {
+        b[i] = (int8_t)(rand() % 255 - 127);
+    }
+    gemm_u8s8(a, 9, 16, b, 7, 72, 72, out);
+    for (size_t r = 0; r < 9; r++) {
+        for (size_t c = 0; c < 7; c++) {
+            int32_t sum = 0;
+            for (size_t k = 0; k < 72; k++) {
+                sum += (int32_t)a[r * 16 + k] * (int32_t)b[c * 72 + k];
+            }
+            if (out[r * 7 + c] != sum) {
+                return -1;
+            }
+        }
+    }
+    
+    char model_path[64];
+    snprintf(model_path, sizeof(model_path), "/tmp/neurolock_test_%d.nlcn", (int)getpid());
+    const size_t samples = SAMPLING_RATE * 2;
+    
+    int result = -1;
+    CNNModel *model = write_test_network(model_path, samples) == 0 ? cnn_load(model_path) : NULL;
+    EEGData *window = eeg_data_alloc(NUM_CHANNELS, samples);
+    float first[FEATURE_VECTOR_SIZE], second[FEATURE_VECTOR_SIZE], other[FEATURE_VECTOR_SIZE];
+    if (model && window && model->output_size == FEATURE_VECTOR_SIZE) {
+        for (size_t i = 0; i < window->num_channels * window->num_samples; i++) {
+            window->data[i] = 2.0f * ((float)rand() / RAND_MAX - 0.5f);
+        }
+        int ok = cnn_embed(model, window, first) == 0 && cnn_embed(model, window, second) == 0;
+        window->data[0] += 1.0f;
+        for (size_t i = 0; i < window->num_channels * window->num_samples; i += 2) {
+            window->data[i] = -window->data[i];
+        }
+        ok = ok && cnn_embed(model, window, other) == 0;
+        
+        // Deterministic, finite, and sensitive to the input
+        float norm = 0.0f;
+        for (size_t i = 0; ok && i < FEATURE_VECTOR_SIZE; i++) {
+            ok = isfinite(first[i]);
+            norm += first[i] * first[i];
+        }
+        if (ok && norm > 0.0f && memcmp(first, second, sizeof(first)) == 0 &&
+            memcmp(first, other, sizeof(first)) != 0) {
+            result = 0;
+        }
+    }
+    cnn_free(model);
+    eeg_data_free(window);
+    
+    // A flipped weight byte must fail the checksum
+    uint8_t *bytes = NULL;
+    size_t size = 0;
+    if (result == 0 && read_file(model_path, &bytes, &size) == 0) {
+        bytes[size / 2] ^= 0x10;
+        CNNModel *corrupt = write_file(model_path, bytes, size) == 0 ? cnn_load(model_path) : NULL;
+        result = corrupt ? -1 : 0;
+        cnn_free(corrupt);
+    }
+    free(bytes);
+    unlink(model_path);
+    return result;
+}
+
+static int test_score_matrix(void) {
+    // Panel product must match the plain loop, with row and column tails
+    float a[7 * 40], bt[40 * 37], out[7 * 37];
+    for (size_t i = 0; i < sizeof(a) / sizeof(a[0]); i++) {
+        a[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+    for (size_t i = 0; i < sizeof(bt) / sizeof(bt[0]); i++) {
+        bt[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+    gemm_t_f32(a, 7, 40, bt, 37, 40, out);
+    for (size_t r = 0; r < 7; r++) {
+        for (size_t c = 0; c < 37; c++) {
+            float sum = 0.0f;
+            for (size_t d = 0; d < 40; d++) {
+                sum += a[r * 40 + d] * bt[d * 37 + c];
+            }
+            if (fabsf(out[r * 37 + c] - sum) > 1e-4f) {
+                return -1;
+            }
+        }
+    }
+    
+    // One noisy probe per enrolled user plus probes from users never enrolled
+    const size_t users = 300, strangers = 20;
+    TemplateMatrix *gallery = template_matrix_alloc(users, FEATURE_VECTOR_SIZE);
+    TemplateMatrix *probes = template_matrix_alloc(users + strangers, FEATURE_VECTOR_SIZE);
+    ScoreHistogram *hist = eval_histogram_alloc(EVAL_HISTOGRAM_BINS);
+    int result = -1;
+    if (gallery && probes && hist) {
+        float row[FEATURE_VECTOR_SIZE];
+        for (size_t p = 0; p < users + strangers; p++) {
+            for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                row[i] = (float)rand() / RAND_MAX;
+            }
+            if (p < users) {
+                vector_normalize(row, gallery->matrix + p * gallery->stride, FEATURE_VECTOR_SIZE);
+                snprintf(gallery->usernames[p], 64, "eval_user_%zu", p);
+                for (size_t i = 0; i < FEATURE_VECTOR_SIZE; i++) {
+                    row[i] += 0.05f * ((float)rand() / RAND_MAX - 0.5f);
+                }
+            }
+            vector_normalize(row, probes->matrix + p * probes->stride, FEATURE_VECTOR_SIZE);
+            snprintf(probes->usernames[p], 64, "eval_user_%zu", p);
+        }
+        
+        // Brute-force count of impostor scores at or above a threshold on a bin edge
+        const float threshold = 0.75f;
+        uint64_t accepted = 0;
+        for (size_t p = 0; p < probes->num_templates; p++) {
+            for (size_t g = 0; g < gallery->num_templates; g++) {
+                if (p != g && dot_product(probes->matrix + p * probes->stride,
+                                          gallery->matrix + g * gallery->stride, FEATURE_VECTOR_SIZE) >= threshold) {
+                    accepted++;
+                }
+            }
+        }
+        
+        double far, frr, eer;
+        if (eval_score_matrix(probes, gallery, hist) == 0 && hist->genuine_count == users &&
+            hist->impostor_count == (users + strangers) * users - users) {
+            eval_rates(hist, threshold, &far, &frr);
+            eval_equal_error(hist, &eer);
+            double expected = (double)accepted / (double)hist->impostor_count;
+            if (fabs(far - expected) * (double)hist->impostor_count <= 2.0 && frr == 0.0 && eer < 0.01) {
+                result = 0;
+            }
+        }
+    }
+    template_matrix_free(gallery);
+    template_matrix_free(probes);
+    eval_histogram_free(hist);
+    return result;
+}
+
+/**
+ * Publish a small quantized matrix, map it back and follow one swap
+ */
+static int test_snapshot_swap(void) {
+    char control_path[64];
+    snprintf(control_path, sizeof(control_path), "/tmp/neurolock_test_%d.snap", (int)getpid());
+    
+    const size_t rows = 16;
+    TemplateMatrix *matrix = template_matrix_alloc(rows, FEATURE_VECTOR_SIZE);
+    SnapshotPublisher *publisher = snapshot_publisher_open(control_path);
+    SnapshotReader *reader = NULL;
+    int result = -1;
+    
+    if (matrix && publisher) {
+        for (size_t r = 0; r < rows; r++) {
+            snprintf(matrix->usernames[r], sizeof(matrix->usernames[r]), "snapshot_user_%zu", r);
+            for (size_t c = 0; c < matrix->dim; c++) {
+                matrix->matrix[r * matrix->stride + c] = (float)rand() / RAND_MAX;
+            }
+            vector_normalize(matrix->matrix + r * matrix->stride, matrix->matrix + r * matrix->stride, matrix->dim);
+        }
+        
+        if (template_matrix_quantize(matrix) == 0 && snapshot_publish(publisher, matrix, 1) == 0 &&
+            (reader = snapshot_reader_open(control_path)) != NULL) {
+            const TemplateMatrix *view = snapshot_matrix(reader);
+            int same = view->num_templates == rows && view->codes &&
+                       memcmp(view->codes, matrix->codes, rows * matrix->stride) == 0 &&
+                       memcmp(view->usernames, matrix->usernames, rows * sizeof(*matrix->usernames)) == 0;
+            
+            // A second publish must be picked up exactly once
+            if (same && snapshot_publish(publisher, matrix, 2) == 0 &&
+                snapshot_reader_refresh(reader) == 1 && snapshot_reader_refresh(reader) == 0 &&
+                snapshot_db_generation(reader) == 2) {
+                result = 0;
+            }
+        }
+    }
+    
+    snapshot_reader_close(reader);
+    snapshot_publisher_close(publisher);
+    template_matrix_free(matrix);
+    unlink(control_path);
+    return result;
+}
+
+static void* run_test_server(void *arg) {
+    return (void*)(intptr_t)server_run((NeurolockServer*)arg);
+}
+
+/**
+ * Start a daemon on scratch files and drive every request type through
+ * the client calls, including a malformed frame on a live connection
+ */
+static int test_daemon_roundtrip(void) {
+    char db_path[64], wal_path[64], socket_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_daemon.nldb", (int)getpid());
+    snprintf(wal_path, sizeof(wal_path), "/tmp/neurolock_test_%d_daemon.wal", (int)getpid());
+    snprintf(socket_path, sizeof(socket_path), "/tmp/neurolock_test_%d.sock", (int)getpid());
+    
+    ServerConfig config = {0};
+    config.socket_path = socket_path;
+    config.db_path = db_path;
+    config.wal_path = wal_path;
+    config.workers = 2;
+    
+    // Trials share one underlying signal so the probe resembles the template
+    const size_t num_trials = 3;
+    const size_t samples = (size_t)SAMPLING_RATE * CAPTURE_DURATION;
+    EEGData *trials[3] = {NULL, NULL, NULL};
+    int ready = 1;
+    for (size_t t = 0; t < num_trials; t++) {
+        trials[t] = eeg_data_alloc(NUM_CHANNELS, samples);
+        ready = ready && trials[t];
+    }
+    for (size_t i = 0; ready && i < NUM_CHANNELS * samples; i++) {
+        float base = sinf((float)i * 0.05f * (float)(1 + i / samples)) * 40.0f;
+        for (size_t t = 0; t < num_trials; t++) {
+            trials[t]->data[i] = base + ((float)rand() / RAND_MAX - 0.5f) * 4.0f;
+        }
+    }
+    
+    NeurolockServer *server = ready ? server_create(&config) : NULL;
+    pthread_t thread;
+    int started = server && pthread_create(&thread, NULL, run_test_server, server) == 0;
+    int fd = started ? nld_connect(socket_path, 5000) : -1;
+    int result = -1;
+    
+    if (fd >= 0) {
+        NldVerifyReply reply;
+        IdentifyMatch matches[IDENTIFY_TOP_K];
+        size_t num_matches = 0;
+        NldHeader header;
+        uint8_t payload[8];
+        
+        int ok = nld_ping(fd) == NLD_STATUS_OK &&
+                 nld_verify(fd, "daemon_user", trials[0], &reply) == NLD_STATUS_NOT_ENROLLED &&
+                 nld_enroll(fd, "daemon_user", (const EEGData**)trials, num_trials,
+                            TASK_EYES_CLOSED_REST) == NLD_STATUS_OK &&
+                 nld_enroll(fd, "daemon_user", (const EEGData**)trials, 1,
+                            TASK_EYES_CLOSED_REST) == NLD_STATUS_EXISTS;
+        
+        int verified = ok ? nld_verify(fd, "daemon_user", trials[1], &reply) : -1;
+        ok = ok && (verified == NLD_STATUS_OK || verified == NLD_STATUS_REJECTED) &&
+             reply.authenticated == (verified == NLD_STATUS_OK) &&
+             reply.matcher == AUTH_MATCHER_COSINE && reply.threshold == auth_threshold(AUTH_MATCHER_COSINE);
+        
+        // Identification sees the enrolment once the gallery refresh interval has passed
+        sleep_ms(DAEMON_GALLERY_REFRESH_MS + 50);
+        ok = ok && nld_identify(fd, trials[2], matches, IDENTIFY_TOP_K, &num_matches) == NLD_STATUS_OK &&
+             num_matches == 1 && strcmp(matches[0].username, "daemon_user") == 0;
+        
+        // A VERIFY without a payload is refused, and the connection stays usable
+        ok = ok && nld_send_frame(fd, NLD_REQUEST_MAGIC, NLD_OP_VERIFY, 77, NULL, 0) == 0 &&
+             nld_recv_frame(fd, NLD_RESPONSE_MAGIC, &header, payload, sizeof(payload)) == 0 &&
+             header.code == NLD_STATUS_BAD_REQUEST && header.request_id == 77 &&
+             nld_ping(fd) == NLD_STATUS_OK;
+        
+        ok = ok && nld_delete(fd, "daemon_user") == NLD_STATUS_OK &&
+             nld_delete(fd, "daemon_user") == NLD_STATUS_NOT_ENROLLED &&
+             nld_verify(fd, "daemon_user", trials[0], &reply) == NLD_STATUS_NOT_ENROLLED;
+        
+        ServerStats stats;
+        server_get_stats(server, &stats);
+        if (ok && stats.connections == 1 && stats.requests == 11 && stats.failures == 1) {
+            result = 0;
+        }
+        close(fd);
+    }
+    
+    if (started) {
+        server_stop(server);
+        void *status = NULL;
+        pthread_join(thread, &status);
+        if (status != NULL) {
+            result = -1;
+        }
+    }
+    server_destroy(server);
+    for (size_t t = 0; t < num_trials; t++) {
+        eeg_data_free(trials[t]);
+    }
+    unlink(db_path);
+    unlink(wal_path);
+    return result;
+}
+
+/**
+ * Scatter writes and reads through a batch queue, then store a batch with a
+ * replacement and a repeated user, check what a fresh mapping sees and
+ * batch-store users again after deleting them
+ */
+static int test_batched_io(void) {
+    char file_path[64], db_path[64];
+    snprintf(file_path, sizeof(file_path), "/tmp/neurolock_test_%d.io", (int)getpid());
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_batch.nldb", (int)getpid());
+    
+    // Chunks go out in reverse order and come back in forward order
+    const size_t chunks = 96, chunk_size = 4096;
+    uint8_t *out = (uint8_t*)malloc(chunks * chunk_size);
+    uint8_t *in = (uint8_t*)calloc(chunks, chunk_size);
+    IOBatch *io = io_batch_create(16);
+    int fd = open(file_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    int ok = out && in && io && fd >= 0;
+    if (ok) {
+        for (size_t i = 0; i < chunks * chunk_size; i++) {
+            out[i] = (uint8_t)(i * 31 + i / chunk_size);
+        }
+        io_batch_register_file(io, fd);
+        io_batch_register_buffer(io, out, chunks * chunk_size);
+        for (size_t c = chunks; c-- > 0; ) {
+            io_batch_write(io, fd, out + c * chunk_size, chunk_size, c * chunk_size);
+        }
+        ok = io_batch_wait(io) == 0;
+        for (size_t c = 0; ok && c < chunks; c++) {
+            io_batch_read(io, fd, in + c * chunk_size, chunk_size, c * chunk_size);
+        }
+        ok = ok && io_batch_wait(io) == 0 && memcmp(in, out, chunks * chunk_size) == 0;
+        
+        // Reading past the end is reported, and the queue is usable afterwards
+        io_batch_read(io, fd, in, chunk_size, chunks * chunk_size);
+        ok = ok && io_batch_wait(io) != 0 && io_batch_wait(io) == 0;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    io_batch_free(io);
+    free(out);
+    free(in);
+    unlink(file_path);
+    
+    // Two stored users, then a batch replacing one, adding two and repeating one
+    const char *names[] = { "batch_user_0", "batch_user_1", "batch_user_1", "batch_user_2", "batch_user_3",
+                            "batch_user_2" };
+    const size_t count = sizeof(names) / sizeof(names[0]);
+    Template *templates[6] = {NULL};
+    for (size_t n = 0; ok && n < count; n++) {
+        templates[n] = template_alloc();
+        if (templates[n]) {
+            snprintf(templates[n]->username, sizeof(templates[n]->username), "%s", names[n]);
+            templates[n]->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+            templates[n]->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
+            templates[n]->version = (uint32_t)n + 1;
+        }
+        ok = templates[n] && templates[n]->features && templates[n]->hash;
+        for (size_t i = 0; ok && i < FEATURE_VECTOR_SIZE; i++) {
+            templates[n]->features->features[i] = (float)rand() / RAND_MAX;
+        }
+    }
+    
+    int result = -1;
+    TemplateDB *db = ok ? template_db_open(db_path) : NULL;
+    if (db && template_db_put(db, templates[0]) == 0 && template_db_put(db, templates[1]) == 0) {
+        uint64_t generation = template_db_generation(db);
+        TemplateDB *fresh = template_db_put_batch(db, (const Template *const *)templates + 2, count - 2) == 0 ?
+                            template_db_open(db_path) : NULL;
+        if (fresh && template_db_count(fresh) == 4 && template_db_generation(fresh) == generation + 3) {
+            static const size_t expected[] = { 0, 2, 5, 4 };
+            result = 0;
+            for (size_t u = 0; u < 4 && result == 0; u++) {
+                Template stored = {0};
+                const Template *want = templates[expected[u]];
+                if (template_db_get(fresh, want->username, &stored) != 0 || stored.version != want->version ||
+                    memcmp(stored.features->features, want->features->features,
+                           FEATURE_VECTOR_SIZE * sizeof(float)) != 0) {
+                    result = -1;
+                }
+                template_clear(&stored);
+            }
+            
+            // Deleted users come back through their tombstoned slots in one batch
+            const Template *again[] = { templates[0], templates[5] };
+            if (result == 0 && (template_db_remove(fresh, templates[0]->username) != 0 ||
+                                template_db_remove(fresh, templates[5]->username) != 0 ||
+                                template_db_put_batch(fresh, again, 2) != 0 || template_db_count(fresh) != 4 ||
+                                !template_db_contains(fresh, templates[0]->username) ||
+                                !template_db_contains(fresh, templates[5]->username))) {
+                result = -1;
+            }
+        }
+        template_db_close(fresh);
+    }
+    template_db_close(db);
+    for (size_t n = 0; n < count; n++) {
+        template_free(templates[n]);
+    }
+    unlink(db_path);
+    return result;
+}
+
+/**
+ * Enrol one user, score a manifest mixing good, missing, unknown and
+ * mismatched entries to both result formats and check the ok entry
+ * against a direct auth_verify_features() on the same recording
+ */
+static int test_batch_scoring(void) {
+    char db_path[64], good_path[64], bad_path[64], manifest_path[64], csv_path[64], bin_path[64];
+    snprintf(db_path, sizeof(db_path), "/tmp/neurolock_test_%d_scoring.nldb", (int)getpid());
+    snprintf(good_path, sizeof(good_path), "/tmp/neurolock_test_%d_good.nlrc", (int)getpid());
+    snprintf(bad_path, sizeof(bad_path), "/tmp/neurolock_test_%d_bad.nlrc", (int)getpid());
+    snprintf(manifest_path, sizeof(manifest_path), "/tmp/neurolock_test_%d.manifest", (int)getpid());
+    snprintf(csv_path, sizeof(csv_path), "/tmp/neurolock_test_%d_scores.csv", (int)getpid());
+    snprintf(bin_path, sizeof(bin_path), "/tmp/neurolock_test_%d_scores.bin", (int)getpid());
+    
+    const size_t num_trials = 3;
+    const size_t samples = (size_t)SAMPLING_RATE * CAPTURE_DURATION;
+    EEGData *trials[3] = {NULL, NULL, NULL};
+    int ready = 1;
+    for (size_t t = 0; t < num_trials; t++) {
+        trials[t] = eeg_data_alloc(NUM_CHANNELS, samples);
+        ready = ready && trials[t];
+    }
+    for (size_t i = 0; ready && i < NUM_CHANNELS * samples; i++) {
+        float base = sinf((float)i * 0.05f * (float)(1 + i / samples)) * 40.0f;
+        for (size_t t = 0; t < num_trials; t++) {
+            trials[t]->data[i] = base + ((float)rand() / RAND_MAX - 0.5f) * 4.0f;
+        }
+    }
+    
+    // The last trial is held out as the probe
+    Template *enrolled = template_alloc();
+    TemplateDB *db = ready && enrolled ? template_db_open(db_path) : NULL;
+    EEGData *reloaded = NULL;
+    static const uint8_t garbage[40] = {'n', 'o', 't', ' ', 'e', 'e', 'g'};
+    int ok = db && template_create("batch_user", (const EEGData**)trials, num_trials - 1,
+                                   TASK_EYES_CLOSED_REST, enrolled) == 0 &&
+             template_db_put(db, enrolled) == 0 &&
+             eeg_data_save(trials[2], good_path) == 0 && write_file(bad_path, garbage, sizeof(garbage)) == 0 &&
+             (reloaded = eeg_data_load(good_path)) != NULL &&
+             memcmp(reloaded->data, trials[2]->data, NUM_CHANNELS * samples * sizeof(float)) == 0;
+    
+    char manifest[512];
+    int length = snprintf(manifest, sizeof(manifest),
+                          "# recording,username,task\n%s,batch_user,0\n\n%s,batch_user,0\n"
+                          "%s,nobody,0\n%s,batch_user,2\n",
+                          good_path, bad_path, good_path, good_path);
+    ok = ok && length > 0 && (size_t)length < sizeof(manifest) &&
+         write_file(manifest_path, (const uint8_t*)manifest, (size_t)length) == 0;
+    
+    BatchStats csv_stats = {0}, bin_stats = {0};
+    ok = ok && batch_score(db, NULL, NULL, manifest_path, csv_path, BATCH_FORMAT_CSV, &csv_stats) == 0 &&
+         batch_score(db, NULL, NULL, manifest_path, bin_path, BATCH_FORMAT_BINARY, &bin_stats) == 0 &&
+         csv_stats.records == 4 && csv_stats.users == 2 && csv_stats.failed == 3 &&
+         bin_stats.accepted == csv_stats.accepted;
+    
+    // Records come back in manifest order with the same decision as a direct verify
+    FeatureVector *probe = ok ? feature_vector_alloc(FEATURE_VECTOR_SIZE) : NULL;
+    AuthResult direct;
+    AuthMatcher matcher;
+    uint8_t *bytes = NULL;
+    size_t size = 0;
+    int result = -1;
+    if (probe && extract_features(reloaded, probe) == 0 &&
+        auth_verify_features(probe, enrolled, NULL, NULL, &direct, &matcher) == 0 &&
+        read_file(bin_path, &bytes, &size) == 0) {
+        static const uint32_t lines[4] = {2, 4, 5, 6};
+        static const uint8_t statuses[4] = {BATCH_OK, BATCH_BAD_RECORDING, BATCH_UNKNOWN_USER, BATCH_TASK_MISMATCH};
+        int same = size == BATCH_RESULT_HEADER_SIZE + 4 * BATCH_RESULT_RECORD_SIZE &&
+                   load_le32(bytes) == BATCH_RESULT_MAGIC && load_le64(bytes + 8) == 4;
+        for (size_t i = 0; same && i < 4; i++) {
+            const uint8_t *record = bytes + BATCH_RESULT_HEADER_SIZE + i * BATCH_RESULT_RECORD_SIZE;
+            same = load_le32(record) == lines[i] && record[4] == statuses[i];
+        }
+        const uint8_t *first = bytes + BATCH_RESULT_HEADER_SIZE;
+        if (same && first[5] == (uint8_t)matcher && first[6] == (uint8_t)(direct.authenticated != 0) &&
+            load_le_f32(first + 8) == direct.similarity_score) {
+            result = 0;
+        }
+        free(bytes);
+    }
+    
+    feature_vector_free(probe);
+    template_free(enrolled);
+    eeg_data_free(reloaded);
+    for (size_t t = 0; t < num_trials; t++) {
+        eeg_data_free(trials[t]);
+    }
+    template_db_close(db);
+    unlink(db_path);
+    unlink(good_path);
+    unlink(bad_path);
+    unlink(manifest_path);
+    unlink(csv_path);
+    unlink(bin_path);
+    return result;
+}
+
+/* Concurrent guesses at one user in test_attempt_lockout */
+typedef struct {
+    AttemptTable *table;
+    uint64_t now_ms;
+    int allowed;
+} BurstArgs;
+
+static void* burst_attempts(void *arg) {
+    BurstArgs *burst = (BurstArgs*)arg;
+    for (int i = 0; i < 200; i++) {
+        int attempt = 0;
+        if (lockout_acquire(burst->table, "burst_user", burst->now_ms, &attempt, NULL) == 0) {
+            burst->allowed++;
+            lockout_finish(burst->table, "burst_user", ATTEMPT_REJECTED);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Walk one user through failures, lockout, expiry, refund and reset, check
+ * that other users are unaffected and that a concurrent burst gets exactly
+ * MAX_AUTH_ATTEMPTS attempts; then overfill a tiny table to check it fails
+ * closed and reclaims expired slots; last, share a table file between two
+ * handles
+ */
+static int test_attempt_lockout(void) {
+    const uint64_t now = get_timestamp_ms(), window = (uint64_t)AUTH_TIMEOUT * 1000;
+    AttemptTable *table = lockout_create(0);
+    AttemptTable *tiny = lockout_create(1);
+    int attempt = 0, ok = table && tiny;
+    uint64_t retry = 0;
+    
+    for (int i = 1; ok && i <= MAX_AUTH_ATTEMPTS; i++) {
+        ok = lockout_acquire(table, "alice", now, &attempt, NULL) == 0 && attempt == i;
+        lockout_finish(table, "alice", ATTEMPT_REJECTED);
+    }
+    ok = ok && lockout_acquire(table, "alice", now + 1000, &attempt, &retry) == 1 && retry == window - 1000 &&
+         lockout_acquire(table, "bob", now + 1000, &attempt, NULL) == 0 && attempt == 1 &&
+         lockout_refusals(table) == 1;
+    
+    // The lockout lapses on its own; an aborted attempt is refunded, an accepted one clears
+    ok = ok && lockout_acquire(table, "alice", now + window, &attempt, NULL) == 0 && attempt == 1;
+    lockout_finish(table, "alice", ATTEMPT_REJECTED);
+    ok = ok && lockout_acquire(table, "alice", now + window, &attempt, NULL) == 0 && attempt == 2;
+    lockout_finish(table, "alice", ATTEMPT_ABORTED);
+    ok = ok && lockout_acquire(table, "alice", now + window, &attempt, NULL) == 0 && attempt == 2;
+    lockout_finish(table, "alice", ATTEMPT_ACCEPTED);
+    ok = ok && lockout_acquire(table, "alice", now + window, &attempt, NULL) == 0 && attempt == 1;
+    
+    BurstArgs bursts[4];
+    pthread_t threads[4];
+    size_t started = 0;
+    for (size_t t = 0; ok && t < 4; t++) {
+        bursts[t].table = table;
+        bursts[t].now_ms = now;
+        bursts[t].allowed = 0;
+        if (pthread_create(&threads[t], NULL, burst_attempts, &bursts[t]) == 0) {
+            started++;
+        }
+    }
+    int allowed = 0;
+    for (size_t t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+        allowed += bursts[t].allowed;
+    }
+    ok = ok && started == 4 && allowed == MAX_AUTH_ATTEMPTS;
+    
+    // One slot per shard: locked users hold their slots, a user whose shard
+    // is full is refused until a slot lapses, expired slots are reused
+    char name[32];
+    int tracked = 0, refused = 0;
+    for (int u = 0; ok && u < 4 * LOCKOUT_SHARDS; u++) {
+        snprintf(name, sizeof(name), "sprayed_%d", u);
+        if (lockout_acquire(tiny, name, now + 1000, &attempt, &retry) != 0) {
+            refused++;
+            ok = retry == window - 1000;
+            continue;
+        }
+        for (int i = 1; i < MAX_AUTH_ATTEMPTS; i++) {
+            lockout_acquire(tiny, name, now, &attempt, NULL);
+        }
+        tracked += lockout_acquire(tiny, name, now, &attempt, NULL) == 1;
+    }
+    ok = ok && tracked > 0 && tracked <= LOCKOUT_SHARDS && tracked + refused == 4 * LOCKOUT_SHARDS &&
+         lockout_refusals(tiny) == (uint64_t)(tracked + refused);
+    int reclaimed = 0;
+    for (int u = 0; ok && u < LOCKOUT_SHARDS; u++) {
+        snprintf(name, sizeof(name), "later_%d", u);
+        if (lockout_acquire(tiny, name, now + window, &attempt, NULL) != 0) {
+            continue;       // Shard already retaken by an earlier user in this loop
+        }
+        ok = attempt == 1;
+        lockout_finish(tiny, name, ATTEMPT_REJECTED);
+        reclaimed += ok && lockout_acquire(tiny, name, now + window, &attempt, NULL) == 0 && attempt == 2;
+    }
+    ok = ok && reclaimed > 0;
+    
+    // Two handles on one table file count together, and a reopen keeps the counts
+    char table_path[256];
+    snprintf(table_path, sizeof(table_path), "/tmp/neurolock_test_%d.nlt", (int)getpid());
+    unlink(table_path);
+    AttemptTable *cli = ok ? lockout_open(table_path, 0) : NULL;
+    AttemptTable *daemon = cli ? lockout_open(table_path, 0) : NULL;
+    for (int i = 1; daemon && i <= MAX_AUTH_ATTEMPTS; i++) {
+        ok = ok && lockout_acquire(i % 2 ? cli : daemon, "carol", now, &attempt, NULL) == 0 && attempt == i;
+        lockout_finish(i % 2 ? cli : daemon, "carol", ATTEMPT_REJECTED);
+    }
+    lockout_destroy(cli);
+    cli = daemon ? lockout_open(table_path, 0) : NULL;
+    ok = ok && cli && daemon &&
+         lockout_acquire(cli, "carol", now + 1000, &attempt, &retry) == 1 && retry == window - 1000 &&
+         lockout_acquire(daemon, "dave", now, &attempt, NULL) == 0 && attempt == 1;
+    lockout_destroy(cli);
+    lockout_destroy(daemon);
+    unlink(table_path);
+    
+    lockout_destroy(tiny);
+    lockout_destroy(table);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Submit three consistent trials around an outlier without waiting in
+ * between; the outlier must be flagged and the running statistics must match
+ * template_create() over the consistent trials
+ */
+static int test_pipelined_enrollment(void) {
+    const size_t samples = (size_t)SAMPLING_RATE * CAPTURE_DURATION;
+    EEGData *trials[4] = {NULL, NULL, NULL, NULL};
+    int ready = 1;
+    for (size_t t = 0; t < 4; t++) {
+        trials[t] = eeg_data_alloc(NUM_CHANNELS, samples);
+        ready = ready && trials[t];
+    }
+    for (size_t i = 0; ready && i < NUM_CHANNELS * samples; i++) {
+        float base = sinf((float)i * 0.05f * (float)(1 + i / samples)) * 40.0f;
+        for (size_t t = 0; t < 3; t++) {
+            trials[t]->data[i] = base + ((float)rand() / RAND_MAX - 0.5f) * 4.0f;
+        }
+        trials[3]->data[i] = ((float)rand() / RAND_MAX - 0.5f) * 400.0f;
+    }
+    
+    Template *batch = template_alloc();
+    Template *pipelined = template_alloc();
+    int ok = ready && batch && pipelined &&
+             template_create("pipeline_user", (const EEGData**)trials, 3, TASK_EYES_CLOSED_REST, batch) == 0;
+    
+    // Submission order: consistent, outlier, consistent, consistent
+    EnrollSession *session = ok ? enroll_session_create("pipeline_user", TASK_EYES_CLOSED_REST, 4) : NULL;
+    static const size_t order[4] = {0, 3, 1, 2};
+    int index[4] = {-1, -1, -1, -1};
+    for (size_t k = 0; k < 4; k++) {
+        index[k] = session ? enroll_session_submit(session, trials[order[k]]) : -1;
+        if (!session) {
+            eeg_data_free(trials[order[k]]);
+        }
+    }
+    enroll_session_wait(session);
+    
+    float consistency = 1.0f;
+    ok = ok && session &&
+         enroll_session_trial(session, index[0], NULL) == ENROLL_TRIAL_ACCEPTED &&
+         enroll_session_trial(session, index[1], &consistency) == ENROLL_TRIAL_INCONSISTENT &&
+         consistency < ENROLL_MIN_CONSISTENCY &&
+         enroll_session_trial(session, index[2], NULL) == ENROLL_TRIAL_ACCEPTED &&
+         enroll_session_trial(session, index[3], NULL) == ENROLL_TRIAL_ACCEPTED &&
+         enroll_session_accepted(session) == 3 &&
+         enroll_session_submit(session, eeg_data_alloc(NUM_CHANNELS, samples)) < 0 &&
+         enroll_session_finish(session, pipelined) == 0 &&
+         pipelined->variance && batch->variance &&
+         pipelined->num_exemplars == batch->num_exemplars &&
+         pipelined->hash != NULL;
+    
+    for (size_t j = 0; ok && j < FEATURE_VECTOR_SIZE; j++) {
+        float mean_error = fabsf(pipelined->features->features[j] - batch->features->features[j]);
+        float variance_error = fabsf(pipelined->variance->features[j] - batch->variance->features[j]);
+        ok = mean_error <= 1e-4f * (1.0f + fabsf(batch->features->features[j])) &&
+             variance_error <= 1e-3f * (1.0f + batch->variance->features[j]);
+    }
+    
+    enroll_session_free(session);
+    template_free(batch);
+    template_free(pipelined);
+    return ok ? 0 : -1;
+}
+
+/* Sample of a test stream: the genuine signal test trials share, or an impostor's */
+static float stream_sample(size_t ch, size_t t, int impostor) {
+    const size_t samples = (size_t)SAMPLING_RATE * CAPTURE_DURATION;
+    float noise = ((float)rand() / RAND_MAX - 0.5f) * 4.0f;
+    if (impostor) {
+        return sinf((float)t * 6.28318531f * 40.0f / SAMPLING_RATE) * 40.0f + noise;
+    }
+    return sinf((float)(ch * samples + t) * 0.05f * (float)(1 + ch)) * 40.0f + noise;
+}
+
+/**
+ * Stream a genuine wearer in uneven chunks, check the incremental features
+ * against extract_features() on the same window, then switch to an impostor
+ * and expect exactly one de-auth after CONTINUOUS_DEAUTH_WINDOWS rejections
+ */
+static int test_continuous_monitor(void) {
+    const size_t samples = (size_t)SAMPLING_RATE * CAPTURE_DURATION;
+    EEGData *trials[3] = {NULL, NULL, NULL};
+    int ready = 1;
+    for (size_t t = 0; t < 3; t++) {
+        trials[t] = eeg_data_alloc(NUM_CHANNELS, samples);
+        ready = ready && trials[t];
+    }
+    for (size_t ch = 0; ready && ch < NUM_CHANNELS; ch++) {
+        for (size_t i = 0; i < samples; i++) {
+            for (size_t t = 0; t < 3; t++) {
+                trials[t]->data[ch * samples + i] = stream_sample(ch, i, 0);
+            }
+        }
+    }
+    
+    Template *enrolled = template_alloc();
+    int ok = ready && enrolled &&
+             template_create("monitor_user", (const EEGData**)trials, 3, TASK_EYES_CLOSED_REST, enrolled) == 0;
+    for (size_t t = 0; t < 3; t++) {
+        eeg_data_free(trials[t]);
+    }
+    
+    // Keep the genuine stream so the window can be rebuilt for the reference extraction
+    const size_t genuine = 3 * samples + 77;
+    float *stream = (float*)malloc(genuine * NUM_CHANNELS * sizeof(float));
+    ContinuousMonitor *monitor = ok && stream ? continuous_create(enrolled, NULL, NULL, 1000) : NULL;
+    ok = monitor != NULL && continuous_push(monitor, NULL, 0) == CONTINUOUS_IDLE;
+    size_t accepted = 0, pushed = 0;
+    for (size_t t = 0; ok && t < genuine * NUM_CHANNELS; t++) {
+        stream[t] = stream_sample(t % NUM_CHANNELS, t / NUM_CHANNELS, 0);
+    }
+    while (ok && pushed < genuine) {
+        size_t chunk = 1 + (size_t)rand() % 300;
+        chunk = chunk < genuine - pushed ? chunk : genuine - pushed;
+        int event = continuous_push(monitor, stream + pushed * NUM_CHANNELS, chunk);
+        ok = event == CONTINUOUS_IDLE || event == CONTINUOUS_ACCEPTED;
+        accepted += event == CONTINUOUS_ACCEPTED;
+        pushed += chunk;
+    }
+    
+    // The window ends mid-ring, so the sliding bins are compared away from a resync
+    EEGData *window = ok ? eeg_data_alloc(NUM_CHANNELS, samples) : NULL;
+    FeatureVector *incremental = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    FeatureVector *reference = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    ok = ok && accepted >= 2 && window && incremental && reference;
+    if (ok) {
+        window->sampling_rate = SAMPLING_RATE;
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            for (size_t i = 0; i < samples; i++) {
+                window->data[ch * samples + i] = stream[(genuine - samples + i) * NUM_CHANNELS + ch];
+            }
+        }
+        ok = continuous_features(monitor, incremental) == 0 && extract_features(window, reference) == 0;
+    }
+    for (size_t j = 0; ok && j < FEATURE_VECTOR_SIZE; j++) {
+        ok = fabsf(incremental->features[j] - reference->features[j]) <=
+             1e-3f * (1.0f + fabsf(reference->features[j]));
+    }
+    
+    // Once the impostor fills the window: LOW, LOW, ..., DEAUTH once, then LOW again
+    float frame[NUM_CHANNELS];
+    size_t deauths = 0, lows_before = 0;
+    for (size_t t = 0; ok && t < 3 * samples; t++) {
+        for (size_t ch = 0; ch < NUM_CHANNELS; ch++) {
+            frame[ch] = stream_sample(ch, genuine + t, 1);
+        }
+        int event = continuous_push(monitor, frame, 1);
+        ok = event >= CONTINUOUS_IDLE;
+        if (event == CONTINUOUS_DEAUTH) {
+            deauths++;
+        } else if (event == CONTINUOUS_LOW && deauths == 0) {
+            lows_before++;
+        }
+    }
+    
+    ContinuousStats stats;
+    memset(&stats, 0, sizeof(stats));
+    continuous_stats(monitor, &stats);
+    ok = ok && deauths == 1 && lows_before + 1 >= CONTINUOUS_DEAUTH_WINDOWS && stats.deauthenticated &&
+         stats.samples == genuine + 3 * samples && stats.rejected >= CONTINUOUS_DEAUTH_WINDOWS;
+    
+    // Budget: 1% of a core, i.e. 10 ms of CPU per second of stream
+    ok = ok && stats.busy_ns < stats.samples / SAMPLING_RATE * 10000000ULL;
+    
+    eeg_data_free(window);
+    feature_vector_free(incremental);
+    feature_vector_free(reference);
+    continuous_free(monitor);
+    free(stream);
+    template_free(enrolled);
+    return ok ? 0 : -1;
+}
+
+/* Node of the binary spawn tree in test_work_stealing */
+typedef struct {
+    Scheduler *sched;
+    unsigned depth;
+    size_t *leaves;
+} SpawnNode;
+
+static void spawn_tree(void *arg) {
+    SpawnNode *node = (SpawnNode*)arg;
+    if (node->depth == 0) {
+        __atomic_add_fetch(node->leaves, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    SpawnNode children[2] = {
+        { node->sched, node->depth - 1, node->leaves },
+        { node->sched, node->depth - 1, node->leaves }
+    };
+    TaskGroup *group = task_group_create(node->sched);
+    if (group) {
+        task_group_spawn(group, spawn_tree, &children[0]);
+        task_group_spawn(group, spawn_tree, &children[1]);
+        task_group_wait(group);
+    }
+    task_group_free(group);
+}
+
+static void count_task(void *arg) {
+    __atomic_add_fetch((size_t*)arg, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Run a nested spawn tree on a private pool, then check that a scheduler
+ * without workers runs tasks in the wait and skips a cancelled group
+ */
+static int test_work_stealing(void) {
+    size_t leaves = 0, runs = 0, skipped = 0;
+    Scheduler *pool = scheduler_create(3);
+    Scheduler *inline_only = scheduler_create(0);
+    TaskGroup *tree = pool ? task_group_create(pool) : NULL;
+    TaskGroup *counted = inline_only ? task_group_create(inline_only) : NULL;
+    TaskGroup *cancelled = inline_only ? task_group_create(inline_only) : NULL;
+    
+    int result = -1;
+    if (tree && counted && cancelled) {
+        SpawnNode root = { pool, 12, &leaves };
+        task_group_spawn(tree, spawn_tree, &root);
+        for (int i = 0; i < 100; i++) {
+            task_group_spawn(counted, count_task, &runs);
+            task_group_spawn(cancelled, count_task, &skipped);
+        }
+        task_group_cancel(cancelled);
+        
+        int tree_ok = task_group_wait(tree) == 0 && leaves == 4096;
+        int counted_ok = task_group_wait(counted) == 0 && runs == 100;
+        int cancel_ok = task_group_wait(cancelled) == -1 && skipped == 0;
+        result = tree_ok && counted_ok && cancel_ok && scheduler_concurrency(pool) == 4 ? 0 : -1;
+    }
+    task_group_free(tree);
+    task_group_free(counted);
+    task_group_free(cancelled);
+    scheduler_destroy(pool);
+    scheduler_destroy(inline_only);
+    return result;
+}
+
+int cmd_test(void) {
+    printf("\n");
+    printf("========================================\n");
+    printf("         SYSTEM TEST\n");
+    printf("========================================\n\n");
+    
+    printf("Testing capture system...\n");
+    if (capture_init() == 0) {
+        printf("  ✓ Capture initialization: OK\n");
+        capture_cleanup();
+    } else {
+        printf("  ✗ Capture initialization: FAILED\n");
+    }
+    
+    printf("\nTesting feature extraction...\n");
+    EEGData *test_data = eeg_data_alloc(NUM_CHANNELS, SAMPLING_RATE * 2);
+    if (test_data) {
+        // Fill with test data
+        for (size_t i = 0; i < test_data->num_channels * test_data->num_samples; i++) {
+            test_data->data[i] = ((float)rand() / RAND_MAX - 0.5f) * 100.0f;
+        }
+        
+        FeatureVector *features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+        if (features && extract_features(test_data, features) == 0) {
+            printf("  ✓ Feature extraction: OK\n");
+            feature_vector_free(features);
+        } else {
+            printf("  ✗ Feature extraction: FAILED\n");
+        }
+        
+        eeg_data_free(test_data);
+    } else {
+        printf("  ✗ Data allocation: FAILED\n");
+    }
+    
+    printf("\nTesting hashing...\n");
+    uint8_t salt[SALT_LENGTH];
+    if (generate_salt(salt, SALT_LENGTH) == 0) {
+        printf("  ✓ Salt generation: OK\n");
+    } else {
+        printf("  ✗ Salt generation: FAILED\n");
+    }
+    
+    printf("\nTesting template database...\n");
+    if (test_template_db() == 0) {
+        printf("  ✓ Grow, tombstone reinsert and reopen: OK\n");
+    } else {
+        printf("  ✗ Grow, tombstone reinsert and reopen: FAILED\n");
+    }
+    
+    printf("\nTesting template file format...\n");
+    if (test_template_format() == 0) {
+        printf("  ✓ Round trip, CRC and version checks: OK\n");
+    } else {
+        printf("  ✗ Round trip, CRC and version checks: FAILED\n");
+    }
+    
+    printf("\nTesting template cache...\n");
+    if (test_template_cache() == 0) {
+        printf("  ✓ Hit/miss, eviction, file invalidation and concurrent readers: OK\n");
+    } else {
+        printf("  ✗ Hit/miss, eviction, file invalidation and concurrent readers: FAILED\n");
+    }
+    
+    printf("\nTesting HNSW index...\n");
+    if (test_hnsw_index() == 0) {
+        printf("  ✓ Insert/remove, recall against exhaustive scan, save/load: OK\n");
+    } else {
+        printf("  ✗ Insert/remove, recall against exhaustive scan, save/load: FAILED\n");
+    }
+    
+    printf("\nTesting product quantization...\n");
+    if (test_pq_index() == 0) {
+        printf("  ✓ Train/encode, ranking against exact cosine, save/load: OK\n");
+    } else {
+        printf("  ✗ Train/encode, ranking against exact cosine, save/load: FAILED\n");
+    }
+    
+    printf("\nTesting index change log...\n");
+    if (test_index_log() == 0) {
+        printf("  ✓ Resident and one-shot logging, snapshot and torn tail: OK\n");
+    } else {
+        printf("  ✗ Resident and one-shot logging, snapshot and torn tail: FAILED\n");
+    }
+    
+    printf("\nTesting int8 similarity kernel...\n");
+    if (test_quantized_scoring() == 0) {
+        printf("  ✓ Quantized scoring within error bound: OK\n");
+    } else {
+        printf("  ✗ Quantized scoring within error bound: FAILED\n");
+    }
+    
+    printf("\nTesting write-ahead log recovery...\n");
+    if (test_wal_recovery() == 0) {
+        printf("  ✓ Checkpoint, idempotent delete, torn tail and group commit: OK\n");
+    } else {
+        printf("  ✗ Checkpoint, idempotent delete, torn tail and group commit: FAILED\n");
+    }
+    
+    printf("\nTesting adaptive template update...\n");
+    if (test_template_update() == 0) {
+        printf("  ✓ EWMA mean/variance, exemplar and rehash update: OK\n");
+    } else {
+        printf("  ✗ EWMA mean/variance, exemplar and rehash update: FAILED\n");
+    }
+    
+    printf("\nTesting template archive export/import...\n");
+    if (test_archive_roundtrip() == 0) {
+        printf("  ✓ Round trip and hash verification: OK\n");
+    } else {
+        printf("  ✗ Round trip and hash verification: FAILED\n");
+    }
+    
+    printf("\nTesting shared identification snapshot...\n");
+    if (test_snapshot_swap() == 0) {
+        printf("  ✓ Sealed publish, map and swap: OK\n");
+    } else {
+        printf("  ✗ Sealed publish, map and swap: FAILED\n");
+    }
+    
+    printf("\nTesting cohort score normalization...\n");
+    if (test_score_normalization() == 0) {
+        printf("  ✓ Cohort round trip and Z/T-normalized decision: OK\n");
+    } else {
+        printf("  ✗ Cohort round trip and Z/T-normalized decision: FAILED\n");
+    }
+    
+    printf("\nTesting whitened matcher...\n");
+    if (test_whitened_matching() == 0) {
+        printf("  ✓ Cholesky solve and pooled covariance model: OK\n");
+    } else {
+        printf("  ✗ Cholesky solve and pooled covariance model: FAILED\n");
+    }
+    
+    printf("\nTesting per-user discriminant...\n");
+    if (test_lda_discriminant() == 0) {
+        printf("  ✓ Blocked Gram, discriminant training, storage and retraining: OK\n");
+    } else {
+        printf("  ✗ Blocked Gram, discriminant training, storage and retraining: FAILED\n");
+    }
+    
+    printf("\nTesting int8 embedding network...\n");
+    if (test_cnn_embedding() == 0) {
+        printf("  ✓ u8 x s8 product, model load and inference: OK\n");
+    } else {
+        printf("  ✗ u8 x s8 product, model load and inference: FAILED\n");
+    }
+    
+    printf("\nTesting score matrix evaluation...\n");
+    if (test_score_matrix() == 0) {
+        printf("  ✓ Panel GEMM, genuine/impostor split and error rates: OK\n");
+    } else {
+        printf("  ✗ Panel GEMM, genuine/impostor split and error rates: FAILED\n");
+    }
+    
+    printf("\nTesting authentication daemon...\n");
+    if (test_daemon_roundtrip() == 0) {
+        printf("  ✓ Socket protocol, enrol/verify/identify/delete: OK\n");
+    } else {
+        printf("  ✗ Socket protocol, enrol/verify/identify/delete: FAILED\n");
+    }
+    
+    printf("\nTesting batched template I/O...\n");
+    if (test_batched_io() == 0) {
+        printf("  ✓ Queued reads/writes and batched store: OK\n");
+    } else {
+        printf("  ✗ Queued reads/writes and batched store: FAILED\n");
+    }
+    
+    printf("\nTesting work-stealing scheduler...\n");
+    if (test_work_stealing() == 0) {
+        printf("  ✓ Nested task groups, inline waits and cancellation: OK\n");
+    } else {
+        printf("  ✗ Nested task groups, inline waits and cancellation: FAILED\n");
+    }
+    
+    printf("\nTesting batch scoring...\n");
+    if (test_batch_scoring() == 0) {
+        printf("  ✓ Manifest scoring to CSV and binary results: OK\n");
+    } else {
+        printf("  ✗ Manifest scoring to CSV and binary results: FAILED\n");
+    }
+    
+    printf("\nTesting attempt lockout...\n");
+    if (test_attempt_lockout() == 0) {
+        printf("  ✓ Failure counting, timed lockout and concurrent bursts: OK\n");
+    } else {
+        printf("  ✗ Failure counting, timed lockout and concurrent bursts: FAILED\n");
+    }
+    
+    printf("\nTesting pipelined enrolment...\n");
+    if (test_pipelined_enrollment() == 0) {
+        printf("  ✓ Running statistics and inconsistent-trial flagging: OK\n");
+    } else {
+        printf("  ✗ Running statistics and inconsistent-trial flagging: FAILED\n");
+    }
+    
+    printf("\nTesting continuous authentication...\n");
+    if (test_continuous_monitor() == 0) {
+        printf("  ✓ Sliding-window features, cadence and de-auth event: OK\n");
+    } else {
+        printf("  ✗ Sliding-window features, cadence and de-auth event: FAILED\n");
+    }
+    
+    printf("\n========================================\n");
+    printf("  SYSTEM TEST COMPLETE\n");
+    printf("========================================\n\n");
+    
+    return 0;
+}
+
+static int run_command(int argc, char *argv[], const char *device_name, MentalTask task) {
+    const char *command = argv[1];
+    
+    if (strcmp(command, "enroll") == 0) {
+        if (argc < 3) {
+            printf("Error: Username required\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return cmd_enroll(argv[2], device_name, task);
+        
+    } else if (strcmp(command, "auth") == 0 || strcmp(command, "authenticate") == 0) {
+        if (argc < 3) {
+            printf("Error: Username required\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return cmd_authenticate(argv[2], device_name, task);
+        
+    } else if (strcmp(command, "monitor") == 0) {
+        if (argc < 3) {
+            printf("Error: Username required\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return cmd_monitor(argv[2], device_name,
+                           argc > 3 && argv[3][0] != '-' ? (uint32_t)atol(argv[3]) : CONTINUOUS_CADENCE_MS);
+        
+    } else if (strcmp(command, "identify") == 0) {
+        return cmd_identify(device_name, task);
+        
+    } else if (strcmp(command, "index") == 0) {
+        return cmd_index(argc > 2 && argv[2][0] != '-' ? argv[2] : "hnsw");
+        
+    } else if (strcmp(command, "publish") == 0) {
+        return cmd_publish();
+        
+    } else if (strcmp(command, "whiten") == 0) {
+        return cmd_whiten();
+        
+    } else if (strcmp(command, "eval") == 0) {
+        return cmd_eval(argc > 2 && argv[2][0] != '-' ? argv[2] : NULL);
+        
+    } else if (strcmp(command, "cohort") == 0) {
+        return cmd_cohort(argc > 2 && argv[2][0] != '-' ? (size_t)atol(argv[2]) : COHORT_SIZE);
+        
+    } else if (strcmp(command, "delete") == 0) {
+        if (argc < 3) {
+            printf("Error: Username required\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return cmd_delete(argv[2]);
+        
+    } else if (strcmp(command, "list") == 0) {
+        return cmd_list();
+        
+    } else if (strcmp(command, "export") == 0 || strcmp(command, "import") == 0) {
+        if (argc < 3) {
+            printf("Error: Archive path required\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return strcmp(command, "export") == 0 ? cmd_export(argv[2]) : cmd_import(argv[2]);
+    } else if (strcmp(command, "record") == 0) {
+        if (argc < 3) {
+            printf("Error: Recording path required\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return cmd_record(argv[2], device_name, task);
+    } else if (strcmp(command, "batch") == 0) {
+        if (argc < 3) {
+            printf("Error: Manifest path required\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return cmd_batch(argv[2], argc > 3 && argv[3][0] != '-' ? argv[3] : BATCH_OUTPUT_PATH);
+        
+    } else if (strcmp(command, "test") == 0) {
+        return cmd_test();
+        
+    } else if (strcmp(command, "help") == 0) {
+        print_usage(argv[0]);
+        return 0;
+        
+    } else {
+        printf("Error: Unknown command '%s'\n", command);
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    print_banner();
+    
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    const char *device_name = "default_eeg_device"; // Default device
+    MentalTask task = TASK_EYES_CLOSED_REST; // Default task
+    
+    // Parse options
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            device_name = argv[++i];
+        } else if (strcmp(argv[i], "--task") == 0 && i + 1 < argc) {
+            task = (MentalTask)atoi(argv[++i]);
+        }
+    }
+    
+    // Templates only match features from the same extractor, so a configured
+    // network that cannot be loaded is an error rather than a silent fallback
+    CNNModel *embedding = NULL;
+    if (CNN_EMBEDDING) {
+        embedding = file_exists(CNN_MODEL_PATH) ? cnn_load(CNN_MODEL_PATH) : NULL;
+        if (!embedding || feature_extraction_set_model(embedding) != 0) {
+            printf("Error: Embedding network unavailable: %s\n", CNN_MODEL_PATH);
+            cnn_free(embedding);
+            return 1;
+        }
+    }
+    
+    int status = run_command(argc, argv, device_name, task);
+    
+    feature_extraction_set_model(NULL);
+    cnn_free(embedding);
+    return status;
 }
@@ -0,0 +1,92 @@
+/**
+ * neurolockd - NeuroLock authentication daemon
+ *
+ * Keeps templates and models resident and answers enrol, verify, identify
+ * and delete requests over a Unix socket (see protocol.h).
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "config.h"
+#include "cnn.h"
+#include "feature_extraction.h"
+#include "server.h"
+#include "utils.h"
+
+static NeurolockServer *running_server = NULL;
+
+static void handle_signal(int signum) {
+    (void)signum;
+    server_stop(running_server);
+}
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [--socket <path>] [--workers <n>]\n", program);
+    printf("\n");
+    printf("Options:\n");
+    printf("  --socket <path>   Listening socket (default: %s)\n", DAEMON_SOCKET_PATH);
+    printf("  --workers <n>     Request threads (default: one per CPU)\n");
+}
+
+int main(int argc, char *argv[]) {
+    ServerConfig config;
+    server_config_default(&config);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            config.socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            config.workers = (size_t)atoi(argv[++i]);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Same extractor as the CLI, or enrolled templates would not match
+    CNNModel *embedding = NULL;
+    if (CNN_EMBEDDING) {
+        embedding = file_exists(CNN_MODEL_PATH) ? cnn_load(CNN_MODEL_PATH) : NULL;
+        if (!embedding || feature_extraction_set_model(embedding) != 0) {
+            log_message(NL_LOG_ERROR, "Embedding network unavailable: %s", CNN_MODEL_PATH);
+            cnn_free(embedding);
+            return 1;
+        }
+    }
+
+    create_directory(TEMPLATE_DIR);
+    if (strcmp(config.socket_path, DAEMON_SOCKET_PATH) == 0) {
+        create_directory(NEUROLOCK_RUN_DIR);
+    }
+    running_server = server_create(&config);
+    if (!running_server) {
+        feature_extraction_set_model(NULL);
+        cnn_free(embedding);
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int status = server_run(running_server);
+
+    ServerStats stats;
+    server_get_stats(running_server, &stats);
+    log_message(NL_LOG_INFO, "Stopped after %llu requests on %llu connections (%llu failed, %llu locked out)",
+                (unsigned long long)stats.requests, (unsigned long long)stats.connections,
+                (unsigned long long)stats.failures, (unsigned long long)stats.lockouts);
+
+    server_destroy(running_server);
+    running_server = NULL;
+    feature_extraction_set_model(NULL);
+    cnn_free(embedding);
+    return status == 0 ? 0 : 1;
+}
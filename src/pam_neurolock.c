@@ -0,0 +1,231 @@
+#include "capture.h"
+#include "protocol.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define PAM_SM_AUTH
+#include <security/pam_modules.h>
+#include <security/pam_ext.h>
+
+/*
+ * pam_neurolock.so: verifies the login user's EEG against neurolockd.
+ *
+ *   auth  sufficient  pam_neurolock.so socket=/run/neurolock/neurolockd.sock timeout=2000 task=0
+ *
+ * The module captures one trial in-process and sends it over the daemon
+ * protocol, so a login costs the capture and one round trip: no exec, no
+ * template or model loading and no crypto initialisation in the host.
+ *
+ * One connection is kept in the module and reused by later logins of the
+ * same process; the module is linked -z nodelete so pam_end() does not
+ * unload it and drop the connection. A login that finds the connection busy
+ * (threaded hosts) opens a one-off connection rather than waiting. Every
+ * call is bounded by the timeout; a connection that times out or fails is
+ * closed, so a late reply is never read by the next login, and a dead
+ * connection (daemon restarted) is replaced once per login.
+ *
+ * Only symbols starting pam_sm_ are exported, so the shared modules linked
+ * in cannot clash with the host's. Their log_message() output goes to the
+ * host's syslog through pam_syslog(), never to its stderr.
+ */
+#define PAM_NEUROLOCK_EXPORT __attribute__((visibility("default")))
+
+/* Options from the PAM configuration line */
+typedef struct {
+    const char *socket_path;
+    const char *device_name;
+    uint32_t timeout_ms;
+    MentalTask task;
+    int debug;
+} PamOptions;
+
+/* Connection kept between logins */
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static int conn_fd = -1;
+static pid_t conn_owner;                // A forked child must not share its parent's stream
+static char conn_path[108];
+
+/* Handle of the login being served by this thread, for the shared modules' log lines */
+static __thread pam_handle_t *log_handle;
+
+/**
+ * Send log_message() output to the host's syslog rather than its stderr
+ */
+static void log_to_syslog(LogLevel level, const char *message) {
+    static const int priorities[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR, LOG_CRIT };
+    int priority = level <= NL_LOG_CRITICAL ? priorities[level] : LOG_ERR;
+    if (log_handle) {
+        pam_syslog(log_handle, priority, "%s", message);
+    } else {
+        syslog(LOG_AUTHPRIV | priority, "pam_neurolock: %s", message);
+    }
+}
+
+static void parse_options(pam_handle_t *pamh, int argc, const char **argv, PamOptions *options) {
+    options->socket_path = PAM_SOCKET_PATH;
+    options->device_name = PAM_DEVICE_NAME;
+    options->timeout_ms = PAM_TIMEOUT_MS;
+    options->task = TASK_EYES_CLOSED_REST;
+    options->debug = 0;
+
+    for (int i = 0; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "socket=", 7) == 0) {
+            options->socket_path = arg + 7;
+        } else if (strncmp(arg, "device=", 7) == 0) {
+            options->device_name = arg + 7;
+        } else if (strncmp(arg, "timeout=", 8) == 0 && atoi(arg + 8) > 0) {
+            options->timeout_ms = (uint32_t)atoi(arg + 8);
+        } else if (strncmp(arg, "task=", 5) == 0 && atoi(arg + 5) >= TASK_EYES_CLOSED_REST &&
+                   atoi(arg + 5) <= TASK_VISUAL_IMAGERY) {
+            options->task = (MentalTask)atoi(arg + 5);
+        } else if (strcmp(arg, "debug") == 0) {
+            options->debug = 1;
+        } else {
+            pam_syslog(pamh, LOG_ERR, "Unknown option: %s", arg);
+        }
+    }
+}
+
+/**
+ * Take the kept connection, (re)connecting if there is none or it belongs
+ * to another process or socket
+ * Returns: Socket, negative on error; *kept tells whether it must be released
+ */
+static int acquire_connection(const PamOptions *options, int fresh, int *kept) {
+    *kept = 0;
+    if (pthread_mutex_trylock(&conn_lock) != 0) {
+        return nld_connect(options->socket_path, options->timeout_ms);
+    }
+
+    if (conn_fd >= 0 && (fresh || conn_owner != getpid() || strcmp(conn_path, options->socket_path) != 0)) {
+        close(conn_fd);
+        conn_fd = -1;
+    }
+    if (conn_fd < 0 && strlen(options->socket_path) < sizeof(conn_path)) {
+        conn_fd = nld_connect(options->socket_path, options->timeout_ms);
+        conn_owner = getpid();
+        strcpy(conn_path, options->socket_path);
+    }
+    if (conn_fd < 0) {
+        pthread_mutex_unlock(&conn_lock);
+        return -1;
+    }
+    *kept = 1;
+    return conn_fd;
+}
+
+static void release_connection(int fd, int kept, int failed) {
+    if (!kept) {
+        close(fd);
+        return;
+    }
+    if (failed) {
+        close(conn_fd);
+        conn_fd = -1;
+    }
+    pthread_mutex_unlock(&conn_lock);
+}
+
+/**
+ * Send the trial, replacing a dead kept connection once
+ * Returns: NldStatus, negative if the daemon could not be reached in time
+ */
+static int verify_trial(const PamOptions *options, const char *username, const EEGData *trial,
+                        NldVerifyReply *reply) {
+    int status = -1;
+    for (int attempt = 0; attempt < 2 && status < 0; attempt++) {
+        int kept = 0;
+        int fd = acquire_connection(options, attempt > 0, &kept);
+        if (fd < 0) {
+            return -1;
+        }
+        uint64_t start = get_timestamp_ms();
+        status = nld_verify(fd, username, trial, reply);
+        release_connection(fd, kept, status < 0);
+
+        // Retrying after a timeout would double the wait; only a broken stream is retried
+        if (status < 0 && (!kept || get_timestamp_ms() - start >= options->timeout_ms)) {
+            break;
+        }
+    }
+    return status;
+}
+
+static int capture_trial(pam_handle_t *pamh, const PamOptions *options, EEGData *trial) {
+    if (capture_init() != 0 || capture_connect(options->device_name) != 0 || capture_start_streaming() != 0) {
+        pam_syslog(pamh, LOG_ERR, "Cannot start EEG capture on %s", options->device_name);
+        capture_cleanup();
+        return -1;
+    }
+    pam_info(pamh, "NeuroLock: relax and hold the enrolled task for %d seconds.", CAPTURE_DURATION);
+    int result = capture_record(CAPTURE_DURATION, options->task, trial);
+    capture_cleanup();
+    return result;
+}
+
+static int authenticate(pam_handle_t *pamh, int argc, const char **argv) {
+    PamOptions options;
+    parse_options(pamh, argc, argv, &options);
+
+    const char *username = NULL;
+    if (pam_get_user(pamh, &username, NULL) != PAM_SUCCESS || !username || username[0] == '\0' ||
+        strlen(username) >= NLD_USERNAME_SIZE) {
+        return PAM_USER_UNKNOWN;
+    }
+
+    EEGData *trial = eeg_data_alloc(NUM_CHANNELS, (size_t)SAMPLING_RATE * CAPTURE_DURATION);
+    if (!trial || capture_trial(pamh, &options, trial) != 0) {
+        eeg_data_free(trial);
+        return PAM_AUTHINFO_UNAVAIL;
+    }
+
+    NldVerifyReply reply;
+    memset(&reply, 0, sizeof(reply));
+    uint64_t start = get_timestamp_ms();
+    int status = verify_trial(&options, username, trial, &reply);
+    uint64_t elapsed = get_timestamp_ms() - start;
+    eeg_data_free(trial);
+
+    if (options.debug) {
+        pam_syslog(pamh, LOG_DEBUG, "%s: status %d in %llu ms", username, status, (unsigned long long)elapsed);
+    }
+    switch (status) {
+        case NLD_STATUS_OK:
+            return PAM_SUCCESS;
+        case NLD_STATUS_REJECTED:
+            pam_syslog(pamh, LOG_NOTICE, "EEG verification failed for %s (attempt %u)", username, reply.attempts);
+            return PAM_AUTH_ERR;
+        case NLD_STATUS_NOT_ENROLLED:
+            return PAM_USER_UNKNOWN;
+        case NLD_STATUS_LOCKED:
+            pam_info(pamh, "NeuroLock: too many failed attempts, try again in %u s.", (reply.retry_ms + 999) / 1000);
+            pam_syslog(pamh, LOG_NOTICE, "%s is locked out", username);
+            return PAM_MAXTRIES;
+        default:
+            pam_syslog(pamh, LOG_ERR, "neurolockd unavailable on %s (status %d)", options.socket_path, status);
+            return PAM_AUTHINFO_UNAVAIL;
+    }
+}
+
+PAM_NEUROLOCK_EXPORT int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv) {
+    (void)flags;
+    log_set_sink(log_to_syslog);
+    log_handle = pamh;
+    int result = authenticate(pamh, argc, argv);
+    log_handle = NULL;
+    return result;
+}
+
+PAM_NEUROLOCK_EXPORT int pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char **argv) {
+    (void)pamh;
+    (void)flags;
+    (void)argc;
+    (void)argv;
+    return PAM_SUCCESS;
+}
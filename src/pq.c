@@ -0,0 +1,736 @@
+#define _DEFAULT_SOURCE
+#include "pq.h"
+#include "vector_ops.h"
+#include "hashing.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define PQ_FILE_MAGIC 0x51504C4E        // "NLPQ" little-endian
+#define PQ_FILE_VERSION 1
+#define PQ_FILE_HEADER_SIZE 64
+#define PQ_MAX_SUBSPACES 64
+
+/* Rows scored per block; scores for a block stay in L1 */
+#define PQ_BLOCK_ROWS 1024
+
+/* Username map slots: 0 = empty, UINT32_MAX = tombstone, otherwise row + 1 */
+#define MAP_EMPTY 0u
+#define MAP_TOMBSTONE UINT32_MAX
+
+/* Min-heap entry for top-k selection */
+typedef struct {
+    float score;
+    size_t index;
+} HeapItem;
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static void centroid_norms_of(const float *codebook, size_t sub_dim, float *norms) {
+    for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+        norms[c] = 0.0f;
+    }
+    for (size_t d = 0; d < sub_dim; d++) {
+        const float *row = codebook + d * PQ_NUM_CENTROIDS;
+        for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+            norms[c] += row[c] * row[c];
+        }
+    }
+}
+
+/**
+ * Nearest centroid of one subspace to x: argmin |c|^2 - 2 c.x
+ */
+static uint8_t nearest_centroid(const float *codebook, const float *norms, size_t sub_dim,
+                                const float *x) {
+    // Codebooks are stored transposed ([sub_dim][PQ_NUM_CENTROIDS]) so all
+    // centroids are scored in one vectorized pass
+    float dots[PQ_NUM_CENTROIDS];
+    matvec_t_f32(codebook, PQ_NUM_CENTROIDS, sub_dim, x, dots);
+
+    float best = FLT_MAX;
+    size_t best_c = 0;
+    for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+        float d = norms[c] - 2.0f * dots[c];
+        if (d < best) {
+            best = d;
+            best_c = c;
+        }
+    }
+    return (uint8_t)best_c;
+}
+
+/**
+ * Encode one unit vector; norms holds |c|^2 for every centroid of every subspace
+ */
+static void encode_vector(const PQIndex *index, const float *norms, const float *unit, uint8_t *code) {
+    for (size_t m = 0; m < index->num_subspaces; m++) {
+        code[m] = nearest_centroid(index->centroids + m * PQ_NUM_CENTROIDS * index->sub_dim,
+                                   norms + m * PQ_NUM_CENTROIDS, index->sub_dim,
+                                   unit + m * index->sub_dim);
+    }
+}
+
+static float* centroid_norms(const PQIndex *index) {
+    float *norms = (float*)malloc(index->num_subspaces * PQ_NUM_CENTROIDS * sizeof(float));
+    if (norms) {
+        for (size_t m = 0; m < index->num_subspaces; m++) {
+            centroid_norms_of(index->centroids + m * PQ_NUM_CENTROIDS * index->sub_dim,
+                              index->sub_dim, norms + m * PQ_NUM_CENTROIDS);
+        }
+    }
+    return norms;
+}
+
+/**
+ * Lloyd's k-means on one subspace; samples are n contiguous sub_dim slices
+ * and the codebook is written transposed
+ */
+static int train_subspace(const float *samples, size_t n, size_t sub_dim,
+                          float *codebook, uint64_t *rng) {
+    uint8_t *assign = (uint8_t*)malloc(n);
+    double *sums = (double*)malloc(PQ_NUM_CENTROIDS * sub_dim * sizeof(double));
+    size_t *counts = (size_t*)malloc(PQ_NUM_CENTROIDS * sizeof(size_t));
+    if (!assign || !sums || !counts) {
+        free(assign);
+        free(sums);
+        free(counts);
+        return -1;
+    }
+
+    // Seed from random samples (cycling when there are fewer samples than centroids)
+    for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+        size_t pick = n >= PQ_NUM_CENTROIDS ? next_random(rng) % n : c % n;
+        for (size_t d = 0; d < sub_dim; d++) {
+            codebook[d * PQ_NUM_CENTROIDS + c] = samples[pick * sub_dim + d];
+        }
+    }
+
+    float norms[PQ_NUM_CENTROIDS];
+    for (int iter = 0; iter < PQ_TRAIN_ITERATIONS; iter++) {
+        memset(sums, 0, PQ_NUM_CENTROIDS * sub_dim * sizeof(double));
+        memset(counts, 0, PQ_NUM_CENTROIDS * sizeof(size_t));
+        centroid_norms_of(codebook, sub_dim, norms);
+
+        size_t changed = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint8_t c = nearest_centroid(codebook, norms, sub_dim, samples + i * sub_dim);
+            changed += iter == 0 || c != assign[i];
+            assign[i] = c;
+            counts[c]++;
+            for (size_t d = 0; d < sub_dim; d++) {
+                sums[c * sub_dim + d] += samples[i * sub_dim + d];
+            }
+        }
+
+        for (size_t c = 0; c < PQ_NUM_CENTROIDS; c++) {
+            // Re-seed empty clusters so every code value stays useful
+            const float *reseed = counts[c] == 0 ? samples + (next_random(rng) % n) * sub_dim : NULL;
+            for (size_t d = 0; d < sub_dim; d++) {
+                codebook[d * PQ_NUM_CENTROIDS + c] = reseed ? reseed[d] :
+                    (float)(sums[c * sub_dim + d] / (double)counts[c]);
+            }
+        }
+
+        if (changed == 0) {
+            break;
+        }
+    }
+
+    free(assign);
+    free(sums);
+    free(counts);
+    return 0;
+}
+
+/* ---- Username map ---- */
+
+/**
+ * FNV-1a hash of a username
+ */
+static uint32_t hash_username(const char *username) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)username; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t map_find_slot(const PQIndex *index, const char *username) {
+    size_t mask = index->map_slots - 1;
+    size_t pos = hash_username(username) & mask;
+
+    for (size_t probes = 0; probes < index->map_slots; probes++) {
+        uint32_t slot = index->map[pos];
+        if (slot == MAP_EMPTY) {
+            return SIZE_MAX;
+        }
+        if (slot != MAP_TOMBSTONE && strncmp(index->usernames[slot - 1], username, 64) == 0) {
+            return pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return SIZE_MAX;
+}
+
+/**
+ * Point the map at every row, dropping tombstones
+ */
+static int map_rebuild(PQIndex *index, size_t slots) {
+    uint32_t *map = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    if (!map) {
+        return -1;
+    }
+    free(index->map);
+    index->map = map;
+    index->map_slots = slots;
+    index->map_used = index->num_templates;
+
+    size_t mask = slots - 1;
+    for (size_t row = 0; row < index->num_templates; row++) {
+        size_t pos = hash_username(index->usernames[row]) & mask;
+        while (map[pos] != MAP_EMPTY) {
+            pos = (pos + 1) & mask;
+        }
+        map[pos] = (uint32_t)row + 1;
+    }
+    return 0;
+}
+
+/**
+ * Map a new row's username; the row must already be counted in num_templates
+ */
+static int map_insert(PQIndex *index, size_t row) {
+    if ((index->map_used + 1) * 4 > index->map_slots * 3) {
+        size_t slots = index->map_slots;
+        while (index->num_templates * 4 > slots * 3) slots *= 2;
+        return map_rebuild(index, slots);
+    }
+
+    size_t mask = index->map_slots - 1;
+    size_t pos = hash_username(index->usernames[row]) & mask;
+    while (index->map[pos] != MAP_EMPTY && index->map[pos] != MAP_TOMBSTONE) {
+        pos = (pos + 1) & mask;
+    }
+    if (index->map[pos] == MAP_EMPTY) {
+        index->map_used++;
+    }
+    index->map[pos] = (uint32_t)row + 1;
+    return 0;
+}
+
+/* ---- Storage ---- */
+
+static int ensure_capacity(PQIndex *index, size_t needed) {
+    if (needed <= index->capacity) {
+        return 0;
+    }
+
+    size_t capacity = index->capacity ? index->capacity : 1024;
+    while (capacity < needed) capacity *= 2;
+
+    uint8_t *codes = (uint8_t*)realloc(index->codes, capacity * index->num_subspaces);
+    if (!codes) {
+        return -1;
+    }
+    index->codes = codes;
+
+    void *usernames = realloc(index->usernames, capacity * sizeof(*index->usernames));
+    if (!usernames) {
+        return -1;
+    }
+    index->usernames = usernames;
+
+    index->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Allocate an empty index with room for the codebooks
+ */
+static PQIndex* pq_alloc(size_t dim, size_t num_subspaces, size_t capacity) {
+    if (num_subspaces == 0 || num_subspaces > PQ_MAX_SUBSPACES || dim % num_subspaces != 0) {
+        log_message(NL_LOG_ERROR, "PQ subspaces (%zu) must divide feature size (%zu)", num_subspaces, dim);
+        return NULL;
+    }
+
+    PQIndex *index = (PQIndex*)calloc(1, sizeof(PQIndex));
+    if (!index) {
+        log_message(NL_LOG_ERROR, "Failed to allocate PQIndex structure");
+        return NULL;
+    }
+
+    index->dim = dim;
+    index->num_subspaces = num_subspaces;
+    index->sub_dim = dim / num_subspaces;
+    index->centroids = (float*)calloc(num_subspaces * PQ_NUM_CENTROIDS * index->sub_dim, sizeof(float));
+    index->map_slots = 1024;
+    while (capacity * 4 > index->map_slots * 3) index->map_slots *= 2;
+    index->map = (uint32_t*)calloc(index->map_slots, sizeof(uint32_t));
+    if (!index->centroids || !index->map || ensure_capacity(index, capacity > 0 ? capacity : 1) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to allocate PQ index");
+        pq_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+/**
+ * Train codebooks on a template matrix and encode every row
+ */
+PQIndex* pq_train(const TemplateMatrix *matrix, size_t num_subspaces) {
+    if (!matrix || !matrix->matrix || matrix->num_templates == 0) {
+        log_message(NL_LOG_ERROR, "No float templates to train PQ codebooks on");
+        return NULL;
+    }
+
+    PQIndex *index = pq_alloc(matrix->dim, num_subspaces, matrix->num_templates);
+    if (!index) {
+        return NULL;
+    }
+
+    size_t n = matrix->num_templates < PQ_TRAIN_SAMPLES ? matrix->num_templates : PQ_TRAIN_SAMPLES;
+    size_t sub_dim = index->sub_dim;
+    size_t *rows = (size_t*)malloc(n * sizeof(size_t));
+    float *samples = (float*)malloc(n * sub_dim * sizeof(float));
+    if (!rows || !samples) {
+        free(rows);
+        free(samples);
+        pq_free(index);
+        return NULL;
+    }
+
+    // Evenly strided sample of rows
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < n; i++) {
+        rows[i] = i * matrix->num_templates / n;
+    }
+
+    int failed = 0;
+    for (size_t m = 0; m < num_subspaces && !failed; m++) {
+        for (size_t i = 0; i < n; i++) {
+            memcpy(samples + i * sub_dim, matrix->matrix + rows[i] * matrix->stride + m * sub_dim,
+                   sub_dim * sizeof(float));
+        }
+        failed = train_subspace(samples, n, sub_dim,
+                                index->centroids + m * PQ_NUM_CENTROIDS * sub_dim, &rng) != 0;
+    }
+
+    secure_wipe(samples, n * sub_dim * sizeof(float));
+    free(samples);
+    free(rows);
+    if (failed) {
+        pq_free(index);
+        return NULL;
+    }
+
+    float *norms = centroid_norms(index);
+    if (!norms) {
+        pq_free(index);
+        return NULL;
+    }
+
+    // Matrix rows are already unit norm, so encode them directly
+    for (size_t r = 0; r < matrix->num_templates; r++) {
+        encode_vector(index, norms, matrix->matrix + r * matrix->stride, index->codes + r * num_subspaces);
+        memcpy(index->usernames[r], matrix->usernames[r], sizeof(index->usernames[r]));
+    }
+    free(norms);
+    index->num_templates = matrix->num_templates;
+    if (map_rebuild(index, index->map_slots) != 0) {
+        pq_free(index);
+        return NULL;
+    }
+
+    log_message(NL_LOG_INFO, "Trained PQ codebooks on %zu templates (%zu byte codes)", n, num_subspaces);
+    return index;
+}
+
+/**
+ * Free a PQ index
+ */
+void pq_free(PQIndex *index) {
+    if (index) {
+        if (index->centroids) {
+            secure_wipe(index->centroids,
+                        index->num_subspaces * PQ_NUM_CENTROIDS * index->sub_dim * sizeof(float));
+            free(index->centroids);
+        }
+        if (index->codes) {
+            secure_wipe(index->codes, index->num_templates * index->num_subspaces);
+            free(index->codes);
+        }
+        free(index->usernames);
+        free(index->map);
+        free(index);
+    }
+}
+
+/**
+ * Encode a feature vector with the trained codebooks
+ */
+int pq_encode(const PQIndex *index, const float *features, uint8_t *code) {
+    if (!index || !features || !code) {
+        return -1;
+    }
+
+    float unit[index->dim];
+    if (vector_normalize(features, unit, index->dim) < 1e-6f) {
+        log_message(NL_LOG_ERROR, "Refusing to encode zero magnitude vector");
+        return -1;
+    }
+
+    float *norms = centroid_norms(index);
+    if (!norms) {
+        secure_wipe(unit, sizeof(unit));
+        return -1;
+    }
+    encode_vector(index, norms, unit, code);
+
+    free(norms);
+    secure_wipe(unit, sizeof(unit));
+    return 0;
+}
+
+/**
+ * Encode and add (or replace) a user's template
+ */
+int pq_add(PQIndex *index, const char *username, const float *features) {
+    if (!index || !username || !features || username[0] == '\0') {
+        log_message(NL_LOG_ERROR, "Invalid input for PQ add");
+        return -1;
+    }
+
+    size_t slot = map_find_slot(index, username);
+    size_t row = slot == SIZE_MAX ? index->num_templates : index->map[slot] - 1;
+    if (slot == SIZE_MAX) {
+        if (index->num_templates >= UINT32_MAX - 1 || ensure_capacity(index, index->num_templates + 1) != 0) {
+            log_message(NL_LOG_ERROR, "Failed to grow PQ index");
+            return -1;
+        }
+    }
+
+    if (pq_encode(index, features, index->codes + row * index->num_subspaces) != 0) {
+        return -1;
+    }
+
+    if (slot == SIZE_MAX) {
+        memset(index->usernames[row], 0, sizeof(index->usernames[row]));
+        strncpy(index->usernames[row], username, sizeof(index->usernames[row]) - 1);
+        index->num_templates++;
+        if (map_insert(index, row) != 0) {
+            log_message(NL_LOG_ERROR, "Failed to grow PQ username map");
+            index->num_templates--;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Remove a user's code
+ */
+int pq_remove(PQIndex *index, const char *username) {
+    if (!index || !username) {
+        return -1;
+    }
+
+    size_t slot = map_find_slot(index, username);
+    if (slot == SIZE_MAX) {
+        return -1;
+    }
+    size_t row = index->map[slot] - 1;
+    index->map[slot] = MAP_TOMBSTONE;
+
+    // Move the last code into the hole
+    size_t last = --index->num_templates;
+    if (row != last) {
+        memcpy(index->codes + row * index->num_subspaces, index->codes + last * index->num_subspaces,
+               index->num_subspaces);
+        memcpy(index->usernames[row], index->usernames[last], sizeof(index->usernames[row]));
+        index->map[map_find_slot(index, index->usernames[row])] = (uint32_t)row + 1;
+    }
+    secure_wipe(index->codes + last * index->num_subspaces, index->num_subspaces);
+    return 0;
+}
+
+/**
+ * Score a block of codes against the per-query lookup table
+ * Four codes are summed together so the table reads overlap.
+ */
+static void adc_scan(const float *lut, size_t num_subspaces, const uint8_t *codes,
+                     size_t n, float *scores) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const uint8_t *c0 = codes + i * num_subspaces;
+        const uint8_t *c1 = c0 + num_subspaces;
+        const uint8_t *c2 = c1 + num_subspaces;
+        const uint8_t *c3 = c2 + num_subspaces;
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        for (size_t m = 0; m < num_subspaces; m++) {
+            const float *table = lut + m * PQ_NUM_CENTROIDS;
+            s0 += table[c0[m]];
+            s1 += table[c1[m]];
+            s2 += table[c2[m]];
+            s3 += table[c3[m]];
+        }
+        scores[i] = s0;
+        scores[i + 1] = s1;
+        scores[i + 2] = s2;
+        scores[i + 3] = s3;
+    }
+    for (; i < n; i++) {
+        const uint8_t *c = codes + i * num_subspaces;
+        float s = 0.0f;
+        for (size_t m = 0; m < num_subspaces; m++) {
+            s += lut[m * PQ_NUM_CENTROIDS + c[m]];
+        }
+        scores[i] = s;
+    }
+}
+
+static void heap_sift_down(HeapItem *heap, size_t n, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t l = 2 * i + 1;
+        size_t r = l + 1;
+        if (l < n && heap[l].score < heap[smallest].score) smallest = l;
+        if (r < n && heap[r].score < heap[smallest].score) smallest = r;
+        if (smallest == i) return;
+        HeapItem tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static int compare_matches(const void *a, const void *b) {
+    float sa = ((const HeapItem*)a)->score;
+    float sb = ((const HeapItem*)b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * Find the k codes with the highest approximate similarity to a probe
+ */
+int pq_search(const PQIndex *index, const FeatureVector *probe, size_t k,
+              IdentifyMatch *matches, size_t *num_matches) {
+    if (!index || !probe || !probe->features || !matches || !num_matches || k == 0) {
+        log_message(NL_LOG_ERROR, "Invalid input for PQ search");
+        return -1;
+    }
+
+    if (probe->size != index->dim) {
+        log_message(NL_LOG_ERROR, "Probe has %zu features, index has %zu", probe->size, index->dim);
+        return -1;
+    }
+
+    *num_matches = 0;
+    if (index->num_templates == 0) {
+        return 0;
+    }
+    if (k > index->num_templates) {
+        k = index->num_templates;
+    }
+
+    float unit[index->dim];
+    if (vector_normalize(probe->features, unit, index->dim) < 1e-6f) {
+        log_message(NL_LOG_ERROR, "Zero magnitude probe");
+        return -1;
+    }
+
+    // Per-query table: dot product of each probe slice with every centroid
+    size_t M = index->num_subspaces;
+    float *lut = (float*)aligned_alloc(64, M * PQ_NUM_CENTROIDS * sizeof(float));
+    HeapItem *heap = (HeapItem*)malloc(k * sizeof(HeapItem));
+    if (!lut || !heap) {
+        free(lut);
+        free(heap);
+        return -1;
+    }
+    for (size_t m = 0; m < M; m++) {
+        matvec_t_f32(index->centroids + m * PQ_NUM_CENTROIDS * index->sub_dim, PQ_NUM_CENTROIDS,
+                     index->sub_dim, unit + m * index->sub_dim, lut + m * PQ_NUM_CENTROIDS);
+    }
+
+    float scores[PQ_BLOCK_ROWS];
+    size_t count = 0;
+    for (size_t block = 0; block < index->num_templates; block += PQ_BLOCK_ROWS) {
+        size_t n = index->num_templates - block;
+        if (n > PQ_BLOCK_ROWS) n = PQ_BLOCK_ROWS;
+
+        adc_scan(lut, M, index->codes + block * M, n, scores);
+
+        for (size_t i = 0; i < n; i++) {
+            if (count < k) {
+                heap[count].score = scores[i];
+                heap[count].index = block + i;
+                count++;
+                if (count == k) {
+                    for (size_t j = k / 2; j-- > 0;) heap_sift_down(heap, k, j);
+                }
+            } else if (scores[i] > heap[0].score) {
+                heap[0].score = scores[i];
+                heap[0].index = block + i;
+                heap_sift_down(heap, k, 0);
+            }
+        }
+    }
+
+    qsort(heap, count, sizeof(HeapItem), compare_matches);
+    for (size_t i = 0; i < count; i++) {
+        float similarity = heap[i].score;
+        if (similarity < 0.0f) similarity = 0.0f;
+        if (similarity > 1.0f) similarity = 1.0f;
+
+        memcpy(matches[i].username, index->usernames[heap[i].index], sizeof(matches[i].username));
+        matches[i].similarity = similarity;
+        matches[i].index = heap[i].index;
+    }
+    *num_matches = count;
+
+    secure_wipe(unit, sizeof(unit));
+    secure_wipe(lut, M * PQ_NUM_CENTROIDS * sizeof(float));
+    free(lut);
+    free(heap);
+    return 0;
+}
+
+/*
+ * File layout (little-endian):
+ *   header (64 bytes): magic, version, dim, num_subspaces, centroids per
+ *                      subspace, num_templates
+ *   centroids: f32[num_subspaces][sub_dim][PQ_NUM_CENTROIDS] (transposed)
+ *   per template: username[64], code[num_subspaces]
+ */
+
+/**
+ * Write codebooks and codes to a file (temp file + rename)
+ */
+int pq_save(const PQIndex *index, const char *path) {
+    if (!index || !path) {
+        return -1;
+    }
+
+    char tmp_path[520];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        log_message(NL_LOG_ERROR, "PQ index path too long: %s", path);
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!file) {
+        if (fd >= 0) close(fd);
+        log_message(NL_LOG_ERROR, "Failed to create PQ index file: %s", tmp_path);
+        return -1;
+    }
+
+    uint8_t header[PQ_FILE_HEADER_SIZE] = {0};
+    store_le32(header + 0, PQ_FILE_MAGIC);
+    store_le32(header + 4, PQ_FILE_VERSION);
+    store_le32(header + 8, (uint32_t)index->dim);
+    store_le32(header + 12, (uint32_t)index->num_subspaces);
+    store_le32(header + 16, PQ_NUM_CENTROIDS);
+    store_le64(header + 20, index->num_templates);
+    int failed = fwrite(header, sizeof(header), 1, file) != 1;
+
+    size_t num_centroid_floats = index->num_subspaces * PQ_NUM_CENTROIDS * index->sub_dim;
+    for (size_t i = 0; i < num_centroid_floats && !failed; i++) {
+        uint8_t le[4];
+        store_le_f32(le, index->centroids[i]);
+        failed = fwrite(le, sizeof(le), 1, file) != 1;
+    }
+    for (size_t i = 0; i < index->num_templates && !failed; i++) {
+        failed = fwrite(index->usernames[i], sizeof(index->usernames[i]), 1, file) != 1 ||
+                 fwrite(index->codes + i * index->num_subspaces, index->num_subspaces, 1, file) != 1;
+    }
+
+    failed = failed || fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed = fclose(file) != 0 || failed;
+    if (failed || rename(tmp_path, path) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to write PQ index: %s", path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Read an index written by pq_save
+ */
+PQIndex* pq_load(const char *path) {
+    if (!path) {
+        return NULL;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        log_message(NL_LOG_ERROR, "Failed to open PQ index file: %s", path);
+        return NULL;
+    }
+
+    uint8_t header[PQ_FILE_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+        load_le32(header) != PQ_FILE_MAGIC || load_le32(header + 4) != PQ_FILE_VERSION ||
+        load_le32(header + 16) != PQ_NUM_CENTROIDS) {
+        log_message(NL_LOG_ERROR, "Not a NeuroLock PQ index: %s", path);
+        fclose(file);
+        return NULL;
+    }
+
+    uint64_t count = load_le64(header + 20);
+    PQIndex *index = count <= UINT32_MAX ?
+        pq_alloc(load_le32(header + 8), load_le32(header + 12), (size_t)count) : NULL;
+    if (!index) {
+        fclose(file);
+        return NULL;
+    }
+
+    int failed = 0;
+    size_t num_centroid_floats = index->num_subspaces * PQ_NUM_CENTROIDS * index->sub_dim;
+    for (size_t i = 0; i < num_centroid_floats && !failed; i++) {
+        uint8_t le[4];
+        failed = fread(le, sizeof(le), 1, file) != 1;
+        index->centroids[i] = load_le_f32(le);
+    }
+    for (size_t i = 0; i < count && !failed; i++) {
+        failed = fread(index->usernames[i], sizeof(index->usernames[i]), 1, file) != 1 ||
+                 fread(index->codes + i * index->num_subspaces, index->num_subspaces, 1, file) != 1;
+        index->usernames[i][63] = '\0';
+    }
+    fclose(file);
+
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Truncated PQ index file: %s", path);
+        pq_free(index);
+        return NULL;
+    }
+
+    // Rows are mapped one by one so a username stored twice is caught
+    for (size_t i = 0; i < count && !failed; i++) {
+        failed = map_find_slot(index, index->usernames[i]) != SIZE_MAX;
+        index->num_templates = i + 1;
+        failed = failed || map_insert(index, i) != 0;
+    }
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Corrupt PQ index file: %s", path);
+        pq_free(index);
+        return NULL;
+    }
+    return index;
+}
@@ -0,0 +1,428 @@
+#define _DEFAULT_SOURCE
+#include "protocol.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+/* Samples in one trial of a capture */
+#define NLD_TRIAL_SAMPLES ((size_t)SAMPLING_RATE * CAPTURE_DURATION)
+
+/** Client request identifiers; only used to pair replies with requests */
+static uint32_t next_request_id = 1;
+
+/**
+ * Write a header and payload, resuming after partial writes
+ */
+static int send_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)count;
+
+        ssize_t written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        // Drop what was written from the front of the vector
+        size_t left = (size_t)written;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Read exactly size bytes
+ * Returns: 0 on success, 1 on end of stream before any byte, negative on error
+ */
+static int recv_all(int fd, uint8_t *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = recv(fd, buffer + done, size - done, 0);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (got == 0) {
+            return done == 0 ? 1 : -1;
+        }
+        done += (size_t)got;
+    }
+    return 0;
+}
+
+/**
+ * Send one frame
+ */
+int nld_send_frame(int fd, uint32_t magic, uint16_t code, uint32_t request_id,
+                   const uint8_t *payload, size_t payload_size) {
+    if (fd < 0 || (payload_size > 0 && !payload) || payload_size > UINT32_MAX) {
+        return -1;
+    }
+
+    uint8_t header[NLD_HEADER_SIZE];
+    store_le32(header, magic);
+    store_le16(header + 4, NLD_PROTOCOL_VERSION);
+    store_le16(header + 6, code);
+    store_le32(header + 8, (uint32_t)payload_size);
+    store_le32(header + 12, request_id);
+
+    struct iovec iov[2] = {
+        { header, sizeof(header) },
+        { (void*)payload, payload_size }
+    };
+    return send_all(fd, iov, payload_size > 0 ? 2 : 1);
+}
+
+/**
+ * Receive one frame
+ */
+int nld_recv_frame(int fd, uint32_t magic, NldHeader *header, uint8_t *payload, size_t capacity) {
+    if (fd < 0 || !header) {
+        return -1;
+    }
+
+    uint8_t raw[NLD_HEADER_SIZE];
+    int status = recv_all(fd, raw, sizeof(raw));
+    if (status != 0) {
+        return status;
+    }
+
+    if (load_le32(raw) != magic || load_le16(raw + 4) != NLD_PROTOCOL_VERSION) {
+        log_message(NL_LOG_WARNING, "Dropping connection: bad frame header");
+        return -1;
+    }
+    header->code = load_le16(raw + 6);
+    header->payload_size = load_le32(raw + 8);
+    header->request_id = load_le32(raw + 12);
+
+    if (header->payload_size > capacity || (header->payload_size > 0 && !payload)) {
+        log_message(NL_LOG_WARNING, "Dropping connection: %u-byte frame exceeds %zu",
+                    header->payload_size, capacity);
+        return -1;
+    }
+    return header->payload_size > 0 && recv_all(fd, payload, header->payload_size) != 0 ? -1 : 0;
+}
+
+/**
+ * Validate and decode a request payload
+ */
+int nld_parse_request(const NldHeader *header, const uint8_t *payload, NldRequest *request) {
+    if (!header || !request) {
+        return -1;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->opcode = (NldOpcode)header->code;
+    request->request_id = header->request_id;
+
+    size_t size = header->payload_size;
+    size_t offset = 0;
+    int has_user, has_capture;
+    switch (header->code) {
+        case NLD_OP_PING:
+            return size == 0 ? 0 : -1;
+        case NLD_OP_ENROLL:
+        case NLD_OP_VERIFY:
+            has_user = 1;
+            has_capture = 1;
+            break;
+        case NLD_OP_IDENTIFY:
+            has_user = 0;
+            has_capture = 1;
+            break;
+        case NLD_OP_DELETE:
+            has_user = 1;
+            has_capture = 0;
+            break;
+        default:
+            return -1;
+    }
+
+    if (has_user) {
+        if (size < NLD_USERNAME_SIZE || payload[0] == '\0' ||
+            memchr(payload, '\0', NLD_USERNAME_SIZE) == NULL) {
+            return -1;
+        }
+        memcpy(request->username, payload, NLD_USERNAME_SIZE);
+        offset = NLD_USERNAME_SIZE;
+    }
+
+    if (!has_capture) {
+        return size == offset ? 0 : -1;
+    }
+
+    if (size - offset < NLD_CAPTURE_HEADER_SIZE) {
+        return -1;
+    }
+    const uint8_t *capture = payload + offset;
+    uint32_t task = load_le32(capture);
+    uint32_t channels = load_le32(capture + 4);
+    uint32_t samples = load_le32(capture + 8);
+    uint32_t trials = load_le32(capture + 12);
+    size_t max_trials = header->code == NLD_OP_ENROLL ? NLD_MAX_TRIALS : 1;
+
+    if (task > TASK_VISUAL_IMAGERY || channels != NUM_CHANNELS || samples != NLD_TRIAL_SAMPLES ||
+        trials == 0 || trials > max_trials ||
+        size - offset - NLD_CAPTURE_HEADER_SIZE != (size_t)trials * NLD_TRIAL_BYTES) {
+        return -1;
+    }
+
+    request->task = (MentalTask)task;
+    request->trials = trials;
+    request->samples = capture + NLD_CAPTURE_HEADER_SIZE;
+    return 0;
+}
+
+/**
+ * Copy one trial of a decoded capture into EEG data
+ */
+int nld_load_trial(const NldRequest *request, size_t trial, EEGData *output) {
+    if (!request || !output || !output->data || trial >= request->trials ||
+        output->num_channels != NUM_CHANNELS || output->num_samples != NLD_TRIAL_SAMPLES) {
+        return -1;
+    }
+
+    const uint8_t *src = request->samples + trial * NLD_TRIAL_BYTES;
+    for (size_t i = 0; i < NUM_CHANNELS * NLD_TRIAL_SAMPLES; i++) {
+        output->data[i] = load_le_f32(src + 4 * i);
+    }
+    output->sampling_rate = SAMPLING_RATE;
+    output->task_type = request->task;
+    output->timestamp = get_timestamp_ms();
+    return 0;
+}
+
+/**
+ * Connect to a daemon
+ */
+int nld_connect(const char *socket_path, uint32_t timeout_ms) {
+    struct sockaddr_un addr;
+    if (!socket_path || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        log_message(NL_LOG_ERROR, "Invalid daemon socket path");
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to create socket");
+        return -1;
+    }
+
+    struct timeval timeout = { (time_t)(timeout_ms / 1000), (suseconds_t)(timeout_ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to connect to daemon: %s", socket_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Send a request and wait for its reply
+ * Returns: NldStatus, negative on transport error
+ */
+static int call(int fd, NldOpcode opcode, const uint8_t *payload, size_t payload_size,
+                uint8_t *reply, size_t reply_capacity, size_t *reply_size) {
+    uint32_t id = __atomic_fetch_add(&next_request_id, 1, __ATOMIC_RELAXED);
+    if (nld_send_frame(fd, NLD_REQUEST_MAGIC, (uint16_t)opcode, id, payload, payload_size) != 0) {
+        return -1;
+    }
+
+    NldHeader header;
+    if (nld_recv_frame(fd, NLD_RESPONSE_MAGIC, &header, reply, reply_capacity) != 0 ||
+        header.request_id != id) {
+        return -1;
+    }
+    if (reply_size) {
+        *reply_size = header.payload_size;
+    }
+    return header.code;
+}
+
+/**
+ * Encode a username field; returns negative if it does not fit
+ */
+static int store_username(uint8_t *dst, const char *username) {
+    if (!username || username[0] == '\0' || strlen(username) >= NLD_USERNAME_SIZE) {
+        return -1;
+    }
+    memset(dst, 0, NLD_USERNAME_SIZE);
+    memcpy(dst, username, strlen(username));
+    return 0;
+}
+
+/**
+ * Encode a capture of equally sized trials
+ */
+static int store_capture(uint8_t *dst, const EEGData **trials, size_t num_trials, MentalTask task) {
+    store_le32(dst, (uint32_t)task);
+    store_le32(dst + 4, NUM_CHANNELS);
+    store_le32(dst + 8, (uint32_t)NLD_TRIAL_SAMPLES);
+    store_le32(dst + 12, (uint32_t)num_trials);
+    dst += NLD_CAPTURE_HEADER_SIZE;
+
+    for (size_t t = 0; t < num_trials; t++) {
+        const EEGData *trial = trials[t];
+        if (!trial || !trial->data || trial->num_channels != NUM_CHANNELS ||
+            trial->num_samples != NLD_TRIAL_SAMPLES) {
+            log_message(NL_LOG_ERROR, "Trial %zu does not match the daemon capture format", t);
+            return -1;
+        }
+        for (size_t i = 0; i < NUM_CHANNELS * NLD_TRIAL_SAMPLES; i++) {
+            store_le_f32(dst + 4 * i, trial->data[i]);
+        }
+        dst += NLD_TRIAL_BYTES;
+    }
+    return 0;
+}
+
+/**
+ * Check that the daemon answers
+ */
+int nld_ping(int fd) {
+    return call(fd, NLD_OP_PING, NULL, 0, NULL, 0, NULL);
+}
+
+/**
+ * Enrol a user from captured trials
+ */
+int nld_enroll(int fd, const char *username, const EEGData **trials, size_t num_trials, MentalTask task) {
+    if (!trials || num_trials == 0 || num_trials > NLD_MAX_TRIALS) {
+        return -1;
+    }
+
+    size_t size = NLD_USERNAME_SIZE + NLD_CAPTURE_HEADER_SIZE + num_trials * NLD_TRIAL_BYTES;
+    uint8_t *payload = (uint8_t*)malloc(size);
+    if (!payload || store_username(payload, username) != 0 ||
+        store_capture(payload + NLD_USERNAME_SIZE, trials, num_trials, task) != 0) {
+        free(payload);
+        return -1;
+    }
+
+    int status = call(fd, NLD_OP_ENROLL, payload, size, NULL, 0, NULL);
+    free(payload);
+    return status;
+}
+
+/**
+ * Verify a claimed identity
+ */
+int nld_verify(int fd, const char *username, const EEGData *trial, NldVerifyReply *reply) {
+    if (!trial || !reply) {
+        return -1;
+    }
+
+    size_t size = NLD_USERNAME_SIZE + NLD_CAPTURE_HEADER_SIZE + NLD_TRIAL_BYTES;
+    uint8_t *payload = (uint8_t*)malloc(size);
+    if (!payload || store_username(payload, username) != 0 ||
+        store_capture(payload + NLD_USERNAME_SIZE, &trial, 1, trial->task_type) != 0) {
+        free(payload);
+        return -1;
+    }
+
+    uint8_t out[NLD_VERIFY_REPLY_SIZE];
+    size_t out_size = 0;
+    int status = call(fd, NLD_OP_VERIFY, payload, size, out, sizeof(out), &out_size);
+    free(payload);
+
+    if (status == NLD_STATUS_OK || status == NLD_STATUS_REJECTED) {
+        if (out_size != NLD_VERIFY_REPLY_SIZE) {
+            return -1;
+        }
+        reply->authenticated = load_le32(out) != 0;
+        reply->matcher = load_le32(out + 4);
+        reply->attempts = load_le32(out + 8);
+        reply->similarity = load_le_f32(out + 12);
+        reply->score = load_le_f32(out + 16);
+        reply->threshold = load_le_f32(out + 20);
+        reply->retry_ms = 0;
+    } else if (status == NLD_STATUS_LOCKED) {
+        if (out_size != NLD_LOCKED_REPLY_SIZE) {
+            return -1;
+        }
+        memset(reply, 0, sizeof(*reply));
+        reply->retry_ms = load_le32(out);
+    }
+    return status;
+}
+
+/**
+ * Identify the wearer among enrolled users
+ */
+int nld_identify(int fd, const EEGData *trial, IdentifyMatch *matches, size_t max_matches,
+                 size_t *num_matches) {
+    if (!trial || !matches || !num_matches) {
+        return -1;
+    }
+
+    size_t size = NLD_CAPTURE_HEADER_SIZE + NLD_TRIAL_BYTES;
+    size_t capacity = 4 + (size_t)IDENTIFY_TOP_K * NLD_MATCH_SIZE;
+    uint8_t *payload = (uint8_t*)malloc(size);
+    uint8_t *out = (uint8_t*)malloc(capacity);
+    if (!payload || !out || store_capture(payload, &trial, 1, trial->task_type) != 0) {
+        free(payload);
+        free(out);
+        return -1;
+    }
+
+    size_t out_size = 0;
+    int status = call(fd, NLD_OP_IDENTIFY, payload, size, out, capacity, &out_size);
+    free(payload);
+
+    *num_matches = 0;
+    if (status == NLD_STATUS_OK) {
+        uint32_t count = out_size >= 4 ? load_le32(out) : 0;
+        if (out_size < 4 || out_size != 4 + (size_t)count * NLD_MATCH_SIZE) {
+            free(out);
+            return -1;
+        }
+        for (size_t i = 0; i < count && i < max_matches; i++) {
+            const uint8_t *match = out + 4 + i * NLD_MATCH_SIZE;
+            memcpy(matches[i].username, match, NLD_USERNAME_SIZE);
+            matches[i].username[NLD_USERNAME_SIZE - 1] = '\0';
+            matches[i].similarity = load_le_f32(match + NLD_USERNAME_SIZE);
+            matches[i].index = i;
+            (*num_matches)++;
+        }
+    }
+    free(out);
+    return status;
+}
+
+/**
+ * Delete a user's template
+ */
+int nld_delete(int fd, const char *username) {
+    uint8_t payload[NLD_USERNAME_SIZE];
+    if (store_username(payload, username) != 0) {
+        return -1;
+    }
+    return call(fd, NLD_OP_DELETE, payload, sizeof(payload), NULL, 0, NULL);
+}
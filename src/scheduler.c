@@ -0,0 +1,443 @@
+#define _DEFAULT_SOURCE
+#include "scheduler.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if (SCHEDULER_DEQUE_SIZE & (SCHEDULER_DEQUE_SIZE - 1)) != 0 || SCHEDULER_DEQUE_SIZE < 2
+#error "SCHEDULER_DEQUE_SIZE must be a power of two"
+#endif
+
+/* Empty sweeps over the queues before an idle worker goes to sleep */
+#define SCHEDULER_SPIN_ROUNDS 64
+
+/* A waiter with nothing to run re-checks the queues this often */
+#define SCHEDULER_WAIT_POLL_NS 1000000L
+
+/* One queued task */
+typedef struct Job {
+    TaskFunc func;
+    void *arg;
+    TaskGroup *group;
+    struct Job *next;               // Injection queue link
+} Job;
+
+/*
+ * Bounded Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+ * The owner pushes and takes at bottom, thieves take at top.
+ */
+typedef struct {
+    _Alignas(64) int64_t top;
+    _Alignas(64) int64_t bottom;
+    _Alignas(64) Job *slots[SCHEDULER_DEQUE_SIZE];
+} Deque;
+
+typedef struct {
+    Deque deque;
+    Scheduler *sched;
+    uint32_t seed;                  // Victim selection
+    pthread_t thread;
+    int running;
+} Worker;
+
+struct Scheduler {
+    Worker *workers;
+    size_t num_workers;
+    pthread_mutex_t inject_lock;
+    Job *inject_head;               // Tasks from outside the workers, FIFO
+    Job *inject_tail;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    size_t queued;                  // Tasks queued anywhere and not yet taken
+    size_t sleepers;
+    int stopping;
+};
+
+struct TaskGroup {
+    Scheduler *sched;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    size_t outstanding;             // Spawned and not yet finished
+    int cancelled;
+};
+
+/* Worker running on this thread, NULL for other threads */
+static _Thread_local Worker *current_worker = NULL;
+
+static Scheduler *shared_scheduler = NULL;
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+
+static int deque_push(Deque *dq, Job *job) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if (b - t >= SCHEDULER_DEQUE_SIZE) {
+        return -1;
+    }
+    __atomic_store_n(&dq->slots[b & (SCHEDULER_DEQUE_SIZE - 1)], job, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static Job* deque_take(Deque *dq) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    Job *job = NULL;
+    if (t <= b) {
+        job = __atomic_load_n(&dq->slots[b & (SCHEDULER_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+        if (t == b) {
+            // Last task: race the thieves for it
+            if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                job = NULL;
+            }
+            __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return job;
+}
+
+static Job* deque_steal(Deque *dq) {
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+
+    Job *job = __atomic_load_n(&dq->slots[t & (SCHEDULER_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return job;
+}
+
+static Job* inject_take(Scheduler *sched) {
+    if (!__atomic_load_n(&sched->inject_head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sched->inject_lock);
+    Job *job = sched->inject_head;
+    if (job) {
+        __atomic_store_n(&sched->inject_head, job->next, __ATOMIC_RELEASE);
+        if (!job->next) {
+            sched->inject_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&sched->inject_lock);
+    return job;
+}
+
+static void inject_push(Scheduler *sched, Job *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&sched->inject_lock);
+    if (sched->inject_tail) {
+        sched->inject_tail->next = job;
+    } else {
+        __atomic_store_n(&sched->inject_head, job, __ATOMIC_RELEASE);
+    }
+    sched->inject_tail = job;
+    pthread_mutex_unlock(&sched->inject_lock);
+}
+
+/**
+ * Next task for a thread: its own deque, then the injection queue, then a victim
+ */
+static Job* find_job(Scheduler *sched, Worker *self) {
+    Job *job = self ? deque_take(&self->deque) : NULL;
+    if (!job) {
+        job = inject_take(sched);
+    }
+
+    size_t n = sched->num_workers;
+    if (!job && n > 0) {
+        size_t start = 0;
+        if (self) {
+            // xorshift32 victim order so thieves spread over the workers
+            self->seed ^= self->seed << 13;
+            self->seed ^= self->seed >> 17;
+            self->seed ^= self->seed << 5;
+            start = self->seed % n;
+        }
+        for (size_t i = 0; i < n && !job; i++) {
+            Worker *victim = &sched->workers[(start + i) % n];
+            if (victim != self) {
+                job = deque_steal(&victim->deque);
+            }
+        }
+    }
+
+    if (job) {
+        __atomic_sub_fetch(&sched->queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return job;
+}
+
+static void run_job(Job *job) {
+    TaskGroup *group = job->group;
+    if (!__atomic_load_n(&group->cancelled, __ATOMIC_ACQUIRE)) {
+        job->func(job->arg);
+    }
+    free(job);
+
+    // Decrement under the lock so a waiter cannot free the group under us
+    pthread_mutex_lock(&group->lock);
+    if (__atomic_sub_fetch(&group->outstanding, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_cond_broadcast(&group->done);
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+static void* worker_main(void *arg) {
+    Worker *self = (Worker*)arg;
+    Scheduler *sched = self->sched;
+    current_worker = self;
+
+    for (;;) {
+        Job *job = NULL;
+        for (int round = 0; round < SCHEDULER_SPIN_ROUNDS && !job; round++) {
+            job = find_job(sched, self);
+            if (!job && __atomic_load_n(&sched->queued, __ATOMIC_RELAXED) == 0) {
+                sched_yield();
+            }
+        }
+        if (job) {
+            run_job(job);
+            continue;
+        }
+
+        // Sleep until a spawn sees us registered (sleepers) or the queues are non-empty
+        pthread_mutex_lock(&sched->sleep_lock);
+        __atomic_add_fetch(&sched->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (!sched->stopping && __atomic_load_n(&sched->queued, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait(&sched->wake, &sched->sleep_lock);
+        }
+        __atomic_sub_fetch(&sched->sleepers, 1, __ATOMIC_SEQ_CST);
+        int stop = sched->stopping && __atomic_load_n(&sched->queued, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&sched->sleep_lock);
+        if (stop) {
+            break;
+        }
+    }
+
+    current_worker = NULL;
+    return NULL;
+}
+
+/**
+ * Start a scheduler
+ */
+Scheduler* scheduler_create(size_t workers) {
+    Scheduler *sched = (Scheduler*)calloc(1, sizeof(Scheduler));
+    if (!sched) {
+        log_message(NL_LOG_ERROR, "Failed to allocate scheduler");
+        return NULL;
+    }
+    if (workers > 0) {
+        sched->workers = (Worker*)aligned_alloc(64, workers * sizeof(Worker));
+        if (!sched->workers) {
+            log_message(NL_LOG_ERROR, "Failed to allocate %zu scheduler workers", workers);
+            free(sched);
+            return NULL;
+        }
+        memset(sched->workers, 0, workers * sizeof(Worker));
+    }
+
+    pthread_mutex_init(&sched->inject_lock, NULL);
+    pthread_mutex_init(&sched->sleep_lock, NULL);
+    pthread_cond_init(&sched->wake, NULL);
+
+    // Every worker is set up before any starts stealing from the others
+    sched->num_workers = workers;
+    for (size_t w = 0; w < workers; w++) {
+        sched->workers[w].sched = sched;
+        sched->workers[w].seed = 2654435761u * (uint32_t)(w + 1);
+    }
+    for (size_t w = 0; w < workers; w++) {
+        Worker *worker = &sched->workers[w];
+        worker->running = pthread_create(&worker->thread, NULL, worker_main, worker) == 0;
+        if (!worker->running) {
+            log_message(NL_LOG_ERROR, "Failed to start scheduler worker %zu", w);
+            scheduler_destroy(sched);
+            return NULL;
+        }
+    }
+
+    return sched;
+}
+
+/**
+ * Stop the workers and free a scheduler
+ */
+void scheduler_destroy(Scheduler *sched) {
+    if (!sched) {
+        return;
+    }
+
+    pthread_mutex_lock(&sched->sleep_lock);
+    sched->stopping = 1;
+    pthread_cond_broadcast(&sched->wake);
+    pthread_mutex_unlock(&sched->sleep_lock);
+
+    for (size_t w = 0; w < sched->num_workers; w++) {
+        if (sched->workers[w].running) {
+            pthread_join(sched->workers[w].thread, NULL);
+        }
+    }
+
+    pthread_mutex_destroy(&sched->inject_lock);
+    pthread_mutex_destroy(&sched->sleep_lock);
+    pthread_cond_destroy(&sched->wake);
+    free(sched->workers);
+    free(sched);
+}
+
+static void shared_init(void) {
+    long workers = SCHEDULER_THREADS;
+    if (workers <= 0) {
+        // The thread that waits for a group runs tasks too
+        workers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+        if (workers < 0) workers = 0;
+    }
+    shared_scheduler = scheduler_create((size_t)workers);
+}
+
+/**
+ * Process-wide scheduler
+ */
+Scheduler* scheduler_shared(void) {
+    pthread_once(&shared_once, shared_init);
+    return shared_scheduler;
+}
+
+/**
+ * Threads that run tasks while a caller waits
+ */
+size_t scheduler_concurrency(const Scheduler *sched) {
+    return sched ? sched->num_workers + 1 : 1;
+}
+
+/**
+ * Create an empty task group
+ */
+TaskGroup* task_group_create(Scheduler *sched) {
+    if (!sched) {
+        log_message(NL_LOG_ERROR, "No scheduler for task group");
+        return NULL;
+    }
+
+    TaskGroup *group = (TaskGroup*)calloc(1, sizeof(TaskGroup));
+    if (!group) {
+        log_message(NL_LOG_ERROR, "Failed to allocate task group");
+        return NULL;
+    }
+    group->sched = sched;
+    pthread_mutex_init(&group->lock, NULL);
+    pthread_cond_init(&group->done, NULL);
+    return group;
+}
+
+/**
+ * Queue a task in a group
+ */
+void task_group_spawn(TaskGroup *group, TaskFunc func, void *arg) {
+    Job *job = (Job*)malloc(sizeof(Job));
+    if (!job) {
+        if (!task_group_cancelled(group)) {
+            func(arg);
+        }
+        return;
+    }
+    job->func = func;
+    job->arg = arg;
+    job->group = group;
+    __atomic_add_fetch(&group->outstanding, 1, __ATOMIC_ACQ_REL);
+
+    // Counted before it is visible so a thief never takes the count below zero;
+    // pairs with the sleepers/queued check in worker_main
+    Scheduler *sched = group->sched;
+    __atomic_add_fetch(&sched->queued, 1, __ATOMIC_SEQ_CST);
+
+    Worker *self = current_worker;
+    if (!self || self->sched != sched || deque_push(&self->deque, job) != 0) {
+        inject_push(sched, job);
+    }
+    if (__atomic_load_n(&sched->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&sched->sleep_lock);
+        pthread_cond_signal(&sched->wake);
+        pthread_mutex_unlock(&sched->sleep_lock);
+    }
+}
+
+/**
+ * Run queued tasks until every task of the group has finished
+ */
+int task_group_wait(TaskGroup *group) {
+    Scheduler *sched = group->sched;
+    Worker *self = current_worker && current_worker->sched == sched ? current_worker : NULL;
+
+    while (__atomic_load_n(&group->outstanding, __ATOMIC_ACQUIRE) > 0) {
+        Job *job = find_job(sched, self);
+        if (job) {
+            run_job(job);
+            continue;
+        }
+
+        // The rest is running elsewhere; doze, but look again for nested spawns
+        pthread_mutex_lock(&group->lock);
+        if (__atomic_load_n(&group->outstanding, __ATOMIC_ACQUIRE) > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += SCHEDULER_WAIT_POLL_NS;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&group->done, &group->lock, &deadline);
+        }
+        pthread_mutex_unlock(&group->lock);
+    }
+
+    // The last task leaves the group lock before the group may be freed
+    pthread_mutex_lock(&group->lock);
+    pthread_mutex_unlock(&group->lock);
+    return task_group_cancelled(group) ? -1 : 0;
+}
+
+/**
+ * Skip the group's tasks that have not started yet
+ */
+void task_group_cancel(TaskGroup *group) {
+    if (group) {
+        __atomic_store_n(&group->cancelled, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Whether a group has been cancelled
+ */
+int task_group_cancelled(const TaskGroup *group) {
+    return group && __atomic_load_n(&group->cancelled, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Free a task group
+ */
+void task_group_free(TaskGroup *group) {
+    if (!group) {
+        return;
+    }
+    pthread_mutex_destroy(&group->lock);
+    pthread_cond_destroy(&group->done);
+    free(group);
+}
@@ -0,0 +1,733 @@
+#define _GNU_SOURCE                 // accept4() and struct ucred
+#include "server.h"
+#include "protocol.h"
+#include "auth.h"
+#include "cohort.h"
+#include "identify.h"
+#include "index_log.h"
+#include "lockout.h"
+#include "mahalanobis.h"
+#include "template_cache.h"
+#include "template_db.h"
+#include "wal.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/* Largest reply payload: an identification candidate list */
+#define SERVER_REPLY_CAPACITY (4 + IDENTIFY_TOP_K * NLD_MATCH_SIZE)
+
+/* Per-worker buffers, allocated once so a request does not touch the heap for I/O */
+typedef struct {
+    NeurolockServer *server;
+    uint8_t *request;               // [NLD_MAX_PAYLOAD]
+    uint8_t reply[SERVER_REPLY_CAPACITY];
+    EEGData *trials[NLD_MAX_TRIALS];
+    FeatureVector *probe;
+    pthread_t thread;
+    int running;
+    int failed;
+} ServerWorker;
+
+struct NeurolockServer {
+    char *socket_path;
+    char *db_path;
+
+    int listen_fd;
+    int epoll_fd;
+    int stop_fd;                    // eventfd, level-triggered: wakes every worker
+
+    TemplateDB *cache_db;           // Read by the template cache only
+    TemplateCache *cache;
+    TemplateDB *log_db;             // Written by the log only
+    TemplateWAL *wal;
+    TemplateDB *scan_db;            // Gallery rebuilds only, under refresh_lock
+
+    TemplateMatrix *cohort;         // NULL if no cohort was built
+    MahalanobisModel *whitening;    // NULL if no model was trained
+    AttemptTable *attempts;         // Failed verifications and lockouts per user
+    IndexSet *indexes;              // Resident HNSW/PQ indexes, under admin_lock
+
+    pthread_rwlock_t gallery_lock;  // Scans read, rebuilds swap
+    TemplateMatrix *gallery;
+    pthread_mutex_t refresh_lock;
+    uint64_t gallery_generation;    // Database generation the gallery was built from
+    uint64_t gallery_checked_ms;    // Zeroed by writers to force a check; __atomic access only
+
+    pthread_mutex_t admin_lock;     // Enrol/delete and index files
+
+    pthread_mutex_t conn_lock;      // Open client sockets, closed on destroy
+    int *conns;
+    size_t num_conns;
+    size_t conn_capacity;
+
+    ServerWorker *workers;
+    size_t num_workers;
+
+    uint64_t connections;
+    uint64_t requests;
+    uint64_t failures;
+    uint64_t gallery_rebuilds;
+};
+
+static char* copy_path(const char *path) {
+    return path ? strdup(path) : NULL;
+}
+
+/**
+ * Fill a configuration with the default paths
+ */
+void server_config_default(ServerConfig *config) {
+    if (!config) {
+        return;
+    }
+    config->socket_path = DAEMON_SOCKET_PATH;
+    config->db_path = TEMPLATE_DB_PATH;
+    config->wal_path = WAL_PATH;
+    config->cohort_path = COHORT_PATH;
+    config->whitening_path = MAHALANOBIS_PATH;
+    config->hnsw_path = HNSW_INDEX_PATH;
+    config->pq_path = PQ_INDEX_PATH;
+    config->lockout_path = LOCKOUT_PATH;
+    config->workers = DAEMON_WORKERS;
+}
+
+/**
+ * Bind the listening socket, replacing a socket file left by a dead daemon
+ */
+static int open_listener(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_message(NL_LOG_ERROR, "Socket path too long: %s", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+
+    // A socket nobody answers on is stale; one that answers belongs to a live daemon
+    if (file_exists(path)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            log_message(NL_LOG_ERROR, "Another daemon is listening on %s", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        chmod(path, DAEMON_SOCKET_MODE) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int arm(NeurolockServer *server, int fd, int op, uint32_t events) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    return epoll_ctl(server->epoll_fd, op, fd, &event);
+}
+
+/**
+ * Load templates and models and start listening
+ */
+NeurolockServer* server_create(const ServerConfig *config) {
+    if (!config || !config->socket_path || !config->db_path || !config->wal_path) {
+        log_message(NL_LOG_ERROR, "Invalid server configuration");
+        return NULL;
+    }
+
+    NeurolockServer *server = (NeurolockServer*)calloc(1, sizeof(NeurolockServer));
+    if (!server) {
+        log_message(NL_LOG_ERROR, "Failed to allocate server");
+        return NULL;
+    }
+    server->listen_fd = -1;
+    server->epoll_fd = -1;
+    server->stop_fd = -1;
+    pthread_rwlock_init(&server->gallery_lock, NULL);
+    pthread_mutex_init(&server->refresh_lock, NULL);
+    pthread_mutex_init(&server->admin_lock, NULL);
+    pthread_mutex_init(&server->conn_lock, NULL);
+
+    server->socket_path = copy_path(config->socket_path);
+    server->db_path = copy_path(config->db_path);
+    server->indexes = index_set_open(config->hnsw_path, config->pq_path);
+    if (!server->socket_path || !server->db_path || !server->indexes) {
+        server_destroy(server);
+        return NULL;
+    }
+
+    // Separate handles: the log writes through its own, the cache and the
+    // gallery each read through theirs
+    server->cache_db = template_db_open(config->db_path);
+    server->log_db = template_db_open(config->db_path);
+    server->scan_db = template_db_open(config->db_path);
+    server->cache = server->cache_db ? template_cache_create(server->cache_db, TEMPLATE_CACHE_CAPACITY) : NULL;
+    server->wal = server->log_db ? wal_open(config->wal_path, server->log_db) : NULL;
+    if (!server->cache || !server->wal || !server->scan_db) {
+        log_message(NL_LOG_ERROR, "Failed to open template store: %s", config->db_path);
+        server_destroy(server);
+        return NULL;
+    }
+    if (template_cache_watch(server->cache, config->db_path) != 0) {
+        log_message(NL_LOG_WARNING, "Changes made by other processes will not reach the cache");
+    }
+
+    server->gallery = template_matrix_build(server->scan_db);
+    server->gallery_generation = template_db_generation(server->scan_db);
+    server->gallery_checked_ms = get_timestamp_ms();
+    if (!server->gallery) {
+        server_destroy(server);
+        return NULL;
+    }
+
+    if (config->cohort_path && file_exists(config->cohort_path) &&
+        (server->cohort = cohort_load(config->cohort_path)) == NULL) {
+        log_message(NL_LOG_WARNING, "Serving without score normalization");
+    }
+    if (MAHALANOBIS_MATCHER && config->whitening_path && file_exists(config->whitening_path) &&
+        (server->whitening = mahalanobis_load(config->whitening_path)) == NULL) {
+        log_message(NL_LOG_WARNING, "Serving without the whitened matcher");
+    }
+
+    server->attempts = config->lockout_path ? lockout_open(config->lockout_path, LOCKOUT_TABLE_SIZE)
+                                            : lockout_create(LOCKOUT_TABLE_SIZE);
+    if (!server->attempts) {
+        server_destroy(server);
+        return NULL;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    server->num_workers = config->workers > 0 ? config->workers : (cpus > 0 ? (size_t)cpus : 1);
+    server->workers = (ServerWorker*)calloc(server->num_workers, sizeof(ServerWorker));
+    if (!server->workers) {
+        server_destroy(server);
+        return NULL;
+    }
+    for (size_t w = 0; w < server->num_workers; w++) {
+        ServerWorker *worker = &server->workers[w];
+        worker->server = server;
+        worker->request = (uint8_t*)malloc(NLD_MAX_PAYLOAD);
+        worker->probe = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+        int ok = worker->request && worker->probe;
+        for (size_t t = 0; t < NLD_MAX_TRIALS && ok; t++) {
+            worker->trials[t] = eeg_data_alloc(NUM_CHANNELS, (size_t)SAMPLING_RATE * CAPTURE_DURATION);
+            ok = worker->trials[t] != NULL;
+        }
+        if (!ok) {
+            log_message(NL_LOG_ERROR, "Failed to allocate worker buffers");
+            server_destroy(server);
+            return NULL;
+        }
+    }
+
+    server->listen_fd = open_listener(config->socket_path);
+    server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int cache_fd = template_cache_fd(server->cache);
+    if (server->listen_fd < 0 || server->stop_fd < 0 || server->epoll_fd < 0 ||
+        arm(server, server->stop_fd, EPOLL_CTL_ADD, EPOLLIN) != 0 ||
+        arm(server, server->listen_fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLONESHOT) != 0 ||
+        (cache_fd >= 0 && arm(server, cache_fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLONESHOT) != 0)) {
+        log_message(NL_LOG_ERROR, "Failed to set up the event loop");
+        server_destroy(server);
+        return NULL;
+    }
+
+    log_message(NL_LOG_INFO, "Listening on %s with %zu workers (%zu templates)",
+                server->socket_path, server->num_workers, server->gallery->num_templates);
+    return server;
+}
+
+static void add_connection(NeurolockServer *server, int fd) {
+    pthread_mutex_lock(&server->conn_lock);
+    if (server->num_conns == server->conn_capacity) {
+        size_t capacity = server->conn_capacity ? server->conn_capacity * 2 : 64;
+        int *grown = (int*)realloc(server->conns, capacity * sizeof(int));
+        if (grown) {
+            server->conns = grown;
+            server->conn_capacity = capacity;
+        }
+    }
+    if (server->num_conns < server->conn_capacity) {
+        server->conns[server->num_conns++] = fd;
+    }
+    pthread_mutex_unlock(&server->conn_lock);
+}
+
+static void drop_connection(NeurolockServer *server, int fd) {
+    pthread_mutex_lock(&server->conn_lock);
+    for (size_t i = 0; i < server->num_conns; i++) {
+        if (server->conns[i] == fd) {
+            server->conns[i] = server->conns[--server->num_conns];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->conn_lock);
+    close(fd);
+}
+
+/**
+ * Accept every pending connection and arm each for its first request
+ */
+static void accept_clients(NeurolockServer *server) {
+    struct timeval timeout = { DAEMON_IO_TIMEOUT_MS / 1000, (DAEMON_IO_TIMEOUT_MS % 1000) * 1000 };
+
+    for (;;) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_message(NL_LOG_WARNING, "Failed to accept connection: %s", strerror(errno));
+            }
+            return;
+        }
+
+        // Requests are read and answered blocking; a stalled peer times out
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        add_connection(server, fd);
+        __atomic_fetch_add(&server->connections, 1, __ATOMIC_RELAXED);
+        if (arm(server, fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLONESHOT) != 0) {
+            drop_connection(server, fd);
+        }
+    }
+}
+
+/**
+ * Rebuild the identification matrix if the database moved on
+ * Runs at most once per DAEMON_GALLERY_REFRESH_MS; scans meanwhile use the
+ * matrix they have.
+ */
+static void refresh_gallery(NeurolockServer *server) {
+    if (pthread_mutex_trylock(&server->refresh_lock) != 0) {
+        return;
+    }
+
+    uint64_t now = get_timestamp_ms();
+    if (now - __atomic_load_n(&server->gallery_checked_ms, __ATOMIC_RELAXED) >= DAEMON_GALLERY_REFRESH_MS) {
+        // Stamped before the refresh, so a change published during it forces the next one
+        __atomic_store_n(&server->gallery_checked_ms, now, __ATOMIC_RELAXED);
+        template_db_refresh(server->scan_db);
+        uint64_t generation = template_db_generation(server->scan_db);
+        TemplateMatrix *fresh = generation != server->gallery_generation ?
+                                template_matrix_build(server->scan_db) : NULL;
+        if (fresh) {
+            pthread_rwlock_wrlock(&server->gallery_lock);
+            TemplateMatrix *old = server->gallery;
+            server->gallery = fresh;
+            pthread_rwlock_unlock(&server->gallery_lock);
+            template_matrix_free(old);
+            server->gallery_generation = generation;
+            __atomic_fetch_add(&server->gallery_rebuilds, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&server->refresh_lock);
+}
+
+/** Peers running as root or as the daemon's user may change templates */
+static int peer_may_write(int fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        return 0;
+    }
+    return cred.uid == 0 || cred.uid == geteuid();
+}
+
+/** Check enrolment through the cache (a hit also warms it) */
+static int is_enrolled(NeurolockServer *server, const char *username) {
+    Template *template = template_alloc();
+    int enrolled = template && template_cache_get(server->cache, username, template) == 0;
+    template_free(template);
+    return enrolled;
+}
+
+/** Make the cache and later scans see a change this process just logged */
+static void publish_change(NeurolockServer *server, const char *username, const float *features) {
+    template_cache_invalidate(server->cache, username);
+    template_cache_poll(server->cache);
+    index_set_update(server->indexes, username, features);
+    __atomic_store_n(&server->gallery_checked_ms, 0, __ATOMIC_RELAXED);
+}
+
+static NldStatus handle_enroll(ServerWorker *worker, int fd, const NldRequest *request) {
+    NeurolockServer *server = worker->server;
+    if (!peer_may_write(fd)) {
+        return NLD_STATUS_DENIED;
+    }
+
+    for (size_t t = 0; t < request->trials; t++) {
+        if (nld_load_trial(request, t, worker->trials[t]) != 0) {
+            return NLD_STATUS_BAD_REQUEST;
+        }
+    }
+
+    // One enrolment or deletion at a time, so the existence check holds until the write
+    pthread_mutex_lock(&server->admin_lock);
+    if (is_enrolled(server, request->username)) {
+        pthread_mutex_unlock(&server->admin_lock);
+        return NLD_STATUS_EXISTS;
+    }
+
+    Template *template = template_alloc();
+    if (!template || template_create(request->username, (const EEGData**)worker->trials, request->trials,
+                                     request->task, template) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to create template for %s", request->username);
+        template_free(template);
+        pthread_mutex_unlock(&server->admin_lock);
+        return NLD_STATUS_ERROR;
+    }
+    auth_train(template, server->cohort);
+
+    if (wal_put(server->wal, template) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to save template for %s", request->username);
+        template_free(template);
+        pthread_mutex_unlock(&server->admin_lock);
+        return NLD_STATUS_ERROR;
+    }
+    publish_change(server, request->username, template->features->features);
+    pthread_mutex_unlock(&server->admin_lock);
+
+    log_message(NL_LOG_INFO, "Enrolled %s", request->username);
+    template_free(template);
+    return NLD_STATUS_OK;
+}
+
+static NldStatus handle_verify(ServerWorker *worker, const NldRequest *request, size_t *reply_size) {
+    NeurolockServer *server = worker->server;
+    EEGData *trial = worker->trials[0];
+    if (nld_load_trial(request, 0, trial) != 0) {
+        return NLD_STATUS_BAD_REQUEST;
+    }
+
+    Template *template = template_alloc();
+    if (!template) {
+        return NLD_STATUS_ERROR;
+    }
+    if (template_cache_get(server->cache, request->username, template) != 0) {
+        template_free(template);
+        return NLD_STATUS_NOT_ENROLLED;
+    }
+
+    // Counted before matching, so a burst of parallel guesses cannot overrun the limit
+    int attempt = 1;
+    uint64_t retry_ms = 0;
+    if (lockout_acquire(server->attempts, request->username, get_timestamp_ms(), &attempt, &retry_ms) != 0) {
+        template_free(template);
+        store_le32(worker->reply, (uint32_t)retry_ms);
+        *reply_size = NLD_LOCKED_REPLY_SIZE;
+        return NLD_STATUS_LOCKED;
+    }
+
+    AuthResult result;
+    AuthMatcher matcher;
+    if (auth_verify(trial, template, server->whitening, server->cohort, &result, &matcher) != 0) {
+        lockout_finish(server->attempts, request->username, ATTEMPT_ABORTED);
+        template_free(template);
+        return NLD_STATUS_ERROR;
+    }
+    result.attempts = attempt;
+    lockout_finish(server->attempts, request->username,
+                   result.authenticated ? ATTEMPT_ACCEPTED : ATTEMPT_REJECTED);
+    if (attempt == MAX_AUTH_ATTEMPTS && !result.authenticated) {
+        log_message(NL_LOG_WARNING, "Locked out %s for %d s after %d failed attempts",
+                    request->username, AUTH_TIMEOUT, attempt);
+    }
+
+    // Follow slow drift like the CLI; readers see the update before it is durable
+    if (result.authenticated && auth_adapt(template, trial, server->cohort) == 0) {
+        template_cache_publish(server->cache, template);
+        if (wal_put_async(server->wal, template) != 0) {
+            log_message(NL_LOG_WARNING, "Failed to persist template update for %s", request->username);
+        }
+    }
+    template_free(template);
+
+    store_le32(worker->reply, result.authenticated ? 1u : 0u);
+    store_le32(worker->reply + 4, (uint32_t)matcher);
+    store_le32(worker->reply + 8, (uint32_t)result.attempts);
+    store_le_f32(worker->reply + 12, result.similarity_score);
+    store_le_f32(worker->reply + 16, result.normalized_score);
+    store_le_f32(worker->reply + 20, auth_threshold(matcher));
+    *reply_size = NLD_VERIFY_REPLY_SIZE;
+    return result.authenticated ? NLD_STATUS_OK : NLD_STATUS_REJECTED;
+}
+
+static NldStatus handle_identify(ServerWorker *worker, const NldRequest *request, size_t *reply_size) {
+    NeurolockServer *server = worker->server;
+    if (nld_load_trial(request, 0, worker->trials[0]) != 0) {
+        return NLD_STATUS_BAD_REQUEST;
+    }
+    if (extract_features(worker->trials[0], worker->probe) != 0) {
+        return NLD_STATUS_ERROR;
+    }
+
+    refresh_gallery(server);
+
+    IdentifyMatch matches[IDENTIFY_TOP_K];
+    size_t num_matches = 0;
+    pthread_rwlock_rdlock(&server->gallery_lock);
+    int empty = server->gallery->num_templates == 0;
+    int result = empty ? 0 : template_identify(server->gallery, worker->probe, IDENTIFY_TOP_K,
+                                               matches, &num_matches);
+    pthread_rwlock_unlock(&server->gallery_lock);
+    if (empty) {
+        return NLD_STATUS_NOT_ENROLLED;
+    }
+    if (result != 0) {
+        return NLD_STATUS_ERROR;
+    }
+
+    store_le32(worker->reply, (uint32_t)num_matches);
+    for (size_t i = 0; i < num_matches; i++) {
+        uint8_t *match = worker->reply + 4 + i * NLD_MATCH_SIZE;
+        memset(match, 0, NLD_USERNAME_SIZE);
+        memcpy(match, matches[i].username, strnlen(matches[i].username, NLD_USERNAME_SIZE - 1));
+        store_le_f32(match + NLD_USERNAME_SIZE, matches[i].similarity);
+    }
+    *reply_size = 4 + num_matches * NLD_MATCH_SIZE;
+    return NLD_STATUS_OK;
+}
+
+static NldStatus handle_delete(ServerWorker *worker, int fd, const NldRequest *request) {
+    NeurolockServer *server = worker->server;
+    if (!peer_may_write(fd)) {
+        return NLD_STATUS_DENIED;
+    }
+
+    pthread_mutex_lock(&server->admin_lock);
+    if (!is_enrolled(server, request->username)) {
+        pthread_mutex_unlock(&server->admin_lock);
+        return NLD_STATUS_NOT_ENROLLED;
+    }
+    int removed = wal_delete(server->wal, request->username) == 0;
+    if (removed) {
+        publish_change(server, request->username, NULL);
+    }
+    pthread_mutex_unlock(&server->admin_lock);
+
+    if (!removed) {
+        return NLD_STATUS_ERROR;
+    }
+    log_message(NL_LOG_INFO, "Deleted %s", request->username);
+    return NLD_STATUS_OK;
+}
+
+/**
+ * Read one request from a readable connection and answer it
+ * Returns: 0 to keep the connection, negative to drop it
+ */
+static int serve_request(ServerWorker *worker, int fd) {
+    NeurolockServer *server = worker->server;
+    NldHeader header;
+    if (nld_recv_frame(fd, NLD_REQUEST_MAGIC, &header, worker->request, NLD_MAX_PAYLOAD) != 0) {
+        return -1;
+    }
+
+    NldRequest request;
+    size_t reply_size = 0;
+    NldStatus status;
+    if (nld_parse_request(&header, worker->request, &request) != 0) {
+        status = NLD_STATUS_BAD_REQUEST;
+    } else {
+        switch (request.opcode) {
+            case NLD_OP_ENROLL:
+                status = handle_enroll(worker, fd, &request);
+                break;
+            case NLD_OP_VERIFY:
+                status = handle_verify(worker, &request, &reply_size);
+                break;
+            case NLD_OP_IDENTIFY:
+                status = handle_identify(worker, &request, &reply_size);
+                break;
+            case NLD_OP_DELETE:
+                status = handle_delete(worker, fd, &request);
+                break;
+            default:
+                status = NLD_STATUS_OK;
+                break;
+        }
+    }
+
+    __atomic_fetch_add(&server->requests, 1, __ATOMIC_RELAXED);
+    if (status == NLD_STATUS_BAD_REQUEST || status == NLD_STATUS_ERROR) {
+        __atomic_fetch_add(&server->failures, 1, __ATOMIC_RELAXED);
+    }
+    return nld_send_frame(fd, NLD_RESPONSE_MAGIC, (uint16_t)status, header.request_id,
+                          worker->reply, reply_size);
+}
+
+/**
+ * Take one event at a time from the shared set until stopped
+ */
+static void* worker_main(void *arg) {
+    ServerWorker *worker = (ServerWorker*)arg;
+    NeurolockServer *server = worker->server;
+    int cache_fd = template_cache_fd(server->cache);
+
+    for (;;) {
+        struct epoll_event event;
+        int n = epoll_wait(server->epoll_fd, &event, 1, -1);
+        if (n < 0 && errno != EINTR) {
+            log_message(NL_LOG_ERROR, "Event wait failed: %s", strerror(errno));
+            worker->failed = 1;
+            break;
+        }
+        if (n <= 0) {
+            continue;
+        }
+
+        int fd = event.data.fd;
+        if (fd == server->stop_fd) {
+            break;
+        }
+        if (fd == server->listen_fd) {
+            accept_clients(server);
+            arm(server, fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT);
+        } else if (fd == cache_fd) {
+            template_cache_poll(server->cache);
+            arm(server, fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT);
+        } else if (serve_request(worker, fd) != 0 ||
+                   arm(server, fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT) != 0) {
+            drop_connection(server, fd);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Serve requests until server_stop() is called
+ */
+int server_run(NeurolockServer *server) {
+    if (!server) {
+        return -1;
+    }
+
+    // Caller's thread serves too; a failed spawn just leaves fewer workers
+    for (size_t w = 1; w < server->num_workers; w++) {
+        ServerWorker *worker = &server->workers[w];
+        worker->running = pthread_create(&worker->thread, NULL, worker_main, worker) == 0;
+        if (!worker->running) {
+            log_message(NL_LOG_WARNING, "Failed to start worker %zu", w);
+        }
+    }
+    worker_main(&server->workers[0]);
+
+    int failed = server->workers[0].failed;
+    for (size_t w = 1; w < server->num_workers; w++) {
+        if (server->workers[w].running) {
+            pthread_join(server->workers[w].thread, NULL);
+            server->workers[w].running = 0;
+        }
+        failed |= server->workers[w].failed;
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * Ask server_run() to return
+ */
+void server_stop(NeurolockServer *server) {
+    if (server && server->stop_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(server->stop_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/**
+ * Close every connection, flush the log and free the server
+ */
+void server_destroy(NeurolockServer *server) {
+    if (!server) {
+        return;
+    }
+
+    for (size_t i = 0; i < server->num_conns; i++) {
+        close(server->conns[i]);
+    }
+    free(server->conns);
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        unlink(server->socket_path);
+    }
+    if (server->epoll_fd >= 0) {
+        close(server->epoll_fd);
+    }
+    if (server->stop_fd >= 0) {
+        close(server->stop_fd);
+    }
+
+    for (size_t w = 0; server->workers && w < server->num_workers; w++) {
+        ServerWorker *worker = &server->workers[w];
+        free(worker->request);
+        feature_vector_free(worker->probe);
+        for (size_t t = 0; t < NLD_MAX_TRIALS; t++) {
+            eeg_data_free(worker->trials[t]);
+        }
+    }
+    free(server->workers);
+
+    wal_close(server->wal);
+    template_cache_destroy(server->cache);
+    template_db_close(server->cache_db);
+    template_db_close(server->log_db);
+    template_db_close(server->scan_db);
+    template_matrix_free(server->gallery);
+    template_matrix_free(server->cohort);
+    mahalanobis_free(server->whitening);
+    lockout_destroy(server->attempts);
+    index_set_close(server->indexes);
+
+    pthread_rwlock_destroy(&server->gallery_lock);
+    pthread_mutex_destroy(&server->refresh_lock);
+    pthread_mutex_destroy(&server->admin_lock);
+    pthread_mutex_destroy(&server->conn_lock);
+    free(server->socket_path);
+    free(server->db_path);
+    free(server);
+}
+
+/**
+ * Read request counters
+ */
+void server_get_stats(NeurolockServer *server, ServerStats *stats) {
+    if (!server || !stats) {
+        return;
+    }
+    stats->connections = __atomic_load_n(&server->connections, __ATOMIC_RELAXED);
+    stats->requests = __atomic_load_n(&server->requests, __ATOMIC_RELAXED);
+    stats->failures = __atomic_load_n(&server->failures, __ATOMIC_RELAXED);
+    stats->gallery_rebuilds = __atomic_load_n(&server->gallery_rebuilds, __ATOMIC_RELAXED);
+    stats->lockouts = lockout_refusals(server->attempts);
+}
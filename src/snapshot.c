@@ -0,0 +1,463 @@
+#define _GNU_SOURCE                 // memfd_create() and file sealing
+#include "snapshot.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_CONTROL_SIZE 4096
+#define SNAPSHOT_OPEN_RETRIES 8
+#define SNAPSHOT_SEQLOCK_SPINS 1000
+#define SNAPSHOT_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+/* Announcement shared through the control file */
+typedef struct {
+    uint32_t magic;                 // SNAPSHOT_CONTROL_MAGIC
+    uint32_t version;               // SNAPSHOT_VERSION
+    _Atomic uint64_t sequence;      // Odd while the publisher rewrites the fields below
+    _Atomic uint64_t generation;    // Snapshot number, never reused across publishers
+    _Atomic uint64_t db_generation; // Database generation the snapshot was built from
+    _Atomic uint64_t size;          // Segment bytes
+    _Atomic int32_t pid;            // Publisher process, 0 if withdrawn
+    _Atomic int32_t fd;             // Segment fd inside the publisher
+} SnapshotControl;
+
+/* Header at the start of every segment */
+typedef struct {
+    uint32_t magic;                 // SNAPSHOT_MAGIC
+    uint32_t version;               // SNAPSHOT_VERSION
+    uint64_t generation;            // Must match the announcement
+    uint64_t db_generation;
+    uint64_t size;                  // Segment bytes
+    uint64_t num_templates;
+    uint64_t dim;
+    uint64_t stride;
+    uint64_t matrix_offset;         // float rows, 0 if quantized
+    uint64_t codes_offset;          // int8 rows, 0 unless quantized
+    uint64_t scales_offset;
+    uint64_t zero_points_offset;
+    uint64_t usernames_offset;
+    uint64_t task_types_offset;
+} SnapshotHeader;
+
+/* Announcement as read by a reader */
+typedef struct {
+    uint64_t generation;
+    uint64_t db_generation;
+    uint64_t size;
+    int32_t pid;
+    int32_t fd;
+} Announcement;
+
+struct SnapshotPublisher {
+    int control_fd;
+    SnapshotControl *control;
+    int current_fd;                 // Segment being announced
+    int previous_fd;                // Kept open for readers that raced the last swap
+    uint64_t generation;
+};
+
+struct SnapshotReader {
+    int control_fd;
+    const SnapshotControl *control;
+    uint8_t *segment;
+    size_t segment_size;
+    uint64_t generation;
+    uint64_t db_generation;
+    TemplateMatrix view;            // Points into segment
+};
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+/**
+ * Place the arrays of a segment; publishers and readers share this layout
+ */
+static void snapshot_layout(uint64_t rows, uint64_t dim, uint64_t stride, int quantized,
+                            SnapshotHeader *header) {
+    memset(header, 0, sizeof(*header));
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    header->num_templates = rows;
+    header->dim = dim;
+    header->stride = stride;
+
+    uint64_t offset = align_up(sizeof(SnapshotHeader));
+    if (quantized) {
+        header->codes_offset = offset;
+        offset = align_up(offset + rows * stride);
+        header->scales_offset = offset;
+        offset = align_up(offset + rows * sizeof(float));
+        header->zero_points_offset = offset;
+        offset = align_up(offset + rows * sizeof(float));
+    } else {
+        header->matrix_offset = offset;
+        offset = align_up(offset + rows * stride * sizeof(float));
+    }
+    header->usernames_offset = offset;
+    offset = align_up(offset + rows * 64);
+    header->task_types_offset = offset;
+    offset = align_up(offset + rows * sizeof(MentalTask));
+    header->size = offset;
+}
+
+/**
+ * Rewrite the announcement under the seqlock
+ */
+static void announce(SnapshotControl *control, uint64_t generation, uint64_t db_generation,
+                     uint64_t size, int32_t pid, int32_t fd) {
+    uint64_t sequence = atomic_load_explicit(&control->sequence, memory_order_relaxed);
+    atomic_store_explicit(&control->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&control->generation, generation, memory_order_relaxed);
+    atomic_store_explicit(&control->db_generation, db_generation, memory_order_relaxed);
+    atomic_store_explicit(&control->size, size, memory_order_relaxed);
+    atomic_store_explicit(&control->pid, pid, memory_order_relaxed);
+    atomic_store_explicit(&control->fd, fd, memory_order_relaxed);
+
+    atomic_store_explicit(&control->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Copy the announcement out, retrying while the publisher is mid-update
+ */
+static int read_announcement(const SnapshotControl *control, Announcement *out) {
+    SnapshotControl *c = (SnapshotControl*)control;
+    for (int spin = 0; spin < SNAPSHOT_SEQLOCK_SPINS; spin++) {
+        uint64_t before = atomic_load_explicit(&c->sequence, memory_order_acquire);
+        if (before & 1u) {
+            sched_yield();
+            continue;
+        }
+
+        out->generation = atomic_load_explicit(&c->generation, memory_order_relaxed);
+        out->db_generation = atomic_load_explicit(&c->db_generation, memory_order_relaxed);
+        out->size = atomic_load_explicit(&c->size, memory_order_relaxed);
+        out->pid = atomic_load_explicit(&c->pid, memory_order_relaxed);
+        out->fd = atomic_load_explicit(&c->fd, memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&c->sequence, memory_order_relaxed) == before) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Create (or take over) a control file and become its only publisher
+ */
+SnapshotPublisher* snapshot_publisher_open(const char *control_path) {
+    if (!control_path) {
+        return NULL;
+    }
+
+    int fd = open(control_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open snapshot control file: %s", control_path);
+        return NULL;
+    }
+
+    // The lock lives as long as the publisher; a second one fails here
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        log_message(NL_LOG_ERROR, "Another snapshot publisher is running: %s", control_path);
+        close(fd);
+        return NULL;
+    }
+
+    SnapshotControl *control = NULL;
+    if (ftruncate(fd, SNAPSHOT_CONTROL_SIZE) == 0) {
+        void *map = mmap(NULL, SNAPSHOT_CONTROL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        control = map != MAP_FAILED ? (SnapshotControl*)map : NULL;
+    }
+    SnapshotPublisher *publisher = control ? (SnapshotPublisher*)calloc(1, sizeof(SnapshotPublisher)) : NULL;
+    if (!publisher) {
+        log_message(NL_LOG_ERROR, "Failed to map snapshot control file: %s", control_path);
+        if (control) munmap(control, SNAPSHOT_CONTROL_SIZE);
+        close(fd);
+        return NULL;
+    }
+
+    // Continue the generation sequence so readers never mistake a new snapshot for an old one
+    if (control->magic != SNAPSHOT_CONTROL_MAGIC || control->version != SNAPSHOT_VERSION) {
+        memset(control, 0, sizeof(*control));
+        control->magic = SNAPSHOT_CONTROL_MAGIC;
+        control->version = SNAPSHOT_VERSION;
+    }
+    publisher->generation = atomic_load(&control->generation);
+    announce(control, publisher->generation, 0, 0, 0, -1);
+
+    publisher->control_fd = fd;
+    publisher->control = control;
+    publisher->current_fd = -1;
+    publisher->previous_fd = -1;
+    return publisher;
+}
+
+/**
+ * Copy a matrix into a new sealed segment and announce it
+ */
+int snapshot_publish(SnapshotPublisher *publisher, const TemplateMatrix *matrix, uint64_t db_generation) {
+    if (!publisher || !matrix || (!matrix->matrix && !matrix->codes)) {
+        log_message(NL_LOG_ERROR, "Invalid input for snapshot publish");
+        return -1;
+    }
+
+    int quantized = matrix->codes != NULL;
+    SnapshotHeader header;
+    snapshot_layout(matrix->num_templates, matrix->dim, matrix->stride, quantized, &header);
+    header.generation = publisher->generation + 1;
+    header.db_generation = db_generation;
+
+    int fd = memfd_create("neurolock-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0 || ftruncate(fd, (off_t)header.size) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to create snapshot segment (%llu bytes)",
+                    (unsigned long long)header.size);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    uint8_t *segment = (uint8_t*)mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (segment == MAP_FAILED) {
+        log_message(NL_LOG_ERROR, "Failed to map snapshot segment");
+        close(fd);
+        return -1;
+    }
+
+    size_t rows = matrix->num_templates;
+    memcpy(segment, &header, sizeof(header));
+    if (quantized) {
+        memcpy(segment + header.codes_offset, matrix->codes, rows * matrix->stride);
+        memcpy(segment + header.scales_offset, matrix->scales, rows * sizeof(float));
+        memcpy(segment + header.zero_points_offset, matrix->zero_points, rows * sizeof(float));
+    } else {
+        memcpy(segment + header.matrix_offset, matrix->matrix, rows * matrix->stride * sizeof(float));
+    }
+    memcpy(segment + header.usernames_offset, matrix->usernames, rows * 64);
+    memcpy(segment + header.task_types_offset, matrix->task_types, rows * sizeof(MentalTask));
+
+    // Sealing needs every writable mapping gone; afterwards nobody can change the pages
+    munmap(segment, header.size);
+    if (fcntl(fd, F_ADD_SEALS, SNAPSHOT_SEALS) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to seal snapshot segment");
+        close(fd);
+        return -1;
+    }
+
+    announce(publisher->control, header.generation, db_generation, header.size, (int32_t)getpid(), fd);
+
+    if (publisher->previous_fd >= 0) {
+        close(publisher->previous_fd);
+    }
+    publisher->previous_fd = publisher->current_fd;
+    publisher->current_fd = fd;
+    publisher->generation = header.generation;
+
+    log_message(NL_LOG_DEBUG, "Published snapshot %llu (%zu templates, %llu bytes)",
+                (unsigned long long)header.generation, rows, (unsigned long long)header.size);
+    return 0;
+}
+
+/**
+ * Withdraw the announcement and release the publisher's segments
+ */
+void snapshot_publisher_close(SnapshotPublisher *publisher) {
+    if (publisher) {
+        announce(publisher->control, publisher->generation, 0, 0, 0, -1);
+        if (publisher->current_fd >= 0) close(publisher->current_fd);
+        if (publisher->previous_fd >= 0) close(publisher->previous_fd);
+        munmap(publisher->control, SNAPSHOT_CONTROL_SIZE);
+        close(publisher->control_fd);
+        free(publisher);
+    }
+}
+
+/**
+ * Open and validate the segment named by an announcement
+ * Returns: Mapped segment, NULL if it is gone or not the announced one
+ */
+static uint8_t* map_segment(const Announcement *a) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)a->pid, (int)a->fd);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Only a fully sealed segment of the announced size is trusted to stay immutable
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != a->size || a->size < sizeof(SnapshotHeader) ||
+        seals < 0 || (seals & SNAPSHOT_SEALS) != SNAPSHOT_SEALS) {
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *segment = (uint8_t*)mmap(NULL, a->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        return NULL;
+    }
+
+    SnapshotHeader header, expected;
+    memcpy(&header, segment, sizeof(header));
+    int valid = header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION &&
+                header.generation == a->generation && header.size == a->size &&
+                header.dim > 0 && header.dim <= 65536 && header.stride == ((header.dim + 7) & ~(uint64_t)7) &&
+                header.num_templates <= a->size / header.stride;
+    if (valid) {
+        snapshot_layout(header.num_templates, header.dim, header.stride, header.codes_offset != 0, &expected);
+        valid = expected.size == header.size &&
+                expected.matrix_offset == header.matrix_offset &&
+                expected.codes_offset == header.codes_offset &&
+                expected.scales_offset == header.scales_offset &&
+                expected.zero_points_offset == header.zero_points_offset &&
+                expected.usernames_offset == header.usernames_offset &&
+                expected.task_types_offset == header.task_types_offset;
+    }
+    if (!valid) {
+        munmap(segment, a->size);
+        return NULL;
+    }
+
+    return segment;
+}
+
+/**
+ * Attach to a control file and map the current snapshot
+ */
+SnapshotReader* snapshot_reader_open(const char *control_path) {
+    if (!control_path) {
+        return NULL;
+    }
+
+    int fd = open(control_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= SNAPSHOT_CONTROL_SIZE) {
+        map = mmap(NULL, SNAPSHOT_CONTROL_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    const SnapshotControl *control = map != MAP_FAILED ? (const SnapshotControl*)map : NULL;
+    if (!control || control->magic != SNAPSHOT_CONTROL_MAGIC || control->version != SNAPSHOT_VERSION) {
+        log_message(NL_LOG_ERROR, "Not a NeuroLock snapshot control file: %s", control_path);
+        if (control) munmap(map, SNAPSHOT_CONTROL_SIZE);
+        close(fd);
+        return NULL;
+    }
+
+    SnapshotReader *reader = (SnapshotReader*)calloc(1, sizeof(SnapshotReader));
+    if (!reader) {
+        munmap(map, SNAPSHOT_CONTROL_SIZE);
+        close(fd);
+        return NULL;
+    }
+    reader->control_fd = fd;
+    reader->control = control;
+
+    if (snapshot_reader_refresh(reader) < 0) {
+        snapshot_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+/**
+ * Map the newest snapshot if the publisher has announced one
+ */
+int snapshot_reader_refresh(SnapshotReader *reader) {
+    if (!reader) {
+        return -1;
+    }
+
+    // An fd number can be recycled between reading the announcement and opening
+    // it; the generation check in map_segment catches that and we look again
+    for (int attempt = 0; attempt < SNAPSHOT_OPEN_RETRIES; attempt++) {
+        Announcement a;
+        if (read_announcement(reader->control, &a) != 0) {
+            continue;
+        }
+        if (a.pid == 0) {
+            // Withdrawn: a segment already mapped stays valid
+            return reader->segment ? 0 : -1;
+        }
+        if (reader->segment && a.generation == reader->generation) {
+            return 0;
+        }
+
+        uint8_t *segment = map_segment(&a);
+        if (!segment) {
+            continue;
+        }
+
+        if (reader->segment) {
+            munmap(reader->segment, reader->segment_size);
+        }
+        const SnapshotHeader *header = (const SnapshotHeader*)segment;
+        reader->segment = segment;
+        reader->segment_size = a.size;
+        reader->generation = a.generation;
+        reader->db_generation = header->db_generation;
+
+        TemplateMatrix *view = &reader->view;
+        memset(view, 0, sizeof(*view));
+        view->num_templates = header->num_templates;
+        view->dim = header->dim;
+        view->stride = header->stride;
+        if (header->codes_offset) {
+            view->codes = segment + header->codes_offset;
+            view->scales = (float*)(segment + header->scales_offset);
+            view->zero_points = (float*)(segment + header->zero_points_offset);
+        } else {
+            view->matrix = (float*)(segment + header->matrix_offset);
+        }
+        view->usernames = (char (*)[64])(segment + header->usernames_offset);
+        view->task_types = (MentalTask*)(segment + header->task_types_offset);
+        return 1;
+    }
+
+    log_message(NL_LOG_WARNING, "Snapshot announced but could not be mapped");
+    return reader->segment ? 0 : -1;
+}
+
+/**
+ * Get the mapped templates
+ */
+const TemplateMatrix* snapshot_matrix(const SnapshotReader *reader) {
+    return reader && reader->segment ? &reader->view : NULL;
+}
+
+/**
+ * Get the database generation the mapped snapshot was built from
+ */
+uint64_t snapshot_db_generation(const SnapshotReader *reader) {
+    return reader ? reader->db_generation : 0;
+}
+
+/**
+ * Unmap the snapshot and detach from the control file
+ */
+void snapshot_reader_close(SnapshotReader *reader) {
+    if (reader) {
+        if (reader->segment) {
+            munmap(reader->segment, reader->segment_size);
+        }
+        munmap((void*)reader->control, SNAPSHOT_CONTROL_SIZE);
+        close(reader->control_fd);
+        free(reader);
+    }
+}
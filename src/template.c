@@ -1,9 +1,14 @@
+#define _DEFAULT_SOURCE
 #include "template.h"
+#include "index_log.h"
+#include "vector_ops.h"
 #include "utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 
@@ -12,23 +17,23 @@
  */
 int template_create(const char *username, const EEGData **trials, size_t num_trials, MentalTask task, Template *output) {
     if (!username || !trials || !output || num_trials == 0) {
-        log_message(LOG_ERROR, "Invalid input for template creation");
+        log_message(NL_LOG_ERROR, "Invalid input for template creation");
         return -1;
     }
     
-    log_message(LOG_INFO, "Creating template for user: %s", username);
+    log_message(NL_LOG_INFO, "Creating template for user: %s", username);
     
     // Extract features from all trials
     FeatureVector **feature_vectors = (FeatureVector**)malloc(num_trials * sizeof(FeatureVector*));
     if (!feature_vectors) {
-        log_message(LOG_ERROR, "Failed to allocate feature vector array");
+        log_message(NL_LOG_ERROR, "Failed to allocate feature vector array");
         return -1;
     }
     
     for (size_t i = 0; i < num_trials; i++) {
         feature_vectors[i] = feature_vector_alloc(FEATURE_VECTOR_SIZE);
         if (!feature_vectors[i]) {
-            log_message(LOG_ERROR, "Failed to allocate feature vector");
+            log_message(NL_LOG_ERROR, "Failed to allocate feature vector");
             // Cleanup
             for (size_t j = 0; j < i; j++) {
                 feature_vector_free(feature_vectors[j]);
@@ -36,75 +41,103 @@ int template_create(const char *username, const EEGData **trials, size_t num_tri
             free(feature_vectors);
             return -1;
         }
-        
-        if (extract_features(trials[i], feature_vectors[i]) != 0) {
-            log_message(LOG_ERROR, "Failed to extract features from trial %zu", i);
-            // Cleanup
-            for (size_t j = 0; j <= i; j++) {
-                feature_vector_free(feature_vectors[j]);
-            }
-            free(feature_vectors);
-            return -1;
-        }
     }
     
-    // Average feature vectors
-    output->features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
-    if (!output->features) {
-        log_message(LOG_ERROR, "Failed to allocate averaged feature vector");
+    // Trials are independent: extract them in parallel on the shared scheduler
+    int *status = (int*)calloc(num_trials, sizeof(int));
+    if (!status ||
+        extract_features_batch(trials, num_trials, feature_vectors, status) != 0) {
+        for (size_t i = 0; status && i < num_trials; i++) {
+            if (status[i] != 0) {
+                log_message(NL_LOG_ERROR, "Failed to extract features from trial %zu", i);
+            }
+        }
         // Cleanup
+        free(status);
         for (size_t i = 0; i < num_trials; i++) {
             feature_vector_free(feature_vectors[i]);
         }
         free(feature_vectors);
         return -1;
     }
+    free(status);
     
-    if (average_feature_vectors((const FeatureVector**)feature_vectors, num_trials, output->features) != 0) {
-        log_message(LOG_ERROR, "Failed to average feature vectors");
+    // Average feature vectors
+    FeatureVector *mean = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    if (!mean || average_feature_vectors((const FeatureVector**)feature_vectors, num_trials, mean) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to average feature vectors");
         // Cleanup
         for (size_t i = 0; i < num_trials; i++) {
             feature_vector_free(feature_vectors[i]);
         }
         free(feature_vectors);
-        feature_vector_free(output->features);
+        feature_vector_free(mean);
+        return -1;
+    }
+    
+    // Spread across the enrolment trials seeds the adaptive variance
+    FeatureVector *variance = feature_vector_alloc(mean->size);
+    if (variance) {
+        for (size_t j = 0; j < mean->size; j++) {
+            float sum = 0.0f;
+            for (size_t i = 0; i < num_trials; i++) {
+                float d = feature_vectors[i]->features[j] - mean->features[j];
+                sum += d * d;
+            }
+            variance->features[j] = sum / (float)num_trials;
+        }
+        variance->task_type = mean->task_type;
+    } else {
+        log_message(NL_LOG_WARNING, "Failed to allocate template variance");
+    }
+    
+    int result = template_from_features(username, task, (const FeatureVector**)feature_vectors, num_trials,
+                                        mean, variance, output);
+    
+    // Cleanup
+    for (size_t i = 0; i < num_trials; i++) {
+        feature_vector_free(feature_vectors[i]);
+    }
+    free(feature_vectors);
+    return result;
+}
+
+/**
+ * Build a template around an already computed mean and variance
+ */
+int template_from_features(const char *username, MentalTask task, const FeatureVector **trials, size_t num_trials,
+                           FeatureVector *mean, FeatureVector *variance, Template *output) {
+    if (!username || !trials || !mean || !output || num_trials == 0) {
+        log_message(NL_LOG_ERROR, "Invalid input for template creation");
+        feature_vector_free(mean);
+        feature_vector_free(variance);
         return -1;
     }
+    output->features = mean;
+    output->variance = variance;
     
     // Generate salt
     output->hash = hash_data_alloc(HASH_OUTPUT_SIZE, SALT_LENGTH);
     if (!output->hash) {
-        log_message(LOG_ERROR, "Failed to allocate hash data");
-        // Cleanup
-        for (size_t i = 0; i < num_trials; i++) {
-            feature_vector_free(feature_vectors[i]);
-        }
-        free(feature_vectors);
+        log_message(NL_LOG_ERROR, "Failed to allocate hash data");
         feature_vector_free(output->features);
+        feature_vector_free(output->variance);
         return -1;
     }
     
     if (generate_salt(output->hash->salt, SALT_LENGTH) != 0) {
-        log_message(LOG_ERROR, "Failed to generate salt");
-        // Cleanup
-        for (size_t i = 0; i < num_trials; i++) {
-            feature_vector_free(feature_vectors[i]);
-        }
-        free(feature_vectors);
+        log_message(NL_LOG_ERROR, "Failed to generate salt");
         feature_vector_free(output->features);
+        feature_vector_free(output->variance);
         hash_data_free(output->hash);
         return -1;
     }
     
     // Hash the averaged features
     if (hash_features(output->features, output->hash->salt, SALT_LENGTH, output->hash) != 0) {
-        log_message(LOG_ERROR, "Failed to hash features");
-        // Cleanup
-        for (size_t i = 0; i < num_trials; i++) {
-            feature_vector_free(feature_vectors[i]);
-        }
-        free(feature_vectors);
+        log_message(NL_LOG_ERROR, "Failed to hash features");
         feature_vector_free(output->features);
+        feature_vector_free(output->variance);
         hash_data_free(output->hash);
         return -1;
     }
@@ -116,14 +149,360 @@ int template_create(const char *username, const EEGData **trials, size_t num_tri
     output->created_at = time(NULL);
     output->last_used = output->created_at;
     output->version = 1;
+    output->znorm_mean = 0.0f;
+    output->znorm_std = 0.0f;
+    output->lda_weights = NULL;
+    output->lda_bias = 0.0f;
     
-    // Cleanup
-    for (size_t i = 0; i < num_trials; i++) {
-        feature_vector_free(feature_vectors[i]);
+    // Keep the trials themselves, unit-normalized and packed row after row
+    size_t keep = num_trials < TEMPLATE_MAX_EXEMPLARS ? num_trials : TEMPLATE_MAX_EXEMPLARS;
+    size_t dim = output->features->size;
+    output->exemplars = (float*)malloc(keep * dim * sizeof(float));
+    output->num_exemplars = 0;
+    for (size_t i = 0; output->exemplars && i < keep; i++) {
+        float magnitude = vector_magnitude(trials[i]->features, dim);
+        if (magnitude < 1e-6f) continue;
+        float *row = output->exemplars + output->num_exemplars * dim;
+        for (size_t j = 0; j < dim; j++) {
+            row[j] = trials[i]->features[j] / magnitude;
+        }
+        output->num_exemplars++;
     }
-    free(feature_vectors);
+    if (!output->exemplars) {
+        log_message(NL_LOG_WARNING, "Failed to allocate template exemplars");
+    }
+    
+    log_message(NL_LOG_INFO, "Template created successfully");
+    return 0;
+}
+
+/*
+ * Template file layout (little-endian, offsets in bytes):
+ *
+ *   0  magic            u32   TEMPLATE_FILE_MAGIC
+ *   4  format version   u16
+ *   6  header size      u16   offset of the section table
+ *   8  file size        u32
+ *  12  crc32            u32   CRC of the whole file with this field zeroed
+ *  16  template version u32
+ *  20  task type        u32
+ *  24  created_at       i64
+ *  32  last_used        i64
+ *  40  section count    u32
+ *  44  flags            u32   reserved, 0
+ *  48  username         char[64]
+ * 112  reserved         (zero up to header size)
+ *
+ * The section table follows the header as {u32 type, u32 offset, u32 length}
+ * entries; payloads are 16-byte aligned. Unknown section types are skipped.
+ */
+#define TEMPLATE_SECTION_ENTRY_SIZE 12
+#define TEMPLATE_SECTION_ALIGN 16
+
+static size_t align_section(size_t offset) {
+    return (offset + TEMPLATE_SECTION_ALIGN - 1) & ~(size_t)(TEMPLATE_SECTION_ALIGN - 1);
+}
+
+/**
+ * Serialize template into the versioned on-disk format
+ */
+int template_serialize(const Template *template, uint8_t **buffer, size_t *size) {
+    if (!template || !template->features || !template->hash || !buffer || !size) {
+        log_message(NL_LOG_ERROR, "Invalid input for template serialization");
+        return -1;
+    }
+    
+    const FeatureVector *variance = template->variance;
+    if (variance && variance->size != template->features->size) {
+        log_message(NL_LOG_ERROR, "Template variance does not match feature count");
+        return -1;
+    }
+    
+    size_t num_exemplars = template->exemplars ? template->num_exemplars : 0;
+    int has_znorm = template->znorm_std > 0.0f;
+    int has_lda = template->lda_weights != NULL;
+    
+    const uint32_t num_sections = 3 + (variance ? 1 : 0) + (num_exemplars ? 1 : 0) + (has_znorm ? 1 : 0) +
+                                  (has_lda ? 1 : 0);
+    size_t features_len = template->features->size * sizeof(float);
+    size_t exemplars_len = num_exemplars * features_len;
+    size_t features_off = align_section(TEMPLATE_FILE_HEADER_SIZE + num_sections * TEMPLATE_SECTION_ENTRY_SIZE);
+    size_t hash_off = align_section(features_off + features_len);
+    size_t salt_off = align_section(hash_off + template->hash->hash_size);
+    size_t total = salt_off + template->hash->salt_size;
+    size_t variance_off = align_section(total);
+    if (variance) {
+        total = variance_off + features_len;
+    }
+    size_t exemplars_off = align_section(total);
+    if (num_exemplars) {
+        total = exemplars_off + exemplars_len;
+    }
+    size_t znorm_off = align_section(total);
+    if (has_znorm) {
+        total = znorm_off + 2 * sizeof(float);
+    }
+    size_t lda_off = align_section(total);
+    if (has_lda) {
+        total = lda_off + features_len + sizeof(float);
+    }
+    
+    if (total > TEMPLATE_FILE_MAX_SIZE) {
+        log_message(NL_LOG_ERROR, "Template too large to serialize (%zu bytes)", total);
+        return -1;
+    }
+    
+    uint8_t *buf = (uint8_t*)calloc(1, total);
+    if (!buf) {
+        log_message(NL_LOG_ERROR, "Failed to allocate template buffer");
+        return -1;
+    }
+    
+    // Fixed header
+    store_le32(buf + 0, TEMPLATE_FILE_MAGIC);
+    store_le16(buf + 4, TEMPLATE_FILE_VERSION);
+    store_le16(buf + 6, TEMPLATE_FILE_HEADER_SIZE);
+    store_le32(buf + 8, (uint32_t)total);
+    store_le32(buf + 16, template->version);
+    store_le32(buf + 20, (uint32_t)template->task_type);
+    store_le64(buf + 24, (uint64_t)(int64_t)template->created_at);
+    store_le64(buf + 32, (uint64_t)(int64_t)template->last_used);
+    store_le32(buf + 40, num_sections);
+    memcpy(buf + 48, template->username, sizeof(template->username));
+    buf[48 + sizeof(template->username) - 1] = '\0';
+    
+    // Section table
+    uint8_t *entry = buf + TEMPLATE_FILE_HEADER_SIZE;
+    store_le32(entry + 0, TEMPLATE_SECTION_FEATURES);
+    store_le32(entry + 4, (uint32_t)features_off);
+    store_le32(entry + 8, (uint32_t)features_len);
+    entry += TEMPLATE_SECTION_ENTRY_SIZE;
+    store_le32(entry + 0, TEMPLATE_SECTION_HASH);
+    store_le32(entry + 4, (uint32_t)hash_off);
+    store_le32(entry + 8, (uint32_t)template->hash->hash_size);
+    entry += TEMPLATE_SECTION_ENTRY_SIZE;
+    store_le32(entry + 0, TEMPLATE_SECTION_SALT);
+    store_le32(entry + 4, (uint32_t)salt_off);
+    store_le32(entry + 8, (uint32_t)template->hash->salt_size);
+    if (variance) {
+        entry += TEMPLATE_SECTION_ENTRY_SIZE;
+        store_le32(entry + 0, TEMPLATE_SECTION_VARIANCE);
+        store_le32(entry + 4, (uint32_t)variance_off);
+        store_le32(entry + 8, (uint32_t)features_len);
+    }
+    if (num_exemplars) {
+        entry += TEMPLATE_SECTION_ENTRY_SIZE;
+        store_le32(entry + 0, TEMPLATE_SECTION_EXEMPLARS);
+        store_le32(entry + 4, (uint32_t)exemplars_off);
+        store_le32(entry + 8, (uint32_t)exemplars_len);
+    }
+    if (has_znorm) {
+        entry += TEMPLATE_SECTION_ENTRY_SIZE;
+        store_le32(entry + 0, TEMPLATE_SECTION_ZNORM);
+        store_le32(entry + 4, (uint32_t)znorm_off);
+        store_le32(entry + 8, 2 * sizeof(float));
+    }
+    if (has_lda) {
+        entry += TEMPLATE_SECTION_ENTRY_SIZE;
+        store_le32(entry + 0, TEMPLATE_SECTION_LDA);
+        store_le32(entry + 4, (uint32_t)lda_off);
+        store_le32(entry + 8, (uint32_t)(features_len + sizeof(float)));
+    }
+    
+    // Payloads
+    for (size_t i = 0; i < template->features->size; i++) {
+        store_le_f32(buf + features_off + i * sizeof(float), template->features->features[i]);
+    }
+    memcpy(buf + hash_off, template->hash->hash, template->hash->hash_size);
+    memcpy(buf + salt_off, template->hash->salt, template->hash->salt_size);
+    for (size_t i = 0; variance && i < variance->size; i++) {
+        store_le_f32(buf + variance_off + i * sizeof(float), variance->features[i]);
+    }
+    for (size_t i = 0; i < num_exemplars * template->features->size; i++) {
+        store_le_f32(buf + exemplars_off + i * sizeof(float), template->exemplars[i]);
+    }
+    if (has_znorm) {
+        store_le_f32(buf + znorm_off, template->znorm_mean);
+        store_le_f32(buf + znorm_off + sizeof(float), template->znorm_std);
+    }
+    for (size_t i = 0; has_lda && i < template->features->size; i++) {
+        store_le_f32(buf + lda_off + i * sizeof(float), template->lda_weights[i]);
+    }
+    if (has_lda) {
+        store_le_f32(buf + lda_off + features_len, template->lda_bias);
+    }
+    
+    store_le32(buf + 12, crc32_update(0, buf, total));
+    
+    *buffer = buf;
+    *size = total;
+    return 0;
+}
+
+/**
+ * Parse a template from the on-disk format
+ */
+int template_deserialize(const uint8_t *buffer, size_t size, Template *output) {
+    if (!buffer || !output) {
+        log_message(NL_LOG_ERROR, "Invalid input for template deserialization");
+        return -1;
+    }
+    
+    if (size < TEMPLATE_FILE_HEADER_SIZE || load_le32(buffer) != TEMPLATE_FILE_MAGIC) {
+        log_message(NL_LOG_ERROR, "Not a NeuroLock template (bad magic)");
+        return -1;
+    }
+    
+    uint16_t format_version = load_le16(buffer + 4);
+    uint16_t header_size = load_le16(buffer + 6);
+    uint32_t file_size = load_le32(buffer + 8);
+    uint32_t num_sections = load_le32(buffer + 40);
+    
+    if (format_version != TEMPLATE_FILE_VERSION) {
+        log_message(NL_LOG_ERROR, "Unsupported template format version %u", format_version);
+        return -1;
+    }
+    
+    if (file_size != size || header_size < TEMPLATE_FILE_HEADER_SIZE ||
+        (size_t)header_size + (size_t)num_sections * TEMPLATE_SECTION_ENTRY_SIZE > size) {
+        log_message(NL_LOG_ERROR, "Template header does not match file size (%zu bytes)", size);
+        return -1;
+    }
+    
+    // CRC covers the whole file with the CRC field taken as zero
+    static const uint8_t zero_crc[4] = {0, 0, 0, 0};
+    uint32_t crc = crc32_update(0, buffer, 12);
+    crc = crc32_update(crc, zero_crc, sizeof(zero_crc));
+    crc = crc32_update(crc, buffer + 16, size - 16);
+    if (crc != load_le32(buffer + 12)) {
+        log_message(NL_LOG_ERROR, "Template checksum mismatch");
+        return -1;
+    }
+    
+    // Locate sections
+    const uint8_t *features = NULL, *hash = NULL, *salt = NULL, *variance = NULL, *exemplars = NULL, *znorm = NULL;
+    const uint8_t *lda = NULL;
+    uint32_t features_len = 0, hash_len = 0, salt_len = 0, variance_len = 0, exemplars_len = 0, znorm_len = 0;
+    uint32_t lda_len = 0;
+    
+    for (uint32_t i = 0; i < num_sections; i++) {
+        const uint8_t *entry = buffer + header_size + (size_t)i * TEMPLATE_SECTION_ENTRY_SIZE;
+        uint32_t type = load_le32(entry);
+        uint32_t offset = load_le32(entry + 4);
+        uint32_t length = load_le32(entry + 8);
+        
+        if ((size_t)offset + length > size) {
+            log_message(NL_LOG_ERROR, "Template section %u out of bounds", type);
+            return -1;
+        }
+        
+        switch (type) {
+            case TEMPLATE_SECTION_FEATURES:
+                features = buffer + offset;
+                features_len = length;
+                break;
+            case TEMPLATE_SECTION_HASH:
+                hash = buffer + offset;
+                hash_len = length;
+                break;
+            case TEMPLATE_SECTION_SALT:
+                salt = buffer + offset;
+                salt_len = length;
+                break;
+            case TEMPLATE_SECTION_VARIANCE:
+                variance = buffer + offset;
+                variance_len = length;
+                break;
+            case TEMPLATE_SECTION_EXEMPLARS:
+                exemplars = buffer + offset;
+                exemplars_len = length;
+                break;
+            case TEMPLATE_SECTION_ZNORM:
+                znorm = buffer + offset;
+                znorm_len = length;
+                break;
+            case TEMPLATE_SECTION_LDA:
+                lda = buffer + offset;
+                lda_len = length;
+                break;
+            default:
+                break;
+        }
+    }
+    
+    if (!features || !hash || !salt || features_len == 0 || features_len % sizeof(float) != 0) {
+        log_message(NL_LOG_ERROR, "Template is missing required sections");
+        return -1;
+    }
+    
+    size_t feature_count = features_len / sizeof(float);
+    output->features = feature_vector_alloc(feature_count);
+    if (!output->features) {
+        return -1;
+    }
+    
+    output->hash = hash_data_alloc(hash_len, salt_len);
+    if (!output->hash) {
+        feature_vector_free(output->features);
+        output->features = NULL;
+        return -1;
+    }
+    
+    // A variance section of the wrong length is ignored rather than rejected
+    output->variance = NULL;
+    if (variance && variance_len == features_len) {
+        output->variance = feature_vector_alloc(feature_count);
+        for (size_t i = 0; output->variance && i < feature_count; i++) {
+            output->variance->features[i] = load_le_f32(variance + i * sizeof(float));
+        }
+    }
+    
+    // Likewise exemplars that are not whole rows or exceed the limit are dropped
+    output->exemplars = NULL;
+    output->num_exemplars = 0;
+    if (exemplars && exemplars_len > 0 && exemplars_len % features_len == 0 &&
+        exemplars_len / features_len <= TEMPLATE_MAX_EXEMPLARS) {
+        size_t count = exemplars_len / sizeof(float);
+        output->exemplars = (float*)malloc(exemplars_len);
+        for (size_t i = 0; output->exemplars && i < count; i++) {
+            output->exemplars[i] = load_le_f32(exemplars + i * sizeof(float));
+        }
+        output->num_exemplars = output->exemplars ? exemplars_len / features_len : 0;
+    }
+    
+    // Z-norm statistics are only trusted with a positive spread
+    output->znorm_mean = 0.0f;
+    output->znorm_std = 0.0f;
+    if (znorm && znorm_len == 2 * sizeof(float) && load_le_f32(znorm + sizeof(float)) > 0.0f) {
+        output->znorm_mean = load_le_f32(znorm);
+        output->znorm_std = load_le_f32(znorm + sizeof(float));
+    }
+    
+    // A discriminant for a different feature count is dropped
+    output->lda_weights = NULL;
+    output->lda_bias = 0.0f;
+    if (lda && lda_len == features_len + sizeof(float)) {
+        output->lda_weights = (float*)malloc(features_len);
+        for (size_t i = 0; output->lda_weights && i < feature_count; i++) {
+            output->lda_weights[i] = load_le_f32(lda + i * sizeof(float));
+        }
+        output->lda_bias = output->lda_weights ? load_le_f32(lda + features_len) : 0.0f;
+    }
+    
+    output->version = load_le32(buffer + 16);
+    output->task_type = (MentalTask)load_le32(buffer + 20);
+    output->created_at = (time_t)(int64_t)load_le64(buffer + 24);
+    output->last_used = (time_t)(int64_t)load_le64(buffer + 32);
+    memcpy(output->username, buffer + 48, sizeof(output->username));
+    output->username[sizeof(output->username) - 1] = '\0';
+    
+    for (size_t i = 0; i < feature_count; i++) {
+        output->features->features[i] = load_le_f32(features + i * sizeof(float));
+    }
+    output->features->task_type = output->task_type;
+    memcpy(output->hash->hash, hash, hash_len);
+    memcpy(output->hash->salt, salt, salt_len);
     
-    log_message(LOG_INFO, "Template created successfully");
     return 0;
 }
 
@@ -132,44 +511,58 @@ int template_create(const char *username, const EEGData **trials, size_t num_tri
  */
 int template_save(const Template *template, const char *filepath) {
     if (!template || !filepath) {
-        log_message(LOG_ERROR, "Invalid input for template save");
+        log_message(NL_LOG_ERROR, "Invalid input for template save");
         return -1;
     }
     
-    log_message(LOG_INFO, "Saving template to: %s", filepath);
+    log_message(NL_LOG_INFO, "Saving template to: %s", filepath);
     
     // Ensure template directory exists
     if (create_directory(TEMPLATE_DIR) != 0) {
-        log_message(LOG_ERROR, "Failed to create template directory");
+        log_message(NL_LOG_ERROR, "Failed to create template directory");
         return -1;
     }
     
-    FILE *fp = fopen(filepath, "wb");
-    if (!fp) {
-        log_message(LOG_ERROR, "Failed to open file for writing: %s", filepath);
+    uint8_t *buffer;
+    size_t size;
+    if (template_serialize(template, &buffer, &size) != 0) {
         return -1;
     }
     
-    // Write template metadata
-    fwrite(&template->version, sizeof(uint32_t), 1, fp);
-    fwrite(template->username, sizeof(char), 64, fp);
-    fwrite(&template->task_type, sizeof(MentalTask), 1, fp);
-    fwrite(&template->created_at, sizeof(time_t), 1, fp);
-    fwrite(&template->last_used, sizeof(time_t), 1, fp);
+    // Write a sibling temp file and rename it over the old template so a crash
+    // leaves either the previous or the new version, never a torn file
+    char tmp_path[520];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", filepath) >= (int)sizeof(tmp_path)) {
+        log_message(NL_LOG_ERROR, "Template path too long: %s", filepath);
+        free(buffer);
+        return -1;
+    }
+    
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open file for writing: %s", tmp_path);
+        free(buffer);
+        return -1;
+    }
     
-    // Write feature vector
-    fwrite(&template->features->size, sizeof(size_t), 1, fp);
-    fwrite(template->features->features, sizeof(float), template->features->size, fp);
+    // Whole template in a single write
+    ssize_t written = pwrite(fd, buffer, size, 0);
+    int sync_result = fsync(fd);
+    int close_result = close(fd);
+    free(buffer);
     
-    // Write hash data
-    fwrite(&template->hash->hash_size, sizeof(size_t), 1, fp);
-    fwrite(template->hash->hash, sizeof(uint8_t), template->hash->hash_size, fp);
-    fwrite(&template->hash->salt_size, sizeof(size_t), 1, fp);
-    fwrite(template->hash->salt, sizeof(uint8_t), template->hash->salt_size, fp);
+    if (written != (ssize_t)size || sync_result != 0 || close_result != 0 ||
+        rename(tmp_path, filepath) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to write template: %s", filepath);
+        unlink(tmp_path);
+        return -1;
+    }
     
-    fclose(fp);
+    if (sync_parent_directory(filepath) != 0) {
+        log_message(NL_LOG_WARNING, "Failed to sync template directory for: %s", filepath);
+    }
     
-    log_message(LOG_INFO, "Template saved successfully");
+    log_message(NL_LOG_INFO, "Template saved successfully");
     return 0;
 }
 
@@ -178,60 +571,45 @@ int template_save(const Template *template, const char *filepath) {
  */
 int template_load(const char *filepath, Template *output) {
     if (!filepath || !output) {
-        log_message(LOG_ERROR, "Invalid input for template load");
+        log_message(NL_LOG_ERROR, "Invalid input for template load");
         return -1;
     }
     
-    log_message(LOG_INFO, "Loading template from: %s", filepath);
+    log_message(NL_LOG_INFO, "Loading template from: %s", filepath);
     
-    FILE *fp = fopen(filepath, "rb");
-    if (!fp) {
-        log_message(LOG_ERROR, "Failed to open file for reading: %s", filepath);
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open file for reading: %s", filepath);
         return -1;
     }
     
-    // Read template metadata
-    fread(&output->version, sizeof(uint32_t), 1, fp);
-    fread(output->username, sizeof(char), 64, fp);
-    fread(&output->task_type, sizeof(MentalTask), 1, fp);
-    fread(&output->created_at, sizeof(time_t), 1, fp);
-    fread(&output->last_used, sizeof(time_t), 1, fp);
-    
-    // Read feature vector
-    size_t feature_size;
-    fread(&feature_size, sizeof(size_t), 1, fp);
-    output->features = feature_vector_alloc(feature_size);
-    if (!output->features) {
-        fclose(fp);
+    uint8_t *buffer = (uint8_t*)malloc(TEMPLATE_FILE_MAX_SIZE);
+    if (!buffer) {
+        log_message(NL_LOG_ERROR, "Failed to allocate template buffer");
+        close(fd);
         return -1;
     }
-    fread(output->features->features, sizeof(float), feature_size, fp);
     
-    // Read hash data
-    size_t hash_size, salt_size;
-    fread(&hash_size, sizeof(size_t), 1, fp);
-    fread(&salt_size, sizeof(size_t), 1, fp);
+    // Whole template in a single read; a full buffer means the file is oversized
+    ssize_t n = pread(fd, buffer, TEMPLATE_FILE_MAX_SIZE, 0);
+    close(fd);
     
-    // Allocate hash data before reading salt_size again
-    output->hash = hash_data_alloc(hash_size, salt_size);
-    if (!output->hash) {
-        feature_vector_free(output->features);
-        fclose(fp);
+    if (n <= 0 || n >= TEMPLATE_FILE_MAX_SIZE) {
+        log_message(NL_LOG_ERROR, "Failed to read template: %s", filepath);
+        free(buffer);
         return -1;
     }
     
-    // Seek back to read hash and salt
-    fseek(fp, -(long)(sizeof(size_t)), SEEK_CUR);
-    fread(&output->hash->salt_size, sizeof(size_t), 1, fp);
-    
-    fseek(fp, -(long)(sizeof(size_t) * 2 + hash_size), SEEK_CUR);
-    fread(output->hash->hash, sizeof(uint8_t), hash_size, fp);
-    fseek(fp, sizeof(size_t), SEEK_CUR);
-    fread(output->hash->salt, sizeof(uint8_t), salt_size, fp);
+    int result = template_deserialize(buffer, (size_t)n, output);
+    secure_wipe(buffer, (size_t)n);
+    free(buffer);
     
-    fclose(fp);
+    if (result != 0) {
+        log_message(NL_LOG_ERROR, "Invalid template file: %s", filepath);
+        return -1;
+    }
     
-    log_message(LOG_INFO, "Template loaded successfully");
+    log_message(NL_LOG_INFO, "Template loaded successfully");
     return 0;
 }
 
@@ -240,12 +618,12 @@ int template_load(const char *filepath, Template *output) {
  */
 float calculate_similarity(const FeatureVector *vec1, const FeatureVector *vec2) {
     if (!vec1 || !vec2 || !vec1->features || !vec2->features) {
-        log_message(LOG_ERROR, "Invalid feature vectors for similarity calculation");
+        log_message(NL_LOG_ERROR, "Invalid feature vectors for similarity calculation");
         return -1.0f;
     }
     
     if (vec1->size != vec2->size) {
-        log_message(LOG_ERROR, "Feature vectors have different sizes");
+        log_message(NL_LOG_ERROR, "Feature vectors have different sizes");
         return -1.0f;
     }
     
@@ -254,7 +632,7 @@ float calculate_similarity(const FeatureVector *vec1, const FeatureVector *vec2)
     float mag2 = vector_magnitude(vec2->features, vec2->size);
     
     if (mag1 < 1e-6f || mag2 < 1e-6f) {
-        log_message(LOG_ERROR, "Zero magnitude vector");
+        log_message(NL_LOG_ERROR, "Zero magnitude vector");
         return -1.0f;
     }
     
@@ -267,17 +645,96 @@ float calculate_similarity(const FeatureVector *vec1, const FeatureVector *vec2)
     return similarity;
 }
 
+/**
+ * Score a probe against a template's mean and exemplars in one pass
+ */
+float fused_similarity(const FeatureVector *mean, const float *exemplars, size_t num_exemplars,
+                       const FeatureVector *probe, FusionRule rule) {
+    if (!mean || !probe || !mean->features || !probe->features) {
+        log_message(NL_LOG_ERROR, "Invalid feature vectors for similarity calculation");
+        return -1.0f;
+    }
+    
+    if (!exemplars || num_exemplars == 0) {
+        return calculate_similarity(probe, mean);
+    }
+    
+    size_t dim = probe->size;
+    if (mean->size != dim || dim > FEATURE_VECTOR_SIZE || num_exemplars > TEMPLATE_MAX_EXEMPLARS) {
+        log_message(NL_LOG_ERROR, "Feature vectors have different sizes");
+        return -1.0f;
+    }
+    
+    float probe_mag = vector_magnitude(probe->features, dim);
+    float mean_mag = vector_magnitude(mean->features, dim);
+    if (probe_mag < 1e-6f || mean_mag < 1e-6f) {
+        log_message(NL_LOG_ERROR, "Zero magnitude vector");
+        return -1.0f;
+    }
+    
+    float unit[FEATURE_VECTOR_SIZE];
+    for (size_t i = 0; i < dim; i++) {
+        unit[i] = probe->features[i] / probe_mag;
+    }
+    
+    // Exemplar rows are contiguous and unit-norm: one sweep gives every cosine
+    float scores[TEMPLATE_MAX_EXEMPLARS + 1];
+    matvec_f32(exemplars, num_exemplars, dim, dim, unit, scores);
+    scores[num_exemplars] = dot_f32(mean->features, unit, dim) / mean_mag;
+    size_t n = num_exemplars + 1;
+    
+    float best = scores[0];
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        if (scores[i] > best) best = scores[i];
+        sum += scores[i];
+    }
+    
+    float similarity;
+    if (rule == FUSION_MAX) {
+        similarity = best;
+    } else if (rule == FUSION_MEAN) {
+        similarity = sum / (float)n;
+    } else {
+        // Shift by the maximum so the exponentials cannot overflow
+        float weight_sum = 0.0f, weighted = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            float w = expf((scores[i] - best) / (float)TEMPLATE_FUSION_TEMPERATURE);
+            weight_sum += w;
+            weighted += w * scores[i];
+        }
+        similarity = weighted / weight_sum;
+    }
+    
+    if (similarity < 0.0f) similarity = 0.0f;
+    if (similarity > 1.0f) similarity = 1.0f;
+    
+    return similarity;
+}
+
+/**
+ * Score a probe against a template with the configured fusion rule
+ */
+float template_similarity(const Template *template, const FeatureVector *probe) {
+    if (!template) {
+        log_message(NL_LOG_ERROR, "Invalid template for similarity calculation");
+        return -1.0f;
+    }
+    return fused_similarity(template->features, template->exemplars, template->num_exemplars,
+                            probe, (FusionRule)TEMPLATE_FUSION_RULE);
+}
+
 /**
  * Calculate Hamming distance between two hashes
  */
 int calculate_hamming_distance(const HashData *hash1, const HashData *hash2) {
     if (!hash1 || !hash2) {
-        log_message(LOG_ERROR, "Invalid hashes for Hamming distance");
+        log_message(NL_LOG_ERROR, "Invalid hashes for Hamming distance");
         return -1;
     }
     
     if (hash1->hash_size != hash2->hash_size) {
-        log_message(LOG_ERROR, "Hashes have different sizes");
+        log_message(NL_LOG_ERROR, "Hashes have different sizes");
         return -1;
     }
     
@@ -299,39 +756,41 @@ int calculate_hamming_distance(const HashData *hash1, const HashData *hash2) {
  */
 int template_authenticate(const EEGData *trial, const Template *template, AuthResult *result) {
     if (!trial || !template || !result) {
-        log_message(LOG_ERROR, "Invalid input for authentication");
+        log_message(NL_LOG_ERROR, "Invalid input for authentication");
         return -1;
     }
     
-    log_message(LOG_INFO, "Authenticating against template for user: %s", template->username);
+    log_message(NL_LOG_INFO, "Authenticating against template for user: %s", template->username);
     
     // Extract features from trial
     FeatureVector *trial_features = feature_vector_alloc(FEATURE_VECTOR_SIZE);
     if (!trial_features) {
-        log_message(LOG_ERROR, "Failed to allocate trial feature vector");
+        log_message(NL_LOG_ERROR, "Failed to allocate trial feature vector");
         return -1;
     }
     
     if (extract_features(trial, trial_features) != 0) {
-        log_message(LOG_ERROR, "Failed to extract features from trial");
+        log_message(NL_LOG_ERROR, "Failed to extract features from trial");
         feature_vector_free(trial_features);
         return -1;
     }
     
-    // Calculate similarity
-    float similarity = calculate_similarity(trial_features, template->features);
+    // Score against the mean and every exemplar in one pass
+    float similarity = template_similarity(template, trial_features);
     
     result->similarity_score = similarity;
+    result->normalized_score = similarity;
+    result->normalized = 0;
     result->timestamp = time(NULL);
-    result->attempts = 1;
+    result->attempts = 0;                   // Set by the caller from its attempt table
     
     // Check if similarity exceeds threshold
     if (similarity >= SIMILARITY_THRESHOLD) {
         result->authenticated = 1;
-        log_message(LOG_INFO, "Authentication SUCCESSFUL (similarity: %.3f)", similarity);
+        log_message(NL_LOG_INFO, "Authentication SUCCESSFUL (similarity: %.3f)", similarity);
     } else {
         result->authenticated = 0;
-        log_message(LOG_WARNING, "Authentication FAILED (similarity: %.3f < %.3f)", 
+        log_message(NL_LOG_WARNING, "Authentication FAILED (similarity: %.3f < %.3f)", 
                    similarity, SIMILARITY_THRESHOLD);
     }
     
@@ -343,9 +802,127 @@ int template_authenticate(const EEGData *trial, const Template *template, AuthRe
  * Update template with new authentication data
  */
 int template_update(Template *template, const EEGData *trial) {
-    // TODO: Implement adaptive learning
-    // This would update the template with new successful authentication data
-    log_message(LOG_INFO, "Template update not yet implemented");
+    if (!template || !trial) {
+        log_message(NL_LOG_ERROR, "Invalid input for template update");
+        return -1;
+    }
+    
+    FeatureVector *sample = feature_vector_alloc(FEATURE_VECTOR_SIZE);
+    if (!sample) {
+        log_message(NL_LOG_ERROR, "Failed to allocate trial feature vector");
+        return -1;
+    }
+    
+    if (extract_features(trial, sample) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to extract features from trial");
+        feature_vector_free(sample);
+        return -1;
+    }
+    
+    int result = template_update_features(template, sample);
+    feature_vector_free(sample);
+    return result;
+}
+
+/**
+ * Fold a sample into the exponentially weighted mean and variance
+ */
+int template_update_features(Template *template, const FeatureVector *sample) {
+    if (!template || !template->features || !template->hash || !sample ||
+        sample->size != template->features->size) {
+        log_message(NL_LOG_ERROR, "Invalid input for template update");
+        return -1;
+    }
+    
+    // Refuse samples that would pull the template toward someone else
+    float similarity = calculate_similarity(sample, template->features);
+    if (similarity < TEMPLATE_UPDATE_MIN_SIMILARITY) {
+        log_message(NL_LOG_WARNING, "Not updating template for %s (similarity %.3f < %.3f)",
+                   template->username, similarity, TEMPLATE_UPDATE_MIN_SIMILARITY);
+        return 1;
+    }
+    
+    size_t size = template->features->size;
+    FeatureVector *mean = feature_vector_alloc(size);
+    FeatureVector *variance = feature_vector_alloc(size);
+    HashData *fresh = hash_data_alloc(template->hash->hash_size, template->hash->salt_size);
+    
+    // Room for one more exemplar while the set is below the limit; the larger
+    // buffer is harmless if the update fails after this
+    if (template->exemplars && template->num_exemplars < TEMPLATE_MAX_EXEMPLARS) {
+        float *grown = (float*)realloc(template->exemplars, (template->num_exemplars + 1) * size * sizeof(float));
+        if (!grown) {
+            hash_data_free(fresh);
+            fresh = NULL;
+        } else {
+            template->exemplars = grown;
+        }
+    }
+    if (!mean || !variance || !fresh) {
+        log_message(NL_LOG_ERROR, "Failed to allocate template update buffers");
+        feature_vector_free(mean);
+        feature_vector_free(variance);
+        hash_data_free(fresh);
+        return -1;
+    }
+    
+    // West's incremental EWMA: m += a*d; v = (1-a)*(v + a*d^2), d = x - m_old
+    const float alpha = (float)TEMPLATE_UPDATE_ALPHA;
+    for (size_t i = 0; i < size; i++) {
+        float m = template->features->features[i];
+        float v = template->variance ? template->variance->features[i] : 0.0f;
+        float d = sample->features[i] - m;
+        mean->features[i] = m + alpha * d;
+        variance->features[i] = (1.0f - alpha) * (v + alpha * d * d);
+    }
+    mean->task_type = template->features->task_type;
+    mean->timestamp = get_timestamp_ms();
+    variance->task_type = mean->task_type;
+    variance->timestamp = mean->timestamp;
+    
+    // Rehash under the existing salt into a separate buffer before committing anything
+    if (hash_features(mean, template->hash->salt, template->hash->salt_size, fresh) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to hash updated template");
+        feature_vector_free(mean);
+        feature_vector_free(variance);
+        hash_data_free(fresh);
+        return -1;
+    }
+    
+    hash_data_free(template->hash);
+    template->hash = fresh;
+    feature_vector_free(template->features);
+    feature_vector_free(template->variance);
+    template->features = mean;
+    template->variance = variance;
+    
+    // The exemplars follow drift too: the sample fills a free row, or replaces
+    // the exemplar it is closest to. Templates without exemplars stay mean-only
+    float magnitude = vector_magnitude(sample->features, size);
+    if (template->exemplars && magnitude >= 1e-6f) {
+        size_t row = template->num_exemplars;
+        if (row >= TEMPLATE_MAX_EXEMPLARS) {
+            float best = -2.0f;
+            for (size_t e = 0; e < template->num_exemplars; e++) {
+                float dot = dot_product(template->exemplars + e * size, sample->features, size);
+                if (dot > best) {
+                    best = dot;
+                    row = e;
+                }
+            }
+        } else {
+            template->num_exemplars++;
+        }
+        float *exemplar = template->exemplars + row * size;
+        for (size_t j = 0; j < size; j++) {
+            exemplar[j] = sample->features[j] / magnitude;
+        }
+    }
+    template->last_used = time(NULL);
+    template->version++;
+    
+    log_message(NL_LOG_INFO, "Template for %s updated to version %u (sample similarity %.3f)",
+               template->username, template->version, similarity);
     return 0;
 }
 
@@ -355,7 +932,7 @@ int template_update(Template *template, const EEGData *trial) {
 Template* template_alloc(void) {
     Template *template = (Template*)calloc(1, sizeof(Template));
     if (!template) {
-        log_message(LOG_ERROR, "Failed to allocate Template structure");
+        log_message(NL_LOG_ERROR, "Failed to allocate Template structure");
         return NULL;
     }
     
@@ -367,15 +944,110 @@ Template* template_alloc(void) {
  */
 void template_free(Template *template) {
     if (template) {
-        if (template->features) {
-            feature_vector_free(template->features);
+        template_clear(template);
+        free(template);
+    }
+}
+
+/**
+ * Wipe and free everything a template owns
+ */
+void template_clear(Template *template) {
+    if (!template) {
+        return;
+    }
+    size_t dim = template->features ? template->features->size : 0;
+    if (template->exemplars) {
+        secure_wipe(template->exemplars, template->num_exemplars * dim * sizeof(float));
+        free(template->exemplars);
+    }
+    if (template->lda_weights) {
+        secure_wipe(template->lda_weights, dim * sizeof(float));
+        free(template->lda_weights);
+    }
+    feature_vector_free(template->features);
+    feature_vector_free(template->variance);
+    hash_data_free(template->hash);
+    secure_wipe(template, sizeof(Template));
+}
+
+/**
+ * Deep-copy a template
+ */
+int template_copy(const Template *src, Template *dst) {
+    if (!src || !dst || !src->features || !src->hash) {
+        log_message(NL_LOG_ERROR, "Invalid input for template copy");
+        return -1;
+    }
+    
+    dst->features = feature_vector_alloc(src->features->size);
+    if (!dst->features) {
+        return -1;
+    }
+    
+    dst->hash = hash_data_alloc(src->hash->hash_size, src->hash->salt_size);
+    if (!dst->hash) {
+        feature_vector_free(dst->features);
+        dst->features = NULL;
+        return -1;
+    }
+    
+    dst->variance = NULL;
+    if (src->variance) {
+        dst->variance = feature_vector_alloc(src->variance->size);
+        if (!dst->variance) {
+            feature_vector_free(dst->features);
+            hash_data_free(dst->hash);
+            dst->features = NULL;
+            dst->hash = NULL;
+            return -1;
         }
-        if (template->hash) {
-            hash_data_free(template->hash);
+        memcpy(dst->variance->features, src->variance->features, src->variance->size * sizeof(float));
+    }
+    
+    dst->exemplars = NULL;
+    dst->num_exemplars = 0;
+    if (src->exemplars && src->num_exemplars > 0) {
+        size_t bytes = src->num_exemplars * src->features->size * sizeof(float);
+        dst->exemplars = (float*)malloc(bytes);
+        if (!dst->exemplars) {
+            feature_vector_free(dst->features);
+            feature_vector_free(dst->variance);
+            hash_data_free(dst->hash);
+            dst->features = NULL;
+            dst->variance = NULL;
+            dst->hash = NULL;
+            return -1;
+        }
+        memcpy(dst->exemplars, src->exemplars, bytes);
+        dst->num_exemplars = src->num_exemplars;
+    }
+    
+    memcpy(dst->username, src->username, sizeof(dst->username));
+    dst->task_type = src->task_type;
+    dst->created_at = src->created_at;
+    dst->last_used = src->last_used;
+    dst->version = src->version;
+    dst->znorm_mean = src->znorm_mean;
+    dst->znorm_std = src->znorm_std;
+    
+    dst->lda_weights = NULL;
+    dst->lda_bias = 0.0f;
+    if (src->lda_weights) {
+        dst->lda_weights = (float*)malloc(src->features->size * sizeof(float));
+        if (dst->lda_weights) {
+            memcpy(dst->lda_weights, src->lda_weights, src->features->size * sizeof(float));
+            dst->lda_bias = src->lda_bias;
         }
-        secure_wipe(template, sizeof(Template));
-        free(template);
     }
+    
+    memcpy(dst->features->features, src->features->features, src->features->size * sizeof(float));
+    dst->features->task_type = src->features->task_type;
+    dst->features->timestamp = src->features->timestamp;
+    memcpy(dst->hash->hash, src->hash->hash, src->hash->hash_size);
+    memcpy(dst->hash->salt, src->hash->salt, src->hash->salt_size);
+    
+    return 0;
 }
 
 /**
@@ -383,7 +1055,7 @@ void template_free(Template *template) {
  */
 int template_get_filepath(const char *username, char *output, size_t size) {
     if (!username || !output) {
-        log_message(LOG_ERROR, "Invalid input for filepath generation");
+        log_message(NL_LOG_ERROR, "Invalid input for filepath generation");
         return -1;
     }
     
@@ -408,10 +1080,14 @@ int template_delete(const char *username) {
     template_get_filepath(username, filepath, sizeof(filepath));
     
     if (remove(filepath) != 0) {
-        log_message(LOG_ERROR, "Failed to delete template: %s", filepath);
+        log_message(NL_LOG_ERROR, "Failed to delete template: %s", filepath);
         return -1;
     }
     
-    log_message(LOG_INFO, "Template deleted: %s", filepath);
+    if (index_log_record(HNSW_INDEX_PATH, PQ_INDEX_PATH, username, NULL) != 0) {
+        log_message(NL_LOG_WARNING, "Deleted user may still be returned by identify: %s", username);
+    }
+    
+    log_message(NL_LOG_INFO, "Template deleted: %s", filepath);
     return 0;
 }
@@ -0,0 +1,563 @@
+#define _DEFAULT_SOURCE
+#include "template_cache.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+#endif
+
+/*
+ * Readers traverse immutable-once-published bucket chains without locking.
+ * Writers (misses, invalidation, eviction) serialize on write_lock, unlink
+ * entries with atomic stores and free them only after a grace period: the
+ * epoch is flipped twice and each reader counter is waited on in turn, so
+ * every reader that could still see an unlinked entry has finished.
+ *
+ * template_cache_publish() swaps a new entry into the chain with one atomic
+ * store and parks the old one on a retired list instead of waiting; the list
+ * is freed by the next grace period any writer runs, or once RETIRE_BATCH
+ * entries accumulate, so a stream of adaptive updates pays for one grace
+ * period per batch.
+ */
+
+/* Retired entries held before a publish forces a grace period */
+#define RETIRE_BATCH 32
+
+typedef struct CacheEntry {
+    _Atomic(struct CacheEntry*) next;   // Bucket chain
+    uint64_t hash;                      // Username hash
+    uint32_t generation;                // Database record generation when loaded
+    atomic_int referenced;              // CLOCK reference bit
+    Template template;                  // Owned copy of the template
+} CacheEntry;
+
+struct TemplateCache {
+    TemplateDB *db;                     // Backing store (accessed under write_lock)
+    size_t capacity;                    // Maximum entries
+    size_t num_buckets;                 // Power of two
+    _Atomic(CacheEntry*) *buckets;
+    pthread_mutex_t write_lock;         // Serializes all writers
+    size_t count;                       // Entries (under write_lock)
+    size_t clock_hand;                  // Next bucket examined for eviction
+    atomic_uint epoch;                  // Selects reader counter
+    atomic_long readers[2];             // Active readers per epoch parity
+    atomic_ullong hits;
+    atomic_ullong misses;
+    atomic_ullong evictions;
+    atomic_ullong invalidations;
+    atomic_ullong updates;
+    struct CacheEntry **retired;        // Unlinked, awaiting a grace period (under write_lock)
+    size_t num_retired;
+    int inotify_fd;                     // Change notifications, -1 if not watching
+    char db_name[256];                  // Basename of the watched database file
+};
+
+static uint64_t cache_hash(const char *username) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < 64 && username[i]; i++) {
+        h ^= (uint8_t)username[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned read_lock(TemplateCache *cache) {
+    unsigned idx = atomic_load(&cache->epoch) & 1u;
+    atomic_fetch_add(&cache->readers[idx], 1);
+    return idx;
+}
+
+static void read_unlock(TemplateCache *cache, unsigned idx) {
+    atomic_fetch_sub(&cache->readers[idx], 1);
+}
+
+/**
+ * Wait until no reader can hold a reference to an unlinked entry
+ */
+static void synchronize_readers(TemplateCache *cache) {
+    for (int pass = 0; pass < 2; pass++) {
+        unsigned old = atomic_fetch_add(&cache->epoch, 1u) & 1u;
+        while (atomic_load(&cache->readers[old]) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+static void entry_free(CacheEntry *entry) {
+    if (entry) {
+        template_clear(&entry->template);
+        secure_wipe(entry, sizeof(CacheEntry));
+        free(entry);
+    }
+}
+
+static CacheEntry* bucket_find(_Atomic(CacheEntry*) *bucket, uint64_t hash, const char *username) {
+    for (CacheEntry *e = atomic_load(bucket); e; e = atomic_load(&e->next)) {
+        if (e->hash == hash && strncmp(e->template.username, username, sizeof(e->template.username)) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Unlink a user's entry from its chain (caller holds write_lock)
+ */
+static CacheEntry* unlink_locked(TemplateCache *cache, uint64_t hash, const char *username) {
+    _Atomic(CacheEntry*) *link = &cache->buckets[hash & (cache->num_buckets - 1)];
+    for (CacheEntry *e = atomic_load(link); e; link = &e->next, e = atomic_load(link)) {
+        if (e->hash == hash && strncmp(e->template.username, username, sizeof(e->template.username)) == 0) {
+            atomic_store(link, atomic_load(&e->next));
+            cache->count--;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Pick and unlink a victim with the CLOCK algorithm (caller holds write_lock)
+ */
+static CacheEntry* evict_one_locked(TemplateCache *cache) {
+    for (size_t step = 0; step < 2 * cache->num_buckets + 1; step++) {
+        size_t b = cache->clock_hand;
+        for (CacheEntry *e = atomic_load(&cache->buckets[b]); e; e = atomic_load(&e->next)) {
+            if (!atomic_exchange(&e->referenced, 0)) {
+                return unlink_locked(cache, e->hash, e->template.username);
+            }
+        }
+        cache->clock_hand = (b + 1) & (cache->num_buckets - 1);
+    }
+    return NULL;
+}
+
+/**
+ * Free retired entries; caller holds write_lock and has just run a grace period
+ */
+static void free_retired_locked(TemplateCache *cache) {
+    for (size_t i = 0; i < cache->num_retired; i++) {
+        entry_free(cache->retired[i]);
+    }
+    cache->num_retired = 0;
+}
+
+/**
+ * Create a template cache in front of a template database
+ */
+TemplateCache* template_cache_create(TemplateDB *db, size_t capacity) {
+    if (!db || capacity == 0) {
+        log_message(NL_LOG_ERROR, "Invalid input for template cache");
+        return NULL;
+    }
+
+    TemplateCache *cache = (TemplateCache*)calloc(1, sizeof(TemplateCache));
+    if (!cache) {
+        log_message(NL_LOG_ERROR, "Failed to allocate TemplateCache structure");
+        return NULL;
+    }
+
+    cache->num_buckets = 16;
+    while (cache->num_buckets < capacity) {
+        cache->num_buckets <<= 1;
+    }
+
+    cache->buckets = (_Atomic(CacheEntry*)*)calloc(cache->num_buckets, sizeof(*cache->buckets));
+    cache->retired = (CacheEntry**)malloc(RETIRE_BATCH * sizeof(CacheEntry*));
+    if (!cache->buckets || !cache->retired) {
+        log_message(NL_LOG_ERROR, "Failed to allocate template cache buckets");
+        free(cache->buckets);
+        free(cache->retired);
+        free(cache);
+        return NULL;
+    }
+
+    cache->db = db;
+    cache->capacity = capacity;
+    cache->inotify_fd = -1;
+    pthread_mutex_init(&cache->write_lock, NULL);
+
+    return cache;
+}
+
+/**
+ * Destroy cache, securely wiping every cached template
+ */
+void template_cache_destroy(TemplateCache *cache) {
+    if (!cache) {
+        return;
+    }
+
+    for (size_t b = 0; b < cache->num_buckets; b++) {
+        CacheEntry *e = atomic_load(&cache->buckets[b]);
+        while (e) {
+            CacheEntry *next = atomic_load(&e->next);
+            entry_free(e);
+            e = next;
+        }
+    }
+
+    free_retired_locked(cache);
+    if (cache->inotify_fd >= 0) {
+        close(cache->inotify_fd);
+    }
+    pthread_mutex_destroy(&cache->write_lock);
+    free(cache->retired);
+    free(cache->buckets);
+    free(cache);
+}
+
+/**
+ * Get a copy of a user's template, loading it from the database on a miss
+ */
+int template_cache_get(TemplateCache *cache, const char *username, Template *output) {
+    if (!cache || !username || !output) {
+        log_message(NL_LOG_ERROR, "Invalid input for template cache lookup");
+        return -1;
+    }
+
+    uint64_t hash = cache_hash(username);
+    _Atomic(CacheEntry*) *bucket = &cache->buckets[hash & (cache->num_buckets - 1)];
+
+    // Fast path: lock-free lookup
+    unsigned idx = read_lock(cache);
+    CacheEntry *entry = bucket_find(bucket, hash, username);
+    if (entry) {
+        atomic_store_explicit(&entry->referenced, 1, memory_order_relaxed);
+        int result = template_copy(&entry->template, output);
+        read_unlock(cache, idx);
+        atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+        return result;
+    }
+    read_unlock(cache, idx);
+
+    atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&cache->write_lock);
+
+    // Another thread may have filled it while we waited
+    entry = bucket_find(bucket, hash, username);
+    if (entry) {
+        int result = template_copy(&entry->template, output);
+        pthread_mutex_unlock(&cache->write_lock);
+        return result;
+    }
+
+    const TemplateRecord *record = template_db_find(cache->db, username);
+    if (!record) {
+        pthread_mutex_unlock(&cache->write_lock);
+        return -1;
+    }
+
+    entry = (CacheEntry*)calloc(1, sizeof(CacheEntry));
+    if (!entry) {
+        log_message(NL_LOG_ERROR, "Failed to allocate template cache entry");
+        pthread_mutex_unlock(&cache->write_lock);
+        return -1;
+    }
+
+    // Record the generation before copying so a concurrent rewrite is caught by the next sweep
+    entry->generation = record->generation;
+    if (template_db_get(cache->db, username, &entry->template) != 0) {
+        free(entry);
+        pthread_mutex_unlock(&cache->write_lock);
+        return -1;
+    }
+    entry->hash = hash;
+    atomic_init(&entry->referenced, 1);
+
+    CacheEntry *victim = NULL;
+    if (cache->count >= cache->capacity) {
+        victim = evict_one_locked(cache);
+    }
+
+    atomic_init(&entry->next, atomic_load(bucket));
+    atomic_store(bucket, entry);
+    cache->count++;
+
+    int result = template_copy(&entry->template, output);
+
+    if (victim) {
+        synchronize_readers(cache);
+        free_retired_locked(cache);
+        entry_free(victim);
+        atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&cache->write_lock);
+    return result;
+}
+
+/**
+ * Drop a user's cached template
+ */
+int template_cache_invalidate(TemplateCache *cache, const char *username) {
+    if (!cache || !username) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache->write_lock);
+    CacheEntry *entry = unlink_locked(cache, cache_hash(username), username);
+    if (entry) {
+        synchronize_readers(cache);
+        free_retired_locked(cache);
+        entry_free(entry);
+        atomic_fetch_add_explicit(&cache->invalidations, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&cache->write_lock);
+
+    return entry ? 1 : 0;
+}
+
+/**
+ * Publish a new version of a user's template without blocking readers
+ */
+int template_cache_publish(TemplateCache *cache, const Template *template) {
+    if (!cache || !template) {
+        log_message(NL_LOG_ERROR, "Invalid input for template cache publish");
+        return -1;
+    }
+
+    CacheEntry *entry = (CacheEntry*)calloc(1, sizeof(CacheEntry));
+    if (!entry) {
+        log_message(NL_LOG_ERROR, "Failed to allocate template cache entry");
+        return -1;
+    }
+    if (template_copy(template, &entry->template) != 0) {
+        free(entry);
+        return -1;
+    }
+    entry->hash = cache_hash(entry->template.username);
+    atomic_init(&entry->referenced, 1);
+
+    pthread_mutex_lock(&cache->write_lock);
+
+    // Keep the stored generation so the entry survives sweeps until the update is persisted
+    const TemplateRecord *record = template_db_find(cache->db, entry->template.username);
+    entry->generation = record ? record->generation : 0;
+
+    _Atomic(CacheEntry*) *link = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+    CacheEntry *old = NULL;
+    for (CacheEntry *e = atomic_load(link); e; link = &e->next, e = atomic_load(link)) {
+        if (e->hash == entry->hash &&
+            strncmp(e->template.username, entry->template.username, sizeof(e->template.username)) == 0) {
+            old = e;
+            break;
+        }
+    }
+
+    if (old) {
+        // Readers already on the old entry still reach the rest of the chain through it
+        atomic_init(&entry->next, atomic_load(&old->next));
+        atomic_store(link, entry);
+    } else {
+        if (cache->count >= cache->capacity) {
+            old = evict_one_locked(cache);
+            if (old) {
+                atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+            }
+        }
+        _Atomic(CacheEntry*) *bucket = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+        atomic_init(&entry->next, atomic_load(bucket));
+        atomic_store(bucket, entry);
+        cache->count++;
+    }
+    atomic_fetch_add_explicit(&cache->updates, 1, memory_order_relaxed);
+
+    if (old) {
+        cache->retired[cache->num_retired++] = old;
+        if (cache->num_retired == RETIRE_BATCH) {
+            synchronize_readers(cache);
+            free_retired_locked(cache);
+        }
+    }
+
+    pthread_mutex_unlock(&cache->write_lock);
+    return 0;
+}
+
+/**
+ * Drop every entry whose database record changed or disappeared
+ */
+static int sweep_stale(TemplateCache *cache) {
+    int dropped = 0;
+
+    pthread_mutex_lock(&cache->write_lock);
+    template_db_refresh(cache->db);
+
+    CacheEntry **retired = NULL;
+    if (cache->count > 0) {
+        retired = (CacheEntry**)malloc(cache->count * sizeof(CacheEntry*));
+        if (!retired) {
+            pthread_mutex_unlock(&cache->write_lock);
+            return -1;
+        }
+    }
+
+    for (size_t b = 0; b < cache->num_buckets && retired; b++) {
+        CacheEntry *e = atomic_load(&cache->buckets[b]);
+        while (e) {
+            CacheEntry *next = atomic_load(&e->next);
+            const TemplateRecord *record = template_db_find(cache->db, e->template.username);
+            if (!record || record->generation != e->generation) {
+                retired[dropped++] = unlink_locked(cache, e->hash, e->template.username);
+            }
+            e = next;
+        }
+    }
+
+    if (dropped > 0) {
+        synchronize_readers(cache);
+        free_retired_locked(cache);
+        for (int i = 0; i < dropped; i++) {
+            entry_free(retired[i]);
+        }
+        atomic_fetch_add_explicit(&cache->invalidations, (unsigned long long)dropped, memory_order_relaxed);
+    }
+
+    free(retired);
+    pthread_mutex_unlock(&cache->write_lock);
+    return dropped;
+}
+
+/**
+ * Watch the database file (and .nlt files beside it) for changes
+ */
+int template_cache_watch(TemplateCache *cache, const char *db_path) {
+    if (!cache || !db_path) {
+        return -1;
+    }
+
+    #ifdef __linux__
+    char dir[512];
+    strncpy(dir, db_path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+
+    char *slash = strrchr(dir, '/');
+    const char *name = db_path;
+    if (slash) {
+        name = db_path + (slash - dir) + 1;
+        *slash = '\0';
+    } else {
+        strcpy(dir, ".");
+    }
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to initialize inotify: %s", strerror(errno));
+        return -1;
+    }
+
+    uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+    if (inotify_add_watch(fd, dir, mask) < 0) {
+        log_message(NL_LOG_ERROR, "Failed to watch %s: %s", dir, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (cache->inotify_fd >= 0) {
+        close(cache->inotify_fd);
+    }
+    cache->inotify_fd = fd;
+    strncpy(cache->db_name, name, sizeof(cache->db_name) - 1);
+
+    log_message(NL_LOG_DEBUG, "Template cache watching %s for %s", dir, cache->db_name);
+    return 0;
+    #else
+    log_message(NL_LOG_WARNING, "Template cache invalidation requires inotify (Linux)");
+    return -1;
+    #endif
+}
+
+/**
+ * Get the change notification descriptor
+ */
+int template_cache_fd(const TemplateCache *cache) {
+    return cache ? cache->inotify_fd : -1;
+}
+
+/**
+ * Process pending change notifications without blocking
+ */
+int template_cache_poll(TemplateCache *cache) {
+    if (!cache || cache->inotify_fd < 0) {
+        return -1;
+    }
+
+    #ifdef __linux__
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int db_changed = 0;
+    int dropped = 0;
+    size_t ext_len = strlen(TEMPLATE_EXTENSION);
+
+    for (;;) {
+        ssize_t len = read(cache->inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno != EAGAIN && errno != EINTR) {
+                log_message(NL_LOG_ERROR, "Failed to read inotify events: %s", strerror(errno));
+                return -1;
+            }
+            break;
+        }
+
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                db_changed = 1;
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            size_t name_len = strlen(event->name);
+            if (strcmp(event->name, cache->db_name) == 0) {
+                db_changed = 1;
+            } else if (name_len > ext_len && name_len - ext_len < 64 &&
+                       strcmp(event->name + name_len - ext_len, TEMPLATE_EXTENSION) == 0) {
+                char username[64];
+                memcpy(username, event->name, name_len - ext_len);
+                username[name_len - ext_len] = '\0';
+                dropped += template_cache_invalidate(cache, username);
+            }
+        }
+    }
+
+    if (db_changed) {
+        dropped += sweep_stale(cache);
+    }
+
+    if (dropped > 0) {
+        log_message(NL_LOG_DEBUG, "Template cache invalidated %d entries", dropped);
+    }
+    return dropped;
+    #else
+    return -1;
+    #endif
+}
+
+/**
+ * Get cache statistics
+ */
+void template_cache_get_stats(const TemplateCache *cache, TemplateCacheStats *stats) {
+    if (!cache || !stats) {
+        return;
+    }
+
+    TemplateCache *c = (TemplateCache*)cache;
+    stats->hits = atomic_load(&c->hits);
+    stats->misses = atomic_load(&c->misses);
+    stats->evictions = atomic_load(&c->evictions);
+    stats->invalidations = atomic_load(&c->invalidations);
+    stats->updates = atomic_load(&c->updates);
+    pthread_mutex_lock(&c->write_lock);
+    stats->entries = c->count;
+    pthread_mutex_unlock(&c->write_lock);
+}
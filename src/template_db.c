@@ -0,0 +1,1116 @@
+#define _DEFAULT_SOURCE
+#include "template_db.h"
+#include "io_batch.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+/* Index slot values (anything else is record index + 1) */
+#define INDEX_EMPTY 0u
+#define INDEX_TOMBSTONE 0xFFFFFFFFu
+
+/* Record sizes of older versions, indexed by version; such files are rebuilt on open */
+static const uint32_t legacy_record_size[TEMPLATE_DB_VERSION] = { 0, 512, 1024 };
+
+/* Retries for a consistent read of a record being rewritten */
+#define READ_RETRIES 64
+
+/* New records encoded ahead of one batched write round */
+#define BATCH_STAGE_RECORDS 1024
+
+_Static_assert(sizeof(TemplateRecord) == TEMPLATE_DB_RECORD_SIZE, "TemplateRecord size mismatch");
+_Static_assert(offsetof(TemplateRecord, features) == 112, "TemplateRecord layout changed");
+_Static_assert(TEMPLATE_DB_RECORD_SIZE % 64 == 0, "Records must be cache-line aligned");
+_Static_assert(sizeof(TemplateDBHeader) <= TEMPLATE_DB_HEADER_SIZE, "Header too large");
+
+struct TemplateDB {
+    char path[512];                 // Database file path
+    int fd;                         // Open file descriptor
+    const uint8_t *map;             // Read-only shared mapping
+    size_t map_size;                // Size of mapping
+    dev_t dev;                      // Identity of the mapped file
+    ino_t ino;
+};
+
+/**
+ * FNV-1a hash of a username
+ */
+static uint64_t hash_username(const char *username) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < 64 && username[i]; i++) {
+        h ^= (uint8_t)username[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static size_t records_offset(uint32_t index_slots) {
+    size_t end = TEMPLATE_DB_HEADER_SIZE + (size_t)index_slots * sizeof(uint32_t);
+    return (end + 4095) & ~(size_t)4095;
+}
+
+static size_t db_file_size(uint32_t capacity, uint32_t index_slots) {
+    return records_offset(index_slots) + (size_t)capacity * TEMPLATE_DB_RECORD_SIZE;
+}
+
+static uint32_t index_slots_for(uint32_t capacity) {
+    uint32_t slots = 64;
+    while (slots < capacity * 2) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+static const TemplateDBHeader* db_header(const TemplateDB *db) {
+    return (const TemplateDBHeader*)db->map;
+}
+
+static const uint32_t* db_index(const TemplateDB *db) {
+    return (const uint32_t*)(db->map + TEMPLATE_DB_HEADER_SIZE);
+}
+
+static const TemplateRecord* db_record(const TemplateDB *db, uint32_t idx) {
+    return (const TemplateRecord*)(db->map + records_offset(db_header(db)->index_slots)
+                                   + (size_t)idx * db_header(db)->record_size);
+}
+
+static off_t record_file_offset(const TemplateDB *db, uint32_t idx) {
+    return (off_t)(records_offset(db_header(db)->index_slots) + (size_t)idx * db_header(db)->record_size);
+}
+
+/**
+ * Write a buffer at an offset, retrying short writes
+ */
+static int pwrite_full(int fd, const void *buf, size_t size, off_t offset) {
+    const uint8_t *p = (const uint8_t*)buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * Initialize an empty database in an open, locked file
+ */
+static int db_format(int fd, uint32_t capacity) {
+    TemplateDBHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TEMPLATE_DB_MAGIC;
+    header.version = TEMPLATE_DB_VERSION;
+    header.record_size = TEMPLATE_DB_RECORD_SIZE;
+    header.feature_size = FEATURE_VECTOR_SIZE;
+    header.capacity = capacity;
+    header.index_slots = index_slots_for(capacity);
+
+    if (ftruncate(fd, (off_t)db_file_size(header.capacity, header.index_slots)) != 0) {
+        return -1;
+    }
+    return pwrite_full(fd, &header, sizeof(header), 0);
+}
+
+static void db_unmap(TemplateDB *db) {
+    if (db->map) {
+        munmap((void*)db->map, db->map_size);
+        db->map = NULL;
+        db->map_size = 0;
+    }
+    if (db->fd >= 0) {
+        close(db->fd);
+        db->fd = -1;
+    }
+}
+
+/**
+ * Open the file at db->path, formatting it if empty, and map it
+ */
+static int db_map(TemplateDB *db) {
+    int fd = open(db->path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open template database: %s", db->path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        flock(fd, LOCK_EX);
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            if (db_format(fd, TEMPLATE_DB_INITIAL_CAPACITY) != 0) {
+                log_message(NL_LOG_ERROR, "Failed to initialize template database");
+                flock(fd, LOCK_UN);
+                close(fd);
+                return -1;
+            }
+            fstat(fd, &st);
+        }
+        flock(fd, LOCK_UN);
+    }
+
+    if ((size_t)st.st_size < TEMPLATE_DB_HEADER_SIZE) {
+        log_message(NL_LOG_ERROR, "Template database truncated: %s", db->path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_message(NL_LOG_ERROR, "Failed to map template database: %s", db->path);
+        close(fd);
+        return -1;
+    }
+
+    const TemplateDBHeader *header = (const TemplateDBHeader*)map;
+    int current = header->version == TEMPLATE_DB_VERSION && header->record_size == TEMPLATE_DB_RECORD_SIZE;
+    int legacy = header->version >= 1 && header->version < TEMPLATE_DB_VERSION &&
+                 header->record_size == legacy_record_size[header->version];
+    if (header->magic != TEMPLATE_DB_MAGIC || (!current && !legacy) || header->feature_size != FEATURE_VECTOR_SIZE) {
+        log_message(NL_LOG_ERROR, "Incompatible template database: %s", db->path);
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return -1;
+    }
+
+    if ((header->index_slots & (header->index_slots - 1)) != 0 ||
+        records_offset(header->index_slots) + (size_t)header->capacity * header->record_size > (size_t)st.st_size) {
+        log_message(NL_LOG_ERROR, "Corrupt template database header: %s", db->path);
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return -1;
+    }
+
+    db->fd = fd;
+    db->map = (const uint8_t*)map;
+    db->map_size = (size_t)st.st_size;
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+    return 0;
+}
+
+static int db_upgrade(TemplateDB *db);
+
+/**
+ * Open (or create) a template database and map it read-only
+ */
+TemplateDB* template_db_open(const char *path) {
+    if (!path) {
+        log_message(NL_LOG_ERROR, "Invalid template database path");
+        return NULL;
+    }
+
+    TemplateDB *db = (TemplateDB*)calloc(1, sizeof(TemplateDB));
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Failed to allocate TemplateDB structure");
+        return NULL;
+    }
+
+    strncpy(db->path, path, sizeof(db->path) - 1);
+    db->fd = -1;
+
+    if (db_map(db) != 0) {
+        free(db);
+        return NULL;
+    }
+
+    if (db_header(db)->version != TEMPLATE_DB_VERSION && db_upgrade(db) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to upgrade template database: %s", path);
+        db_unmap(db);
+        free(db);
+        return NULL;
+    }
+
+    log_message(NL_LOG_DEBUG, "Opened template database %s (%u records)", path, db_header(db)->count);
+    return db;
+}
+
+/**
+ * Unmap and close a template database
+ */
+void template_db_close(TemplateDB *db) {
+    if (db) {
+        db_unmap(db);
+        free(db);
+    }
+}
+
+/**
+ * Remap the database if another process has grown or replaced it
+ */
+int template_db_refresh(TemplateDB *db) {
+    if (!db) {
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(db->path, &st) == 0 && st.st_dev == db->dev && st.st_ino == db->ino &&
+        (size_t)st.st_size == db->map_size) {
+        return 0;
+    }
+
+    db_unmap(db);
+    return db_map(db);
+}
+
+/**
+ * Find the index slot for a username in an index laid out like the file's
+ * Returns: 1 if found (slot holds the record), 0 if absent (slot is the insert position:
+ *          the first tombstone or empty slot on the chain, INDEX_TOMBSTONE if there is none)
+ */
+static int db_probe_index(const TemplateDB *db, const uint32_t *index, const char *username,
+                          uint32_t *slot_out) {
+    const TemplateDBHeader *header = db_header(db);
+    uint32_t mask = header->index_slots - 1;
+    uint32_t slot = (uint32_t)hash_username(username) & mask;
+    uint32_t insert_at = INDEX_TOMBSTONE;   // Slot numbers stay below index_slots, so this means none
+
+    for (uint32_t n = 0; n < header->index_slots; n++) {
+        uint32_t v = index[slot];
+        if (v == INDEX_EMPTY) {
+            if (insert_at == INDEX_TOMBSTONE) insert_at = slot;
+            break;
+        }
+        if (v == INDEX_TOMBSTONE) {
+            if (insert_at == INDEX_TOMBSTONE) insert_at = slot;
+        } else if (v - 1 < header->capacity &&
+                   strncmp(db_record(db, v - 1)->username, username, 64) == 0) {
+            *slot_out = slot;
+            return 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    *slot_out = insert_at;
+    return 0;
+}
+
+static int db_probe(const TemplateDB *db, const char *username, uint32_t *slot_out) {
+    return db_probe_index(db, db_index(db), username, slot_out);
+}
+
+/**
+ * Look up a user's record in the mapping (zero-copy)
+ */
+const TemplateRecord* template_db_find(TemplateDB *db, const char *username) {
+    if (!db || !username) {
+        return NULL;
+    }
+
+    uint32_t slot;
+    if (!db_probe(db, username, &slot)) {
+        return NULL;
+    }
+    return db_record(db, db_index(db)[slot] - 1);
+}
+
+/**
+ * Check if a template exists for user
+ */
+int template_db_contains(TemplateDB *db, const char *username) {
+    return template_db_find(db, username) != NULL;
+}
+
+/**
+ * Copy a mapped record into a Template structure
+ */
+int template_record_to_template(const TemplateRecord *record, Template *output) {
+    if (!record || !output) {
+        log_message(NL_LOG_ERROR, "Invalid input for record conversion");
+        return -1;
+    }
+
+    if (record->feature_count > FEATURE_VECTOR_SIZE || record->hash_size > HASH_OUTPUT_SIZE ||
+        record->salt_size > SALT_LENGTH || record->exemplar_count > TEMPLATE_MAX_EXEMPLARS) {
+        log_message(NL_LOG_ERROR, "Corrupt template record for user: %.64s", record->username);
+        return -1;
+    }
+
+    output->features = feature_vector_alloc(record->feature_count);
+    if (!output->features) {
+        return -1;
+    }
+    output->hash = hash_data_alloc(record->hash_size, record->salt_size);
+    if (!output->hash) {
+        feature_vector_free(output->features);
+        output->features = NULL;
+        return -1;
+    }
+
+    memcpy(output->username, record->username, sizeof(output->username));
+    output->username[sizeof(output->username) - 1] = '\0';
+    output->version = record->version;
+    output->task_type = (MentalTask)record->task_type;
+    output->created_at = (time_t)record->created_at;
+    output->last_used = (time_t)record->last_used;
+
+    memcpy(output->features->features, record->features, record->feature_count * sizeof(float));
+    output->features->task_type = output->task_type;
+    memcpy(output->hash->hash, record->hash, record->hash_size);
+    memcpy(output->hash->salt, record->salt, record->salt_size);
+
+    output->variance = NULL;
+    if (record->flags & TEMPLATE_RECORD_VARIANCE) {
+        output->variance = feature_vector_alloc(record->feature_count);
+        if (!output->variance) {
+            feature_vector_free(output->features);
+            hash_data_free(output->hash);
+            output->features = NULL;
+            output->hash = NULL;
+            return -1;
+        }
+        memcpy(output->variance->features, record->variance, record->feature_count * sizeof(float));
+        output->variance->task_type = output->task_type;
+    }
+
+    output->exemplars = NULL;
+    output->num_exemplars = 0;
+    if (record->exemplar_count > 0) {
+        size_t bytes = (size_t)record->exemplar_count * record->feature_count * sizeof(float);
+        output->exemplars = (float*)malloc(bytes);
+        if (!output->exemplars) {
+            feature_vector_free(output->features);
+            feature_vector_free(output->variance);
+            hash_data_free(output->hash);
+            output->features = NULL;
+            output->variance = NULL;
+            output->hash = NULL;
+            return -1;
+        }
+        memcpy(output->exemplars, record->exemplars, bytes);
+        output->num_exemplars = record->exemplar_count;
+    }
+
+    output->znorm_mean = 0.0f;
+    output->znorm_std = 0.0f;
+    if ((record->flags & TEMPLATE_RECORD_ZNORM) && record->znorm_std > 0.0f) {
+        output->znorm_mean = record->znorm_mean;
+        output->znorm_std = record->znorm_std;
+    }
+
+    output->lda_weights = NULL;
+    output->lda_bias = 0.0f;
+    if (record->flags & TEMPLATE_RECORD_LDA) {
+        output->lda_weights = (float*)malloc(record->feature_count * sizeof(float));
+        if (!output->lda_weights) {
+            free(output->exemplars);
+            feature_vector_free(output->features);
+            feature_vector_free(output->variance);
+            hash_data_free(output->hash);
+            output->exemplars = NULL;
+            output->features = NULL;
+            output->variance = NULL;
+            output->hash = NULL;
+            return -1;
+        }
+        memcpy(output->lda_weights, record->lda_weights, record->feature_count * sizeof(float));
+        output->lda_bias = record->lda_bias;
+    }
+
+    return 0;
+}
+
+/**
+ * Load a user's template into a Template structure
+ */
+int template_db_get(TemplateDB *db, const char *username, Template *output) {
+    if (!db || !username || !output) {
+        log_message(NL_LOG_ERROR, "Invalid input for template database lookup");
+        return -1;
+    }
+
+    const TemplateRecord *record = template_db_find(db, username);
+    if (!record) {
+        log_message(NL_LOG_ERROR, "No template for user: %s", username);
+        return -1;
+    }
+
+    // Copy out under the record's generation so a concurrent rewrite is never observed torn
+    TemplateRecord copy;
+    int consistent = 0;
+    for (int attempt = 0; attempt < READ_RETRIES && !consistent; attempt++) {
+        uint32_t before = *(volatile const uint32_t*)&record->generation;
+        atomic_thread_fence(memory_order_acquire);
+        memcpy(&copy, record, sizeof(copy));
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t after = *(volatile const uint32_t*)&record->generation;
+        consistent = (before == after) && !(before & 1u);
+    }
+
+    if (!consistent || !(copy.flags & TEMPLATE_RECORD_USED) ||
+        strncmp(copy.username, username, sizeof(copy.username)) != 0) {
+        log_message(NL_LOG_ERROR, "Template record for %s changed during read", username);
+        secure_wipe(&copy, sizeof(copy));
+        return -1;
+    }
+
+    int result = template_record_to_template(&copy, output);
+    secure_wipe(&copy, sizeof(copy));
+    return result;
+}
+
+/**
+ * Take the writer lock, following the file if it was replaced by a grow
+ */
+static int db_lock(TemplateDB *db) {
+    for (int attempt = 0; attempt < 8; attempt++) {
+        if (flock(db->fd, LOCK_EX) != 0) {
+            return -1;
+        }
+
+        struct stat st;
+        if (stat(db->path, &st) == 0 && st.st_dev == db->dev && st.st_ino == db->ino) {
+            if ((size_t)st.st_size == db->map_size) {
+                return 0;
+            }
+        }
+
+        flock(db->fd, LOCK_UN);
+        db_unmap(db);
+        if (db_map(db) != 0) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static void db_unlock(TemplateDB *db) {
+    flock(db->fd, LOCK_UN);
+}
+
+/**
+ * Write header counters back to disk
+ */
+static int db_write_header(TemplateDB *db, const TemplateDBHeader *header) {
+    return pwrite_full(db->fd, header, sizeof(*header), 0);
+}
+
+/**
+ * Rebuild the database into a larger file and atomically replace it
+ * Caller holds the writer lock; on success db maps the new file.
+ */
+static int db_grow(TemplateDB *db, uint32_t new_capacity) {
+    const TemplateDBHeader *old = db_header(db);
+    char tmp_path[sizeof(db->path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", db->path);
+
+    log_message(NL_LOG_INFO, "Growing template database to %u records", new_capacity);
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to create %s", tmp_path);
+        return -1;
+    }
+
+    TemplateDBHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TEMPLATE_DB_MAGIC;
+    header.version = TEMPLATE_DB_VERSION;
+    header.record_size = TEMPLATE_DB_RECORD_SIZE;
+    header.feature_size = FEATURE_VECTOR_SIZE;
+    header.capacity = new_capacity;
+    header.index_slots = index_slots_for(new_capacity);
+    header.generation = old->generation + 1;
+
+    size_t size = db_file_size(header.capacity, header.index_slots);
+    uint32_t *index = (uint32_t*)calloc(header.index_slots, sizeof(uint32_t));
+    if (!index || ftruncate(fd, (off_t)size) != 0) {
+        free(index);
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // Compact live records to the front of the new file and rebuild the index
+    int failed = 0;
+    uint32_t mask = header.index_slots - 1;
+    size_t rec_base = records_offset(header.index_slots);
+    for (uint32_t i = 0; i < old->high_water && !failed; i++) {
+        const TemplateRecord *rec = db_record(db, i);
+        if (!(rec->flags & TEMPLATE_RECORD_USED)) continue;
+
+        // Older, shorter records are a prefix of the current layout
+        TemplateRecord copy;
+        memset(&copy, 0, sizeof(copy));
+        memcpy(&copy, rec, old->record_size < sizeof(copy) ? old->record_size : sizeof(copy));
+
+        uint32_t dst = header.count++;
+        failed = pwrite_full(fd, &copy, sizeof(copy), (off_t)(rec_base + (size_t)dst * TEMPLATE_DB_RECORD_SIZE));
+        secure_wipe(&copy, sizeof(copy));
+
+        uint32_t slot = (uint32_t)hash_username(rec->username) & mask;
+        while (index[slot] != INDEX_EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = dst + 1;
+    }
+    header.high_water = header.count;
+
+    if (!failed) {
+        failed = pwrite_full(fd, index, header.index_slots * sizeof(uint32_t), TEMPLATE_DB_HEADER_SIZE) ||
+                 pwrite_full(fd, &header, sizeof(header), 0) ||
+                 fsync(fd) != 0 ||
+                 rename(tmp_path, db->path) != 0;
+    }
+    free(index);
+    close(fd);
+
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Failed to grow template database");
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // Keep holding the old lock until the new file is mapped and locked
+    int old_fd = dup(db->fd);
+    db_unmap(db);
+    int result = db_map(db);
+    if (result == 0) {
+        flock(db->fd, LOCK_EX);
+    }
+    if (old_fd >= 0) {
+        flock(old_fd, LOCK_UN);
+        close(old_fd);
+    }
+    return result;
+}
+
+/**
+ * Rebuild an older file into the current record layout
+ */
+static int db_upgrade(TemplateDB *db) {
+    if (db_lock(db) != 0) {
+        return -1;
+    }
+
+    // Another process may have upgraded it while we waited for the lock
+    int result = 0;
+    if (db_header(db)->version != TEMPLATE_DB_VERSION) {
+        result = db_grow(db, db_header(db)->capacity);
+        if (result == 0) {
+            log_message(NL_LOG_INFO, "Upgraded template database to version %d: %s", TEMPLATE_DB_VERSION, db->path);
+        }
+    }
+
+    db_unlock(db);
+    return result;
+}
+
+/**
+ * Check that a template can be stored in one record
+ */
+static int template_fits_record(const Template *template) {
+    if (!template || !template->features || !template->hash) {
+        log_message(NL_LOG_ERROR, "Invalid input for template database put");
+        return 0;
+    }
+
+    if (template->features->size > FEATURE_VECTOR_SIZE || template->hash->hash_size > HASH_OUTPUT_SIZE ||
+        template->hash->salt_size > SALT_LENGTH || template->num_exemplars > TEMPLATE_MAX_EXEMPLARS) {
+        log_message(NL_LOG_ERROR, "Template does not fit database record");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Lay out a template as a record carrying the given (even) generation
+ */
+static void db_encode_record(const Template *template, uint32_t generation, TemplateRecord *record) {
+    memset(record, 0, sizeof(*record));
+    memcpy(record->username, template->username, sizeof(record->username) - 1);
+    record->flags = TEMPLATE_RECORD_USED;
+    record->generation = generation;
+    record->version = template->version;
+    record->task_type = (uint32_t)template->task_type;
+    record->created_at = (int64_t)template->created_at;
+    record->last_used = (int64_t)template->last_used;
+    record->feature_count = (uint32_t)template->features->size;
+    record->hash_size = (uint32_t)template->hash->hash_size;
+    record->salt_size = (uint32_t)template->hash->salt_size;
+    memcpy(record->features, template->features->features, template->features->size * sizeof(float));
+    memcpy(record->hash, template->hash->hash, template->hash->hash_size);
+    memcpy(record->salt, template->hash->salt, template->hash->salt_size);
+    if (template->variance && template->variance->size == template->features->size) {
+        record->flags |= TEMPLATE_RECORD_VARIANCE;
+        memcpy(record->variance, template->variance->features, template->variance->size * sizeof(float));
+    }
+    if (template->exemplars && template->num_exemplars > 0) {
+        record->exemplar_count = (uint32_t)template->num_exemplars;
+        memcpy(record->exemplars, template->exemplars,
+               template->num_exemplars * template->features->size * sizeof(float));
+    }
+    if (template->znorm_std > 0.0f) {
+        record->flags |= TEMPLATE_RECORD_ZNORM;
+        record->znorm_mean = template->znorm_mean;
+        record->znorm_std = template->znorm_std;
+    }
+    if (template->lda_weights) {
+        record->flags |= TEMPLATE_RECORD_LDA;
+        memcpy(record->lda_weights, template->lda_weights, template->features->size * sizeof(float));
+        record->lda_bias = template->lda_bias;
+    }
+}
+
+/**
+ * Insert or replace one record
+ * Caller holds the writer lock.
+ */
+static int db_put_locked(TemplateDB *db, const Template *template) {
+    uint32_t slot;
+    int found = db_probe(db, template->username, &slot);
+
+    if (!found) {
+        const TemplateDBHeader *h = db_header(db);
+        if (slot == INDEX_TOMBSTONE || (h->count + 1) * 2 > h->index_slots ||
+            (h->free_head == 0 && h->high_water >= h->capacity)) {
+            if (db_grow(db, h->capacity * 2) != 0) {
+                return -1;
+            }
+            db_probe(db, template->username, &slot);
+        }
+    }
+
+    TemplateDBHeader header;
+    memcpy(&header, db_header(db), sizeof(header));
+
+    uint32_t idx;
+    uint32_t generation = 0;
+    if (found) {
+        idx = db_index(db)[slot] - 1;
+        generation = db_record(db, idx)->generation;
+    } else if (header.free_head != 0) {
+        idx = header.free_head - 1;
+        generation = db_record(db, idx)->generation;
+        header.free_head = db_record(db, idx)->next_free;
+    } else {
+        idx = header.high_water++;
+    }
+
+    TemplateRecord record;
+    db_encode_record(template, (generation | 1u) + 1u, &record);
+
+    off_t offset = record_file_offset(db, idx);
+    int failed = 0;
+
+    if (found) {
+        // Mark the record odd (write in progress) so readers retry instead of tearing
+        uint32_t busy = generation | 1u;
+        failed = pwrite_full(db->fd, &busy, sizeof(busy), offset + (off_t)offsetof(TemplateRecord, generation));
+    }
+    if (!failed) {
+        failed = pwrite_full(db->fd, &record, sizeof(record), offset);
+    }
+    if (!failed && !found) {
+        uint32_t value = idx + 1;
+        header.count++;
+        failed = pwrite_full(db->fd, &value, sizeof(value),
+                             (off_t)(TEMPLATE_DB_HEADER_SIZE + (size_t)slot * sizeof(uint32_t)));
+    }
+    if (!failed) {
+        header.generation++;
+        failed = db_write_header(db, &header);
+    }
+
+    secure_wipe(&record, sizeof(record));
+
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Failed to write template record for %s", template->username);
+        return -1;
+    }
+
+    log_message(NL_LOG_DEBUG, "Stored template for %s in record %u", template->username, idx);
+    return 0;
+}
+
+/**
+ * Grow the file so it holds at least records live records
+ * Caller holds the writer lock.
+ */
+static int db_reserve_locked(TemplateDB *db, uint64_t records) {
+    const TemplateDBHeader *h = db_header(db);
+    if (records <= h->capacity) {
+        return 0;
+    }
+
+    uint64_t capacity = h->capacity;
+    while (capacity < records) {
+        capacity *= 2;
+    }
+    if (capacity > UINT32_MAX / 2 || db_grow(db, (uint32_t)capacity) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to grow template database to %llu records",
+                    (unsigned long long)records);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Grow the database ahead of a bulk load
+ */
+int template_db_reserve(TemplateDB *db, size_t records) {
+    if (!db) {
+        log_message(NL_LOG_ERROR, "Invalid input for template database reserve");
+        return -1;
+    }
+
+    if (db_lock(db) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to lock template database");
+        return -1;
+    }
+
+    int result = db_reserve_locked(db, records);
+    db_unlock(db);
+    return result;
+}
+
+/**
+ * Insert or replace a user's template
+ */
+int template_db_put(TemplateDB *db, const Template *template) {
+    if (!db || !template_fits_record(template)) {
+        return -1;
+    }
+
+    if (db_lock(db) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to lock template database");
+        return -1;
+    }
+
+    int result = db_put_locked(db, template);
+    db_unlock(db);
+    return result;
+}
+
+/**
+ * Write staged new records, adjacent ones as a single request, and wait
+ */
+static int db_flush_stage(TemplateDB *db, IOBatch *io, TemplateRecord *stage, const uint32_t *stage_idx,
+                          size_t staged) {
+    int failed = 0;
+    for (size_t run = 0; run < staged && !failed; ) {
+        size_t end = run + 1;
+        while (end < staged && stage_idx[end] == stage_idx[end - 1] + 1) {
+            end++;
+        }
+        failed = io_batch_write(io, db->fd, &stage[run], (end - run) * sizeof(TemplateRecord),
+                                (uint64_t)record_file_offset(db, stage_idx[run])) != 0;
+        run = end;
+    }
+    failed = io_batch_wait(io) != 0 || failed;
+    secure_wipe(stage, staged * sizeof(TemplateRecord));
+    return failed;
+}
+
+/**
+ * Store distinct new and replaced templates with batched writes
+ * Caller holds the writer lock and has reserved room for every record.
+ *
+ * Replacements keep the per-record busy/write sequence readers retry on.
+ * New records are unreachable until indexed, so they are staged and written
+ * BATCH_STAGE_RECORDS at a time; once all are down, the index pages they
+ * touched are written, then the header once.
+ */
+static int db_put_batch_locked(TemplateDB *db, const Template *const *templates, size_t count) {
+    TemplateDBHeader header;
+    memcpy(&header, db_header(db), sizeof(header));
+
+    // Plan against a private copy of the index so slots taken by this batch are seen
+    size_t index_bytes = (size_t)header.index_slots * sizeof(uint32_t);
+    size_t index_pages = (index_bytes + 4095) / 4096;
+    uint32_t *index = (uint32_t*)malloc(index_bytes);
+    uint8_t *dirty = (uint8_t*)calloc(index_pages, 1);
+    TemplateRecord *stage = (TemplateRecord*)malloc(BATCH_STAGE_RECORDS * sizeof(TemplateRecord));
+    uint32_t *stage_idx = (uint32_t*)malloc(BATCH_STAGE_RECORDS * sizeof(uint32_t));
+    IOBatch *io = io_batch_create(TEMPLATE_DB_IO_DEPTH);
+    if (!index || !dirty || !stage || !stage_idx || !io) {
+        log_message(NL_LOG_ERROR, "Failed to allocate batch write buffers");
+        free(index);
+        free(dirty);
+        free(stage);
+        free(stage_idx);
+        io_batch_free(io);
+        return -1;
+    }
+    memcpy(index, db_index(db), index_bytes);
+    io_batch_register_file(io, db->fd);
+    io_batch_register_buffer(io, stage, BATCH_STAGE_RECORDS * sizeof(TemplateRecord));
+
+    int failed = 0;
+    size_t staged = 0;
+    size_t num_new = 0;
+    for (size_t i = 0; i < count && !failed; i++) {
+        const Template *template = templates[i];
+        uint32_t slot;
+        if (db_probe_index(db, index, template->username, &slot)) {
+            uint32_t idx = index[slot] - 1;
+            off_t offset = record_file_offset(db, idx);
+            uint32_t busy = db_record(db, idx)->generation | 1u;
+
+            TemplateRecord record;
+            db_encode_record(template, busy + 1u, &record);
+            failed = pwrite_full(db->fd, &busy, sizeof(busy), offset + (off_t)offsetof(TemplateRecord, generation)) ||
+                     pwrite_full(db->fd, &record, sizeof(record), offset);
+            secure_wipe(&record, sizeof(record));
+        } else if (slot == INDEX_TOMBSTONE) {
+            // No insert position on the chain; the reserve above rules that out
+            log_message(NL_LOG_ERROR, "No index slot for %s", template->username);
+            failed = 1;
+        } else {
+            uint32_t idx;
+            uint32_t generation = 0;
+            if (header.free_head != 0) {
+                idx = header.free_head - 1;
+                generation = db_record(db, idx)->generation;
+                header.free_head = db_record(db, idx)->next_free;
+            } else {
+                idx = header.high_water++;
+            }
+            db_encode_record(template, (generation | 1u) + 1u, &stage[staged]);
+            stage_idx[staged++] = idx;
+            index[slot] = idx + 1;
+            dirty[slot / 1024] = 1;
+            header.count++;
+            num_new++;
+
+            if (staged == BATCH_STAGE_RECORDS) {
+                failed = db_flush_stage(db, io, stage, stage_idx, staged);
+                staged = 0;
+            }
+        }
+        header.generation++;
+    }
+    if (!failed && staged > 0) {
+        failed = db_flush_stage(db, io, stage, stage_idx, staged);
+    }
+
+    // Publish the new records: index pages holding their slots, then the header
+    for (size_t page = 0; page < index_pages && !failed; ) {
+        if (!dirty[page]) {
+            page++;
+            continue;
+        }
+        size_t end = page + 1;
+        while (end < index_pages && dirty[end]) {
+            end++;
+        }
+        size_t size = (end * 4096 < index_bytes ? end * 4096 : index_bytes) - page * 4096;
+        failed = io_batch_write(io, db->fd, (uint8_t*)index + page * 4096, size,
+                                TEMPLATE_DB_HEADER_SIZE + (uint64_t)page * 4096) != 0;
+        page = end;
+    }
+    failed = io_batch_wait(io) != 0 || failed;
+    if (!failed) {
+        failed = db_write_header(db, &header);
+    }
+
+    io_batch_free(io);
+    free(index);
+    free(dirty);
+    free(stage);
+    free(stage_idx);
+
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Failed to write template batch");
+        return -1;
+    }
+    log_message(NL_LOG_DEBUG, "Stored %zu templates (%zu new)", count, num_new);
+    return 0;
+}
+
+/**
+ * Drop all but the last template of each user, as repeated puts would
+ * Returns: Number of templates left in unique
+ */
+static size_t db_unique_templates(const Template *const *templates, size_t count, const Template **unique) {
+    size_t table_size = 16;
+    while (table_size < count * 2) {
+        table_size <<= 1;
+    }
+    size_t *table = (size_t*)malloc(table_size * sizeof(size_t));
+    if (!table) {
+        return 0;
+    }
+    memset(table, 0xFF, table_size * sizeof(size_t));
+
+    size_t num_unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t h = (size_t)hash_username(templates[i]->username) & (table_size - 1);
+        while (table[h] != SIZE_MAX && strncmp(unique[table[h]]->username, templates[i]->username, 64) != 0) {
+            h = (h + 1) & (table_size - 1);
+        }
+        if (table[h] == SIZE_MAX) {
+            table[h] = num_unique;
+            unique[num_unique++] = templates[i];
+        } else {
+            unique[table[h]] = templates[i];
+        }
+    }
+    free(table);
+    return num_unique;
+}
+
+/**
+ * Insert or replace many templates under one writer lock
+ */
+int template_db_put_batch(TemplateDB *db, const Template *const *templates, size_t count) {
+    if (!db || (!templates && count > 0)) {
+        log_message(NL_LOG_ERROR, "Invalid input for template database batch put");
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!template_fits_record(templates[i])) {
+            return -1;
+        }
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if (db_lock(db) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to lock template database");
+        return -1;
+    }
+
+    // Grow once up front instead of doubling repeatedly inside the loop
+    if (db_reserve_locked(db, (uint64_t)db_header(db)->count + count) != 0) {
+        db_unlock(db);
+        return -1;
+    }
+
+    const Template **unique = (const Template**)malloc(count * sizeof(Template*));
+    size_t num_unique = unique ? db_unique_templates(templates, count, unique) : 0;
+    int result = -1;
+    if (num_unique > 0) {
+        result = db_put_batch_locked(db, unique, num_unique);
+    } else {
+        log_message(NL_LOG_ERROR, "Failed to allocate batch write buffers");
+    }
+    free(unique);
+
+    db_unlock(db);
+    return result;
+}
+
+/**
+ * Remove a user's template
+ */
+int template_db_remove(TemplateDB *db, const char *username) {
+    if (!db || !username) {
+        log_message(NL_LOG_ERROR, "Invalid input for template database remove");
+        return -1;
+    }
+
+    if (db_lock(db) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to lock template database");
+        return -1;
+    }
+
+    uint32_t slot;
+    if (!db_probe(db, username, &slot)) {
+        db_unlock(db);
+        log_message(NL_LOG_ERROR, "No template for user: %s", username);
+        return -1;
+    }
+
+    TemplateDBHeader header;
+    memcpy(&header, db_header(db), sizeof(header));
+    uint32_t idx = db_index(db)[slot] - 1;
+
+    // Unlink from the index first, then overwrite the record with zeros
+    TemplateRecord record;
+    memset(&record, 0, sizeof(record));
+    record.generation = (db_record(db, idx)->generation | 1u) + 1u;
+    record.next_free = header.free_head;
+
+    uint32_t tombstone = INDEX_TOMBSTONE;
+    int failed = pwrite_full(db->fd, &tombstone, sizeof(tombstone),
+                             (off_t)(TEMPLATE_DB_HEADER_SIZE + (size_t)slot * sizeof(uint32_t)));
+    if (!failed) {
+        failed = pwrite_full(db->fd, &record, sizeof(record), record_file_offset(db, idx));
+    }
+    if (!failed) {
+        header.count--;
+        header.free_head = idx + 1;
+        header.generation++;
+        failed = db_write_header(db, &header);
+    }
+
+    db_unlock(db);
+
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Failed to remove template for %s", username);
+        return -1;
+    }
+
+    log_message(NL_LOG_INFO, "Template removed from database: %s", username);
+    return 0;
+}
+
+/**
+ * Get number of templates stored
+ */
+size_t template_db_count(TemplateDB *db) {
+    return db ? db_header(db)->count : 0;
+}
+
+/**
+ * Get database generation
+ */
+uint64_t template_db_generation(TemplateDB *db) {
+    return db ? db_header(db)->generation : 0;
+}
+
+/**
+ * Flush committed writes to stable storage
+ */
+int template_db_sync(TemplateDB *db) {
+    if (!db) {
+        return -1;
+    }
+    if (fsync(db->fd) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to sync template database: %s", db->path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Visit every live record in slot order
+ */
+int template_db_foreach(TemplateDB *db, TemplateRecordVisitor visitor, void *ctx) {
+    if (!db || !visitor) {
+        return -1;
+    }
+
+    uint32_t high_water = db_header(db)->high_water;
+    for (uint32_t i = 0; i < high_water; i++) {
+        const TemplateRecord *record = db_record(db, i);
+        if (!(record->flags & TEMPLATE_RECORD_USED)) continue;
+
+        int rc = visitor(record, ctx);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,623 @@
+#include "vector_ops.h"
+#include "utils.h"
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define VECTOR_OPS_X86 1
+    #if (defined(__clang__) && __clang_major__ >= 12) || (!defined(__clang__) && __GNUC__ >= 11)
+        #define VECTOR_OPS_AVXVNNI 1
+    #endif
+#endif
+
+/* Rows processed together so each probe load is reused across them */
+#define MATVEC_ROW_BLOCK 4
+
+/**
+ * Portable kernel
+ */
+static void matvec_scalar(const float *matrix, size_t rows, size_t dim, size_t stride,
+                          const float *vec, float *out) {
+    size_t r = 0;
+    for (; r + MATVEC_ROW_BLOCK <= rows; r += MATVEC_ROW_BLOCK) {
+        const float *r0 = matrix + r * stride;
+        const float *r1 = r0 + stride;
+        const float *r2 = r1 + stride;
+        const float *r3 = r2 + stride;
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        for (size_t c = 0; c < dim; c++) {
+            float v = vec[c];
+            s0 += r0[c] * v;
+            s1 += r1[c] * v;
+            s2 += r2[c] * v;
+            s3 += r3[c] * v;
+        }
+        out[r] = s0;
+        out[r + 1] = s1;
+        out[r + 2] = s2;
+        out[r + 3] = s3;
+    }
+    for (; r < rows; r++) {
+        out[r] = dot_product(matrix + r * stride, vec, dim);
+    }
+}
+
+#ifdef VECTOR_OPS_X86
+
+static inline float hsum_ps128(__m128 v) {
+    __m128 shuf = _mm_movehl_ps(v, v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_shuffle_ps(sums, sums, 0x55);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+/**
+ * SSE kernel (dim must be a multiple of 4)
+ */
+static void matvec_sse(const float *matrix, size_t rows, size_t dim, size_t stride,
+                       const float *vec, float *out) {
+    size_t r = 0;
+    for (; r + MATVEC_ROW_BLOCK <= rows; r += MATVEC_ROW_BLOCK) {
+        const float *r0 = matrix + r * stride;
+        __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+        __m128 a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+        for (size_t c = 0; c < dim; c += 4) {
+            __m128 v = _mm_loadu_ps(vec + c);
+            a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(r0 + c), v));
+            a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(r0 + stride + c), v));
+            a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(r0 + 2 * stride + c), v));
+            a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(r0 + 3 * stride + c), v));
+        }
+        out[r] = hsum_ps128(a0);
+        out[r + 1] = hsum_ps128(a1);
+        out[r + 2] = hsum_ps128(a2);
+        out[r + 3] = hsum_ps128(a3);
+    }
+    if (r < rows) {
+        matvec_scalar(matrix + r * stride, rows - r, dim, stride, vec, out + r);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_ps256(__m256 v) {
+    return hsum_ps128(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+/**
+ * AVX2/FMA kernel (dim must be a multiple of 8)
+ */
+__attribute__((target("avx2,fma")))
+static void matvec_avx2(const float *matrix, size_t rows, size_t dim, size_t stride,
+                        const float *vec, float *out) {
+    size_t r = 0;
+    for (; r + MATVEC_ROW_BLOCK <= rows; r += MATVEC_ROW_BLOCK) {
+        const float *r0 = matrix + r * stride;
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        for (size_t c = 0; c < dim; c += 8) {
+            __m256 v = _mm256_loadu_ps(vec + c);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + c), v, a0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + stride + c), v, a1);
+            a2 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + 2 * stride + c), v, a2);
+            a3 = _mm256_fmadd_ps(_mm256_loadu_ps(r0 + 3 * stride + c), v, a3);
+        }
+        out[r] = hsum_ps256(a0);
+        out[r + 1] = hsum_ps256(a1);
+        out[r + 2] = hsum_ps256(a2);
+        out[r + 3] = hsum_ps256(a3);
+    }
+    if (r < rows) {
+        matvec_scalar(matrix + r * stride, rows - r, dim, stride, vec, out + r);
+    }
+}
+
+/**
+ * AVX2/FMA transposed kernel (cols must be a multiple of 8)
+ */
+__attribute__((target("avx2,fma")))
+static void matvec_t_avx2(const float *matrix, size_t cols, size_t dim, const float *vec, float *out) {
+    size_t c = 0;
+    for (; c + 32 <= cols; c += 32) {
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        for (size_t d = 0; d < dim; d++) {
+            const float *row = matrix + d * cols + c;
+            __m256 v = _mm256_set1_ps(vec[d]);
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(row), v, a0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(row + 8), v, a1);
+            a2 = _mm256_fmadd_ps(_mm256_loadu_ps(row + 16), v, a2);
+            a3 = _mm256_fmadd_ps(_mm256_loadu_ps(row + 24), v, a3);
+        }
+        _mm256_storeu_ps(out + c, a0);
+        _mm256_storeu_ps(out + c + 8, a1);
+        _mm256_storeu_ps(out + c + 16, a2);
+        _mm256_storeu_ps(out + c + 24, a3);
+    }
+    for (; c < cols; c += 8) {
+        __m256 a0 = _mm256_setzero_ps();
+        for (size_t d = 0; d < dim; d++) {
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(matrix + d * cols + c), _mm256_set1_ps(vec[d]), a0);
+        }
+        _mm256_storeu_ps(out + c, a0);
+    }
+}
+
+/**
+ * SSE dot product (dim must be a multiple of 8)
+ */
+static float dot_sse(const float *a, const float *b, size_t dim) {
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    for (size_t c = 0; c < dim; c += 8) {
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(a + c), _mm_loadu_ps(b + c)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(a + c + 4), _mm_loadu_ps(b + c + 4)));
+    }
+    return hsum_ps128(_mm_add_ps(a0, a1));
+}
+
+/*
+ * u8 x s8 kernels: 32 columns per 256-bit step, then 16 and 8 column tails
+ * on 128-bit registers. Each row is reduced separately.
+ */
+
+__attribute__((target("ssse3")))
+static inline __m128i madd_u8s8_sse(__m128i acc, __m128i a, __m128i b) {
+    return _mm_add_epi32(acc, _mm_madd_epi16(_mm_maddubs_epi16(a, b), _mm_set1_epi16(1)));
+}
+
+__attribute__((target("ssse3")))
+static inline int32_t hsum_epi32_128(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    return _mm_cvtsi128_si32(v);
+}
+
+/**
+ * SSSE3 u8 x s8 kernel (dim must be a multiple of 8)
+ */
+__attribute__((target("ssse3")))
+static void matvec_u8s8_ssse3(const uint8_t *matrix, size_t rows, size_t dim, size_t stride,
+                              const int8_t *vec, int32_t *out) {
+    for (size_t r = 0; r < rows; r++) {
+        const uint8_t *row = matrix + r * stride;
+        __m128i acc = _mm_setzero_si128();
+        size_t c = 0;
+        for (; c + 16 <= dim; c += 16) {
+            acc = madd_u8s8_sse(acc, _mm_loadu_si128((const __m128i*)(row + c)),
+                                _mm_loadu_si128((const __m128i*)(vec + c)));
+        }
+        for (; c + 8 <= dim; c += 8) {
+            acc = madd_u8s8_sse(acc, _mm_loadl_epi64((const __m128i*)(row + c)),
+                                _mm_loadl_epi64((const __m128i*)(vec + c)));
+        }
+        out[r] = hsum_epi32_128(acc);
+    }
+}
+
+/**
+ * AVX2 u8 x s8 kernel (dim must be a multiple of 8)
+ */
+__attribute__((target("avx2")))
+static void matvec_u8s8_avx2(const uint8_t *matrix, size_t rows, size_t dim, size_t stride,
+                             const int8_t *vec, int32_t *out) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (size_t r = 0; r < rows; r++) {
+        const uint8_t *row = matrix + r * stride;
+        __m256i acc256 = _mm256_setzero_si256();
+        size_t c = 0;
+        for (; c + 32 <= dim; c += 32) {
+            __m256i prod = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(row + c)),
+                                                _mm256_loadu_si256((const __m256i*)(vec + c)));
+            acc256 = _mm256_add_epi32(acc256, _mm256_madd_epi16(prod, ones));
+        }
+        __m128i acc = _mm_add_epi32(_mm256_castsi256_si128(acc256), _mm256_extracti128_si256(acc256, 1));
+        for (; c + 16 <= dim; c += 16) {
+            acc = madd_u8s8_sse(acc, _mm_loadu_si128((const __m128i*)(row + c)),
+                                _mm_loadu_si128((const __m128i*)(vec + c)));
+        }
+        for (; c + 8 <= dim; c += 8) {
+            acc = madd_u8s8_sse(acc, _mm_loadl_epi64((const __m128i*)(row + c)),
+                                _mm_loadl_epi64((const __m128i*)(vec + c)));
+        }
+        out[r] = hsum_epi32_128(acc);
+    }
+}
+
+#ifdef VECTOR_OPS_AVXVNNI
+/**
+ * AVX-VNNI u8 x s8 kernel (dim must be a multiple of 8)
+ */
+__attribute__((target("avx2,avxvnni")))
+static void matvec_u8s8_vnni(const uint8_t *matrix, size_t rows, size_t dim, size_t stride,
+                             const int8_t *vec, int32_t *out) {
+    for (size_t r = 0; r < rows; r++) {
+        const uint8_t *row = matrix + r * stride;
+        __m256i acc256 = _mm256_setzero_si256();
+        size_t c = 0;
+        for (; c + 32 <= dim; c += 32) {
+            acc256 = _mm256_dpbusd_avx_epi32(acc256, _mm256_loadu_si256((const __m256i*)(row + c)),
+                                             _mm256_loadu_si256((const __m256i*)(vec + c)));
+        }
+        __m128i acc = _mm_add_epi32(_mm256_castsi256_si128(acc256), _mm256_extracti128_si256(acc256, 1));
+        for (; c + 16 <= dim; c += 16) {
+            acc = _mm_dpbusd_avx_epi32(acc, _mm_loadu_si128((const __m128i*)(row + c)),
+                                       _mm_loadu_si128((const __m128i*)(vec + c)));
+        }
+        for (; c + 8 <= dim; c += 8) {
+            acc = _mm_dpbusd_avx_epi32(acc, _mm_loadl_epi64((const __m128i*)(row + c)),
+                                       _mm_loadl_epi64((const __m128i*)(vec + c)));
+        }
+        out[r] = hsum_epi32_128(acc);
+    }
+}
+#endif /* VECTOR_OPS_AVXVNNI */
+
+/**
+ * AVX2/FMA float product kernel: 6 rows x 16 columns of accumulators in registers
+ */
+__attribute__((target("avx2,fma")))
+static void gemm_t_avx2(const float *a, size_t rows, size_t lda, const float *bt, size_t cols, size_t dim,
+                        float *out) {
+    size_t wide = cols & ~(size_t)15;
+    size_t r = 0;
+    for (; r + 6 <= rows; r += 6) {
+        const float *a0 = a + r * lda;
+        for (size_t c = 0; c < wide; c += 16) {
+            __m256 s00 = _mm256_setzero_ps(), s01 = _mm256_setzero_ps();
+            __m256 s10 = _mm256_setzero_ps(), s11 = _mm256_setzero_ps();
+            __m256 s20 = _mm256_setzero_ps(), s21 = _mm256_setzero_ps();
+            __m256 s30 = _mm256_setzero_ps(), s31 = _mm256_setzero_ps();
+            __m256 s40 = _mm256_setzero_ps(), s41 = _mm256_setzero_ps();
+            __m256 s50 = _mm256_setzero_ps(), s51 = _mm256_setzero_ps();
+            for (size_t d = 0; d < dim; d++) {
+                const float *col = bt + d * cols + c;
+                __m256 b0 = _mm256_loadu_ps(col);
+                __m256 b1 = _mm256_loadu_ps(col + 8);
+                __m256 x = _mm256_broadcast_ss(a0 + d);
+                s00 = _mm256_fmadd_ps(x, b0, s00);
+                s01 = _mm256_fmadd_ps(x, b1, s01);
+                x = _mm256_broadcast_ss(a0 + lda + d);
+                s10 = _mm256_fmadd_ps(x, b0, s10);
+                s11 = _mm256_fmadd_ps(x, b1, s11);
+                x = _mm256_broadcast_ss(a0 + 2 * lda + d);
+                s20 = _mm256_fmadd_ps(x, b0, s20);
+                s21 = _mm256_fmadd_ps(x, b1, s21);
+                x = _mm256_broadcast_ss(a0 + 3 * lda + d);
+                s30 = _mm256_fmadd_ps(x, b0, s30);
+                s31 = _mm256_fmadd_ps(x, b1, s31);
+                x = _mm256_broadcast_ss(a0 + 4 * lda + d);
+                s40 = _mm256_fmadd_ps(x, b0, s40);
+                s41 = _mm256_fmadd_ps(x, b1, s41);
+                x = _mm256_broadcast_ss(a0 + 5 * lda + d);
+                s50 = _mm256_fmadd_ps(x, b0, s50);
+                s51 = _mm256_fmadd_ps(x, b1, s51);
+            }
+            float *dst = out + r * cols + c;
+            _mm256_storeu_ps(dst, s00);
+            _mm256_storeu_ps(dst + 8, s01);
+            _mm256_storeu_ps(dst + cols, s10);
+            _mm256_storeu_ps(dst + cols + 8, s11);
+            _mm256_storeu_ps(dst + 2 * cols, s20);
+            _mm256_storeu_ps(dst + 2 * cols + 8, s21);
+            _mm256_storeu_ps(dst + 3 * cols, s30);
+            _mm256_storeu_ps(dst + 3 * cols + 8, s31);
+            _mm256_storeu_ps(dst + 4 * cols, s40);
+            _mm256_storeu_ps(dst + 4 * cols + 8, s41);
+            _mm256_storeu_ps(dst + 5 * cols, s50);
+            _mm256_storeu_ps(dst + 5 * cols + 8, s51);
+        }
+    }
+    for (; r < rows; r++) {
+        const float *row = a + r * lda;
+        for (size_t c = 0; c < wide; c += 16) {
+            __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+            for (size_t d = 0; d < dim; d++) {
+                __m256 x = _mm256_broadcast_ss(row + d);
+                s0 = _mm256_fmadd_ps(x, _mm256_loadu_ps(bt + d * cols + c), s0);
+                s1 = _mm256_fmadd_ps(x, _mm256_loadu_ps(bt + d * cols + c + 8), s1);
+            }
+            _mm256_storeu_ps(out + r * cols + c, s0);
+            _mm256_storeu_ps(out + r * cols + c + 8, s1);
+        }
+    }
+    for (r = 0; wide < cols && r < rows; r++) {
+        for (size_t c = wide; c < cols; c++) {
+            float sum = 0.0f;
+            for (size_t d = 0; d < dim; d++) {
+                sum += a[r * lda + d] * bt[d * cols + c];
+            }
+            out[r * cols + c] = sum;
+        }
+    }
+}
+
+/**
+ * AVX2 histogram binning: 8 values per pass, truncated and clamped as integers
+ */
+__attribute__((target("avx2")))
+static size_t bin_index_avx2(const float *values, size_t count, float low, float scale, int32_t top,
+                             int32_t *bins) {
+    const __m256 vlow = _mm256_set1_ps(low);
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 vtop = _mm256_set1_ps((float)top);
+    const __m256 zero = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 position = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(values + i), vlow), vscale);
+        position = _mm256_min_ps(_mm256_max_ps(position, zero), vtop);  // max(NaN, 0) is 0
+        _mm256_storeu_si256((__m256i*)(bins + i), _mm256_cvttps_epi32(position));
+    }
+    return i;
+}
+
+/* Columns of the u8 x s8 product computed per load of an A row */
+#define GEMM_COL_BLOCK 4
+
+/**
+ * AVX2 u8 x s8 product kernel (dim must be a multiple of 8)
+ */
+__attribute__((target("avx2")))
+static void gemm_u8s8_avx2(const uint8_t *a, size_t rows, size_t lda, const int8_t *b, size_t cols,
+                           size_t ldb, size_t dim, int32_t *out) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (size_t r = 0; r < rows; r++) {
+        const uint8_t *row = a + r * lda;
+        int32_t *dst = out + r * cols;
+        size_t c = 0;
+        for (; c + GEMM_COL_BLOCK <= cols; c += GEMM_COL_BLOCK) {
+            const int8_t *b0 = b + c * ldb;
+            const int8_t *b1 = b0 + ldb;
+            const int8_t *b2 = b1 + ldb;
+            const int8_t *b3 = b2 + ldb;
+            __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+            __m256i s2 = _mm256_setzero_si256(), s3 = _mm256_setzero_si256();
+            size_t k = 0;
+            for (; k + 32 <= dim; k += 32) {
+                __m256i x = _mm256_loadu_si256((const __m256i*)(row + k));
+                s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(
+                         _mm256_maddubs_epi16(x, _mm256_loadu_si256((const __m256i*)(b0 + k))), ones));
+                s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(
+                         _mm256_maddubs_epi16(x, _mm256_loadu_si256((const __m256i*)(b1 + k))), ones));
+                s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(
+                         _mm256_maddubs_epi16(x, _mm256_loadu_si256((const __m256i*)(b2 + k))), ones));
+                s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(
+                         _mm256_maddubs_epi16(x, _mm256_loadu_si256((const __m256i*)(b3 + k))), ones));
+            }
+            __m128i t0 = _mm_add_epi32(_mm256_castsi256_si128(s0), _mm256_extracti128_si256(s0, 1));
+            __m128i t1 = _mm_add_epi32(_mm256_castsi256_si128(s1), _mm256_extracti128_si256(s1, 1));
+            __m128i t2 = _mm_add_epi32(_mm256_castsi256_si128(s2), _mm256_extracti128_si256(s2, 1));
+            __m128i t3 = _mm_add_epi32(_mm256_castsi256_si128(s3), _mm256_extracti128_si256(s3, 1));
+            for (; k + 16 <= dim; k += 16) {
+                __m128i x = _mm_loadu_si128((const __m128i*)(row + k));
+                t0 = madd_u8s8_sse(t0, x, _mm_loadu_si128((const __m128i*)(b0 + k)));
+                t1 = madd_u8s8_sse(t1, x, _mm_loadu_si128((const __m128i*)(b1 + k)));
+                t2 = madd_u8s8_sse(t2, x, _mm_loadu_si128((const __m128i*)(b2 + k)));
+                t3 = madd_u8s8_sse(t3, x, _mm_loadu_si128((const __m128i*)(b3 + k)));
+            }
+            for (; k + 8 <= dim; k += 8) {
+                __m128i x = _mm_loadl_epi64((const __m128i*)(row + k));
+                t0 = madd_u8s8_sse(t0, x, _mm_loadl_epi64((const __m128i*)(b0 + k)));
+                t1 = madd_u8s8_sse(t1, x, _mm_loadl_epi64((const __m128i*)(b1 + k)));
+                t2 = madd_u8s8_sse(t2, x, _mm_loadl_epi64((const __m128i*)(b2 + k)));
+                t3 = madd_u8s8_sse(t3, x, _mm_loadl_epi64((const __m128i*)(b3 + k)));
+            }
+            // Four horizontal sums in two rounds of pairwise adds
+            _mm_storeu_si128((__m128i*)(dst + c),
+                             _mm_hadd_epi32(_mm_hadd_epi32(t0, t1), _mm_hadd_epi32(t2, t3)));
+        }
+        for (; c < cols; c++) {
+            matvec_u8s8_avx2(row, 1, dim, lda, b + c * ldb, dst + c);
+        }
+    }
+}
+
+#endif /* VECTOR_OPS_X86 */
+
+/**
+ * Dense matrix-vector product over row-major float rows
+ */
+void matvec_f32(const float *matrix, size_t rows, size_t dim, size_t stride,
+                const float *vec, float *out) {
+    if (!matrix || !vec || !out || rows == 0) {
+        return;
+    }
+
+    #ifdef VECTOR_OPS_X86
+    if (dim % 8 == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        matvec_avx2(matrix, rows, dim, stride, vec, out);
+        return;
+    }
+    if (dim % 4 == 0) {
+        matvec_sse(matrix, rows, dim, stride, vec, out);
+        return;
+    }
+    #endif
+
+    matvec_scalar(matrix, rows, dim, stride, vec, out);
+}
+
+/**
+ * Integer matrix-vector product of unsigned 8-bit rows and a signed 8-bit vector
+ */
+void matvec_u8s8(const uint8_t *matrix, size_t rows, size_t dim, size_t stride,
+                 const int8_t *vec, int32_t *out) {
+    if (!matrix || !vec || !out || rows == 0) {
+        return;
+    }
+
+    #ifdef VECTOR_OPS_X86
+    if (dim % 8 == 0) {
+        #ifdef VECTOR_OPS_AVXVNNI
+        if (__builtin_cpu_supports("avxvnni")) {
+            matvec_u8s8_vnni(matrix, rows, dim, stride, vec, out);
+            return;
+        }
+        #endif
+        if (__builtin_cpu_supports("avx2")) {
+            matvec_u8s8_avx2(matrix, rows, dim, stride, vec, out);
+            return;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            matvec_u8s8_ssse3(matrix, rows, dim, stride, vec, out);
+            return;
+        }
+    }
+    #endif
+
+    for (size_t r = 0; r < rows; r++) {
+        const uint8_t *row = matrix + r * stride;
+        int32_t sum = 0;
+        for (size_t c = 0; c < dim; c++) {
+            sum += (int32_t)row[c] * vec[c];
+        }
+        out[r] = sum;
+    }
+}
+
+/**
+ * Integer matrix product of unsigned 8-bit rows and signed 8-bit rows
+ */
+void gemm_u8s8(const uint8_t *a, size_t rows, size_t lda, const int8_t *b, size_t cols, size_t ldb,
+               size_t dim, int32_t *out) {
+    if (!a || !b || !out || rows == 0 || cols == 0) {
+        return;
+    }
+
+    #ifdef VECTOR_OPS_X86
+    if (dim % 8 == 0 && __builtin_cpu_supports("avx2")) {
+        gemm_u8s8_avx2(a, rows, lda, b, cols, ldb, dim, out);
+        return;
+    }
+    #endif
+
+    for (size_t r = 0; r < rows; r++) {
+        const uint8_t *row = a + r * lda;
+        for (size_t c = 0; c < cols; c++) {
+            const int8_t *col = b + c * ldb;
+            int32_t sum = 0;
+            for (size_t k = 0; k < dim; k++) {
+                sum += (int32_t)row[k] * (int32_t)col[k];
+            }
+            out[r * cols + c] = sum;
+        }
+    }
+}
+
+/**
+ * Matrix product of row-major rows and a transposed (column-major) panel
+ */
+void gemm_t_f32(const float *a, size_t rows, size_t lda, const float *bt, size_t cols, size_t dim,
+                float *out) {
+    if (!a || !bt || !out || rows == 0 || cols == 0) {
+        return;
+    }
+
+    #ifdef VECTOR_OPS_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        gemm_t_avx2(a, rows, lda, bt, cols, dim, out);
+        return;
+    }
+    #endif
+
+    // Row times panel, one feature at a time; the inner loop is contiguous
+    for (size_t r = 0; r < rows; r++) {
+        float *dst = out + r * cols;
+        memset(dst, 0, cols * sizeof(float));
+        for (size_t d = 0; d < dim; d++) {
+            float x = a[r * lda + d];
+            const float *col = bt + d * cols;
+            for (size_t c = 0; c < cols; c++) {
+                dst[c] += x * col[c];
+            }
+        }
+    }
+}
+
+/**
+ * Map values to equal-width histogram bins
+ */
+void bin_index_f32(const float *values, size_t count, float low, float scale, int32_t top, int32_t *bins) {
+    if (!values || !bins) {
+        return;
+    }
+
+    size_t i = 0;
+    #ifdef VECTOR_OPS_X86
+    if (__builtin_cpu_supports("avx2")) {
+        i = bin_index_avx2(values, count, low, scale, top, bins);
+    }
+    #endif
+
+    // Clamp before converting so out-of-range values stay defined
+    for (; i < count; i++) {
+        float position = (values[i] - low) * scale;
+        position = position > 0.0f ? position : 0.0f;
+        position = position < (float)top ? position : (float)top;
+        bins[i] = (int32_t)position;
+    }
+}
+
+/**
+ * Matrix-vector product over a column-major (transposed) matrix
+ */
+void matvec_t_f32(const float *matrix, size_t cols, size_t dim, const float *vec, float *out) {
+    if (!matrix || !vec || !out || cols == 0) {
+        return;
+    }
+
+    #ifdef VECTOR_OPS_X86
+    if (cols % 8 == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        matvec_t_avx2(matrix, cols, dim, vec, out);
+        return;
+    }
+    #endif
+
+    for (size_t c = 0; c < cols; c++) {
+        out[c] = 0.0f;
+    }
+    for (size_t d = 0; d < dim; d++) {
+        const float *row = matrix + d * cols;
+        float v = vec[d];
+        for (size_t c = 0; c < cols; c++) {
+            out[c] += row[c] * v;
+        }
+    }
+}
+
+/**
+ * Dot product of two float vectors using the best available kernel
+ */
+float dot_f32(const float *a, const float *b, size_t dim) {
+    #ifdef VECTOR_OPS_X86
+    if (dim % 8 == 0) {
+        return dot_sse(a, b, dim);
+    }
+    #endif
+
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t c = 0;
+    for (; c + 4 <= dim; c += 4) {
+        s0 += a[c] * b[c];
+        s1 += a[c + 1] * b[c + 1];
+        s2 += a[c + 2] * b[c + 2];
+        s3 += a[c + 3] * b[c + 3];
+    }
+    for (; c < dim; c++) {
+        s0 += a[c] * b[c];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+/**
+ * Scale a vector to unit L2 norm
+ */
+float vector_normalize(const float *in, float *out, size_t size) {
+    float magnitude = vector_magnitude(in, size);
+    float scale = magnitude > 1e-6f ? 1.0f / magnitude : 0.0f;
+
+    for (size_t i = 0; i < size; i++) {
+        out[i] = in[i] * scale;
+    }
+
+    return magnitude;
+}
@@ -0,0 +1,516 @@
+#define _DEFAULT_SOURCE
+#include "wal.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+/* Username payload of a delete record */
+#define WAL_USERNAME_SIZE 64
+
+struct TemplateWAL {
+    char path[512];                 // Log file path
+    int fd;                         // Open with O_APPEND
+    TemplateDB *db;                 // Database records are applied to
+    pthread_mutex_t lock;           // Guards everything below
+    pthread_cond_t flushed;         // Signalled after every flush attempt
+    uint8_t *pending;               // Encoded records waiting for the next flush
+    size_t pending_size;
+    size_t pending_capacity;
+    uint8_t *batch;                 // Records being flushed by the leader
+    size_t batch_capacity;
+    uint64_t next_seq;              // Sequence number of the next appended record
+    uint64_t durable_seq;           // Every record below this is on disk and applied
+    int flushing;                   // A leader is writing a batch
+    int broken;                     // A flush failed; refuse further writes
+    WalStats stats;
+};
+
+/**
+ * Write a whole buffer, retrying short writes
+ */
+static int write_full(int fd, const uint8_t *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * CRC of a framed record with its CRC field taken as zero
+ */
+static uint32_t record_crc(const uint8_t *record, size_t payload_size) {
+    static const uint8_t zero_crc[4] = {0, 0, 0, 0};
+    uint32_t crc = crc32_update(0, record, 12);
+    crc = crc32_update(crc, zero_crc, sizeof(zero_crc));
+    return crc32_update(crc, record + 16, WAL_RECORD_HEADER_SIZE - 16 + payload_size);
+}
+
+/**
+ * Apply one logged operation to the database
+ */
+static int apply_record(TemplateDB *db, uint32_t op, const uint8_t *payload, size_t size) {
+    if (op == WAL_OP_PUT) {
+        Template template;
+        if (template_deserialize(payload, size, &template) != 0) {
+            return -1;
+        }
+        int result = template_db_put(db, &template);
+        template_clear(&template);
+        return result;
+    }
+
+    if (op == WAL_OP_DELETE && size == WAL_USERNAME_SIZE) {
+        char username[WAL_USERNAME_SIZE];
+        memcpy(username, payload, sizeof(username));
+        username[sizeof(username) - 1] = '\0';
+
+        // Replaying a delete that already reached the database is a no-op
+        if (!template_db_contains(db, username)) {
+            return 0;
+        }
+        return template_db_remove(db, username);
+    }
+
+    log_message(NL_LOG_ERROR, "Unknown log operation %u", op);
+    return -1;
+}
+
+/**
+ * Apply every record in an encoded batch in log order
+ * Returns: Number of records applied, negative on error
+ */
+static long apply_batch(TemplateDB *db, const uint8_t *data, size_t size) {
+    long applied = 0;
+    size_t pos = 0;
+    while (pos + WAL_RECORD_HEADER_SIZE <= size) {
+        const uint8_t *record = data + pos;
+        size_t payload_size = load_le32(record + 8);
+        if (load_le32(record) != WAL_RECORD_MAGIC || payload_size > size - pos - WAL_RECORD_HEADER_SIZE ||
+            record_crc(record, payload_size) != load_le32(record + 12)) {
+            break;
+        }
+        if (apply_record(db, load_le32(record + 4), record + WAL_RECORD_HEADER_SIZE, payload_size) != 0) {
+            return -1;
+        }
+        pos += WAL_RECORD_HEADER_SIZE + payload_size;
+        applied++;
+    }
+
+    if (pos != size) {
+        log_message(NL_LOG_WARNING, "Discarding %zu bytes of torn log tail", size - pos);
+    }
+    return applied;
+}
+
+/**
+ * Sync the database and cut the log back to its header
+ * Caller holds the file lock and no records are unapplied.
+ */
+static int checkpoint_locked(TemplateWAL *wal) {
+    if (template_db_refresh(wal->db) != 0 || template_db_sync(wal->db) != 0) {
+        return -1;
+    }
+    if (ftruncate(wal->fd, WAL_HEADER_SIZE) != 0 || fdatasync(wal->fd) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to truncate log: %s", wal->path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Write the file header into an empty log
+ */
+static int format_log(TemplateWAL *wal) {
+    uint8_t header[WAL_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    store_le32(header, WAL_MAGIC);
+    store_le32(header + 4, WAL_VERSION);
+
+    if (ftruncate(wal->fd, 0) != 0 || write_full(wal->fd, header, sizeof(header)) != 0 ||
+        fdatasync(wal->fd) != 0) {
+        return -1;
+    }
+    if (sync_parent_directory(wal->path) != 0) {
+        log_message(NL_LOG_WARNING, "Failed to sync log directory for: %s", wal->path);
+    }
+    return 0;
+}
+
+/**
+ * Replay whatever a previous writer left in the log, then checkpoint
+ * Caller holds the file lock.
+ */
+static int recover_locked(TemplateWAL *wal) {
+    struct stat st;
+    if (fstat(wal->fd, &st) != 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size < WAL_HEADER_SIZE) {
+        return format_log(wal);
+    }
+
+    size_t size = (size_t)st.st_size;
+    uint8_t *data = (uint8_t*)malloc(size);
+    if (!data) {
+        log_message(NL_LOG_ERROR, "Failed to allocate log replay buffer");
+        return -1;
+    }
+
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(wal->fd, data + got, size - got, (off_t)got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+
+    if (got != size || load_le32(data) != WAL_MAGIC || load_le32(data + 4) != WAL_VERSION) {
+        log_message(NL_LOG_ERROR, "Invalid log file: %s", wal->path);
+        free(data);
+        return -1;
+    }
+
+    long replayed = apply_batch(wal->db, data + WAL_HEADER_SIZE, size - WAL_HEADER_SIZE);
+    secure_wipe(data, size);
+    free(data);
+
+    if (replayed < 0) {
+        log_message(NL_LOG_ERROR, "Failed to replay log: %s", wal->path);
+        return -1;
+    }
+    if (replayed > 0) {
+        log_message(NL_LOG_INFO, "Replayed %ld logged template changes", replayed);
+    }
+    wal->stats.replayed += (uint64_t)replayed;
+
+    if (size == WAL_HEADER_SIZE) {
+        return 0;
+    }
+    if (checkpoint_locked(wal) != 0) {
+        return -1;
+    }
+    wal->stats.checkpoints++;
+    return 0;
+}
+
+/**
+ * Open a log and recover it into the database
+ */
+TemplateWAL* wal_open(const char *path, TemplateDB *db) {
+    if (!path || !db || strlen(path) >= sizeof(((TemplateWAL*)0)->path)) {
+        log_message(NL_LOG_ERROR, "Invalid input for log open");
+        return NULL;
+    }
+
+    TemplateWAL *wal = (TemplateWAL*)calloc(1, sizeof(TemplateWAL));
+    if (!wal) {
+        log_message(NL_LOG_ERROR, "Failed to allocate TemplateWAL structure");
+        return NULL;
+    }
+
+    strcpy(wal->path, path);
+    wal->db = db;
+    wal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (wal->fd < 0) {
+        log_message(NL_LOG_ERROR, "Failed to open log: %s", path);
+        free(wal);
+        return NULL;
+    }
+
+    if (flock(wal->fd, LOCK_EX) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to lock log: %s", path);
+        close(wal->fd);
+        free(wal);
+        return NULL;
+    }
+    int result = recover_locked(wal);
+    flock(wal->fd, LOCK_UN);
+
+    if (result != 0) {
+        close(wal->fd);
+        free(wal);
+        return NULL;
+    }
+
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->flushed, NULL);
+    return wal;
+}
+
+/**
+ * Write, sync and apply one batch; runs without the mutex held
+ * Returns: 1 if the log was checkpointed, 0 if not, negative on error
+ */
+static int flush_batch(TemplateWAL *wal, const uint8_t *data, size_t size) {
+    if (flock(wal->fd, LOCK_EX) != 0) {
+        log_message(NL_LOG_ERROR, "Failed to lock log: %s", wal->path);
+        return -1;
+    }
+
+    int failed = write_full(wal->fd, data, size) != 0 || fdatasync(wal->fd) != 0;
+    if (failed) {
+        log_message(NL_LOG_ERROR, "Failed to write log: %s", wal->path);
+    } else if (apply_batch(wal->db, data, size) < 0) {
+        // Records are durable; the next wal_open retries them
+        log_message(NL_LOG_ERROR, "Failed to apply logged template changes");
+        failed = 1;
+    }
+
+    int checkpointed = 0;
+    struct stat st;
+    if (!failed && fstat(wal->fd, &st) == 0 && (size_t)st.st_size >= WAL_CHECKPOINT_BYTES) {
+        failed = checkpoint_locked(wal) != 0;
+        checkpointed = !failed;
+    }
+
+    flock(wal->fd, LOCK_UN);
+    return failed ? -1 : checkpointed;
+}
+
+/**
+ * Wait until record seq is durable, leading a flush if nobody else is
+ * Caller holds the mutex.
+ */
+static int wait_durable(TemplateWAL *wal, uint64_t seq) {
+    while (wal->durable_seq <= seq && !wal->broken) {
+        if (wal->flushing) {
+            pthread_cond_wait(&wal->flushed, &wal->lock);
+            continue;
+        }
+
+        // Take everything queued so far; later appends form the next batch
+        uint8_t *data = wal->pending;
+        size_t size = wal->pending_size;
+        size_t capacity = wal->pending_capacity;
+        uint64_t end_seq = wal->next_seq;
+        wal->pending = wal->batch;
+        wal->pending_capacity = wal->batch_capacity;
+        wal->pending_size = 0;
+        wal->flushing = 1;
+        pthread_mutex_unlock(&wal->lock);
+
+        int result = flush_batch(wal, data, size);
+        secure_wipe(data, size);
+
+        pthread_mutex_lock(&wal->lock);
+        wal->batch = data;
+        wal->batch_capacity = capacity;
+        wal->flushing = 0;
+        if (result >= 0) {
+            wal->stats.records += end_seq - wal->durable_seq;
+            wal->stats.batches++;
+            wal->stats.checkpoints += (uint64_t)result;
+            wal->durable_seq = end_seq;
+        } else {
+            wal->broken = 1;
+        }
+        pthread_cond_broadcast(&wal->flushed);
+    }
+    return wal->durable_seq > seq ? 0 : -1;
+}
+
+/**
+ * Queue one framed record; wait for it to become durable unless deferred
+ */
+static int log_record(TemplateWAL *wal, uint32_t op, const uint8_t *payload, size_t payload_size, int wait) {
+    size_t record_size = WAL_RECORD_HEADER_SIZE + payload_size;
+
+    pthread_mutex_lock(&wal->lock);
+    if (wal->broken) {
+        pthread_mutex_unlock(&wal->lock);
+        log_message(NL_LOG_ERROR, "Log is unusable after an earlier failure: %s", wal->path);
+        return -1;
+    }
+
+    if (wal->pending_size + record_size > wal->pending_capacity) {
+        size_t capacity = wal->pending_capacity ? wal->pending_capacity : 4096;
+        while (capacity < wal->pending_size + record_size) {
+            capacity *= 2;
+        }
+        uint8_t *grown = (uint8_t*)realloc(wal->pending, capacity);
+        if (!grown) {
+            pthread_mutex_unlock(&wal->lock);
+            log_message(NL_LOG_ERROR, "Failed to grow log buffer");
+            return -1;
+        }
+        wal->pending = grown;
+        wal->pending_capacity = capacity;
+    }
+
+    uint64_t seq = wal->next_seq++;
+    uint8_t *record = wal->pending + wal->pending_size;
+    store_le32(record, WAL_RECORD_MAGIC);
+    store_le32(record + 4, op);
+    store_le32(record + 8, (uint32_t)payload_size);
+    store_le32(record + 12, 0);
+    store_le64(record + 16, seq);
+    memcpy(record + WAL_RECORD_HEADER_SIZE, payload, payload_size);
+    store_le32(record + 12, record_crc(record, payload_size));
+    wal->pending_size += record_size;
+
+    // Deferred records ride along with the next flush unless the queue grows large
+    int result = 0;
+    if (wait || wal->pending_size >= WAL_ASYNC_FLUSH_BYTES) {
+        result = wait_durable(wal, seq);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return result;
+}
+
+/**
+ * Serialize and queue a put record
+ */
+static int log_put(TemplateWAL *wal, const Template *template, int wait) {
+    if (!wal || !template || !template->features || !template->hash) {
+        log_message(NL_LOG_ERROR, "Invalid input for log put");
+        return -1;
+    }
+
+    // Reject what the database cannot hold before it becomes durable
+    if (template->features->size > FEATURE_VECTOR_SIZE || template->hash->hash_size > HASH_OUTPUT_SIZE ||
+        template->hash->salt_size > SALT_LENGTH || template->num_exemplars > TEMPLATE_MAX_EXEMPLARS) {
+        log_message(NL_LOG_ERROR, "Template does not fit database record");
+        return -1;
+    }
+
+    uint8_t *buffer;
+    size_t size;
+    if (template_serialize(template, &buffer, &size) != 0) {
+        return -1;
+    }
+
+    int result = log_record(wal, WAL_OP_PUT, buffer, size, wait);
+    secure_wipe(buffer, size);
+    free(buffer);
+    return result;
+}
+
+/**
+ * Durably log and apply a removal
+ */
+int wal_delete(TemplateWAL *wal, const char *username) {
+    if (!wal || !username) {
+        log_message(NL_LOG_ERROR, "Invalid input for log delete");
+        return -1;
+    }
+    uint8_t payload[WAL_USERNAME_SIZE];
+    memset(payload, 0, sizeof(payload));
+    strncpy((char*)payload, username, sizeof(payload) - 1);
+    return log_record(wal, WAL_OP_DELETE, payload, sizeof(payload), 1);
+}
+
+/**
+ * Durably log and apply an insert or replace
+ */
+int wal_put(TemplateWAL *wal, const Template *template) {
+    return log_put(wal, template, 1);
+}
+
+/**
+ * Queue an insert or replace for the next flush
+ */
+int wal_put_async(TemplateWAL *wal, const Template *template) {
+    return log_put(wal, template, 0);
+}
+
+/**
+ * Wait until every queued record is durable and applied
+ */
+int wal_sync(TemplateWAL *wal) {
+    if (!wal) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    int result = wal->next_seq > 0 ? wait_durable(wal, wal->next_seq - 1) : 0;
+    pthread_mutex_unlock(&wal->lock);
+    return result;
+}
+
+/**
+ * Sync the database and truncate the log
+ */
+int wal_checkpoint(TemplateWAL *wal) {
+    if (!wal) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    int result = wal->next_seq > 0 ? wait_durable(wal, wal->next_seq - 1) : 0;
+    while (result == 0 && wal->flushing) {
+        pthread_cond_wait(&wal->flushed, &wal->lock);
+    }
+    if (result != 0 || wal->broken) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+
+    // Hold off other flushes in this process while the log is cut
+    wal->flushing = 1;
+    pthread_mutex_unlock(&wal->lock);
+
+    if (flock(wal->fd, LOCK_EX) == 0) {
+        result = checkpoint_locked(wal);
+        flock(wal->fd, LOCK_UN);
+    } else {
+        result = -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    wal->flushing = 0;
+    if (result == 0) {
+        wal->stats.checkpoints++;
+    }
+    pthread_cond_broadcast(&wal->flushed);
+    pthread_mutex_unlock(&wal->lock);
+    return result;
+}
+
+/**
+ * Read group commit counters
+ */
+void wal_get_stats(TemplateWAL *wal, WalStats *stats) {
+    if (!wal || !stats) {
+        return;
+    }
+    pthread_mutex_lock(&wal->lock);
+    *stats = wal->stats;
+    pthread_mutex_unlock(&wal->lock);
+}
+
+/**
+ * Checkpoint and close the log
+ */
+void wal_close(TemplateWAL *wal) {
+    if (!wal) {
+        return;
+    }
+
+    // A failed checkpoint leaves the records in the log for the next open
+    if (wal_checkpoint(wal) != 0) {
+        log_message(NL_LOG_WARNING, "Log not checkpointed; changes will be replayed on next open");
+    }
+
+    close(wal->fd);
+    if (wal->pending) {
+        secure_wipe(wal->pending, wal->pending_capacity);
+        free(wal->pending);
+    }
+    free(wal->batch);
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->flushed);
+    free(wal);
+}